@@ -150,7 +150,8 @@ endif ()
 # HAVE_STAT_ST_CTIME	- The struct stat has st_ctime field,
 # HAVE_STAT_ST_SIZE	- The struct stat has st_size field,
 # HAVE_STAT_ST_BLKSIZE	- The struct stat has st_blksize field,
-# HAVE_STAT_ST_BLOCKS	- The struct stat has st_blocks field.
+# HAVE_STAT_ST_BLOCKS	- The struct stat has st_blocks field,
+# HAVE_EVENTFD		- True if eventfd(2) is available.
 #
 
 # Check of getopt(3) function.
@@ -216,6 +217,14 @@ check_struct_has_member("struct stat" st_rdev sys/stat.h HAVE_STAT_ST_RDEV)
 check_struct_has_member("struct stat" st_size sys/stat.h HAVE_STAT_ST_SIZE)
 check_struct_has_member("struct stat" st_uid sys/stat.h HAVE_STAT_ST_UID)
 
+# eventfd(2) for the event loop wakeup, a pipe is used otherwise
+check_include_file(sys/eventfd.h HAVE_SYS_EVENTFD_H)
+check_function_exists(eventfd HAVE_EVENTFD)
+
+if (NOT HAVE_SYS_EVENTFD_H)
+	set(HAVE_EVENTFD FALSE)
+endif ()
+
 # Configuration file
 configure_file(
 	${CMAKE_CURRENT_LIST_DIR}/internal/IrccdConfig.h.in
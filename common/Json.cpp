@@ -194,3 +194,14 @@ JsonDocument::JsonDocument(std::string content, int flags)
 {
 	m_value = read(std::move(content), flags);
 }
+
+JsonDocument::JsonDocument(const char *data, std::size_t length, int flags)
+{
+	json_error_t error;
+	json_t *json = json_loadb(data, length, flags, &error);
+
+	if (json == nullptr)
+		throw JsonError(error);
+
+	m_value = JsonValue(json);
+}
@@ -1560,6 +1560,16 @@ public:
 	 */
 	JsonDocument(std::string content, int flags = 0);
 
+	/**
+	 * Construct a document from a buffer, it does not need to be null terminated.
+	 *
+	 * @param data the data
+	 * @param length the data length
+	 * @param flags the optional Jansson flags
+	 * @throw JsonError on errors
+	 */
+	JsonDocument(const char *data, std::size_t length, int flags = 0);
+
 	/**
 	 * Check if the document contains an object.
 	 *
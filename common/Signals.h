@@ -129,6 +129,16 @@ public:
 		}
 	}
 
+	/**
+	 * Tell if no function is registered.
+	 *
+	 * @return true if empty
+	 */
+	inline bool empty() const noexcept
+	{
+		return m_functions.empty();
+	}
+
 	/**
 	 * Remove all registered functions.
 	 */
@@ -128,8 +128,14 @@ std::string Ip::ip() const
 		}
 	}
 
-	if (resolve && inet_ntop(m_domain, &address(), &ret[0], ret.size()) == nullptr) {
-		throw SocketError{SocketError::System, "inet_ntop"};
+	if (resolve) {
+		const void *addr = (m_domain == AF_INET6) ? static_cast<const void *>(&m_sin6.sin6_addr) : static_cast<const void *>(&m_sin.sin_addr);
+
+		if (inet_ntop(m_domain, addr, &ret[0], ret.size()) == nullptr) {
+			throw SocketError{SocketError::System, "inet_ntop"};
+		}
+
+		ret.resize(std::strlen(ret.c_str()));
 	}
 
 	return ret;
@@ -53,8 +53,8 @@ std::vector<SocketStatus> Select::wait(const SocketTable &table, int ms)
 		}
 	}
 
-	maxwait.tv_sec = 0;
-	maxwait.tv_usec = ms * 1000;
+	maxwait.tv_sec = ms / 1000;
+	maxwait.tv_usec = (ms % 1000) * 1000;
 
 	// Set to nullptr for infinite timeout.
 	towait = (ms < 0) ? nullptr : &maxwait;
@@ -208,6 +208,15 @@ int Epoll::toflags(uint32_t events) const noexcept
 		flags |= SocketListener::Write;
 	}
 
+	/*
+	 * EPOLLERR is always reported even if not requested, mark the socket
+	 * as ready in both directions so that the next recv() or send()
+	 * reports the error instead of spinning on level-triggered events.
+	 */
+	if (events & EPOLLERR) {
+		flags |= SocketListener::Read | SocketListener::Write;
+	}
+
 	return flags;
 }
 
@@ -240,13 +249,17 @@ Epoll::~Epoll()
 
 /*
  * Add a new epoll_event or just update it.
+ *
+ * Like unset, EPOLL_CTL_MOD replaces the events so we need to keep the flags
+ * that are already set.
  */
-void Epoll::set(const SocketTable &, SocketAbstract &sc, int flags, bool add)
+void Epoll::set(const SocketTable &table, SocketAbstract &sc, int flags, bool add)
 {
-	update(sc, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, toepoll(flags));
-
 	if (add) {
+		update(sc, EPOLL_CTL_ADD, toepoll(flags));
 		m_events.resize(m_events.size() + 1);
+	} else {
+		update(sc, EPOLL_CTL_MOD, toepoll(table.at(sc.handle()).second | flags));
 	}
 }
 
@@ -264,7 +277,7 @@ void Epoll::unset(const SocketTable &table, SocketAbstract &sc, int flags, bool
 		update(sc, EPOLL_CTL_DEL, 0);
 		m_events.resize(m_events.size() - 1);
 	} else {
-		update(sc, EPOLL_CTL_MOD, table.at(sc.handle()).second & ~(toepoll(flags)));
+		update(sc, EPOLL_CTL_MOD, toepoll(table.at(sc.handle()).second & ~(flags)));
 	}
 }
 
@@ -281,7 +294,10 @@ std::vector<SocketStatus> Epoll::wait(const SocketTable &table, int ms)
 	}
 
 	for (int i = 0; i < ret; ++i) {
-		result.push_back(SocketStatus{*table.at(m_events[i].data.fd).first, toflags(m_events[i].events)});
+		const auto &pair = table.at(m_events[i].data.fd);
+
+		/* Only report the directions that were requested */
+		result.push_back(SocketStatus{*pair.first, toflags(m_events[i].events) & pair.second});
 	}
 
 	return result;
@@ -351,7 +367,7 @@ std::vector<SocketStatus> Kqueue::wait(const SocketTable &table, int ms)
 {
 	std::vector<SocketStatus> sockets;
 	timespec ts = { 0, 0 };
-	timespec *pts = (ms <= 0) ? nullptr : &ts;
+	timespec *pts = (ms < 0) ? nullptr : &ts;
 
 	ts.tv_sec = ms / 1000;
 	ts.tv_nsec = (ms % 1000) * 1000000;
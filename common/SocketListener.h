@@ -452,7 +452,7 @@ public:
 	inline void clear()
 	{
 		while (!m_table.empty()) {
-			remove(m_table.begin()->second.first);
+			remove(*m_table.begin()->second.first);
 		}
 	}
 
@@ -0,0 +1,107 @@
+/*
+ * Arena.cpp -- monotonic allocator released in bulk
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+#include "Arena.h"
+
+namespace irccd {
+
+Arena::Arena(std::size_t blockSize) noexcept
+	: m_blockSize(blockSize)
+{
+}
+
+void Arena::grow(std::size_t size)
+{
+	size = std::max(size, m_blockSize);
+
+	m_blocks.emplace_back(new char[size]);
+	m_sizes.push_back(size);
+	m_index = m_blocks.size() - 1;
+	m_offset = 0;
+}
+
+void *Arena::allocate(std::size_t size, std::size_t alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	for (;;) {
+		if (m_index < m_blocks.size()) {
+			auto base = reinterpret_cast<std::uintptr_t>(m_blocks[m_index].get());
+			auto aligned = ((base + m_offset + alignment - 1) & ~(alignment - 1)) - base;
+
+			if (aligned + size <= m_sizes[m_index]) {
+				m_offset = aligned + size;
+				m_used += size;
+
+				return m_blocks[m_index].get() + aligned;
+			}
+
+			/* Try the next block that was kept from a previous round */
+			if (m_index + 1 < m_blocks.size()) {
+				m_index ++;
+				m_offset = 0;
+				continue;
+			}
+		}
+
+		grow(size + alignment);
+	}
+}
+
+ArenaString Arena::copy(const std::string &value)
+{
+	return copy(value.c_str(), value.length());
+}
+
+ArenaString Arena::copy(const char *data, std::size_t length)
+{
+	ArenaString result;
+	char *copy = static_cast<char *>(allocate(length + 1, 1));
+
+	std::memcpy(copy, data, length);
+	copy[length] = '\0';
+
+	result.data = copy;
+	result.length = length;
+
+	return result;
+}
+
+void Arena::reset()
+{
+	/* Merge the blocks so that the next round fits in one */
+	if (m_blocks.size() > 1) {
+		std::size_t total = std::accumulate(m_sizes.begin(), m_sizes.end(), std::size_t(0));
+
+		m_blocks.clear();
+		m_sizes.clear();
+		grow(total);
+	}
+
+	m_index = 0;
+	m_offset = 0;
+	m_used = 0;
+}
+
+} // !irccd
@@ -0,0 +1,230 @@
+/*
+ * Arena.h -- monotonic allocator released in bulk
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_ARENA_H_
+#define _IRCCD_ARENA_H_
+
+/**
+ * @file Arena.h
+ * @brief Monotonic allocator released in bulk
+ */
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace irccd {
+
+/**
+ * @class ArenaString
+ * @brief Read-only string stored in an Arena
+ *
+ * The string is always NUL terminated and is only valid until the arena is reset.
+ */
+class ArenaString {
+public:
+	const char *data{""};
+	std::size_t length{0};
+
+	/**
+	 * Copy the string.
+	 *
+	 * @return the string
+	 */
+	inline std::string str() const
+	{
+		return std::string(data, length);
+	}
+};
+
+/**
+ * @class ArenaArray
+ * @brief Fixed size array stored in an Arena
+ *
+ * The array is only valid until the arena is reset.
+ */
+template <typename T>
+class ArenaArray {
+public:
+	T *data{nullptr};
+	std::size_t length{0};
+
+	/**
+	 * Get the first element.
+	 *
+	 * @return the iterator
+	 */
+	inline T *begin() const noexcept
+	{
+		return data;
+	}
+
+	/**
+	 * Get the past-the-end element.
+	 *
+	 * @return the iterator
+	 */
+	inline T *end() const noexcept
+	{
+		return data + length;
+	}
+
+	/**
+	 * Access an element.
+	 *
+	 * @param index the index
+	 * @return the element
+	 */
+	inline T &operator[](std::size_t index) const noexcept
+	{
+		return data[index];
+	}
+};
+
+/**
+ * @class Arena
+ * @brief Monotonic allocator released in bulk
+ *
+ * Allocations only bump a pointer into the current block, nothing is freed individually. The whole arena is
+ * rewound with reset(), after which the memory is reused.
+ *
+ * When a reset happens with more than one block, they are merged into a single block of the total size so that a
+ * steady workload ends up with exactly one block and no allocation at all.
+ *
+ * Only trivially destructible objects can be created in the arena since no destructor is ever called.
+ */
+class Arena {
+private:
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+	std::vector<std::size_t> m_sizes;
+	std::size_t m_index{0};
+	std::size_t m_offset{0};
+	std::size_t m_used{0};
+	std::size_t m_blockSize;
+
+	void grow(std::size_t size);
+
+public:
+	/**
+	 * Create an empty arena, nothing is allocated until needed.
+	 *
+	 * @param blockSize the minimum size of blocks
+	 */
+	explicit Arena(std::size_t blockSize = 4096) noexcept;
+
+	/**
+	 * Allocate raw memory.
+	 *
+	 * @param size the size
+	 * @param alignment the alignment (must be a power of two)
+	 * @return the memory, valid until reset
+	 * @throw std::bad_alloc on failures
+	 */
+	void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+
+	/**
+	 * Construct an object in the arena.
+	 *
+	 * @param args the constructor arguments
+	 * @return the object, valid until reset
+	 * @throw std::bad_alloc on failures
+	 */
+	template <typename T, typename... Args>
+	T *make(Args&&... args)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+
+		return new (allocate(sizeof (T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Construct an array of default objects in the arena.
+	 *
+	 * @param length the number of objects
+	 * @return the array, valid until reset
+	 * @throw std::bad_alloc on failures
+	 */
+	template <typename T>
+	ArenaArray<T> array(std::size_t length)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+
+		ArenaArray<T> result;
+
+		result.data = static_cast<T *>(allocate(sizeof (T) * length, alignof(T)));
+		result.length = length;
+
+		for (std::size_t i = 0; i < length; ++i) {
+			new (&result.data[i]) T();
+		}
+
+		return result;
+	}
+
+	/**
+	 * Copy a string into the arena.
+	 *
+	 * @param value the string
+	 * @return the arena string, valid until reset
+	 * @throw std::bad_alloc on failures
+	 */
+	ArenaString copy(const std::string &value);
+
+	/**
+	 * Overloaded function.
+	 *
+	 * @param data the characters
+	 * @param length the number of characters
+	 * @return the arena string, valid until reset
+	 * @throw std::bad_alloc on failures
+	 */
+	ArenaString copy(const char *data, std::size_t length);
+
+	/**
+	 * Release everything at once, the memory is kept for the next allocations.
+	 */
+	void reset();
+
+	/**
+	 * Get the number of bytes allocated since the last reset.
+	 *
+	 * @return the number of bytes
+	 */
+	inline std::size_t used() const noexcept
+	{
+		return m_used;
+	}
+
+	/**
+	 * Get the number of blocks currently owned.
+	 *
+	 * @return the number of blocks
+	 */
+	inline std::size_t blocks() const noexcept
+	{
+		return m_blocks.size();
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_ARENA_H_
@@ -0,0 +1,89 @@
+/*
+ * ConnectScheduler.cpp -- limit the concurrent connection attempts
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "ConnectScheduler.h"
+
+namespace irccd {
+
+namespace {
+
+template <typename List>
+void forget(List &list, const std::string &name)
+{
+	auto it = std::find(list.begin(), list.end(), name);
+
+	if (it != list.end()) {
+		list.erase(it);
+	}
+}
+
+} // !namespace
+
+ConnectTicket::ConnectTicket(ConnectScheduler &scheduler, std::string name)
+	: m_scheduler(scheduler)
+	, m_name(std::move(name))
+{
+	std::lock_guard<std::mutex> lock(m_scheduler.m_mutex);
+
+	m_scheduler.m_waiting.push_back(m_name);
+}
+
+ConnectTicket::~ConnectTicket()
+{
+	bool notify = false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_scheduler.m_mutex);
+
+		if (m_active) {
+			forget(m_scheduler.m_active, m_name);
+		} else {
+			forget(m_scheduler.m_waiting, m_name);
+		}
+
+		/* The next waiting ticket may belong to another thread */
+		notify = !m_scheduler.m_waiting.empty() && m_scheduler.isAvailable();
+	}
+
+	if (notify && m_scheduler.m_notify) {
+		m_scheduler.m_notify();
+	}
+}
+
+bool ConnectTicket::acquire() noexcept
+{
+	if (m_active) {
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(m_scheduler.m_mutex);
+
+	if (!m_scheduler.isAvailable() || m_scheduler.m_waiting.front() != m_name) {
+		return false;
+	}
+
+	m_scheduler.m_waiting.pop_front();
+	m_scheduler.m_active.push_back(m_name);
+	m_active = true;
+
+	return true;
+}
+
+} // !irccd
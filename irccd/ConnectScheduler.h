@@ -0,0 +1,191 @@
+/*
+ * ConnectScheduler.h -- limit the concurrent connection attempts
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_CONNECT_SCHEDULER_H_
+#define _IRCCD_CONNECT_SCHEDULER_H_
+
+/**
+ * @file ConnectScheduler.h
+ * @brief Limit the concurrent connection attempts
+ */
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace irccd {
+
+class ConnectScheduler;
+
+/**
+ * @class ConnectTicket
+ * @brief Place of a server in the ConnectScheduler
+ *
+ * The ticket is waiting when created, acquire() turns it into an active one when a slot is available. The place
+ * is given back when the ticket is destroyed, whether it was active or still waiting.
+ */
+class ConnectTicket {
+private:
+	ConnectScheduler &m_scheduler;
+	std::string m_name;
+	bool m_active{false};
+
+public:
+	/**
+	 * Wait for a slot.
+	 *
+	 * @param scheduler the scheduler
+	 * @param name the server name
+	 */
+	ConnectTicket(ConnectScheduler &scheduler, std::string name);
+
+	/**
+	 * Give the slot back or stop waiting.
+	 */
+	~ConnectTicket();
+
+	ConnectTicket(const ConnectTicket &) = delete;
+	ConnectTicket &operator=(const ConnectTicket &) = delete;
+
+	/**
+	 * Try to get a slot, the waiting tickets are served in order.
+	 *
+	 * @return true if the ticket is active
+	 */
+	bool acquire() noexcept;
+
+	/**
+	 * Tells if the ticket has a slot.
+	 *
+	 * @return true if active
+	 */
+	inline bool active() const noexcept
+	{
+		return m_active;
+	}
+};
+
+/**
+ * @class ConnectScheduler
+ * @brief Limit the concurrent connection attempts
+ *
+ * After an upstream outage every server used to reconnect in the same loop iteration, each one doing its TCP
+ * connection and TLS handshake at once. The Connecting state now holds a ConnectTicket: the servers that do not get
+ * a slot wait in order, a slot is given back once the connection (including the TLS handshake) is established or
+ * has failed.
+ *
+ * The scheduler is shared by the servers of every reactor, the notify function is called when a slot is given
+ * back while tickets are waiting so that the event loops owning them can retry.
+ *
+ * @note Thread-safe
+ */
+class ConnectScheduler {
+private:
+	friend class ConnectTicket;
+
+	using Notify = std::function<void ()>;
+
+	mutable std::mutex m_mutex;
+	unsigned m_limit{4};
+	std::vector<std::string> m_active;
+	std::deque<std::string> m_waiting;
+	Notify m_notify;
+
+	inline bool isAvailable() const noexcept
+	{
+		return m_limit == 0 || m_active.size() < m_limit;
+	}
+
+public:
+	/**
+	 * Set the maximum number of concurrent attempts.
+	 *
+	 * @param limit the limit, 0 for unlimited
+	 */
+	inline void setLimit(unsigned limit) noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_limit = limit;
+	}
+
+	/**
+	 * Get the maximum number of concurrent attempts.
+	 *
+	 * @return the limit, 0 if unlimited
+	 */
+	inline unsigned limit() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_limit;
+	}
+
+	/**
+	 * Set the function called when a slot is given back while tickets are waiting.
+	 *
+	 * @param notify the function (may be null)
+	 * @warning Must be set before any ticket is created, it is called from the thread releasing the slot
+	 */
+	inline void setNotify(Notify notify)
+	{
+		m_notify = std::move(notify);
+	}
+
+	/**
+	 * Tells if a waiting ticket would get a slot.
+	 *
+	 * @return true if a slot is free
+	 */
+	inline bool available() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return isAvailable();
+	}
+
+	/**
+	 * Get the servers currently connecting.
+	 *
+	 * @return the server names
+	 */
+	inline std::vector<std::string> active() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_active;
+	}
+
+	/**
+	 * Get the servers waiting for a slot, in order.
+	 *
+	 * @return the server names
+	 */
+	inline std::deque<std::string> waiting() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_waiting;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_CONNECT_SCHEDULER_H_
@@ -0,0 +1,252 @@
+/*
+ * EventQueue.cpp -- bounded queue for cross-thread events
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdint>
+
+#include <IrccdConfig.h>
+
+#if defined(HAVE_EVENTFD)
+#  include <sys/eventfd.h>
+#endif
+
+#include "EventQueue.h"
+
+namespace irccd {
+
+/* --------------------------------------------------------
+ * EventNotifier
+ * -------------------------------------------------------- */
+
+#if defined(_WIN32)
+
+EventNotifier::EventNotifier()
+{
+	SocketTcp<address::Ipv4> master{AF_INET, 0};
+
+	master.set(SOL_SOCKET, SO_REUSEADDR, 1);
+	master.bind(address::Ipv4{"127.0.0.1", 0});
+	master.listen(1);
+
+	m_writer.connect(address::Ipv4{"127.0.0.1", master.getsockname().port()});
+	m_reader = master.accept();
+	m_reader.setBlockMode(false);
+	m_writer.setBlockMode(false);
+	m_handle = m_reader.handle();
+}
+
+EventNotifier::~EventNotifier()
+{
+	/* Owned by m_reader */
+	m_handle = Invalid;
+}
+
+void EventNotifier::notify() noexcept
+{
+	try {
+		m_writer.send(" ");
+	} catch (...) {
+	}
+}
+
+void EventNotifier::clear() noexcept
+{
+	try {
+		while (m_reader.recv(512).size() > 0) {
+			continue;
+		}
+	} catch (...) {
+	}
+}
+
+#elif defined(HAVE_EVENTFD)
+
+EventNotifier::EventNotifier()
+{
+	m_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (m_handle == Invalid) {
+		throw SocketError(SocketError::System, "eventfd");
+	}
+}
+
+EventNotifier::~EventNotifier() = default;
+
+void EventNotifier::notify() noexcept
+{
+	std::uint64_t value = 1;
+
+	(void)::write(m_handle, &value, sizeof (value));
+}
+
+void EventNotifier::clear() noexcept
+{
+	std::uint64_t value;
+
+	(void)::read(m_handle, &value, sizeof (value));
+}
+
+#else
+
+EventNotifier::EventNotifier()
+{
+	int fds[2];
+
+	if (::pipe(fds) < 0) {
+		throw SocketError(SocketError::System, "pipe");
+	}
+
+	m_handle = fds[0];
+	m_writer = fds[1];
+
+	for (int fd : fds) {
+		::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+		::fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+}
+
+EventNotifier::~EventNotifier()
+{
+	::close(m_writer);
+}
+
+void EventNotifier::notify() noexcept
+{
+	char byte = 0;
+
+	(void)::write(m_writer, &byte, 1);
+}
+
+void EventNotifier::clear() noexcept
+{
+	char buffer[512];
+
+	while (::read(m_handle, buffer, sizeof (buffer)) > 0) {
+		continue;
+	}
+}
+
+#endif
+
+/* --------------------------------------------------------
+ * EventQueue
+ * -------------------------------------------------------- */
+
+EventQueue::EventQueue(std::size_t capacity)
+{
+	std::size_t size = 2;
+
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	m_cells.reset(new Cell[size]);
+	m_mask = size - 1;
+
+	for (std::size_t i = 0; i < size; ++i) {
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool EventQueue::push(Event ev) noexcept
+{
+	if (!offer(ev)) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool EventQueue::offer(Event &ev) noexcept
+{
+	std::size_t pos = m_enqueue.load(std::memory_order_relaxed);
+	Cell *cell;
+
+	/*
+	 * A cell is free for position pos when its sequence equals pos, a lower sequence means the consumer did not
+	 * release it yet so the ring is full.
+	 */
+	for (;;) {
+		cell = &m_cells[pos & m_mask];
+
+		auto diff = static_cast<std::intptr_t>(cell->sequence.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos);
+
+		if (diff == 0) {
+			if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = m_enqueue.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->event = std::move(ev);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+
+	/* Metrics */
+	std::size_t depth = pos + 1 - m_dequeue.load(std::memory_order_relaxed);
+	std::size_t high = m_highWater.load(std::memory_order_relaxed);
+
+	while (depth > high && !m_highWater.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {
+		continue;
+	}
+
+	wake();
+
+	return true;
+}
+
+void EventQueue::wake() noexcept
+{
+	/* Only the first event since the last drain wakes up the loop */
+	if (!m_pending.exchange(true, std::memory_order_seq_cst)) {
+		m_notifier.notify();
+	}
+}
+
+bool EventQueue::pop(Event &ev) noexcept
+{
+	std::size_t pos = m_dequeue.load(std::memory_order_relaxed);
+	Cell &cell = m_cells[pos & m_mask];
+
+	/* Empty or the producer did not finish to write the event */
+	if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+		return false;
+	}
+
+	ev = std::move(cell.event);
+	cell.event = nullptr;
+	cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+	m_dequeue.store(pos + 1, std::memory_order_relaxed);
+
+	return true;
+}
+
+void EventQueue::clear() noexcept
+{
+	m_notifier.clear();
+	m_pending.store(false, std::memory_order_seq_cst);
+
+	/* Events published before this point will be seen by the next pop() */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+} // !irccd
@@ -0,0 +1,226 @@
+/*
+ * EventQueue.h -- bounded queue for cross-thread events
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_EVENT_QUEUE_H_
+#define _IRCCD_EVENT_QUEUE_H_
+
+/**
+ * @file EventQueue.h
+ * @brief Bounded multi-producer, single-consumer event queue
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+#include <IrccdConfig.h>
+
+#include <Socket.h>
+#include <SocketAddress.h>
+
+namespace irccd {
+
+/**
+ * Event to be executed in the event loop.
+ */
+using Event = std::function<void ()>;
+
+/**
+ * @class EventNotifier
+ * @brief Readable descriptor used to wake up the event loop
+ *
+ * Uses eventfd(2) when available, a pipe otherwise and a loopback TCP pair on Windows. The descriptor can be
+ * registered into a SocketListener like any other socket.
+ */
+class EventNotifier : public SocketAbstract {
+private:
+#if defined(_WIN32)
+	SocketTcp<address::Ipv4> m_reader{AF_INET, 0};
+	SocketTcp<address::Ipv4> m_writer{AF_INET, 0};
+#elif !defined(HAVE_EVENTFD)
+	Handle m_writer{Invalid};
+#endif
+
+public:
+	/**
+	 * Create the notifier.
+	 *
+	 * @throw SocketError on errors
+	 */
+	EventNotifier();
+
+	/**
+	 * Close the descriptors.
+	 */
+	~EventNotifier();
+
+	/**
+	 * Make the descriptor readable.
+	 *
+	 * @note Thread-safe
+	 */
+	void notify() noexcept;
+
+	/**
+	 * Consume all pending notifications.
+	 */
+	void clear() noexcept;
+};
+
+/**
+ * @class EventQueue
+ * @brief Bounded lock-free queue of events
+ *
+ * Any thread may push events, only the event loop pops them. The queue is a ring of fixed size where each cell
+ * stores a sequence number, producers reserve a cell with a single compare-and-swap and never block. When the
+ * ring is full, push() drops and counts the event while offer() lets the producer keep it.
+ *
+ * The wakeup is coalesced, only the first push after the event loop has cleared the notifier writes to the
+ * descriptor, subsequent pushes are free until the next drain.
+ */
+class EventQueue {
+private:
+	struct Cell {
+		std::atomic<std::size_t> sequence;
+		Event event;
+	};
+
+	std::unique_ptr<Cell[]> m_cells;
+	std::size_t m_mask;
+
+	/* Producers and consumer positions are kept on separate cache lines */
+	alignas(64) std::atomic<std::size_t> m_enqueue{0};
+	alignas(64) std::atomic<std::size_t> m_dequeue{0};
+
+	/* Wakeup */
+	alignas(64) std::atomic<bool> m_pending{false};
+	EventNotifier m_notifier;
+
+	/* Metrics */
+	std::atomic<std::size_t> m_highWater{0};
+	std::atomic<std::size_t> m_dropped{0};
+
+public:
+	/**
+	 * Create the queue.
+	 *
+	 * @param capacity the maximum number of pending events, rounded up to a power of two
+	 * @throw SocketError if the notifier can not be created
+	 */
+	EventQueue(std::size_t capacity = 4096);
+
+	/**
+	 * Push an event and wake up the event loop if needed.
+	 *
+	 * @param ev the event
+	 * @return false if the queue was full and the event dropped
+	 * @note Thread-safe
+	 */
+	bool push(Event ev) noexcept;
+
+	/**
+	 * Like push() but the event is not dropped when the queue is full, it is left to the caller which may retry
+	 * later.
+	 *
+	 * @param ev the event, only moved from on success
+	 * @return false if the queue was full
+	 * @note Thread-safe
+	 */
+	bool offer(Event &ev) noexcept;
+
+	/**
+	 * Wake up the event loop without pushing any event, the notification is coalesced like push().
+	 *
+	 * @note Thread-safe
+	 */
+	void wake() noexcept;
+
+	/**
+	 * Pop the next event.
+	 *
+	 * @param ev the event to fill
+	 * @return false if the queue is empty
+	 * @note Must only be called from the event loop
+	 */
+	bool pop(Event &ev) noexcept;
+
+	/**
+	 * Acknowledge the wakeup, must be called before popping the events.
+	 *
+	 * @note Must only be called from the event loop
+	 */
+	void clear() noexcept;
+
+	/**
+	 * Get the descriptor to watch for reading.
+	 *
+	 * @return the socket
+	 */
+	inline SocketAbstract &socket() noexcept
+	{
+		return m_notifier;
+	}
+
+	/**
+	 * Get the maximum number of pending events.
+	 *
+	 * @return the capacity
+	 */
+	inline std::size_t capacity() const noexcept
+	{
+		return m_mask + 1;
+	}
+
+	/**
+	 * Get the approximate number of pending events.
+	 *
+	 * @return the depth
+	 * @note Thread-safe
+	 */
+	inline std::size_t depth() const noexcept
+	{
+		return m_enqueue.load(std::memory_order_relaxed) - m_dequeue.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get the highest depth ever reached.
+	 *
+	 * @return the high water mark
+	 * @note Thread-safe
+	 */
+	inline std::size_t highWater() const noexcept
+	{
+		return m_highWater.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get the number of events dropped because the queue was full.
+	 *
+	 * @return the number of dropped events
+	 * @note Thread-safe
+	 */
+	inline std::size_t dropped() const noexcept
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_EVENT_QUEUE_H_
@@ -0,0 +1,570 @@
+/*
+ * IrcConnection.cpp -- non-blocking IRC protocol engine
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <IrccdConfig.h>
+
+#if !defined(_WIN32)
+#  include <netinet/tcp.h>
+#endif
+
+#if defined(WITH_SSL)
+#  include <openssl/err.h>
+#  include <openssl/x509v3.h>
+#endif
+
+#include <SocketListener.h>
+
+#include "IrcConnection.h"
+
+#if !defined(MSG_NOSIGNAL)
+#  define MSG_NOSIGNAL 0
+#endif
+
+namespace irccd {
+
+namespace {
+
+/*
+ * Two full lines, a partial line is moved to the front when the end of the buffer is reached.
+ */
+const std::size_t bufferSize{IrcConnection::MaxLine * 2};
+
+#if defined(WITH_SSL)
+
+std::string sslError()
+{
+	unsigned long code = ERR_get_error();
+	char buffer[256];
+
+	if (code == 0) {
+		return "TLS error";
+	}
+
+	ERR_error_string_n(code, buffer, sizeof (buffer));
+
+	return buffer;
+}
+
+#endif
+
+} // !namespace
+
+#if defined(WITH_SSL)
+
+SSL_CTX *IrcConnection::context(bool verify)
+{
+	/*
+	 * One context for all the connections, loading the trusted certificates for every connection was as
+	 * expensive as the handshake. The sessions are stored by the connections, not in the context.
+	 */
+	auto create = [] (bool verify) -> SSL_CTX * {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+		SSL_library_init();
+		SSL_load_error_strings();
+
+		SSL_CTX *context = SSL_CTX_new(SSLv23_client_method());
+#else
+		SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+#endif
+
+		if (context == nullptr) {
+			return nullptr;
+		}
+
+		/* Writes are retried with the remaining of m_output which may have moved */
+		SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(context, &IrcConnection::newSession);
+
+		if (verify) {
+			SSL_CTX_set_default_verify_paths(context);
+			SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+		}
+
+		return context;
+	};
+
+	static SSL_CTX *unverified = create(false);
+	static SSL_CTX *verified = create(true);
+
+	SSL_CTX *context = verify ? verified : unverified;
+
+	if (context == nullptr) {
+		throw std::runtime_error(sslError());
+	}
+
+	return context;
+}
+
+int IrcConnection::newSession(SSL *ssl, SSL_SESSION *session)
+{
+	/* With TLS 1.3 the tickets arrive after the handshake, the last one is kept */
+	IrcConnection *connection = static_cast<IrcConnection *>(SSL_get_app_data(ssl));
+
+	if (connection == nullptr) {
+		return 0;
+	}
+
+	connection->m_session = {session, SSL_SESSION_free};
+
+	return 1;
+}
+
+#endif
+
+IrcConnection::IrcConnection(Handler handler)
+	: m_handler(std::move(handler))
+	, m_input(new char[bufferSize])
+{
+}
+
+IrcConnection::~IrcConnection()
+{
+	disconnect();
+}
+
+void IrcConnection::fail(std::string error) noexcept
+{
+	/*
+	 * The descriptor is only closed by disconnect(): it may still be registered in a listener and the system
+	 * could give its number to another socket before the owner has removed it.
+	 */
+	reset();
+	m_error = std::move(error);
+}
+
+void IrcConnection::reset() noexcept
+{
+#if defined(WITH_SSL)
+	if (m_ssl && m_state == Connected) {
+		SSL_shutdown(m_ssl.get());
+	}
+
+	m_ssl.reset();
+	m_want = 0;
+#endif
+
+	m_state = Disconnected;
+	m_begin = 0;
+	m_end = 0;
+	m_output.clear();
+}
+
+void IrcConnection::connect(const std::string &host, std::uint16_t port, bool ipv6, bool ssl, bool sslverify)
+{
+	disconnect();
+
+	connect(address::Ip(host, port, ipv6 ? AF_INET6 : AF_INET), host, ssl, sslverify);
+}
+
+void IrcConnection::connect(const address::Ip &address, const std::string &host, bool ssl, bool sslverify)
+{
+	disconnect();
+	m_error.clear();
+
+#if !defined(WITH_SSL)
+	(void)sslverify;
+
+	if (ssl) {
+		throw std::runtime_error("SSL support is disabled");
+	}
+#endif
+
+	try {
+		m_socket = SocketTcp<address::Ip>(address.domain(), 0);
+		m_socket.setBlockMode(false);
+
+		/*
+		 * The lines are already coalesced into one write per iteration, Nagle would only hold back the
+		 * registration behind the last TLS handshake message until the server acknowledges it.
+		 */
+		m_socket.set(IPPROTO_TCP, TCP_NODELAY, 1);
+
+#if defined(WITH_SSL)
+		if (ssl) {
+			m_ssl = {SSL_new(context(sslverify)), SSL_free};
+
+			if (!m_ssl) {
+				throw std::runtime_error(sslError());
+			}
+
+			SSL_set_fd(m_ssl.get(), static_cast<int>(m_socket.handle()));
+			SSL_set_connect_state(m_ssl.get());
+			SSL_set_tlsext_host_name(m_ssl.get(), host.c_str());
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+			if (sslverify) {
+				SSL_set1_host(m_ssl.get(), host.c_str());
+			}
+#endif
+			/* A session is only valid for the server that issued it */
+			std::string key = host + ":" + std::to_string(address.port()) + (sslverify ? ":verify" : "");
+
+			if (key != m_sessionKey) {
+				m_session.reset();
+				m_sessionKey = std::move(key);
+			}
+			if (m_session) {
+				SSL_set_session(m_ssl.get(), m_session.get());
+			}
+
+			SSL_set_app_data(m_ssl.get(), this);
+			m_want = SocketListener::Write;
+		}
+#endif
+
+		try {
+			m_socket.connect(address);
+			m_state = ssl ? Handshaking : Connected;
+		} catch (const SocketError &ex) {
+			if (ex.code() != SocketError::WouldBlockWrite) {
+				throw;
+			}
+
+			m_state = Connecting;
+		}
+	} catch (...) {
+		disconnect();
+		throw;
+	}
+}
+
+void IrcConnection::disconnect() noexcept
+{
+	reset();
+	m_socket.close();
+}
+
+void IrcConnection::handshake()
+{
+#if defined(WITH_SSL)
+	int code = SSL_connect(m_ssl.get());
+
+	if (code == 1) {
+		m_state = Connected;
+		m_want = 0;
+		m_handshakes.fetch_add(1, std::memory_order_relaxed);
+
+		if (SSL_session_reused(m_ssl.get())) {
+			m_resumed.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		return;
+	}
+
+	switch (SSL_get_error(m_ssl.get(), code)) {
+	case SSL_ERROR_WANT_READ:
+		m_want = SocketListener::Read;
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		m_want = SocketListener::Write;
+		break;
+	default:
+		/* Do not offer a session the server may have rejected again */
+		m_session.reset();
+
+		if (SSL_get_verify_result(m_ssl.get()) != X509_V_OK) {
+			throw std::runtime_error(X509_verify_cert_error_string(SSL_get_verify_result(m_ssl.get())));
+		}
+
+		throw std::runtime_error(sslError());
+	}
+#endif
+}
+
+int IrcConnection::read(char *data, std::size_t length)
+{
+#if defined(WITH_SSL)
+	if (m_ssl) {
+		int nbread = SSL_read(m_ssl.get(), data, static_cast<int>(length));
+
+		if (nbread > 0) {
+			m_want = 0;
+
+			return nbread;
+		}
+
+		switch (SSL_get_error(m_ssl.get(), nbread)) {
+		case SSL_ERROR_WANT_READ:
+			m_want = 0;
+			return -1;
+		case SSL_ERROR_WANT_WRITE:
+			m_want = SocketListener::Write;
+			return -1;
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		default:
+			throw std::runtime_error(sslError());
+		}
+	}
+#endif
+
+	for (;;) {
+		auto nbread = ::recv(m_socket.handle(), (SocketAbstract::Arg)data, length, 0);
+
+		if (nbread != SocketAbstract::Error) {
+			return static_cast<int>(nbread);
+		}
+
+#if defined(_WIN32)
+		int error = WSAGetLastError();
+
+		if (error == WSAEWOULDBLOCK) {
+			return -1;
+		}
+
+		throw SocketError{SocketError::System, "recv", error};
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return -1;
+		}
+		if (errno != EINTR) {
+			throw SocketError{SocketError::System, "recv"};
+		}
+#endif
+	}
+}
+
+int IrcConnection::write(const char *data, std::size_t length)
+{
+	m_writes.fetch_add(1, std::memory_order_relaxed);
+
+#if defined(WITH_SSL)
+	if (m_ssl) {
+		int nbsent = SSL_write(m_ssl.get(), data, static_cast<int>(length));
+
+		if (nbsent > 0) {
+			m_bytes.fetch_add(nbsent, std::memory_order_relaxed);
+
+			return nbsent;
+		}
+
+		switch (SSL_get_error(m_ssl.get(), nbsent)) {
+		case SSL_ERROR_WANT_READ:
+			m_want = SocketListener::Read;
+			return -1;
+		case SSL_ERROR_WANT_WRITE:
+			return -1;
+		default:
+			throw std::runtime_error(sslError());
+		}
+	}
+#endif
+
+	for (;;) {
+		auto nbsent = ::send(m_socket.handle(), (SocketAbstract::ConstArg)data, length, MSG_NOSIGNAL);
+
+		if (nbsent != SocketAbstract::Error) {
+			m_bytes.fetch_add(nbsent, std::memory_order_relaxed);
+
+			return static_cast<int>(nbsent);
+		}
+
+#if defined(_WIN32)
+		int error = WSAGetLastError();
+
+		if (error == WSAEWOULDBLOCK) {
+			return -1;
+		}
+
+		throw SocketError{SocketError::System, "send", error};
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return -1;
+		}
+		if (errno != EINTR) {
+			throw SocketError{SocketError::System, "send"};
+		}
+#endif
+	}
+}
+
+void IrcConnection::process()
+{
+	char *data = m_input.get();
+
+	while (m_begin < m_end) {
+		char *begin = data + m_begin;
+		char *newline = static_cast<char *>(std::memchr(begin, '\n', m_end - m_begin));
+
+		if (newline == nullptr) {
+			break;
+		}
+
+		m_begin = newline - data + 1;
+
+		/* Also accept bare LF */
+		char *end = (newline > begin && newline[-1] == '\r') ? newline - 1 : newline;
+
+		if (end == begin || !m_message.parse(begin, end - begin)) {
+			continue;
+		}
+
+		if (m_message.command == "PING") {
+			IrcView token = m_message.param(0);
+
+			m_output.append("PONG :", 6);
+			m_output.append(token.data, token.length);
+			m_output.append("\r\n", 2);
+		}
+
+		if (m_handler) {
+			m_handler(m_message);
+		}
+
+		/* The handler may have closed the connection */
+		if (m_state != Connected) {
+			return;
+		}
+	}
+
+	if (m_begin == m_end) {
+		m_begin = 0;
+		m_end = 0;
+	} else if (m_end - m_begin > MaxLine) {
+		throw std::runtime_error("line too long");
+	}
+}
+
+void IrcConnection::receive()
+{
+	while (m_state == Connected) {
+		if (m_end == bufferSize) {
+			std::memmove(m_input.get(), m_input.get() + m_begin, m_end - m_begin);
+			m_end -= m_begin;
+			m_begin = 0;
+		}
+
+		int nbread = read(m_input.get() + m_end, bufferSize - m_end);
+
+		if (nbread < 0) {
+			break;
+		}
+		if (nbread == 0) {
+			throw std::runtime_error("connection closed by the server");
+		}
+
+		m_end += nbread;
+		process();
+	}
+}
+
+void IrcConnection::transmit()
+{
+	std::size_t sent = 0;
+
+	while (sent < m_output.size()) {
+		int nbsent = write(m_output.data() + sent, m_output.size() - sent);
+
+		if (nbsent < 0) {
+			break;
+		}
+
+		sent += nbsent;
+	}
+
+	m_output.erase(0, sent);
+}
+
+void IrcConnection::sync(int flags) noexcept
+{
+	try {
+		if (m_state == Connecting) {
+			if (flags == 0) {
+				return;
+			}
+
+			int error = m_socket.get<int>(SOL_SOCKET, SO_ERROR);
+
+			if (error != 0) {
+				fail(SocketAbstract::syserror(error));
+				return;
+			}
+
+#if defined(WITH_SSL)
+			m_state = m_ssl ? Handshaking : Connected;
+#else
+			m_state = Connected;
+#endif
+		}
+
+		if (m_state == Handshaking) {
+			handshake();
+		}
+
+		/*
+		 * Always try both directions until the socket would block, TLS may need to read while writing and
+		 * the other way around.
+		 */
+		if (m_state == Connected) {
+			receive();
+		}
+		if (m_state == Connected) {
+			transmit();
+		}
+	} catch (const std::exception &ex) {
+		fail(ex.what());
+	}
+}
+
+void IrcConnection::flush() noexcept
+{
+	if (m_state != Connected || m_output.empty()) {
+		return;
+	}
+
+	try {
+		transmit();
+	} catch (const std::exception &ex) {
+		fail(ex.what());
+	}
+}
+
+int IrcConnection::flags() const noexcept
+{
+	int flags = 0;
+
+	switch (m_state) {
+	case Connecting:
+		flags = SocketListener::Write;
+		break;
+	case Connected:
+		flags = SocketListener::Read;
+
+		if (!m_output.empty()) {
+			flags |= SocketListener::Write;
+		}
+		break;
+	default:
+		break;
+	}
+
+#if defined(WITH_SSL)
+	if (m_state == Handshaking || m_state == Connected) {
+		flags |= m_want;
+	}
+#endif
+
+	return flags;
+}
+
+} // !irccd
@@ -0,0 +1,311 @@
+/*
+ * IrcConnection.h -- non-blocking IRC protocol engine
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_IRC_CONNECTION_H_
+#define _IRCCD_IRC_CONNECTION_H_
+
+/**
+ * @file IrcConnection.h
+ * @brief Non-blocking IRC protocol engine
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <IrccdConfig.h>
+
+#if defined(WITH_SSL)
+#  include <openssl/ssl.h>
+#endif
+
+#include <Socket.h>
+#include <SocketAddress.h>
+
+#include "IrcMessage.h"
+
+namespace irccd {
+
+/**
+ * @class IrcConnectionStats
+ * @brief Output metrics of an IrcConnection
+ */
+class IrcConnectionStats {
+public:
+	std::uint64_t lines{0};		//!< number of lines queued
+	std::uint64_t writes{0};	//!< number of write system calls (SSL_write with TLS)
+	std::uint64_t bytes{0};		//!< number of bytes written
+	std::uint64_t handshakes{0};	//!< number of TLS handshakes completed
+	std::uint64_t resumed{0};	//!< number of TLS handshakes that resumed the previous session
+
+	/**
+	 * Get the average number of write system calls per line.
+	 *
+	 * @return the ratio, 0 if nothing was sent
+	 */
+	inline double writesPerLine() const noexcept
+	{
+		return (lines == 0) ? 0 : static_cast<double>(writes) / lines;
+	}
+};
+
+/**
+ * @class IrcConnection
+ * @brief Non-blocking IRC protocol engine
+ *
+ * This class owns the socket (and the TLS session) of one IRC server, it splits the incoming data into lines and
+ * parses them in place with IrcMessage. Nothing is copied between the socket and the handler.
+ *
+ * The connection only knows about the transport: it does not register to the server, it is the job of the user
+ * to send PASS, NICK and USER. The only command handled internally is PING, answered immediately so that it
+ * never waits behind the rate limited commands.
+ *
+ * Each call to sync() reads and writes until the socket would block, the connection can therefore be used with
+ * level-triggered as well as edge-triggered listeners.
+ *
+ * The lines given to send() are only appended to the output buffer, call flush() once all the lines of a loop
+ * iteration are queued to send them with a single write.
+ */
+class IrcConnection {
+public:
+	/**
+	 * @enum State
+	 * @brief Transport state
+	 */
+	enum State {
+		Disconnected,		//!< no socket
+		Connecting,		//!< TCP connection in progress
+		Handshaking,		//!< TLS handshake in progress
+		Connected		//!< ready to send and receive lines
+	};
+
+	/**
+	 * Maximum length of an incoming line, 8191 bytes of tags plus the 512 bytes of RFC 1459.
+	 */
+	static constexpr std::size_t MaxLine{8191 + 512};
+
+	/**
+	 * Function called for every line received, the message is only valid during the call.
+	 *
+	 * @note This is not a Signal because emitting a Signal copies its slot list on every call
+	 */
+	using Handler = std::function<void (const IrcMessage &)>;
+
+private:
+	Handler m_handler;
+	SocketTcp<address::Ip> m_socket;
+	State m_state{Disconnected};
+	std::string m_error;
+
+	/* Incoming data, the lines are parsed in place */
+	std::unique_ptr<char[]> m_input;
+	std::size_t m_begin{0};
+	std::size_t m_end{0};
+	IrcMessage m_message;
+
+	/* Outgoing data */
+	std::string m_output;
+
+	/* Written by the event loop, read by anyone */
+	std::atomic<std::uint64_t> m_lines{0};
+	std::atomic<std::uint64_t> m_writes{0};
+	std::atomic<std::uint64_t> m_bytes{0};
+
+	std::atomic<std::uint64_t> m_handshakes{0};
+	std::atomic<std::uint64_t> m_resumed{0};
+
+#if defined(WITH_SSL)
+	std::unique_ptr<SSL, void (*)(SSL *)> m_ssl{nullptr, nullptr};
+	int m_want{0};
+
+	/* Last session given by the server, offered again when reconnecting to the same endpoint */
+	std::unique_ptr<SSL_SESSION, void (*)(SSL_SESSION *)> m_session{nullptr, nullptr};
+	std::string m_sessionKey;
+
+	static SSL_CTX *context(bool verify);
+	static int newSession(SSL *ssl, SSL_SESSION *session);
+#endif
+
+	void fail(std::string error) noexcept;
+	void reset() noexcept;
+	void handshake();
+	void receive();
+	void transmit();
+	void process();
+	int read(char *data, std::size_t length);
+	int write(const char *data, std::size_t length);
+
+public:
+	/**
+	 * Create a disconnected engine.
+	 *
+	 * @param handler the function called for every line
+	 */
+	IrcConnection(Handler handler = nullptr);
+
+	/**
+	 * Close the connection.
+	 */
+	~IrcConnection();
+
+	/**
+	 * Start connecting, the previous connection is closed. The hostname is resolved synchronously.
+	 *
+	 * @param host the hostname
+	 * @param port the port
+	 * @param ipv6 use IPv6
+	 * @param ssl use TLS
+	 * @param sslverify verify the peer certificate and hostname
+	 * @throw SocketError on resolution or socket errors
+	 * @throw std::runtime_error if TLS is requested but not available
+	 */
+	void connect(const std::string &host, std::uint16_t port, bool ipv6 = false, bool ssl = false, bool sslverify = false);
+
+	/**
+	 * Start connecting to an address already resolved, the previous connection is closed.
+	 *
+	 * With TLS, the session of the previous connection to the same host and port is offered to the server so
+	 * that it can skip the key exchange. The handshake itself is done in non-blocking steps by sync().
+	 *
+	 * @param address the address
+	 * @param host the hostname, used for the TLS server name and verification
+	 * @param ssl use TLS
+	 * @param sslverify verify the peer certificate and hostname
+	 * @throw SocketError on socket errors
+	 * @throw std::runtime_error if TLS is requested but not available
+	 */
+	void connect(const address::Ip &address, const std::string &host, bool ssl = false, bool sslverify = false);
+
+	/**
+	 * Close the connection and discard pending data.
+	 */
+	void disconnect() noexcept;
+
+	/**
+	 * Queue a line for sending, the line terminator is added. Nothing is written before the next flush() or
+	 * sync(), lines queued while connecting are sent once the connection is established.
+	 *
+	 * @param line the line without terminator
+	 * @return false if disconnected
+	 */
+	inline bool send(const std::string &line)
+	{
+		if (m_state == Disconnected) {
+			return false;
+		}
+
+		m_output.append(line);
+		m_output.append("\r\n", 2);
+		m_lines.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	/**
+	 * Write the pending lines now if connected, they are all given to one write system call as long as the
+	 * socket accepts them.
+	 *
+	 * On errors, the state becomes Disconnected and error() contains the reason, the descriptor is only closed
+	 * by disconnect().
+	 */
+	void flush() noexcept;
+
+	/**
+	 * Process the socket once it is ready, the handler is called for each complete line.
+	 *
+	 * On errors, the state becomes Disconnected and error() contains the reason, the descriptor is only closed
+	 * by disconnect().
+	 *
+	 * @param flags the ready directions (SocketListener::Read, SocketListener::Write)
+	 */
+	void sync(int flags) noexcept;
+
+	/**
+	 * Get the directions the engine is waiting for.
+	 *
+	 * @return the SocketListener flags, 0 if disconnected
+	 */
+	int flags() const noexcept;
+
+	/**
+	 * Get the transport state.
+	 *
+	 * @return the state
+	 */
+	inline State state() const noexcept
+	{
+		return m_state;
+	}
+
+	/**
+	 * Get the reason of the last disconnection.
+	 *
+	 * @return the error
+	 */
+	inline const std::string &error() const noexcept
+	{
+		return m_error;
+	}
+
+	/**
+	 * Get the number of bytes waiting to be sent.
+	 *
+	 * @return the number of bytes
+	 */
+	inline std::size_t pending() const noexcept
+	{
+		return m_output.size();
+	}
+
+	/**
+	 * Get the output metrics.
+	 *
+	 * @return the metrics
+	 * @note Thread-safe
+	 */
+	inline IrcConnectionStats stats() const noexcept
+	{
+		IrcConnectionStats stats;
+
+		stats.lines = m_lines.load(std::memory_order_relaxed);
+		stats.writes = m_writes.load(std::memory_order_relaxed);
+		stats.bytes = m_bytes.load(std::memory_order_relaxed);
+		stats.handshakes = m_handshakes.load(std::memory_order_relaxed);
+		stats.resumed = m_resumed.load(std::memory_order_relaxed);
+
+		return stats;
+	}
+
+	/**
+	 * Get the native handle.
+	 *
+	 * @return the handle, invalid once disconnect() has been called
+	 * @note After a failure, the handle stays valid until disconnect() so that it can be removed from a listener
+	 */
+	inline SocketAbstract::Handle handle() const noexcept
+	{
+		return m_socket.handle();
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_IRC_CONNECTION_H_
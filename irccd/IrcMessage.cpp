@@ -0,0 +1,205 @@
+/*
+ * IrcMessage.cpp -- zero-copy IRC line parser
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "IrcMessage.h"
+
+namespace irccd {
+
+namespace {
+
+char *skip(char *p, char *end) noexcept
+{
+	while (p < end && *p == ' ') {
+		++ p;
+	}
+
+	return p;
+}
+
+/*
+ * Unescape a tag value in place, see the IRCv3 message tags specification. Returns the new end.
+ */
+char *unescape(char *begin, char *end) noexcept
+{
+	char *out = begin;
+
+	for (char *in = begin; in < end; ++in) {
+		if (*in != '\\') {
+			*out++ = *in;
+			continue;
+		}
+
+		/* A trailing backslash is dropped */
+		if (++in == end) {
+			break;
+		}
+
+		switch (*in) {
+		case ':':
+			*out++ = ';';
+			break;
+		case 's':
+			*out++ = ' ';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		default:
+			*out++ = *in;
+			break;
+		}
+	}
+
+	return out;
+}
+
+} // !namespace
+
+bool IrcMessage::parse(char *line, std::size_t length) noexcept
+{
+	char *p = line;
+	char *end = line + length;
+	char *stop;
+
+	prefix = IrcView();
+	command = IrcView();
+	tagCount = 0;
+	paramCount = 0;
+
+	/* Tags */
+	if (p < end && *p == '@') {
+		stop = std::find(++p, end, ' ');
+
+		while (p < stop) {
+			char *next = std::find(p, stop, ';');
+			char *equal = std::find(p, next, '=');
+
+			if (equal != p && tagCount < MaxTags) {
+				IrcTag &tag = tags[tagCount++];
+
+				tag.key = IrcView(p, equal - p);
+				tag.value = IrcView();
+
+				if (equal != next) {
+					tag.value = IrcView(equal + 1, unescape(equal + 1, next) - equal - 1);
+				}
+			}
+
+			p = (next == stop) ? next : next + 1;
+		}
+
+		p = skip(stop, end);
+	}
+
+	/* Prefix */
+	if (p < end && *p == ':') {
+		stop = std::find(++p, end, ' ');
+		prefix = IrcView(p, stop - p);
+		p = skip(stop, end);
+	}
+
+	/* Command */
+	stop = std::find(p, end, ' ');
+
+	if (stop == p) {
+		return false;
+	}
+
+	command = IrcView(p, stop - p);
+	p = stop;
+
+	/* Parameters, the last one takes the remaining of the line even without the colon */
+	while ((p = skip(p, end)) < end) {
+		if (*p == ':' || paramCount == MaxParams - 1) {
+			if (*p == ':') {
+				++ p;
+			}
+
+			params[paramCount++] = IrcView(p, end - p);
+			break;
+		}
+
+		stop = std::find(p, end, ' ');
+		params[paramCount++] = IrcView(p, stop - p);
+		p = stop;
+	}
+
+	return true;
+}
+
+int IrcMessage::numeric() const noexcept
+{
+	if (command.length != 3) {
+		return 0;
+	}
+
+	int value = 0;
+
+	for (std::size_t i = 0; i < 3; ++i) {
+		if (command.data[i] < '0' || command.data[i] > '9') {
+			return 0;
+		}
+
+		value = value * 10 + (command.data[i] - '0');
+	}
+
+	return value;
+}
+
+const IrcTag *IrcMessage::tag(const char *key) const noexcept
+{
+	for (std::size_t i = 0; i < tagCount; ++i) {
+		if (tags[i].key == key) {
+			return &tags[i];
+		}
+	}
+
+	return nullptr;
+}
+
+IrcView IrcMessage::nickname() const noexcept
+{
+	const char *end = prefix.data + prefix.length;
+
+	return IrcView(prefix.data, std::find_if(prefix.data, end, [] (char c) {
+		return c == '!' || c == '@';
+	}) - prefix.data);
+}
+
+std::string ircNickname(const std::string &origin)
+{
+	return origin.substr(0, origin.find_first_of("!@"));
+}
+
+std::string ircHost(const std::string &origin)
+{
+	auto pos = origin.find('@');
+
+	if (pos == std::string::npos) {
+		pos = origin.find('!');
+	}
+
+	return pos == std::string::npos ? origin : origin.substr(pos + 1);
+}
+
+} // !irccd
@@ -0,0 +1,219 @@
+/*
+ * IrcMessage.h -- zero-copy IRC line parser
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_IRC_MESSAGE_H_
+#define _IRCCD_IRC_MESSAGE_H_
+
+/**
+ * @file IrcMessage.h
+ * @brief Zero-copy IRC line parser
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace irccd {
+
+/**
+ * @class IrcView
+ * @brief Non-owning view into a received line
+ *
+ * The view is only valid until the connection reads more data, use str() to keep it.
+ */
+class IrcView {
+public:
+	const char *data{""};
+	std::size_t length{0};
+
+	/**
+	 * Default constructor, empty view.
+	 */
+	IrcView() = default;
+
+	/**
+	 * Create a view.
+	 *
+	 * @param data the characters
+	 * @param length the number of characters
+	 */
+	inline IrcView(const char *data, std::size_t length) noexcept
+		: data(data)
+		, length(length)
+	{
+	}
+
+	/**
+	 * Tells if the view is empty.
+	 *
+	 * @return true if empty
+	 */
+	inline bool empty() const noexcept
+	{
+		return length == 0;
+	}
+
+	/**
+	 * Copy the view.
+	 *
+	 * @return the string
+	 */
+	inline std::string str() const
+	{
+		return std::string(data, length);
+	}
+
+	/**
+	 * Compare with a NUL terminated string.
+	 *
+	 * @param other the string
+	 * @return true if equals
+	 */
+	inline bool operator==(const char *other) const noexcept
+	{
+		return std::strlen(other) == length && std::memcmp(data, other, length) == 0;
+	}
+
+	/**
+	 * Compare with a string.
+	 *
+	 * @param other the string
+	 * @return true if equals
+	 */
+	inline bool operator==(const std::string &other) const noexcept
+	{
+		return other.length() == length && other.compare(0, length, data, length) == 0;
+	}
+
+	/**
+	 * Compare with a NUL terminated string.
+	 *
+	 * @param other the string
+	 * @return true if different
+	 */
+	inline bool operator!=(const char *other) const noexcept
+	{
+		return !(*this == other);
+	}
+};
+
+/**
+ * @class IrcTag
+ * @brief IRCv3 message tag
+ */
+class IrcTag {
+public:
+	IrcView key;		//!< the key, including the vendor prefix if any
+	IrcView value;		//!< the unescaped value, empty if not set
+};
+
+/**
+ * @class IrcMessage
+ * @brief A parsed IRC line
+ *
+ * The parser does not copy anything, all fields are views into the line given to parse(). Only the tag values are
+ * unescaped in place, the result is never longer than the escaped form.
+ *
+ * The line is in the RFC 1459 form with the IRCv3 message tags extension:
+ *
+ *	[@tag[=value][;tag...] ][:prefix ]command[ param...][ :trailing]
+ *
+ * The trailing parameter is stored as the last parameter, like any other.
+ */
+class IrcMessage {
+public:
+	/**
+	 * Maximum number of parameters (RFC 1459, section 2.3).
+	 */
+	static constexpr std::size_t MaxParams{15};
+
+	/**
+	 * Maximum number of tags, others are ignored.
+	 */
+	static constexpr std::size_t MaxTags{32};
+
+	IrcView prefix;					//!< the origin, empty if not set
+	IrcView command;				//!< the command or the numeric
+	std::array<IrcTag, MaxTags> tags;		//!< the tags
+	std::size_t tagCount{0};			//!< number of tags
+	std::array<IrcView, MaxParams> params;		//!< the parameters
+	std::size_t paramCount{0};			//!< number of parameters
+
+	/**
+	 * Parse a line, without the line terminator.
+	 *
+	 * @param line the line, tag values are unescaped in place
+	 * @param length the line length
+	 * @return false if the line has no command
+	 */
+	bool parse(char *line, std::size_t length) noexcept;
+
+	/**
+	 * Get the numeric reply.
+	 *
+	 * @return the numeric or 0 if the command is not a three digit numeric
+	 */
+	int numeric() const noexcept;
+
+	/**
+	 * Get a parameter.
+	 *
+	 * @param index the parameter index
+	 * @return the parameter or an empty view if not present
+	 */
+	inline IrcView param(std::size_t index) const noexcept
+	{
+		return index < paramCount ? params[index] : IrcView();
+	}
+
+	/**
+	 * Find a tag.
+	 *
+	 * @param key the tag key
+	 * @return the tag or nullptr if not present
+	 */
+	const IrcTag *tag(const char *key) const noexcept;
+
+	/**
+	 * Get the nickname part of the prefix.
+	 *
+	 * @return the nickname (or the server name)
+	 */
+	IrcView nickname() const noexcept;
+};
+
+/**
+ * Get the nickname part of nickname!user@host.
+ *
+ * @param origin the full origin
+ * @return the nickname
+ */
+std::string ircNickname(const std::string &origin);
+
+/**
+ * Get the host part of nickname!user@host.
+ *
+ * @param origin the full origin
+ * @return the host or the origin if it has no host
+ */
+std::string ircHost(const std::string &origin);
+
+} // !irccd
+
+#endif // !_IRCCD_IRC_MESSAGE_H_
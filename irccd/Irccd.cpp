@@ -18,9 +18,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <sstream>
 #include <stdexcept>
 
 #include <Filesystem.h>
+#include <Json.h>
 #include <Logger.h>
 #include <Util.h>
 
@@ -34,47 +36,259 @@ using namespace irccd::address;
 
 namespace irccd {
 
+namespace {
+
+const char *stateName(const ServerStatus &status) noexcept
+{
+	switch (status.state) {
+	case ServerState::Connecting:
+		return status.waiting ? "waiting" : "connecting";
+	case ServerState::Connected:
+		return "connected";
+	case ServerState::Disconnected:
+		return "disconnected";
+	case ServerState::Dead:
+		return "dead";
+	default:
+		return "";
+	}
+}
+
+/*
+ * Number of milliseconds elapsed since a time point, -1 if it never happened.
+ */
+long long elapsed(chrono::steady_clock::time_point point) noexcept
+{
+	if (point == chrono::steady_clock::time_point()) {
+		return -1;
+	}
+
+	return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - point).count();
+}
+
+} // !namespace
+
 #if defined(WITH_JS)
 
-ServerMessagePair Irccd::parseMessage(string message, Server &server, Plugin &plugin)
+namespace {
+
+PluginHandler handler(const ServerEvent &event, bool command) noexcept
 {
-	string cc = server.settings().command;
-	string name = plugin.info().name;
-	string result = message;
-	bool iscommand = false;
+	switch (event.type) {
+	case ServerEventType::ChannelNotice:
+		return PluginHandler::ChannelNotice;
+	case ServerEventType::Connect:
+		return PluginHandler::Connect;
+	case ServerEventType::Invite:
+		return PluginHandler::Invite;
+	case ServerEventType::Join:
+		return PluginHandler::Join;
+	case ServerEventType::JoinBatch:
+		return PluginHandler::JoinBatch;
+	case ServerEventType::Kick:
+		return PluginHandler::Kick;
+	case ServerEventType::Message:
+		return command ? PluginHandler::Command : PluginHandler::Message;
+	case ServerEventType::Me:
+		return PluginHandler::Me;
+	case ServerEventType::Mode:
+		return PluginHandler::Mode;
+	case ServerEventType::Names:
+		return PluginHandler::Names;
+	case ServerEventType::Nick:
+		return PluginHandler::Nick;
+	case ServerEventType::Notice:
+		return PluginHandler::Notice;
+	case ServerEventType::Part:
+		return PluginHandler::Part;
+	case ServerEventType::PartBatch:
+		return PluginHandler::PartBatch;
+	case ServerEventType::Query:
+		return command ? PluginHandler::QueryCommand : PluginHandler::Query;
+	case ServerEventType::Topic:
+		return PluginHandler::Topic;
+	default:
+		return PluginHandler::UserMode;
+	}
+}
 
-	// handle special commands "!<plugin> command"
-	if (cc.length() > 0) {
-		auto pos = result.find_first_of(" \t");
-		auto fullcommand = cc + name;
+} // !namespace
 
-		/*
-		 * If the message that comes is "!foo" without spaces we
-		 * compare the command char + the plugin name. If there
-		 * is a space, we check until we find a space, if not
-		 * typing "!foo123123" will trigger foo plugin.
-		 */
-		if (pos == string::npos) {
-			iscommand = result == fullcommand;
+void Irccd::execServerEvent(const ServerEvent &event, Plugin &plugin)
+{
+	shared_ptr<Server> server = event.server->shared_from_this();
+
+	switch (event.type) {
+	case ServerEventType::ChannelNotice:
+		plugin.onChannelNotice(move(server), event.origin.str(), event.channel.str(), event.message.str());
+		break;
+	case ServerEventType::Connect:
+		plugin.onConnect(move(server));
+		break;
+	case ServerEventType::Invite:
+		plugin.onInvite(move(server), event.origin.str(), event.channel.str());
+		break;
+	case ServerEventType::Join:
+		plugin.onJoin(move(server), event.origin.str(), event.channel.str());
+		break;
+	case ServerEventType::JoinBatch:
+		plugin.onJoinBatch(move(server), event.entries);
+		break;
+	case ServerEventType::Kick:
+		plugin.onKick(move(server), event.origin.str(), event.channel.str(), event.message.str(), event.extra.str());
+		break;
+	case ServerEventType::Message:
+		if (event.isCommandFor(plugin.info().name)) {
+			plugin.onCommand(move(server), event.origin.str(), event.channel.str(), event.command.str());
 		} else {
-			iscommand = result.length() >= fullcommand.length() &&
-			    result.compare(0, pos, fullcommand) == 0;
-		}
-
-		if (iscommand) {
-			/*
-			 * If no space is found we just set the message to "" otherwise
-			 * the plugin name will be passed through onCommand
-			 */
-			if (pos == string::npos) {
-				result = "";
-			} else {
-				result = message.substr(pos + 1);
-			}
+			plugin.onMessage(move(server), event.origin.str(), event.channel.str(), event.message.str());
+		}
+		break;
+	case ServerEventType::Me:
+		plugin.onMe(move(server), event.origin.str(), event.channel.str(), event.message.str());
+		break;
+	case ServerEventType::Mode:
+		plugin.onMode(move(server), event.origin.str(), event.channel.str(), event.message.str(), event.extra.str());
+		break;
+	case ServerEventType::Names:
+		plugin.onNames(move(server), event.channel.str(), Util::split(event.message.str(), " "));
+		break;
+	case ServerEventType::Nick:
+		plugin.onNick(move(server), event.origin.str(), event.message.str());
+		break;
+	case ServerEventType::Notice:
+		plugin.onNotice(move(server), event.origin.str(), event.message.str());
+		break;
+	case ServerEventType::Part:
+		plugin.onPart(move(server), event.origin.str(), event.channel.str(), event.message.str());
+		break;
+	case ServerEventType::PartBatch:
+		plugin.onPartBatch(move(server), event.entries);
+		break;
+	case ServerEventType::Query:
+		if (event.isCommandFor(plugin.info().name)) {
+			plugin.onQueryCommand(move(server), event.origin.str(), event.command.str());
+		} else {
+			plugin.onQuery(move(server), event.origin.str(), event.message.str());
+		}
+		break;
+	case ServerEventType::Topic:
+		plugin.onTopic(move(server), event.origin.str(), event.channel.str(), event.message.str());
+		break;
+	case ServerEventType::UserMode:
+		plugin.onUserMode(move(server), event.origin.str(), event.message.str());
+		break;
+	default:
+		break;
+	}
+}
+
+void Irccd::deliverServerEvent(const ServerEvent &event, const shared_ptr<Plugin> &plugin, shared_ptr<ServerEventCopy> &copy)
+{
+	auto worker = m_pluginWorkers.find(plugin->info().name);
+
+	/* Only copied if a worker needs the event after the arena is released */
+	if (worker != m_pluginWorkers.end()) {
+		if (!copy) {
+			copy = make_shared<ServerEventCopy>(event);
 		}
+
+		worker->second->push([this, copy, plugin] () {
+			execServerEvent(copy->event(), *plugin);
+		});
+	} else {
+		execServerEvent(event, *plugin);
 	}
+}
+
+void Irccd::dispatchServerBatch(const ServerEvent &event)
+{
+	const bool join = event.type == ServerEventType::JoinBatch;
+	const ArenaArray<ServerEventEntry> &entries = event.entries;
+
+	/* The rules see the individual events, a rule on onJoin also applies to the joins of a batch */
+	const char *name = join ? "onJoin" : "onPart";
+	const string server = event.server->info().name;
+
+	/* Rules only know the nickname part of the origin, computed once for all plugins */
+	vector<string> nicknames;
+	vector<string> channels;
+
+	/* Events for the plugins that do not handle the batch, created once for all of them */
+	vector<ServerEvent *> events;
+	vector<shared_ptr<ServerEventCopy>> copies;
+	shared_ptr<ServerEventCopy> copy;
+
+	for (auto &pair : m_plugins) {
+		bool batch = pair.second->implements(join ? PluginHandler::JoinBatch : PluginHandler::PartBatch);
+
+		if (!batch && !pair.second->implements(join ? PluginHandler::Join : PluginHandler::Part)) {
+			continue;
+		}
+
+		if (nicknames.empty()) {
+			for (const ServerEventEntry &entry : entries) {
+				nicknames.emplace_back(entry.origin.data, std::find(entry.origin.data, entry.origin.data + entry.origin.length, '!'));
+				channels.push_back(entry.channel.str());
+			}
+		}
+
+		vector<bool> allowed(entries.length);
+		size_t count = 0;
+
+		for (size_t i = 0; i < entries.length; ++i) {
+			allowed[i] = m_rules.solve(server, channels[i], nicknames[i], pair.first, name);
+			count += allowed[i] ? 1 : 0;
+		}
+
+		if (count != entries.length) {
+			Logger::debug() << "rule: " << (entries.length - count) << " event(s) " << name
+					<< " dropped for plugin " << pair.first << endl;
+		}
+
+		if (count == 0) {
+			continue;
+		}
+
+		if (batch && count == entries.length) {
+			deliverServerEvent(event, pair.second, copy);
+		} else if (batch) {
+			/* Same event with the allowed entries only, they still point to the strings of the original */
+			ServerEvent *filtered = m_arena.make<ServerEvent>(event);
+			shared_ptr<ServerEventCopy> own;
+
+			filtered->entries = m_arena.array<ServerEventEntry>(count);
+
+			for (size_t i = 0, j = 0; i < entries.length; ++i) {
+				if (allowed[i]) {
+					filtered->entries[j++] = entries[i];
+				}
+			}
+
+			deliverServerEvent(*filtered, pair.second, own);
+		} else {
+			if (events.empty()) {
+				for (const ServerEventEntry &entry : entries) {
+					ServerEvent *single = m_arena.make<ServerEvent>();
+
+					single->type = join ? ServerEventType::Join : ServerEventType::Part;
+					single->server = event.server;
+					single->origin = entry.origin;
+					single->channel = entry.channel;
+					single->message = entry.reason;
+					events.push_back(single);
+				}
+
+				copies.resize(entries.length);
+			}
 
-	return ServerMessagePair{result, ((iscommand) ? ServerMessageType::Command : ServerMessageType::Message)};
+			for (size_t i = 0; i < entries.length; ++i) {
+				if (allowed[i]) {
+					deliverServerEvent(*events[i], pair.second, copies[i]);
+				}
+			}
+		}
+	}
 }
 
 #endif
@@ -82,182 +296,430 @@ ServerMessagePair Irccd::parseMessage(string message, Server &server, Plugin &pl
 void Irccd::dispatch()
 {
 	/*
-	 * Make a copy because the events can add other events while we are iterating it. Also lock because the timers
-	 * may alter these events too.
+	 * Make a copy because the events can add other events while we are iterating it, they will be dispatched on
+	 * the next iteration.
 	 */
-	vector<Event> copy;
-
-	{
-		lock_guard<mutex> lock{m_mutex};
+	Events copy = move(m_events);
+	Event ev;
 
-		copy = move(m_events);
+	m_events.clear();
 
-		/* Clear for safety */
-		m_events.clear();
+	/* Do not starve the loop if other threads keep pushing */
+	for (std::size_t i = 0; i < m_queue.capacity() && m_queue.pop(ev); ++i) {
+		copy.push_back(move(ev));
 	}
 
 	if (copy.size() > 0) {
-		Logger::debug() << "irccd: dispatching " << copy.size() << " event(s)" << endl;
+		Logger::debug() << "irccd: dispatching " << copy.size() << " event(s), "
+				<< "queue high water: " << m_queue.highWater() << endl;
+	}
+
+	if (m_queue.dropped() != m_dropped) {
+		Logger::warning() << "irccd: event queue full, " << (m_queue.dropped() - m_dropped) << " event(s) dropped" << endl;
+		m_dropped = m_queue.dropped();
 	}
 
+	/* Events of the servers run by the reactors, they only add the IRC events below */
+	for (auto &reactor : m_reactors) {
+		for (std::size_t i = 0; i < reactor->outbox().capacity() && reactor->outbox().pop(ev); ++i) {
+			ev();
+		}
+
+		/* The reactor stops reading its servers while its outbox is full */
+		reactor->resume();
+	}
+
+	/* IRC events first, they were produced before the events of this iteration */
+	for (std::size_t i = 0; i < m_serverEvents.size(); ++i) {
+		dispatchServerEvent(*m_serverEvents[i]);
+	}
+
+	m_serverEvents.clear();
+	m_arena.reset();
+
 	for (auto &ev : copy) {
 		ev();
 	}
 }
 
-void Irccd::process(fd_set &setinput, fd_set &setoutput)
+void Irccd::process(const SocketStatus &status)
 {
-	/* 1. May be IPC */
-	if (FD_ISSET(m_socketServer.handle(), &setinput)) {
-		try {
-			(void)m_socketServer.recv(8);
-		} catch (const std::exception &) {
-			// TODO: think what we can do here
+	auto handle = status.socket.handle();
+
+	/* 1. May be IPC, the events are popped in dispatch() */
+	if (handle == m_queue.socket().handle()) {
+		m_queue.clear();
+
+		return;
+	}
+
+	for (auto &reactor : m_reactors) {
+		if (handle == reactor->outbox().socket().handle()) {
+			reactor->outbox().clear();
+
+			return;
 		}
 	}
 
 	/* 2. Check for transport clients */
-	for (auto &pair : m_lookupTransportClients) {
-		pair.second->sync(setinput, setoutput);
+	auto client = m_lookupTransportClients.find(handle);
+
+	if (client != m_lookupTransportClients.end()) {
+		/* Keep a reference, the client may die while syncing */
+		auto tc = client->second;
+
+		tc->sync(status.flags);
+		watchTransportClient(*tc);
+
+		return;
 	}
 
 	/* 3. Check for transport servers */
-	for (auto &pair : m_lookupTransportServers) {
-		if (FD_ISSET(pair.second->socket().handle(), &setinput)) {
-			Logger::debug() << "transport: new client connected" << endl;
+	auto transport = m_lookupTransportServers.find(handle);
 
-			auto client = pair.second->accept();
+	if (transport != m_lookupTransportServers.end()) {
+		Logger::debug() << "transport: new client connected" << endl;
 
-			m_lookupTransportClients.emplace(client->socket().handle(), move(client));
+		try {
+			auto tc = transport->second->accept();
+
+			tc->onChannelNotice.connect(bind(&Irccd::handleTransportChannelNotice, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onChannels.connect(bind(&Irccd::handleTransportChannels, this, weak_ptr<TransportClientAbstract>(tc), _1, _2));
+			tc->onClients.connect(bind(&Irccd::handleTransportClients, this, weak_ptr<TransportClientAbstract>(tc)));
+			tc->onConnections.connect(bind(&Irccd::handleTransportConnections, this, weak_ptr<TransportClientAbstract>(tc)));
+			tc->onDisconnect.connect(bind(&Irccd::handleTransportDisconnect, this, weak_ptr<TransportClientAbstract>(tc), _1));
+			tc->onInvite.connect(bind(&Irccd::handleTransportInvite, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onJoin.connect(bind(&Irccd::handleTransportJoin, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onKick.connect(bind(&Irccd::handleTransportKick, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3, _4));
+			tc->onMe.connect(bind(&Irccd::handleTransportMe, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onMessage.connect(bind(&Irccd::handleTransportMessage, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onMode.connect(bind(&Irccd::handleTransportMode, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onNick.connect(bind(&Irccd::handleTransportNick, this, weak_ptr<TransportClientAbstract>(tc), _1, _2));
+			tc->onNotice.connect(bind(&Irccd::handleTransportNotice, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onPart.connect(bind(&Irccd::handleTransportPart, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onStats.connect(bind(&Irccd::handleTransportStats, this, weak_ptr<TransportClientAbstract>(tc), _1));
+			tc->onSubscribe.connect(bind(&Irccd::handleTransportSubscribe, this, weak_ptr<TransportClientAbstract>(tc), _1));
+			tc->onTopic.connect(bind(&Irccd::handleTransportTopic, this, weak_ptr<TransportClientAbstract>(tc), _1, _2, _3));
+			tc->onUserMode.connect(bind(&Irccd::handleTransportUserMode, this, weak_ptr<TransportClientAbstract>(tc), _1, _2));
+			tc->onOverflow.connect(bind(&Irccd::handleTransportOverflow, this, weak_ptr<TransportClientAbstract>(tc)));
+			tc->onDie.connect(bind(&Irccd::handleTransportDie, this, weak_ptr<TransportClientAbstract>(tc)));
+			m_listener.set(tc->socket(), SocketListener::Read);
+			m_lookupTransportClients.emplace(tc->socket().handle(), move(tc));
+		} catch (const std::exception &ex) {
+			Logger::warning() << "transport: " << ex.what() << endl;
 		}
+
+		return;
 	}
 
-	/* 3. Check for servers */
-	for (auto &pair : m_servers) {
-		pair.second->sync(setinput, setoutput);
+	/* 4. Check for servers */
+	auto server = m_lookupServers.find(handle);
+
+	if (server != m_lookupServers.end()) {
+		server->second->sync(status.flags);
 	}
 }
 
-void Irccd::exec()
+int Irccd::timeout() noexcept
 {
-	fd_set setinput;
-	fd_set setoutput;
-	auto max = m_socketServer.handle();
-	auto set = [&] (fd_set &set, SocketAbstract::Handle handle) {
-		FD_SET(handle, &set);
+	/* Events added from the loop itself must not wait */
+	if (!m_events.empty() || !m_serverEvents.empty()) {
+		return 0;
+	}
+
+	int result = -1;
 
-		if (handle > max) {
-			max = handle;
+	auto merge = [&] (int value) {
+		if (value >= 0 && (result < 0 || value < result)) {
+			result = value;
 		}
 	};
 
-	FD_ZERO(&setinput);
-	FD_ZERO(&setoutput);
+	/* The reactors have their own deadlines */
+	if (m_reactors.empty()) {
+		for (const auto &pair : m_servers) {
+			merge(pair.second->timeout());
+		}
+	}
 
-	/* 1. Add master socket */
-	FD_SET(m_socketServer.handle(), &setinput);
+#if defined(WITH_JS)
+	merge(m_timerQueue.timeout());
+#endif
 
-	/* 2. Add servers */
-	for (auto &pair : m_servers) {
-		pair.second->update();
-		pair.second->prepare(setinput, setoutput, max);
-	}
+	return result;
+}
 
-	/* 3. Add transports clients */
-	for (auto &pair : m_lookupTransportClients) {
-		set(setinput, pair.first);
+void Irccd::exec()
+{
+	/*
+	 * 1. Run the servers state, they update their registration in the listener only when the connection
+	 *    changes its socket or its interest. With reactors, the servers are run in their threads.
+	 */
+	if (m_reactors.empty()) {
+		for (auto &pair : m_servers) {
+			auto &server = pair.second;
+			auto previous = server->socket().handle();
+
+			server->update();
+			server->prepare(m_listener);
 
-		if (pair.second->hasOutput()) {
-			set(setoutput, pair.first);
+			auto current = server->socket().handle();
+
+			if (current != previous) {
+				m_lookupServers.erase(previous);
+
+				if (current != SocketAbstract::Invalid) {
+					m_lookupServers.emplace(current, server);
+				}
+			}
 		}
 	}
 
-	/* 4. Add transport servers */
-	for (auto &pair : m_lookupTransportServers) {
-		set(setinput, pair.first);
+	/* 2. Only visit the sockets that are ready, sleep until the earliest deadline */
+	try {
+		for (const SocketStatus &status : m_listener.waitMultiple(timeout())) {
+			/* Skip anyway */
+			if (!m_running) {
+				return;
+			}
+
+			process(status);
+		}
+	} catch (const SocketError &ex) {
+		/* Timeout is not an error and EINTR is reported when stopping */
+		if (ex.code() != SocketError::Timeout && m_running) {
+			Logger::warning() << "irccd: " << ex.what() << std::endl;
+		}
 	}
 
-	// 4. Do the selection
-	struct timeval tv;
+	if (!m_running) {
+		return;
+	}
 
-	tv.tv_sec = 0;
-	tv.tv_usec = 250000;
+#if defined(WITH_JS)
+	/* 3. Expire the timers that are due */
+	m_timerQueue.process();
+#endif
 
-	int error = select(max + 1, &setinput, &setoutput, nullptr, &tv);
+	dispatch();
+}
 
-	/* Skip anyway */
-	if (!m_running) {
+void Irccd::watchTransportClient(TransportClientAbstract &tc) noexcept
+{
+	/* The client may have died in the meantime */
+	if (m_lookupTransportClients.count(tc.socket().handle()) == 0) {
 		return;
 	}
 
-	/* Skip on error */
-	if (error < 0 && errno != EINTR) {
-		Logger::warning() << "irccd: " << SocketAbstract::syserror() << std::endl;
-		return;
+	try {
+		if (tc.hasOutput()) {
+			m_listener.set(tc.socket(), SocketListener::Write);
+		} else {
+			m_listener.unset(tc.socket(), SocketListener::Write);
+		}
+	} catch (const std::exception &ex) {
+		Logger::warning() << "transport: " << ex.what() << endl;
 	}
+}
 
-	process(setinput, setoutput);
-	dispatch();
+void Irccd::wakeServers() noexcept
+{
+	if (m_reactors.empty()) {
+		m_queue.wake();
+	} else {
+		for (auto &reactor : m_reactors) {
+			reactor->wake();
+		}
+	}
 }
 
 void Irccd::addTransportEvent(shared_ptr<TransportClientAbstract> tc, Event ev)  noexcept
 {
+	/* The replies are sent later, they still need the request identifier */
+	TransportRequest request = tc->defer();
+
 	addEvent([=] () {
+		tc->resume(request);
+
 		try {
 			ev();
 		} catch (const std::exception &ex) {
 			tc->error(ex.what());
 		}
+
+		tc->complete();
+		watchTransportClient(*tc);
 	});
 }
 
-void Irccd::addServerEvent(ServerEvent event) noexcept
+void Irccd::postServerEvent(const shared_ptr<Server> &server, Event ev) noexcept
 {
-	addEvent([=] () {
-		for (auto &pair : m_plugins) {
-			auto name = event.name(*pair.second);
+	auto it = m_serverReactors.find(server->info().name);
+
+	if (it == m_serverReactors.end()) {
+		ev();
+	} else if (!it->second->post(move(ev))) {
+		Logger::warning() << "server " << server->info().name << ": reactor inbox full, command dropped" << endl;
+	}
+}
 
-			// TODO: match rules here
-			(void)name;
+void Irccd::addServerEvent(ServerEventType type,
+			   Server &server,
+			   const string &origin,
+			   const string &channel,
+			   const string &message,
+			   const string &extra) noexcept
+{
+	/* Called from a reactor, the event is built by the event loop */
+	if (this_thread::get_id() != m_thread) {
+		addEvent([=, server = server.shared_from_this()] () {
+			addServerEvent(type, *server, origin, channel, message, extra);
+		});
 
-			event.exec(*pair.second);
-		}
-	});
+		return;
+	}
+
+	ServerEvent *event = ServerEvent::create(m_arena, type, &server, origin, channel, message, extra);
+
+	/* Classify the command once for all plugins */
+	if (type == ServerEventType::Message || type == ServerEventType::Query) {
+		event->parseCommand(m_arena, server.settings().command);
+	}
+
+	publishServerEvent(event);
+}
+
+void Irccd::addServerEvent(ServerEventType type, Server &server, const ServerBatch &batch) noexcept
+{
+	if (this_thread::get_id() != m_thread) {
+		addEvent([=, server = server.shared_from_this()] () {
+			addServerEvent(type, *server, batch);
+		});
+
+		return;
+	}
+
+	publishServerEvent(ServerEvent::create(m_arena, type, &server, batch));
+}
+
+void Irccd::publishServerEvent(ServerEvent *event) noexcept
+{
+	/* Asynchronous send, each format is only built if someone wants the event and shared by the clients */
+	TransportOutput::Message json;
+	TransportOutput::Message msgpack;
 
-	/* Asynchronous send */
 	for (auto &pair : m_lookupTransportClients) {
-		pair.second->send(event.json);
+		if (!pair.second->filter().match(*event)) {
+			continue;
+		}
+
+		if (pair.second->format() == TransportFormat::MsgPack) {
+			if (!msgpack) {
+				msgpack = TransportOutput::makeFrame(event->msgpack());
+			}
+
+			pair.second->send(msgpack);
+		} else {
+			if (!json) {
+				json = TransportOutput::make(event->json());
+			}
+
+			pair.second->send(json);
+		}
+
+		watchTransportClient(*pair.second);
 	}
+
+	m_serverEvents.push_back(event);
 }
 
-Irccd::Irccd()
-	: m_socketServer{AF_INET, 0}
-	, m_socketClient{AF_INET, 0}
+void Irccd::dispatchServerEvent(const ServerEvent &event)
 {
-	/* Create temporary socket */
-	SocketTcp<Ipv4> master{AF_INET, 0};
+	/* Plugins may opt out and receive the individual events */
+	if (event.isBatch()) {
+		dispatchServerBatch(event);
+		return;
+	}
 
-	master.set(SOL_SOCKET, SO_REUSEADDR, 1);
-	master.bind(Ipv4{"*", 0});
-	master.listen(1);
+	/* Rules only know the nickname part of the origin */
+	const string nickname(event.origin.data, std::find(event.origin.data, event.origin.data + event.origin.length, '!'));
+	const string channel = event.channel.str();
 
-	Ipv4 local = master.getsockname();
+	/* At most one plugin receives the command, found in the plugin table directly */
+	const Plugin *target = nullptr;
 
-	m_socketClient.connect(Ipv4{"127.0.0.1", local.port()});
-	m_socketServer = master.accept();
-	m_socketClient.setBlockMode(false);
+	if (event.plugin.length > 0) {
+		auto it = m_plugins.find(event.plugin.str());
+
+		if (it != m_plugins.end()) {
+			target = it->second.get();
+		}
+	}
+
+	shared_ptr<ServerEventCopy> copy;
+
+	for (auto &pair : m_plugins) {
+		bool command = pair.second.get() == target;
+
+		/* Nothing to marshal if the plugin does not handle it */
+		if (!pair.second->implements(handler(event, command))) {
+			continue;
+		}
+
+		const char *name = event.name(command);
+
+		/* Check the rules before pushing anything to the plugin */
+		if (!m_rules.solve(event.server->info().name, channel, nickname, pair.first, name)) {
+			Logger::debug() << "rule: event " << name << " dropped for plugin " << pair.first << endl;
+			continue;
+		}
+
+		deliverServerEvent(event, pair.second, copy);
+	}
+}
+
+Irccd::Irccd()
+	: m_thread(this_thread::get_id())
+	, m_resolver([this] () { wakeServers(); })
+{
+	m_listener.set(m_queue.socket(), SocketListener::Read);
+}
+
+Irccd::~Irccd()
+{
+	for (auto &reactor : m_reactors) {
+		reactor->stop();
+	}
 }
 
 void Irccd::addEvent(Event ev) noexcept
 {
-	lock_guard<std::mutex> lock{m_mutex};
+	Reactor *reactor;
 
-	m_events.push_back(std::move(ev));
+	/* No need to wake up ourselves */
+	if (this_thread::get_id() == m_thread) {
+		m_events.push_back(move(ev));
+	} else if ((reactor = Reactor::current()) != nullptr) {
+		reactor->forward(move(ev));
+	} else {
+		m_queue.push(move(ev));
+	}
+}
 
-	/* Silently discard */
-	try {
-		m_socketClient.send(" ");
-	} catch (...) {
+void Irccd::setReactors(unsigned count)
+{
+	assert(m_servers.empty());
+
+	for (unsigned i = 0; i < count; ++i) {
+		auto reactor = make_unique<Reactor>();
+
+		m_listener.set(reactor->outbox().socket(), SocketListener::Read);
+		m_reactors.push_back(move(reactor));
+	}
+
+	/* A slot given back by a reactor may be for a server of another one */
+	if (!m_reactors.empty()) {
+		m_scheduler.setNotify([this] () { wakeServers(); });
 	}
 }
 
@@ -267,16 +729,37 @@ void Irccd::addServer(shared_ptr<Server> server) noexcept
 	server->onConnect.connect(bind(&Irccd::handleServerOnConnect, this, server));
 	server->onInvite.connect(bind(&Irccd::handleServerOnInvite, this, server, _1, _2, _3));
 	server->onJoin.connect(bind(&Irccd::handleServerOnJoin, this, server, _1, _2));
+	server->onJoinBatch.connect(bind(&Irccd::handleServerOnJoinBatch, this, server, _1));
 	server->onKick.connect(bind(&Irccd::handleServerOnKick, this, server, _1, _2, _3, _4));
 	server->onMessage.connect(bind(&Irccd::handleServerOnMessage, this, server, _1, _2, _3));
 	server->onMe.connect(bind(&Irccd::handleServerOnMe, this, server, _1, _2, _3));
 	server->onMode.connect(bind(&Irccd::handleServerOnMode, this, server, _1, _2, _3, _4));
+	server->onNames.connect(bind(&Irccd::handleServerOnNames, this, server, _1, _2));
 	server->onNick.connect(bind(&Irccd::handleServerOnNick, this, server, _1, _2));
 	server->onNotice.connect(bind(&Irccd::handleServerOnNotice, this, server, _1, _2));
 	server->onPart.connect(bind(&Irccd::handleServerOnPart, this, server, _1, _2, _3));
+	server->onPartBatch.connect(bind(&Irccd::handleServerOnPartBatch, this, server, _1));
 	server->onQuery.connect(bind(&Irccd::handleServerOnQuery, this, server, _1, _2));
 	server->onTopic.connect(bind(&Irccd::handleServerOnTopic, this, server, _1, _2, _3));
 	server->onUserMode.connect(bind(&Irccd::handleServerOnUserMode, this, server, _1, _2));
+	server->setResolver(&m_resolver);
+	server->setScheduler(&m_scheduler);
+
+	if (m_reactors.empty()) {
+		server->onQueued.connect(bind(&Irccd::handleServerQueued, this));
+	} else {
+		/* From now on, the server is only run by its reactor */
+		Reactor *reactor = m_reactors[m_servers.size() % m_reactors.size()].get();
+
+		server->onQueued.connect([reactor] () {
+			if (Reactor::current() != reactor) {
+				reactor->wake();
+			}
+		});
+
+		m_serverReactors.emplace(server->info().name, reactor);
+		reactor->add(server);
+	}
 
 	m_servers.emplace(server->info().name, move(server));
 }
@@ -285,6 +768,7 @@ void Irccd::addTransport(std::shared_ptr<TransportServerAbstract> ts)
 {
 	Logger::info() << "transport: listening on " << ts->info() << endl;
 
+	m_listener.set(ts->socket(), SocketListener::Read);
 	m_lookupTransportServers.emplace(ts->socket().handle(), move(ts));
 }
 
@@ -351,452 +835,475 @@ void Irccd::loadPlugin(string path)
 		return;
 	}
 
+	/* Pin the plugin to a worker if enabled */
+	PluginWorker *worker = nullptr;
+
+	if (m_workerCount > 0) {
+		if (m_workers.size() < m_workerCount) {
+			m_workers.push_back(make_unique<PluginWorker>());
+		}
+
+		worker = m_workers[m_plugins.size() % m_workerCount].get();
+		m_pluginWorkers.emplace(plugin->info().name, worker);
+	}
+
 	/*
-	 * These signals will be called from the Timer thread.
+	 * These signals are called from the thread that owns the plugin, either the event loop or its worker. The
+	 * worker is bound now because m_pluginWorkers may grow on the event loop while a worker runs.
 	 */
+	plugin->onTimerStart.connect(bind(&Irccd::handleTimerStart, this, worker, _1));
 	plugin->onTimerSignal.connect(bind(&Irccd::handleTimerSignal, this, plugin, _1));
 	plugin->onTimerEnd.connect(bind(&Irccd::handleTimerEnd, this, plugin, _1));
-	plugin->onLoad();
+
+	auto start = [this, plugin, worker] () {
+		/* Timers started while the plugin was evaluated were not scheduled yet */
+		for (const auto &timer : plugin->timers()) {
+			if (timer->isRunning()) {
+				handleTimerStart(worker, timer);
+			}
+		}
+
+		plugin->onLoad();
+	};
+
+	if (worker) {
+		worker->push(start);
+	} else {
+		start();
+	}
 
 	m_plugins.emplace(plugin->info().name, move(plugin));
 }
 
 #endif // !WITH_JS
 
-void Irccd::handleServerOnChannelNotice(shared_ptr<Server> server, string origin, string channel, string notice)
+void Irccd::handleServerOnChannelNotice(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &notice)
 {
 	Logger::debug() << "server " << server->info().name << ": onChannelNotice: "
 			<< "origin=" << origin << ", channel=" << channel <<", notice=" << notice << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"channelNotice\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\","
-	     << "\"notice\":\"" << JsonValue::escape(notice) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onChannelNotice";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onChannelNotice(move(server), move(origin), move(channel), move(notice));
-		}
-	});
+	addServerEvent(ServerEventType::ChannelNotice, *server, origin, channel, notice);
 }
 
-void Irccd::handleServerOnConnect(shared_ptr<Server> server)
+void Irccd::handleServerOnConnect(const shared_ptr<Server> &server)
 {
 	Logger::debug() << "server " << server->info().name << ": onConnect" << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onConnect\","
-	     << "\"server\":\"" << server->info().name << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, /* origin */ "", /* channel */ "", json.str(),
-		[=] (Plugin &) -> string {
-			return "onConnect";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onConnect(move(server));
-		}
-	});
+	addServerEvent(ServerEventType::Connect, *server);
 }
 
-void Irccd::handleServerOnInvite(shared_ptr<Server> server, string origin, string channel, string target)
+void Irccd::handleServerOnInvite(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &target)
 {
 	Logger::debug() << "server " << server->info().name << ": onInvite: "
 			<< "origin=" << origin << ", channel=" << channel << ", target=" << target << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onInvite\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onInvite";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onInvite(move(server), move(origin), move(channel));
-		}
-	});
+	addServerEvent(ServerEventType::Invite, *server, origin, channel, target);
 }
 
-void Irccd::handleServerOnJoin(shared_ptr<Server> server, string origin, string channel)
+void Irccd::handleServerOnJoin(const shared_ptr<Server> &server, const string &origin, const string &channel)
 {
 	Logger::debug() << "server " << server->info().name << ": onJoin: "
 			<< "origin=" << origin << ", channel=" << channel << endl;
 
-	ostringstream json;
+	addServerEvent(ServerEventType::Join, *server, origin, channel);
+}
 
-	json << "{"
-	     << "\"event\":\"onJoin\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\""
-	     << "}";
+void Irccd::handleServerOnJoinBatch(const shared_ptr<Server> &server, const ServerBatch &batch)
+{
+	Logger::debug() << "server " << server->info().name << ": onJoinBatch: " << batch.size() << " join(s)" << endl;
 
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onJoin";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onInvite(move(server), move(origin), move(channel));
-		}
-	});
+	addServerEvent(ServerEventType::JoinBatch, *server, batch);
 }
 
-void Irccd::handleServerOnKick(shared_ptr<Server> server, string origin, string channel, string target, string reason)
+void Irccd::handleServerOnKick(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &target, const string &reason)
 {
 	Logger::debug() << "server " << server->info().name << ": onKick: "
 			<< "origin=" << origin << ", channel=" << channel << ", target=" << target << ", reason=" << reason << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onKick\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\","
-	     << "\"target\":\"" << JsonValue::escape(target) << "\","
-	     << "\"reason\":\"" << JsonValue::escape(reason) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onKick";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onKick(move(server), move(origin), move(channel), move(target), move(reason));
-		}
-	});
+	addServerEvent(ServerEventType::Kick, *server, origin, channel, target, reason);
 }
 
-void Irccd::handleServerOnMessage(shared_ptr<Server> server, string origin, string channel, string message)
+void Irccd::handleServerOnMessage(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &message)
 {
 	Logger::debug() << "server " << server->info().name << ": onMessage: "
 			<< "origin=" << origin << ", channel=" << channel << ", message=" << message << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"Message\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\","
-	     << "\"message\":\"" << JsonValue::escape(message) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &plugin) -> string {
-			return parseMessage(message, *server, plugin).second == ServerMessageType::Command ? "onCommand" : "onMessage";
-		},
-		[=] (Plugin &plugin) {
-			ServerMessagePair pack = parseMessage(message, *server, plugin);
-
-			if (pack.second == ServerMessageType::Command) {
-				plugin.onCommand(move(server), move(channel), move(origin), move(message));
-			} else {
-				plugin.onMessage(move(server), move(channel), move(origin), move(message));
-			}
-		}
-	});
+	addServerEvent(ServerEventType::Message, *server, origin, channel, message);
 }
 
-void Irccd::handleServerOnMe(shared_ptr<Server> server, string origin, string target, string message)
+void Irccd::handleServerOnMe(const shared_ptr<Server> &server, const string &origin, const string &target, const string &message)
 {
 	Logger::debug() << "server " << server->info().name << ": onMe: "
 			<< "origin=" << origin << ", target=" << target << ", message=" << message << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onMe\","
-	     << "\"server\":\"" << server->info().name << "\""
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"target\":\"" << JsonValue::escape(target) << "\","
-	     << "\"message\":\"" << JsonValue::escape(message) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, target, json.str(),
-		[=] (Plugin &) -> string {
-			return "onMe";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onMe(move(server), move(origin), move(target), move(message));
-		}
-	});
+	addServerEvent(ServerEventType::Me, *server, origin, target, message);
 }
 
-void Irccd::handleServerOnMode(shared_ptr<Server> server, string origin, string channel, string mode, string arg)
+void Irccd::handleServerOnMode(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &mode, const string &arg)
 {
 	Logger::debug() << "server " << server->info().name << ": onMode: "
 			<< "origin=" << origin << ", channel=" << channel << ", mode=" << mode << ", argument=" << arg << endl;
 
-	ostringstream json;
+	addServerEvent(ServerEventType::Mode, *server, origin, channel, mode, arg);
+}
 
-	json << "{"
-	     << "\"event\":\"Mode\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"mode\":\"" << JsonValue::escape(mode) << "\","
-	     << "\"argument\":\"" << JsonValue::escape(arg) << "\""
-	     << "}";
+void Irccd::handleServerOnNames(const shared_ptr<Server> &server, const string &channel, const vector<string> &names)
+{
+	Logger::debug() << "server " << server->info().name << ": onNames: "
+			<< "channel=" << channel << ", names=" << names.size() << endl;
 
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onMode";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onMode(move(server), move(origin), move(channel), move(mode), move(arg));
-		}
-	});
+	addServerEvent(ServerEventType::Names, *server, "", channel, Util::join(names.begin(), names.end(), ' '));
 }
 
-void Irccd::handleServerOnNick(shared_ptr<Server> server, string origin, string nickname)
+void Irccd::handleServerOnNick(const shared_ptr<Server> &server, const string &origin, const string &nickname)
 {
 	Logger::debug() << "server " << server->info().name << ": onNick: "
 			<< "origin=" << origin << ", nickname=" << nickname << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onNick\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"old\":\"" << origin << "\","
-	     << "\"new\":\"" << nickname << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, /* channel */ "", json.str(),
-		[=] (Plugin &) -> string {
-			return "onNick";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onNick(move(server), move(origin), move(nickname));
-		}
-	});
+	addServerEvent(ServerEventType::Nick, *server, origin, nickname);
 }
 
-void Irccd::handleServerOnNotice(shared_ptr<Server> server, string origin, string message)
+void Irccd::handleServerOnNotice(const shared_ptr<Server> &server, const string &origin, const string &message)
 {
 	Logger::debug() << "server " << server->info().name << ": onNotice: "
 			<< "origin=" << origin << ", message=" << message << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"onNotice\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"notice\":\"" << JsonValue::escape(message) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, /* channel */ "", json.str(),
-		[=] (Plugin &) -> string {
-			return "onNotice";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onNotice(move(server), move(origin), move(message));
-		}
-	});
+	addServerEvent(ServerEventType::Notice, *server, origin, message);
 }
 
-void Irccd::handleServerOnPart(shared_ptr<Server> server, string origin, string channel, string reason)
+void Irccd::handleServerOnPart(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &reason)
 {
 	Logger::debug() << "server " << server->info().name << ": onPart: "
 			<< "origin=" << origin << ", channel=" << channel << ", reason=" << reason << endl;
 
-	ostringstream json;
+	addServerEvent(ServerEventType::Part, *server, origin, channel, reason);
+}
 
-	json << "{"
-	     << "\"event\":\"Part\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\","
-	     << "\"reason\":\"" << JsonValue::escape(reason) << "\""
-	     << "}";
+void Irccd::handleServerOnPartBatch(const shared_ptr<Server> &server, const ServerBatch &batch)
+{
+	Logger::debug() << "server " << server->info().name << ": onPartBatch: " << batch.size() << " part(s)" << endl;
 
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onPart";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onPart(move(server), move(origin), move(channel), move(reason));
-		}
-	});
+	addServerEvent(ServerEventType::PartBatch, *server, batch);
 }
 
-void Irccd::handleServerOnQuery(shared_ptr<Server> server, string origin, string message)
+void Irccd::handleServerOnQuery(const shared_ptr<Server> &server, const string &origin, const string &message)
 {
 	Logger::debug() << "server " << server->info().name << ": onQuery: "
 			<< "origin=" << origin << ", message=" << message << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"query\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"message\":\"" << JsonValue::escape(message) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, /* channel */ "", json.str(),
-		[=] (Plugin &plugin) -> string {
-			return parseMessage(message, *server, plugin).second == ServerMessageType::Command ? "onQueryCommand" : "onQuery";
-		},
-		[=] (Plugin &plugin) {
-			ServerMessagePair pack = parseMessage(message, *server, plugin);
-
-			if (pack.second == ServerMessageType::Command) {
-				plugin.onQueryCommand(move(server), move(origin), move(message));
-			} else {
-				plugin.onQuery(move(server), move(origin), move(message));
-			}
-		}
-	});
+	addServerEvent(ServerEventType::Query, *server, origin, message);
 }
 
-void Irccd::handleServerOnTopic(shared_ptr<Server> server, string origin, string channel, string topic)
+void Irccd::handleServerOnTopic(const shared_ptr<Server> &server, const string &origin, const string &channel, const string &topic)
 {
 	Logger::debug() << "server " << server->info().name << ": onTopic: "
 			<< "origin=" << origin << ", channel=" << channel << ", topic=" << topic << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"Topic\""
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"channel\":\"" << JsonValue::escape(channel) << "\","
-	     << "\"topic\":\"" << JsonValue::escape(topic) << "\""
-	     << "}";
-
-	addServerEvent({server->info().name, origin, channel, json.str(),
-		[=] (Plugin &) -> string {
-			return "onTopic";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onTopic(move(server), move(origin), move(channel), move(topic));
-		}
-	});
+	addServerEvent(ServerEventType::Topic, *server, origin, channel, topic);
 }
 
-void Irccd::handleServerOnUserMode(shared_ptr<Server> server, string origin, string mode)
+void Irccd::handleServerOnUserMode(const shared_ptr<Server> &server, const string &origin, const string &mode)
 {
 	Logger::debug() << "server " << server->info().name << ": onUserMode: "
 			<< "origin=" << origin << ", mode=" << mode << endl;
 
-	ostringstream json;
-
-	json << "{"
-	     << "\"event\":\"UserMode\","
-	     << "\"server\":\"" << server->info().name << "\","
-	     << "\"origin\":\"" << JsonValue::escape(origin) << "\","
-	     << "\"mode\":\"" << JsonValue::escape(mode) << "\""
-	     << "}";
+	addServerEvent(ServerEventType::UserMode, *server, origin, mode);
+}
 
-	addServerEvent({server->info().name, origin, /* channel */ "", json.str(),
-		[=] (Plugin &) -> string {
-			return "onUserMode";
-		},
-		[=] (Plugin &plugin) {
-			plugin.onUserMode(move(server), move(origin), move(mode));
-		}
-	});
+void Irccd::handleServerQueued()
+{
+	/* Commands queued from a plugin worker are flushed by the event loop, wake it up */
+	if (this_thread::get_id() != m_thread) {
+		m_queue.push([] () {});
+	}
 }
 
 /* ---------------------------------------------------------
  * Transport management
  * --------------------------------------------------------- */
 
-void Irccd::handleTransportChannelNotice(shared_ptr<TransportClientAbstract> tc, string server, string channel, string message)
+void Irccd::handleTransportChannelNotice(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string message)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->cnotice(move(channel), move(message));
 	});
 }
 
+void Irccd::handleTransportChannels(weak_ptr<TransportClientAbstract> ptr, string server, string channel)
+{
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
+	addTransportEvent(tc, [=] () {
+		shared_ptr<Server> s = findServer(server);
+		ostringstream json;
+
+		json << "{\"response\":\"channels\",\"server\":\"" << JsonValue::escape(server) << "\",";
+
+		if (channel.empty()) {
+			vector<string> channels = s->channels();
+
+			json << "\"channels\":[";
+
+			for (size_t i = 0; i < channels.size(); ++i) {
+				json << (i > 0 ? "," : "") << "\"" << JsonValue::escape(channels[i]) << "\"";
+			}
+
+			json << "]";
+		} else {
+			ServerChannelInfo info = s->channel(channel);
+
+			json << "\"channel\":{"
+			     << "\"name\":\"" << JsonValue::escape(info.name) << "\","
+			     << "\"topic\":\"" << JsonValue::escape(info.topic) << "\","
+			     << "\"users\":[";
+
+			for (size_t i = 0; i < info.members.size(); ++i) {
+				json << (i > 0 ? "," : "") << "{"
+				     << "\"nickname\":\"" << JsonValue::escape(info.members[i].nickname) << "\","
+				     << "\"modes\":\"" << JsonValue::escape(info.members[i].modes) << "\""
+				     << "}";
+			}
+
+			json << "]}";
+		}
+
+		json << "}";
+
+		tc->send(json.str());
+		watchTransportClient(*tc);
+	});
+}
+
+void Irccd::handleTransportClients(weak_ptr<TransportClientAbstract> ptr)
+{
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
+	addTransportEvent(tc, [=] () {
+		ostringstream json;
+
+		json << "{\"response\":\"clients\",\"clients\":[";
+
+		for (auto it = m_lookupTransportClients.begin(); it != m_lookupTransportClients.end(); ++it) {
+			const TransportOutput &output = it->second->output();
+
+			json << (it != m_lookupTransportClients.begin() ? "," : "") << "{"
+			     << "\"self\":" << (it->second == tc ? "true" : "false") << ","
+			     << "\"pending\":" << output.count() << ","
+			     << "\"bytes\":" << output.size() << ","
+			     << "\"sent\":" << output.sent() << ","
+			     << "\"dropped\":" << output.dropped() << ","
+			     << "\"writes\":" << output.writes() << ","
+			     << "\"limit\":" << output.limit() << ","
+			     << "\"overflow\":\"" << (output.overflow() == TransportOverflow::DropOldest ? "drop-oldest" : "disconnect") << "\""
+			     << "}";
+		}
+
+		json << "]}";
+
+		tc->send(json.str());
+		watchTransportClient(*tc);
+	});
+}
+
 void Irccd::handleTransportConnect()
 {
 	// TODO
 }
 
-void Irccd::handleTransportDisconnect(shared_ptr<TransportClientAbstract> tc, string server)
+void Irccd::handleTransportConnections(weak_ptr<TransportClientAbstract> ptr)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
-		findServer(server)->disconnect();
+		ostringstream json;
+
+		auto list = [&] (const char *key, const auto &names) {
+			json << "\"" << key << "\":[";
+
+			for (auto it = names.begin(); it != names.end(); ++it) {
+				json << (it != names.begin() ? "," : "") << "\"" << JsonValue::escape(*it) << "\"";
+			}
+
+			json << "],";
+		};
+
+		json << "{\"response\":\"connections\",\"limit\":" << m_scheduler.limit() << ",";
+		list("active", m_scheduler.active());
+		list("waiting", m_scheduler.waiting());
+		json << "\"servers\":[";
+
+		/* The servers may run in the reactors, only use their snapshot */
+		for (auto it = m_servers.begin(); it != m_servers.end(); ++it) {
+			ServerStatus status = it->second->status();
+			long long retry = 0;
+
+			if (status.state == ServerState::Disconnected) {
+				retry = std::max<long long>(0, chrono::duration_cast<chrono::milliseconds>(status.retry - chrono::steady_clock::now()).count());
+			}
+
+			json << (it != m_servers.begin() ? "," : "") << "{"
+			     << "\"name\":\"" << JsonValue::escape(it->first) << "\","
+			     << "\"state\":\"" << stateName(status) << "\","
+			     << "\"failures\":" << status.failures << ","
+			     << "\"retry\":" << retry
+			     << "}";
+		}
+
+		json << "]}";
+
+		tc->send(json.str());
+		watchTransportClient(*tc);
 	});
 }
 
-void Irccd::handleTransportInvite(shared_ptr<TransportClientAbstract> tc, string server, string target, string channel)
+void Irccd::handleTransportDisconnect(weak_ptr<TransportClientAbstract> ptr, string server)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
+	addTransportEvent(tc, [=] () {
+		shared_ptr<Server> s = findServer(server);
+
+		/* Changing the state is only allowed from the thread running the server */
+		postServerEvent(s, [s] () {
+			s->disconnect();
+		});
+	});
+}
+
+void Irccd::handleTransportInvite(weak_ptr<TransportClientAbstract> ptr, string server, string target, string channel)
+{
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->invite(move(target), move(channel));
 	});
 }
 
-void Irccd::handleTransportJoin(shared_ptr<TransportClientAbstract> tc, string server, string channel, string password)
+void Irccd::handleTransportJoin(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string password)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->join(move(channel), move(password));
 	});
 }
 
-void Irccd::handleTransportKick(shared_ptr<TransportClientAbstract> tc, string server, string target, string channel, string reason)
+void Irccd::handleTransportKick(weak_ptr<TransportClientAbstract> ptr, string server, string target, string channel, string reason)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->kick(move(target), move(channel), move(reason));
 	});
 }
 
-void Irccd::handleTransportMe(shared_ptr<TransportClientAbstract> tc, string server, string channel, string message)
+void Irccd::handleTransportMe(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string message)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->me(move(channel), move(message));
 	});
 }
 
-void Irccd::handleTransportMessage(shared_ptr<TransportClientAbstract> tc, string server, string channel, string message)
+void Irccd::handleTransportMessage(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string message)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->message(move(channel), move(message));
 	});
 }
 
-void Irccd::handleTransportMode(shared_ptr<TransportClientAbstract> tc, string server, string channel, string mode)
+void Irccd::handleTransportMode(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string mode)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->mode(move(channel), move(mode));
 	});
 }
 
-void Irccd::handleTransportNick(shared_ptr<TransportClientAbstract> tc, string server, string nickname)
+void Irccd::handleTransportNick(weak_ptr<TransportClientAbstract> ptr, string server, string nickname)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->nick(move(nickname));
 	});
 }
 
-void Irccd::handleTransportNotice(shared_ptr<TransportClientAbstract> tc, string server, string target, string message)
+void Irccd::handleTransportNotice(weak_ptr<TransportClientAbstract> ptr, string server, string target, string message)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->notice(move(target), move(message));
 	});
 }
 
-void Irccd::handleTransportPart(shared_ptr<TransportClientAbstract> tc, string server, string channel, string reason)
+void Irccd::handleTransportPart(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string reason)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->part(move(channel), move(reason));
 	});
@@ -820,8 +1327,99 @@ void Irccd::handleTransportReload(shared_ptr<TransportClientAbstract> tc, string
 	(void)plugin;
 }
 
-void Irccd::handleTransportTopic(shared_ptr<TransportClientAbstract> tc, string server, string channel, string topic)
+void Irccd::handleTransportStats(weak_ptr<TransportClientAbstract> ptr, string server)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
+	addTransportEvent(tc, [=] () {
+		vector<shared_ptr<Server>> servers;
+		ostringstream json;
+
+		if (server.empty()) {
+			for (const auto &pair : m_servers) {
+				servers.push_back(pair.second);
+			}
+		} else {
+			servers.push_back(findServer(server));
+		}
+
+		json << "{\"response\":\"stats\",\"servers\":[";
+
+		/* Only the thread-safe snapshots, the servers may run in the reactors */
+		for (size_t i = 0; i < servers.size(); ++i) {
+			ServerStatus status = servers[i]->status();
+			ServerLatency latency = servers[i]->latency();
+			ServerQueueStats queue = servers[i]->queueStats();
+			IrcConnectionStats output = servers[i]->connectionStats();
+
+			json << (i > 0 ? "," : "") << "{"
+			     << "\"name\":\"" << JsonValue::escape(servers[i]->info().name) << "\","
+			     << "\"state\":\"" << stateName(status) << "\","
+			     << "\"lag\":" << latency.last().count() << ","
+			     << "\"rtt\":{"
+			     << "\"count\":" << latency.count() << ","
+			     << "\"min\":" << latency.min().count() << ","
+			     << "\"avg\":" << latency.average().count() << ","
+			     << "\"max\":" << latency.max().count() << ","
+			     << "\"p50\":" << latency.percentile(50).count() << ","
+			     << "\"p99\":" << latency.percentile(99).count() << ","
+			     << "\"buckets\":[";
+
+			for (size_t b = 0; b < ServerLatency::Buckets; ++b) {
+				json << (b > 0 ? "," : "") << latency.bucket(b);
+			}
+
+			json << "]},"
+			     << "\"lastReceived\":" << elapsed(status.lastReceived) << ","
+			     << "\"lastSent\":" << elapsed(status.lastSent) << ","
+			     << "\"resolveTime\":" << servers[i]->resolveTime().count() / 1000.0 << ","
+			     << "\"queue\":{"
+			     << "\"depth\":" << queue.depth << ","
+			     << "\"sent\":" << queue.sent << ","
+			     << "\"dropped\":" << queue.dropped << ","
+			     << "\"maxWait\":" << queue.maxWait.count() << ","
+			     << "\"avgWait\":" << (queue.sent == 0 ? 0 : queue.totalWait.count() / static_cast<long long>(queue.sent))
+			     << "},"
+			     << "\"output\":{"
+			     << "\"lines\":" << output.lines << ","
+			     << "\"writes\":" << output.writes << ","
+			     << "\"bytes\":" << output.bytes
+			     << "},"
+			     << "\"tls\":{"
+			     << "\"handshakes\":" << output.handshakes << ","
+			     << "\"resumed\":" << output.resumed
+			     << "}}";
+		}
+
+		json << "]}";
+
+		tc->send(json.str());
+		watchTransportClient(*tc);
+	});
+}
+
+void Irccd::handleTransportSubscribe(weak_ptr<TransportClientAbstract> ptr, TransportFilter filter)
+{
+	auto tc = ptr.lock();
+
+	/* Already in the event loop thread, the next events are filtered */
+	if (tc) {
+		tc->setFilter(move(filter));
+	}
+}
+
+void Irccd::handleTransportTopic(weak_ptr<TransportClientAbstract> ptr, string server, string channel, string topic)
+{
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->topic(move(channel), move(topic));
 	});
@@ -836,52 +1434,97 @@ void Irccd::handleTransportUnload(shared_ptr<TransportClientAbstract> tc, string
 	(void)plugin;
 }
 
-void Irccd::handleTransportUserMode(shared_ptr<TransportClientAbstract> tc, string server, string mode)
+void Irccd::handleTransportUserMode(weak_ptr<TransportClientAbstract> ptr, string server, string mode)
 {
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
 	addTransportEvent(tc, [=] () {
 		findServer(server)->umode(move(mode));
 	});
 }
 
+void Irccd::handleTransportOverflow(weak_ptr<TransportClientAbstract> ptr)
+{
+	/* Emitted while the clients may be iterated, remove it later */
+	addEvent([=] () {
+		handleTransportDie(ptr);
+	});
+}
+
+void Irccd::handleTransportDie(weak_ptr<TransportClientAbstract> ptr)
+{
+	auto tc = ptr.lock();
+
+	if (!tc) {
+		return;
+	}
+
+	Logger::debug() << "transport: client disconnected" << endl;
+
+	/* Remove from the listener before the socket gets closed */
+	try {
+		m_listener.remove(tc->socket());
+	} catch (const std::exception &ex) {
+		Logger::warning() << "transport: " << ex.what() << endl;
+	}
+
+	m_lookupTransportClients.erase(tc->socket().handle());
+}
+
 /* --------------------------------------------------------
  * Timer slots
  * -------------------------------------------------------- */
 
 #if defined(WITH_JS)
 
+void Irccd::handleTimerStart(PluginWorker *worker, std::shared_ptr<Timer> timer)
+{
+	/* Called from the plugin thread, so the worker queue can be used directly */
+	if (worker) {
+		worker->timers().add(timer);
+	} else {
+		m_timerQueue.add(timer);
+	}
+}
+
 void Irccd::handleTimerSignal(std::shared_ptr<Plugin> plugin, std::shared_ptr<Timer> timer)
 {
-	addEvent([this, plugin, timer] () {
-		duk_context *ctx = plugin->context();
+	duk_context *ctx = plugin->context();
 
-		dukx_assert_begin(ctx);
-		duk_push_global_object(ctx);
-		duk_get_prop_string(ctx, -1, "\xff" "irccd-timers");
-		duk_push_pointer(ctx, timer.get());
-		duk_get_prop(ctx, -2);
+	dukx_assert_begin(ctx);
+	duk_push_global_object(ctx);
+	duk_get_prop_string(ctx, -1, "\xff" "irccd-timers");
+	duk_push_pointer(ctx, timer.get());
+	duk_get_prop(ctx, -2);
 
-		if (duk_pcall(ctx, 0) != 0) {
-			Logger::warning() << "plugin " << plugin->info().name
-					  << "failed to call timer: " << duk_safe_to_string(ctx, -1) << std::endl;
-		}
+	if (duk_pcall(ctx, 0) != 0) {
+		Logger::warning() << "plugin " << plugin->info().name
+				  << "failed to call timer: " << duk_safe_to_string(ctx, -1) << std::endl;
+	}
 
-		duk_pop(ctx);
-		duk_pop_2(ctx);
-		dukx_assert_equals(ctx);
-	});
+	duk_pop(ctx);
+	duk_pop_2(ctx);
+	dukx_assert_equals(ctx);
+
+	/* The timer may have defined or removed handlers */
+	plugin->refresh();
 }
 
 void Irccd::handleTimerEnd(std::shared_ptr<Plugin> plugin, std::shared_ptr<Timer> timer)
 {
-	addEvent([this, plugin, timer] () {
-		plugin->timerRemove(timer);
-	});
+	plugin->timerRemove(timer);
 }
 
 #endif
 
 void Irccd::run()
 {
+	m_thread = this_thread::get_id();
+
 	while (m_running) {
 		exec();
 	}
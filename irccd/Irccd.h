@@ -23,7 +23,7 @@
 #include <condition_variable>
 #include <functional>
 #include <memory>
-#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <IrccdConfig.h>
@@ -31,51 +31,25 @@
 #include <Logger.h>
 #include <Socket.h>
 #include <SocketAddress.h>
+#include <SocketListener.h>
 
+#include "Arena.h"
+#include "ConnectScheduler.h"
+#include "EventQueue.h"
 #include "Plugin.h"
+#include "PluginWorker.h"
+#include "Reactor.h"
+#include "Resolver.h"
+#include "RuleManager.h"
 #include "Server.h"
+#include "ServerEvent.h"
+#include "TimerQueue.h"
 #include "TransportServer.h"
 
 namespace irccd {
 
-using Event = std::function<void ()>;
 using Events = std::vector<Event>;
 
-/**
- * @class ServerEvent
- * @brief Structure that owns several informations about an IRC event
- *
- * This structure is used to dispatch the IRC event to the plugins and the transports.
- */
-class ServerEvent {
-public:
-	std::string server;
-	std::string origin;
-	std::string target;
-	std::string json;
-	std::function<std::string (Plugin &)> name;
-	std::function<void (Plugin &)> exec;
-};
-
-/**
- * @enum ServerMessageType
- * @brief Describe which type of message has been received
- *
- * On channels and queries, you may have a special command or a standard message depending on the
- * beginning of the message.
- *
- * Example: `!reminder help' may invoke the command event if a plugin reminder exists.
- */
-enum class ServerMessageType {
-	Command,		//!< special command
-	Message			//!< standard message
-};
-
-/**
- * @brief Combine the type of message and its content
- */
-using ServerMessagePair = std::pair<std::string, ServerMessageType>;
-
 /**
  * @brief Table of servers
  */
@@ -90,8 +64,10 @@ using LookupTable = std::unordered_map<SocketAbstract::Handle, std::shared_ptr<T
  *
  * This class is used as the main application event loop, it stores servers, plugins and transports.
  *
- * In a general manner, no code in irccd is thread-safe because irccd is mono-threaded except the JavaScript timer
- * API.
+ * In a general manner, no code in irccd is thread-safe because irccd is mono-threaded, the JavaScript timers are
+ * also scheduled from the event loop. The only exception is when plugin workers are enabled (see setWorkers), plugins
+ * then run in their PluginWorker and only reach the event loop through Server commands and Irccd::addEvent. Host
+ * names are also resolved in the Resolver threads.
  *
  * If you plan to add more threads to irccd, then the simpliest and safest way to execute thread-safe code is to
  * register an event using Irccd::addEvent function which will be called during the event loop dispatching.
@@ -103,16 +79,36 @@ private:
 	/* Main loop */
 	static std::atomic<bool> m_running;
 
-	/* Mutex for addEvent */
-	std::mutex m_mutex;
+	/* Thread running the event loop */
+	std::thread::id m_thread;
+
+	/* Events from other threads, they wake up the listener */
+	EventQueue m_queue;
+	std::size_t m_dropped{0};
+
+	/*
+	 * Optional threads running the servers, server name -> reactor. They are stopped by the destructor but
+	 * destroyed after the resolver which may still wake them up.
+	 */
+	std::vector<std::unique_ptr<Reactor>> m_reactors;
+	std::unordered_map<std::string, Reactor *> m_serverReactors;
+
+	/* Host names are resolved out of the event loop, the results wake it up */
+	Resolver m_resolver;
+
+	/* Limit of concurrent connection attempts, shared by the servers */
+	ConnectScheduler m_scheduler;
 
-	/* IPC */
-	SocketTcp<address::Ipv4> m_socketServer;
-	SocketTcp<address::Ipv4> m_socketClient;
+	/* Persistent listener, sockets are only updated when their interest changes */
+	SocketListener m_listener;
 
-	/* Event loop */
+	/* Events added from the event loop itself */
 	Events m_events;
 
+	/* IRC events of the current iteration, allocated in the arena and released after dispatch */
+	Arena m_arena;
+	std::vector<ServerEvent *> m_serverEvents;
+
 	/* Servers */
 	Servers m_servers;
 
@@ -120,74 +116,123 @@ private:
 #if defined(WITH_JS)
 	std::unordered_map<std::string, std::shared_ptr<Plugin>> m_plugins;
 	std::unordered_map<std::string, PluginConfig> m_pluginConf;
+
+	/* Timers, their deadlines bound the listener timeout */
+	TimerQueue m_timerQueue;
+
+	/* Optional worker threads, plugin name -> worker */
+	unsigned m_workerCount{0};
+	std::unordered_map<std::string, PluginWorker *> m_pluginWorkers;
 #endif
 
 	/* Identities */
 	std::unordered_map<std::string, ServerIdentity> m_identities;
 
+	/* Rules, compiled on demand */
+	RuleManager m_rules;
+
 	/* Lookup tables */
+	LookupTable<Server> m_lookupServers;
 	LookupTable<TransportClientAbstract> m_lookupTransportClients;
 	LookupTable<TransportServerAbstract> m_lookupTransportServers;
 
+#if defined(WITH_JS)
+	/* Destroyed first so that no plugin code runs while irccd is destroyed */
+	std::vector<std::unique_ptr<PluginWorker>> m_workers;
+#endif
+
 	/* Server slots */
-	void handleServerOnChannelNotice(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string notice);
-	void handleServerOnConnect(std::shared_ptr<Server> server);
-	void handleServerOnInvite(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string target);
-	void handleServerOnJoin(std::shared_ptr<Server> server, std::string origin, std::string channel);
-	void handleServerOnKick(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string target, std::string reason);
-	void handleServerOnMessage(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string message);
-	void handleServerOnMe(std::shared_ptr<Server> server, std::string origin, std::string target, std::string message);
-	void handleServerOnMode(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string mode, std::string arg);
-	void handleServerOnNick(std::shared_ptr<Server> server, std::string origin, std::string nickname);
-	void handleServerOnNotice(std::shared_ptr<Server> server, std::string origin, std::string message);
-	void handleServerOnPart(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string reason);
-	void handleServerOnQuery(std::shared_ptr<Server> server, std::string origin, std::string message);
-	void handleServerOnTopic(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string topic);
-	void handleServerOnUserMode(std::shared_ptr<Server> server, std::string origin, std::string mode);
+	void handleServerOnChannelNotice(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &notice);
+	void handleServerOnConnect(const std::shared_ptr<Server> &server);
+	void handleServerOnInvite(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &target);
+	void handleServerOnJoin(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel);
+	void handleServerOnJoinBatch(const std::shared_ptr<Server> &server, const ServerBatch &batch);
+	void handleServerOnKick(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &target, const std::string &reason);
+	void handleServerOnMessage(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &message);
+	void handleServerOnMe(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &target, const std::string &message);
+	void handleServerOnMode(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &mode, const std::string &arg);
+	void handleServerOnNames(const std::shared_ptr<Server> &server, const std::string &channel, const std::vector<std::string> &names);
+	void handleServerOnNick(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &nickname);
+	void handleServerOnNotice(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &message);
+	void handleServerOnPart(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &reason);
+	void handleServerOnPartBatch(const std::shared_ptr<Server> &server, const ServerBatch &batch);
+	void handleServerOnQuery(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &message);
+	void handleServerOnTopic(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &channel, const std::string &topic);
+	void handleServerOnUserMode(const std::shared_ptr<Server> &server, const std::string &origin, const std::string &mode);
+	void handleServerQueued();
 
 	/* Transport slots */
-	void handleTransportChannelNotice(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
+	void handleTransportChannelNotice(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
+	void handleTransportChannels(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel);
+	void handleTransportClients(std::weak_ptr<TransportClientAbstract> tc);
 	void handleTransportConnect();
-	void handleTransportDisconnect(std::shared_ptr<TransportClientAbstract> tc, std::string server);
-	void handleTransportInvite(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string channel);
-	void handleTransportJoin(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string password);
-	void handleTransportKick(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string channel, std::string reason);
-	void handleTransportMe(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
-	void handleTransportMessage(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
-	void handleTransportMode(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string mode);
-	void handleTransportNick(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string nickname);
-	void handleTransportNotice(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string message);
-	void handleTransportPart(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string reason);
+	void handleTransportConnections(std::weak_ptr<TransportClientAbstract> tc);
+	void handleTransportDisconnect(std::weak_ptr<TransportClientAbstract> tc, std::string server);
+	void handleTransportInvite(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string channel);
+	void handleTransportJoin(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string password);
+	void handleTransportKick(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string channel, std::string reason);
+	void handleTransportMe(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
+	void handleTransportMessage(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string message);
+	void handleTransportMode(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string mode);
+	void handleTransportNick(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string nickname);
+	void handleTransportNotice(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string target, std::string message);
+	void handleTransportPart(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string reason);
 	void handleTransportReconnect(std::shared_ptr<TransportClientAbstract> tc, std::string server);
 	void handleTransportReload(std::shared_ptr<TransportClientAbstract> tc, std::string plugin);
-	void handleTransportTopic(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string topic);
+	void handleTransportStats(std::weak_ptr<TransportClientAbstract> tc, std::string server);
+	void handleTransportSubscribe(std::weak_ptr<TransportClientAbstract> tc, TransportFilter filter);
+	void handleTransportTopic(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string channel, std::string topic);
 	void handleTransportUnload(std::shared_ptr<TransportClientAbstract> tc, std::string plugin);
-	void handleTransportUserMode(std::shared_ptr<TransportClientAbstract> tc, std::string server, std::string mode);
+	void handleTransportUserMode(std::weak_ptr<TransportClientAbstract> tc, std::string server, std::string mode);
+	void handleTransportOverflow(std::weak_ptr<TransportClientAbstract> tc);
+	void handleTransportDie(std::weak_ptr<TransportClientAbstract> tc);
 
 	/* Timer slots */
 #if defined(WITH_JS)
+	void handleTimerStart(PluginWorker *, std::shared_ptr<Timer>);
 	void handleTimerSignal(std::shared_ptr<Plugin>, std::shared_ptr<Timer>);
 	void handleTimerEnd(std::shared_ptr<Plugin>, std::shared_ptr<Timer>);
 #endif
 
 	/* Private helpers */
 #if defined(WITH_JS)
-	ServerMessagePair parseMessage(std::string message, Server &server, Plugin &plugin);
+	void execServerEvent(const ServerEvent &event, Plugin &plugin);
+	void deliverServerEvent(const ServerEvent &event, const std::shared_ptr<Plugin> &plugin, std::shared_ptr<ServerEventCopy> &copy);
+	void dispatchServerBatch(const ServerEvent &event);
 #endif
 	void dispatch();
-	void process(fd_set &setinput, fd_set &setoutput);
+	int timeout() noexcept;
+	void process(const SocketStatus &status);
 	void exec();
+	void watchTransportClient(TransportClientAbstract &tc) noexcept;
+	void wakeServers() noexcept;
 
 	/* Private event helpers */
 	void addTransportEvent(std::shared_ptr<TransportClientAbstract> tc, Event ev) noexcept;
-	void addServerEvent(ServerEvent) noexcept;
+	void postServerEvent(const std::shared_ptr<Server> &server, Event ev) noexcept;
+	void addServerEvent(ServerEventType type,
+			    Server &server,
+			    const std::string &origin = "",
+			    const std::string &channel = "",
+			    const std::string &message = "",
+			    const std::string &extra = "") noexcept;
+	void addServerEvent(ServerEventType type, Server &server, const ServerBatch &batch) noexcept;
+	void publishServerEvent(ServerEvent *event) noexcept;
+	void dispatchServerEvent(const ServerEvent &event);
 
 public:
 	/**
 	 * Constructor that instanciate IPC.
+	 *
+	 * The calling thread is assumed to be the one that will call run().
 	 */
 	Irccd();
 
+	/**
+	 * Stop the reactors before the objects shared by their servers are destroyed.
+	 */
+	~Irccd();
+
 	/* ------------------------------------------------
 	 * Event loop
 	 * ------------------------------------------------ */
@@ -196,11 +241,56 @@ public:
 	 * Add an event to the queue. This will immediately signals the event loop to interrupt itself to dispatch
 	 * the pending events.
 	 *
+	 * When called from another thread, the event is pushed into a bounded queue and is dropped if the queue is
+	 * full, see eventQueue() for the metrics. Events added from a reactor go through its own outbox.
+	 *
 	 * @param ev the event
 	 * @note Thread-safe
 	 */
 	void addEvent(Event ev) noexcept;
 
+	/**
+	 * Get the resolver shared by the servers.
+	 *
+	 * @return the resolver
+	 */
+	inline Resolver &resolver() noexcept
+	{
+		return m_resolver;
+	}
+
+	/**
+	 * Get the scheduler that limits the concurrent connection attempts.
+	 *
+	 * @return the scheduler
+	 */
+	inline ConnectScheduler &scheduler() noexcept
+	{
+		return m_scheduler;
+	}
+
+	/**
+	 * Create the threads running the servers, must be called before adding servers.
+	 *
+	 * When set to 0 (the default), the servers run in the main event loop. Otherwise the servers are given to the
+	 * reactors in a round-robin manner, their events are forwarded to the main loop which still runs the plugins
+	 * and the transports.
+	 *
+	 * @param count the number of reactors
+	 * @throw SocketError if the reactor queues can not be created
+	 */
+	void setReactors(unsigned count);
+
+	/**
+	 * Get the queue used for events coming from other threads.
+	 *
+	 * @return the queue
+	 */
+	inline const EventQueue &eventQueue() const noexcept
+	{
+		return m_queue;
+	}
+
 	/* ------------------------------------------------
 	 * Identity management
 	 * ------------------------------------------------ */
@@ -229,6 +319,30 @@ public:
 		return it == m_identities.end() ? ServerIdentity{} : it->second;
 	}
 
+	/* ------------------------------------------------
+	 * Rule management
+	 * ------------------------------------------------ */
+
+	/**
+	 * Append a rule, it is applied after the previous ones.
+	 *
+	 * @param rule the rule
+	 */
+	inline void addRule(Rule rule)
+	{
+		m_rules.add(std::move(rule));
+	}
+
+	/**
+	 * Get the rules.
+	 *
+	 * @return the rule manager
+	 */
+	inline RuleManager &rules() noexcept
+	{
+		return m_rules;
+	}
+
 	/* ------------------------------------------------
 	 * Server management
 	 * ------------------------------------------------ */
@@ -245,11 +359,17 @@ public:
 	 *
 	 * @param name the server name
 	 * @return the server
-	 * @throw std::exception if the server does not exist
+	 * @throw std::out_of_range if the server does not exist
 	 */
 	inline std::shared_ptr<Server> findServer(const std::string &name) const
 	{
-		return m_servers.at(name);
+		auto it = m_servers.find(name);
+
+		if (it == m_servers.end()) {
+			throw std::out_of_range("server " + name + " not found");
+		}
+
+		return it->second;
 	}
 
 	/**
@@ -298,6 +418,22 @@ public:
 		m_pluginConf.emplace(std::move(name), std::move(config));
 	}
 
+#if defined(WITH_JS)
+	/**
+	 * Set the number of worker threads for plugins, must be called before loading plugins.
+	 *
+	 * When set to 0 (the default), plugins run in the event loop thread. Otherwise plugins are pinned to the
+	 * workers in a round-robin manner, each plugin receives its events in order but different plugins may run in
+	 * parallel.
+	 *
+	 * @param count the number of workers
+	 */
+	inline void setWorkers(unsigned count) noexcept
+	{
+		m_workerCount = count;
+	}
+#endif
+
 	/**
 	 * Load a plugin by a path or a name.
 	 *
@@ -358,6 +494,7 @@ public:
 #include <IrccdConfig.h>
 
 #include "Server.h"
+#include "ServerEvent.h"
 
 #if defined(WITH_LUA)
 #  include "Plugin.h"
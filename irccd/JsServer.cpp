@@ -16,6 +16,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <chrono>
 #include <sstream>
 #include <unordered_map>
 
@@ -26,6 +27,81 @@ namespace irccd {
 
 namespace {
 
+/*
+ * Method: Server.channel(name)
+ * --------------------------------------------------------
+ *
+ * Get a snapshot of a channel we are in.
+ *
+ * Arguments:
+ *   - name, the channel
+ *
+ * Returns:
+ *   - an object with name, topic and users (array of { nickname, modes }) or undefined if not in that channel
+ */
+duk_ret_t Server_prototype_channel(duk_context *ctx)
+{
+	dukx_assert_begin(ctx);
+	dukx_with_this<std::shared_ptr<Server>>(ctx, [&] (std::shared_ptr<Server> &s) {
+		ServerChannelInfo info;
+
+		try {
+			info = s->channel(duk_require_string(ctx, 0));
+		} catch (const std::out_of_range &) {
+			duk_push_undefined(ctx);
+			return;
+		}
+
+		duk_push_object(ctx);
+		duk_push_string(ctx, info.name.c_str());
+		duk_put_prop_string(ctx, -2, "name");
+		duk_push_string(ctx, info.topic.c_str());
+		duk_put_prop_string(ctx, -2, "topic");
+		duk_push_array(ctx);
+
+		for (std::size_t i = 0; i < info.members.size(); ++i) {
+			duk_push_object(ctx);
+			duk_push_string(ctx, info.members[i].nickname.c_str());
+			duk_put_prop_string(ctx, -2, "nickname");
+			duk_push_string(ctx, info.members[i].modes.c_str());
+			duk_put_prop_string(ctx, -2, "modes");
+			duk_put_prop_index(ctx, -2, static_cast<duk_uarridx_t>(i));
+		}
+
+		duk_put_prop_string(ctx, -2, "users");
+	});
+	dukx_assert_end(ctx, 1);
+
+	return 1;
+}
+
+/*
+ * Method: Server.channels()
+ * --------------------------------------------------------
+ *
+ * Get the channels we are in.
+ *
+ * Returns:
+ *   - an array of channel names
+ */
+duk_ret_t Server_prototype_channels(duk_context *ctx)
+{
+	dukx_assert_begin(ctx);
+	dukx_with_this<std::shared_ptr<Server>>(ctx, [&] (std::shared_ptr<Server> &s) {
+		std::vector<std::string> channels = s->channels();
+
+		duk_push_array(ctx);
+
+		for (std::size_t i = 0; i < channels.size(); ++i) {
+			duk_push_string(ctx, channels[i].c_str());
+			duk_put_prop_index(ctx, -2, static_cast<duk_uarridx_t>(i));
+		}
+	});
+	dukx_assert_end(ctx, 1);
+
+	return 1;
+}
+
 /*
  * Method: Server.cnotice(channel, message)
  * --------------------------------------------------------
@@ -298,6 +374,59 @@ duk_ret_t Server_prototype_send(duk_context *ctx)
 	return 0;
 }
 
+/*
+ * Method: Server.stats()
+ * --------------------------------------------------------
+ *
+ * Get the lag and the activity of the server, all times are in milliseconds.
+ *
+ * Returns:
+ *   - an object with lag (last round trip), rtt ({ count, min, avg, max }), lastReceived and lastSent (time
+ *     elapsed since the last message received and the last write, -1 if none), resolveTime (time spent resolving
+ *     the host name for the last connection, 0 if never resolved) and queue ({ depth, maxWait, avgWait })
+ */
+duk_ret_t Server_prototype_stats(duk_context *ctx)
+{
+	dukx_assert_begin(ctx);
+	dukx_with_this<std::shared_ptr<Server>>(ctx, [&] (std::shared_ptr<Server> &s) {
+		ServerStatus status = s->status();
+		ServerLatency latency = s->latency();
+		ServerQueueStats queue = s->queueStats();
+
+		auto number = [&] (const char *name, double value) {
+			duk_push_number(ctx, value);
+			duk_put_prop_string(ctx, -2, name);
+		};
+		auto elapsed = [] (std::chrono::steady_clock::time_point point) -> double {
+			if (point == std::chrono::steady_clock::time_point()) {
+				return -1;
+			}
+
+			return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - point).count();
+		};
+
+		duk_push_object(ctx);
+		number("lag", latency.last().count());
+		duk_push_object(ctx);
+		number("count", latency.count());
+		number("min", latency.min().count());
+		number("avg", latency.average().count());
+		number("max", latency.max().count());
+		duk_put_prop_string(ctx, -2, "rtt");
+		number("lastReceived", elapsed(status.lastReceived));
+		number("lastSent", elapsed(status.lastSent));
+		number("resolveTime", s->resolveTime().count() / 1000.0);
+		duk_push_object(ctx);
+		number("depth", queue.depth);
+		number("maxWait", queue.maxWait.count());
+		number("avgWait", (queue.sent == 0) ? 0 : static_cast<double>(queue.totalWait.count()) / queue.sent);
+		duk_put_prop_string(ctx, -2, "queue");
+	});
+	dukx_assert_end(ctx, 1);
+
+	return 1;
+}
+
 /*
  * Method: Server.topic(channel, topic)
  * --------------------------------------------------------
@@ -382,6 +511,8 @@ duk_ret_t Server_prototype_toString(duk_context *ctx)
 
 const duk_function_list_entry serverMethods[] = {
 	/* Server methods */
+	{ "channel",	Server_prototype_channel,	1		},
+	{ "channels",	Server_prototype_channels,	0		},
 	{ "cnotice",	Server_prototype_cnotice,	2		},
 	{ "invite",	Server_prototype_invite,	2		},
 	{ "join",	Server_prototype_join,		DUK_VARARGS	},
@@ -394,6 +525,7 @@ const duk_function_list_entry serverMethods[] = {
 	{ "notice",	Server_prototype_notice,	2		},
 	{ "part",	Server_prototype_part,		DUK_VARARGS	},
 	{ "send",	Server_prototype_send,		1		},
+	{ "stats",	Server_prototype_stats,		0		},
 	{ "topic",	Server_prototype_topic,		2		},
 	{ "umode",	Server_prototype_umode,		1		},
 	{ "whois",	Server_prototype_whois,		1		},
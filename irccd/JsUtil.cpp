@@ -24,6 +24,7 @@
 #include <Date.h>
 #include <Util.h>
 
+#include "IrcMessage.h"
 #include "Irccd.h"
 
 namespace irccd {
@@ -309,22 +310,14 @@ duk_ret_t Util_split(duk_context *)
 
 duk_ret_t Util_splituser(duk_context *ctx)
 {
-	const char *target = duk_require_string(ctx, 0);
-	char nick[32] = {0};
-
-	irc_target_get_nick(target, nick, sizeof (nick) -1);
-	duk_push_string(ctx, nick);
+	duk_push_string(ctx, ircNickname(duk_require_string(ctx, 0)).c_str());
 
 	return 1;
 }
 
 duk_ret_t Util_splithost(duk_context *ctx)
 {
-	const char *target = duk_require_string(ctx, 0);
-	char host[32] = {0};
-
-	irc_target_get_host(target, host, sizeof (host) -1);
-	duk_push_string(ctx, host);
+	duk_push_string(ctx, ircHost(duk_require_string(ctx, 0)).c_str());
 
 	return 1;
 }
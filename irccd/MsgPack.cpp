@@ -0,0 +1,378 @@
+/*
+ * MsgPack.cpp -- MessagePack encoding of the transport messages
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "MsgPack.h"
+
+namespace irccd {
+
+/* --------------------------------------------------------
+ * MsgPackWriter
+ * -------------------------------------------------------- */
+
+void MsgPackWriter::header(unsigned char type, std::uint64_t value, unsigned size)
+{
+	m_data.push_back(static_cast<char>(type));
+
+	/* Big endian */
+	for (unsigned i = size; i > 0; --i) {
+		m_data.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+	}
+}
+
+void MsgPackWriter::value(const json_t *value)
+{
+	switch (json_typeof(value)) {
+	case JSON_OBJECT:
+		map(json_object_size(value));
+
+		/* The iteration functions are not const in Jansson but do not modify the object */
+		for (void *it = json_object_iter(const_cast<json_t *>(value)); it != nullptr; it = json_object_iter_next(const_cast<json_t *>(value), it)) {
+			const char *key = json_object_iter_key(it);
+
+			string(key, std::strlen(key));
+			this->value(json_object_iter_value(it));
+		}
+		break;
+	case JSON_ARRAY:
+		array(json_array_size(value));
+
+		for (std::size_t i = 0; i < json_array_size(value); ++i) {
+			this->value(json_array_get(value, i));
+		}
+		break;
+	case JSON_STRING:
+		string(json_string_value(value), std::strlen(json_string_value(value)));
+		break;
+	case JSON_INTEGER:
+		integer(json_integer_value(value));
+		break;
+	case JSON_REAL:
+		real(json_real_value(value));
+		break;
+	case JSON_TRUE:
+		boolean(true);
+		break;
+	case JSON_FALSE:
+		boolean(false);
+		break;
+	default:
+		nil();
+		break;
+	}
+}
+
+void MsgPackWriter::nil()
+{
+	m_data.push_back(static_cast<char>(0xc0));
+}
+
+void MsgPackWriter::boolean(bool value)
+{
+	m_data.push_back(static_cast<char>(value ? 0xc3 : 0xc2));
+}
+
+void MsgPackWriter::integer(std::int64_t value)
+{
+	std::uint64_t bits = static_cast<std::uint64_t>(value);
+
+	if (value >= 0) {
+		if (value <= 0x7f) {
+			m_data.push_back(static_cast<char>(value));
+		} else if (value <= 0xff) {
+			header(0xcc, bits, 1);
+		} else if (value <= 0xffff) {
+			header(0xcd, bits, 2);
+		} else if (value <= 0xffffffffLL) {
+			header(0xce, bits, 4);
+		} else {
+			header(0xcf, bits, 8);
+		}
+	} else {
+		if (value >= -32) {
+			m_data.push_back(static_cast<char>(bits & 0xff));
+		} else if (value >= std::numeric_limits<std::int8_t>::min()) {
+			header(0xd0, bits, 1);
+		} else if (value >= std::numeric_limits<std::int16_t>::min()) {
+			header(0xd1, bits, 2);
+		} else if (value >= std::numeric_limits<std::int32_t>::min()) {
+			header(0xd2, bits, 4);
+		} else {
+			header(0xd3, bits, 8);
+		}
+	}
+}
+
+void MsgPackWriter::real(double value)
+{
+	std::uint64_t bits;
+
+	static_assert(sizeof (bits) == sizeof (value), "unsupported double");
+	std::memcpy(&bits, &value, sizeof (bits));
+	header(0xcb, bits, 8);
+}
+
+void MsgPackWriter::string(const char *data, std::size_t length)
+{
+	if (length < 32) {
+		m_data.push_back(static_cast<char>(0xa0 | length));
+	} else if (length <= 0xff) {
+		header(0xd9, length, 1);
+	} else if (length <= 0xffff) {
+		header(0xda, length, 2);
+	} else {
+		header(0xdb, length, 4);
+	}
+
+	m_data.append(data, length);
+}
+
+void MsgPackWriter::array(std::size_t size)
+{
+	if (size < 16) {
+		m_data.push_back(static_cast<char>(0x90 | size));
+	} else if (size <= 0xffff) {
+		header(0xdc, size, 2);
+	} else {
+		header(0xdd, size, 4);
+	}
+}
+
+void MsgPackWriter::map(std::size_t size)
+{
+	if (size < 16) {
+		m_data.push_back(static_cast<char>(0x80 | size));
+	} else if (size <= 0xffff) {
+		header(0xde, size, 2);
+	} else {
+		header(0xdf, size, 4);
+	}
+}
+
+void MsgPackWriter::value(const JsonValue &value)
+{
+	this->value(static_cast<const json_t *>(value));
+}
+
+/* --------------------------------------------------------
+ * MsgPackReader
+ * -------------------------------------------------------- */
+
+constexpr unsigned MsgPackReader::MaxDepth;
+
+std::uint64_t MsgPackReader::number(unsigned size)
+{
+	if (static_cast<std::size_t>(m_end - m_current) < size) {
+		throw std::invalid_argument("truncated MessagePack data");
+	}
+
+	std::uint64_t result = 0;
+
+	for (unsigned i = 0; i < size; ++i) {
+		result = (result << 8) | *m_current++;
+	}
+
+	return result;
+}
+
+std::string MsgPackReader::string(std::size_t length)
+{
+	if (static_cast<std::size_t>(m_end - m_current) < length) {
+		throw std::invalid_argument("truncated MessagePack data");
+	}
+
+	std::string result(reinterpret_cast<const char *>(m_current), length);
+
+	m_current += length;
+
+	return result;
+}
+
+std::string MsgPackReader::key()
+{
+	if (m_current == m_end) {
+		throw std::invalid_argument("truncated MessagePack data");
+	}
+
+	/* Read directly, the keys are always strings */
+	unsigned char type = *m_current++;
+
+	if ((type & 0xe0) == 0xa0) {
+		return string(type & 0x1f);
+	}
+
+	switch (type) {
+	case 0xd9:
+		return string(number(1));
+	case 0xda:
+		return string(number(2));
+	case 0xdb:
+		return string(number(4));
+	default:
+		throw std::invalid_argument("MessagePack map keys must be strings");
+	}
+}
+
+JsonValue MsgPackReader::array(std::size_t size)
+{
+	/* Each element is at least one byte, do not trust the size */
+	if (++ m_depth > MaxDepth || size > static_cast<std::size_t>(m_end - m_current)) {
+		throw std::invalid_argument("invalid MessagePack array");
+	}
+
+	JsonValue result(json_array());
+
+	for (std::size_t i = 0; i < size; ++i) {
+		json_array_append(result, value());
+	}
+
+	-- m_depth;
+
+	return result;
+}
+
+JsonValue MsgPackReader::map(std::size_t size)
+{
+	if (++ m_depth > MaxDepth || size > static_cast<std::size_t>(m_end - m_current) / 2) {
+		throw std::invalid_argument("invalid MessagePack map");
+	}
+
+	JsonValue result(json_object());
+
+	for (std::size_t i = 0; i < size; ++i) {
+		std::string name = key();
+
+		json_object_set(result, name.c_str(), value());
+	}
+
+	-- m_depth;
+
+	return result;
+}
+
+JsonValue MsgPackReader::value()
+{
+	if (m_current == m_end) {
+		throw std::invalid_argument("truncated MessagePack data");
+	}
+
+	unsigned char type = *m_current++;
+
+	/* Fixed size types first */
+	if (type <= 0x7f) {
+		return JsonValue(json_integer(type));
+	}
+	if (type >= 0xe0) {
+		return JsonValue(json_integer(static_cast<std::int8_t>(type)));
+	}
+	if ((type & 0xf0) == 0x80) {
+		return map(type & 0x0f);
+	}
+	if ((type & 0xf0) == 0x90) {
+		return array(type & 0x0f);
+	}
+	if ((type & 0xe0) == 0xa0) {
+		return JsonValue(string(type & 0x1f));
+	}
+
+	switch (type) {
+	case 0xc0:
+		return JsonValue();
+	case 0xc2:
+		return JsonValue(false);
+	case 0xc3:
+		return JsonValue(true);
+	case 0xca:
+	{
+		std::uint32_t bits = static_cast<std::uint32_t>(number(4));
+		float result;
+
+		std::memcpy(&result, &bits, sizeof (result));
+
+		return JsonValue(static_cast<double>(result));
+	}
+	case 0xcb:
+	{
+		std::uint64_t bits = number(8);
+		double result;
+
+		std::memcpy(&result, &bits, sizeof (result));
+
+		return JsonValue(result);
+	}
+	case 0xcc:
+	case 0xcd:
+	case 0xce:
+	case 0xcf:
+	{
+		std::uint64_t result = number(1U << (type - 0xcc));
+
+		if (result > static_cast<std::uint64_t>(std::numeric_limits<json_int_t>::max())) {
+			throw std::invalid_argument("MessagePack integer too large");
+		}
+
+		return JsonValue(json_integer(static_cast<json_int_t>(result)));
+	}
+	case 0xd0:
+		return JsonValue(json_integer(static_cast<std::int8_t>(number(1))));
+	case 0xd1:
+		return JsonValue(json_integer(static_cast<std::int16_t>(number(2))));
+	case 0xd2:
+		return JsonValue(json_integer(static_cast<std::int32_t>(number(4))));
+	case 0xd3:
+		return JsonValue(json_integer(static_cast<std::int64_t>(number(8))));
+	case 0xd9:
+		return JsonValue(string(number(1)));
+	case 0xda:
+		return JsonValue(string(number(2)));
+	case 0xdb:
+		return JsonValue(string(number(4)));
+	case 0xdc:
+		return array(number(2));
+	case 0xdd:
+		return array(number(4));
+	case 0xde:
+		return map(number(2));
+	case 0xdf:
+		return map(number(4));
+	default:
+		throw std::invalid_argument("unsupported MessagePack type");
+	}
+}
+
+MsgPackReader::MsgPackReader(const char *data, std::size_t length) noexcept
+	: m_current(reinterpret_cast<const unsigned char *>(data))
+	, m_end(reinterpret_cast<const unsigned char *>(data) + length)
+{
+}
+
+JsonValue MsgPackReader::read()
+{
+	JsonValue result = value();
+
+	if (m_current != m_end) {
+		throw std::invalid_argument("trailing MessagePack data");
+	}
+
+	return result;
+}
+
+} // !irccd
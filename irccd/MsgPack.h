@@ -0,0 +1,172 @@
+/*
+ * MsgPack.h -- MessagePack encoding of the transport messages
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_MSGPACK_H_
+#define _IRCCD_MSGPACK_H_
+
+/**
+ * @file MsgPack.h
+ * @brief MessagePack encoding of the transport messages
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <Json.h>
+
+namespace irccd {
+
+/**
+ * @class MsgPackWriter
+ * @brief Append MessagePack values to a buffer
+ *
+ * The values are written in the smallest form. The containers are written with their number of elements first, the
+ * elements must then follow.
+ */
+class MsgPackWriter {
+private:
+	std::string m_data;
+
+	void header(unsigned char type, std::uint64_t value, unsigned size);
+	void value(const json_t *value);
+
+public:
+	/**
+	 * Write nil.
+	 */
+	void nil();
+
+	/**
+	 * Write a boolean.
+	 *
+	 * @param value the value
+	 */
+	void boolean(bool value);
+
+	/**
+	 * Write an integer.
+	 *
+	 * @param value the value
+	 */
+	void integer(std::int64_t value);
+
+	/**
+	 * Write a double.
+	 *
+	 * @param value the value
+	 */
+	void real(double value);
+
+	/**
+	 * Write a string.
+	 *
+	 * @param data the string
+	 * @param length the length
+	 */
+	void string(const char *data, std::size_t length);
+
+	/**
+	 * Overloaded function.
+	 *
+	 * @param value the string
+	 */
+	inline void string(const std::string &value)
+	{
+		string(value.data(), value.length());
+	}
+
+	/**
+	 * Start an array.
+	 *
+	 * @param size the number of elements that follow
+	 */
+	void array(std::size_t size);
+
+	/**
+	 * Start a map.
+	 *
+	 * @param size the number of key/value pairs that follow
+	 */
+	void map(std::size_t size);
+
+	/**
+	 * Write a JSON value and its children.
+	 *
+	 * @param value the value
+	 */
+	void value(const JsonValue &value);
+
+	/**
+	 * Get the data written.
+	 *
+	 * @return the data
+	 */
+	inline const std::string &data() const noexcept
+	{
+		return m_data;
+	}
+};
+
+/**
+ * @class MsgPackReader
+ * @brief Decode MessagePack data into JSON values
+ *
+ * The commands are decoded to the same values as their JSON form so that they are handled by the same code. The map
+ * keys must be strings, the binary and extension types are not supported.
+ */
+class MsgPackReader {
+public:
+	/**
+	 * Maximum nesting of arrays and maps.
+	 */
+	static constexpr unsigned MaxDepth{32};
+
+private:
+	const unsigned char *m_current;
+	const unsigned char *m_end;
+	unsigned m_depth{0};
+
+	std::uint64_t number(unsigned size);
+	std::string string(std::size_t length);
+	std::string key();
+	JsonValue array(std::size_t size);
+	JsonValue map(std::size_t size);
+	JsonValue value();
+
+public:
+	/**
+	 * Prepare to read the data.
+	 *
+	 * @param data the data, must be valid while reading
+	 * @param length the length
+	 */
+	MsgPackReader(const char *data, std::size_t length) noexcept;
+
+	/**
+	 * Decode one value, all the data must be used.
+	 *
+	 * @return the value
+	 * @throw std::invalid_argument on invalid or truncated data
+	 */
+	JsonValue read();
+};
+
+} // !irccd
+
+#endif // !_IRCCD_MSGPACK_H_
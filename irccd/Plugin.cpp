@@ -32,9 +32,44 @@
 
 #include "Plugin.h"
 #include "Server.h"
+#include "ServerEvent.h"
 
 namespace irccd {
 
+namespace {
+
+/* Indexed by PluginHandler */
+const char *handlerNames[] = {
+	"onChannelNotice",
+	"onCommand",
+	"onConnect",
+	"onInvite",
+	"onJoin",
+	"onJoinBatch",
+	"onKick",
+	"onLoad",
+	"onMe",
+	"onMessage",
+	"onMode",
+	"onNames",
+	"onNick",
+	"onNotice",
+	"onPart",
+	"onPartBatch",
+	"onQuery",
+	"onQueryCommand",
+	"onReload",
+	"onTopic",
+	"onUnload",
+	"onUserMode",
+	"onWhois"
+};
+
+static_assert(sizeof (handlerNames) / sizeof (handlerNames[0]) == static_cast<unsigned>(PluginHandler::Whois) + 1,
+	"missing handler name");
+
+} // !namespace
+
 std::string Plugin::global(const std::string &name) const
 {
 	std::string result;
@@ -47,13 +82,13 @@ std::string Plugin::global(const std::string &name) const
 	return result;
 }
 
-void Plugin::call(const char *name, int nargs)
+void Plugin::call(PluginHandler handler, int nargs)
 {
 	duk_push_global_object(m_context);
-	duk_get_prop_string(m_context, -1, name);
+	duk_get_prop_string(m_context, -1, handlerNames[static_cast<unsigned>(handler)]);
 
-	if (duk_get_type(m_context, -1) == DUK_TYPE_UNDEFINED) {
-		duk_pop_2(m_context);
+	if (!duk_is_function(m_context, -1)) {
+		duk_pop_n(m_context, 2 + nargs);
 	} else {
 		duk_remove(m_context, -2);
 		duk_insert(m_context, -1 -nargs);
@@ -67,6 +102,27 @@ void Plugin::call(const char *name, int nargs)
 	}
 }
 
+void Plugin::refresh() noexcept
+{
+	std::uint32_t handlers = 0;
+
+	duk_push_global_object(m_context);
+
+	for (unsigned i = 0; i < sizeof (handlerNames) / sizeof (handlerNames[0]); ++i) {
+		duk_get_prop_string(m_context, -1, handlerNames[i]);
+
+		if (duk_is_function(m_context, -1)) {
+			handlers |= (1U << i);
+		}
+
+		duk_pop(m_context);
+	}
+
+	duk_pop(m_context);
+
+	m_handlers.store(handlers, std::memory_order_relaxed);
+}
+
 Plugin::Plugin(std::string name, std::string path, PluginConfig config)
 	: m_context(Filesystem::dirName(path))
 	, m_config(std::move(config))
@@ -115,6 +171,9 @@ Plugin::Plugin(std::string name, std::string path, PluginConfig config)
 	if (duk_peval_file(m_context, m_info.path.c_str()) != 0) {
 		throw std::runtime_error(duk_safe_to_string(m_context, -1));
 	}
+
+	duk_pop(m_context);
+	refresh();
 }
 
 const PluginInfo &Plugin::info() const
@@ -125,8 +184,11 @@ const PluginInfo &Plugin::info() const
 void Plugin::timerAdd(std::shared_ptr<Timer> timer) noexcept
 {
 	/*
-	 * These signals are called from the Timer thread.
+	 * These signals are called from the event loop.
 	 */
+	timer->onStart.connect([this, timer] () {
+		onTimerStart(std::move(timer));
+	});
 	timer->onSignal.connect([this, timer] () {
 		onTimerSignal(std::move(timer));
 	});
@@ -139,95 +201,163 @@ void Plugin::timerAdd(std::shared_ptr<Timer> timer) noexcept
 
 void Plugin::onCommand(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string message)
 {
+	if (!implements(PluginHandler::Command)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, message.c_str());
-	call("onCommand", 4);
+	call(PluginHandler::Command, 4);
 }
 
 void Plugin::onConnect(std::shared_ptr<Server> server)
 {
+	if (!implements(PluginHandler::Connect)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
-	call("onConnect", 1);
+	call(PluginHandler::Connect, 1);
 }
 
 void Plugin::onChannelNotice(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string notice)
 {
+	if (!implements(PluginHandler::ChannelNotice)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, notice.c_str());
-	call("onChannelNotice", 4);
+	call(PluginHandler::ChannelNotice, 4);
 }
 
 void Plugin::onInvite(std::shared_ptr<Server> server, std::string origin, std::string channel)
 {
+	if (!implements(PluginHandler::Invite)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
-	call("onInvite", 3);
+	call(PluginHandler::Invite, 3);
 }
 
 void Plugin::onJoin(std::shared_ptr<Server> server, std::string origin, std::string channel)
 {
+	if (!implements(PluginHandler::Join)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
-	call("onJoin", 3);
+	call(PluginHandler::Join, 3);
+}
+
+void Plugin::onJoinBatch(std::shared_ptr<Server> server, const ArenaArray<ServerEventEntry> &batch)
+{
+	if (!implements(PluginHandler::JoinBatch)) {
+		return;
+	}
+
+	dukx_push_shared(m_context, server);
+	duk_push_array(m_context);
+
+	for (std::size_t i = 0; i < batch.length; ++i) {
+		duk_push_object(m_context);
+		duk_push_lstring(m_context, batch[i].origin.data, batch[i].origin.length);
+		duk_put_prop_string(m_context, -2, "origin");
+		duk_push_lstring(m_context, batch[i].channel.data, batch[i].channel.length);
+		duk_put_prop_string(m_context, -2, "channel");
+		duk_put_prop_index(m_context, -2, i);
+	}
+
+	call(PluginHandler::JoinBatch, 2);
 }
 
 void Plugin::onKick(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string target, std::string reason)
 {
+	if (!implements(PluginHandler::Kick)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, target.c_str());
 	duk_push_string(m_context, reason.c_str());
-	call("onKick", 5);
+	call(PluginHandler::Kick, 5);
 }
 
 void Plugin::onLoad()
 {
+	if (!implements(PluginHandler::Load)) {
+		return;
+	}
+
 	duk_push_object(m_context);
 	for (const auto &pair : m_config) {
 		duk_push_string(m_context, pair.second.c_str());
 		duk_put_prop_string(m_context, -2, pair.first.c_str());
 	}
 
-	call("onLoad", 1);
+	call(PluginHandler::Load, 1);
+
+	/* The plugin may define its handlers when loaded */
+	refresh();
 }
 
 void Plugin::onMessage(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string message)
 {
+	if (!implements(PluginHandler::Message)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, message.c_str());
-	call("onMessage", 4);
+	call(PluginHandler::Message, 4);
 }
 
 void Plugin::onMe(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string message)
 {
+	if (!implements(PluginHandler::Me)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, message.c_str());
-	call("onMe", 4);
+	call(PluginHandler::Me, 4);
 }
 
 void Plugin::onMode(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string mode, std::string arg)
 {
+	if (!implements(PluginHandler::Mode)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, mode.c_str());
 	duk_push_string(m_context, arg.c_str());
-	call("onMode", 5);
+	call(PluginHandler::Mode, 5);
 }
 
 void Plugin::onNames(std::shared_ptr<Server> server, std::string channel, std::vector<std::string> names)
 {
+	if (!implements(PluginHandler::Names)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, channel.c_str());
 	duk_push_array(m_context);
@@ -238,79 +368,143 @@ void Plugin::onNames(std::shared_ptr<Server> server, std::string channel, std::v
 		duk_put_prop_index(m_context, -2, i++);
 	}
 
-	call("onNames", 3);
+	call(PluginHandler::Names, 3);
 }
 
 void Plugin::onNick(std::shared_ptr<Server> server, std::string oldnick, std::string newnick)
 {
+	if (!implements(PluginHandler::Nick)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, oldnick.c_str());
 	duk_push_string(m_context, newnick.c_str());
-	call("onNick", 3);
+	call(PluginHandler::Nick, 3);
 }
 
 void Plugin::onNotice(std::shared_ptr<Server> server, std::string origin, std::string notice)
 {
+	if (!implements(PluginHandler::Notice)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, notice.c_str());
-	call("onNotice", 3);
+	call(PluginHandler::Notice, 3);
 }
 
 void Plugin::onPart(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string reason)
 {
+	if (!implements(PluginHandler::Part)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, reason.c_str());
-	call("onPart", 4);
+	call(PluginHandler::Part, 4);
+}
+
+void Plugin::onPartBatch(std::shared_ptr<Server> server, const ArenaArray<ServerEventEntry> &batch)
+{
+	if (!implements(PluginHandler::PartBatch)) {
+		return;
+	}
+
+	dukx_push_shared(m_context, server);
+	duk_push_array(m_context);
+
+	for (std::size_t i = 0; i < batch.length; ++i) {
+		duk_push_object(m_context);
+		duk_push_lstring(m_context, batch[i].origin.data, batch[i].origin.length);
+		duk_put_prop_string(m_context, -2, "origin");
+		duk_push_lstring(m_context, batch[i].channel.data, batch[i].channel.length);
+		duk_put_prop_string(m_context, -2, "channel");
+		duk_push_lstring(m_context, batch[i].reason.data, batch[i].reason.length);
+		duk_put_prop_string(m_context, -2, "reason");
+		duk_put_prop_index(m_context, -2, i);
+	}
+
+	call(PluginHandler::PartBatch, 2);
 }
 
 void Plugin::onQuery(std::shared_ptr<Server> server, std::string origin, std::string message)
 {
+	if (!implements(PluginHandler::Query)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, message.c_str());
-	call("onQuery", 3);
+	call(PluginHandler::Query, 3);
 }
 
 void Plugin::onQueryCommand(std::shared_ptr<Server> server, std::string origin, std::string message)
 {
+	if (!implements(PluginHandler::QueryCommand)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, message.c_str());
-	call("onQueryCommand", 3);
+	call(PluginHandler::QueryCommand, 3);
 }
 
 void Plugin::onReload()
 {
-	call("onReload");
+	if (!implements(PluginHandler::Reload)) {
+		return;
+	}
+
+	call(PluginHandler::Reload);
+	refresh();
 }
 
 void Plugin::onTopic(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string topic)
 {
+	if (!implements(PluginHandler::Topic)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, channel.c_str());
 	duk_push_string(m_context, topic.c_str());
-	call("onTopic", 4);
+	call(PluginHandler::Topic, 4);
 }
 
 void Plugin::onUnload()
 {
-	call("onUnload");
+	if (!implements(PluginHandler::Unload)) {
+		return;
+	}
+
+	call(PluginHandler::Unload);
 }
 
 void Plugin::onUserMode(std::shared_ptr<Server> server, std::string origin, std::string mode)
 {
+	if (!implements(PluginHandler::UserMode)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_string(m_context, origin.c_str());
 	duk_push_string(m_context, mode.c_str());
-	call("onUserMode", 3);
+	call(PluginHandler::UserMode, 3);
 }
 
 void Plugin::onWhois(std::shared_ptr<Server> server, ServerWhois whois)
 {
+	if (!implements(PluginHandler::Whois)) {
+		return;
+	}
+
 	dukx_push_shared(m_context, server);
 	duk_push_object(m_context);
 	duk_push_boolean(m_context, whois.found);
@@ -331,7 +525,7 @@ void Plugin::onWhois(std::shared_ptr<Server> server, ServerWhois whois)
 		duk_put_prop_index(m_context, -2, i++);
 	}
 	duk_put_prop_string(m_context, -2, "channels");
-	call("onWhois", 2);
+	call(PluginHandler::Whois, 2);
 }
 
 } // !irccd
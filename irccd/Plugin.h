@@ -24,6 +24,8 @@
  * @brief Irccd plugins
  */
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -31,12 +33,14 @@
 
 #include <Signals.h>
 
+#include "Arena.h"
 #include "Js.h"
 #include "Timer.h"
 
 namespace irccd {
 
 class Server;
+class ServerEventEntry;
 class ServerWhois;
 
 /**
@@ -55,6 +59,36 @@ public:
  */
 using PluginConfig = std::unordered_map<std::string, std::string>;
 
+/**
+ * @enum PluginHandler
+ * @brief JavaScript event handlers that a plugin may define
+ */
+enum class PluginHandler {
+	ChannelNotice,		//!< onChannelNotice
+	Command,		//!< onCommand
+	Connect,		//!< onConnect
+	Invite,			//!< onInvite
+	Join,			//!< onJoin
+	JoinBatch,		//!< onJoinBatch
+	Kick,			//!< onKick
+	Load,			//!< onLoad
+	Me,			//!< onMe
+	Message,		//!< onMessage
+	Mode,			//!< onMode
+	Names,			//!< onNames
+	Nick,			//!< onNick
+	Notice,			//!< onNotice
+	Part,			//!< onPart
+	PartBatch,		//!< onPartBatch
+	Query,			//!< onQuery
+	QueryCommand,		//!< onQueryCommand
+	Reload,			//!< onReload
+	Topic,			//!< onTopic
+	Unload,			//!< onUnload
+	UserMode,		//!< onUserMode
+	Whois			//!< onWhois
+};
+
 /**
  * @class Plugin
  * @brief JavaScript plugin
@@ -64,6 +98,17 @@ using PluginConfig = std::unordered_map<std::string, std::string>;
  */
 class Plugin {
 public:
+	/**
+	 * Signal: onTimerStart
+	 * ------------------------------------------------
+	 *
+	 * When a timer has been started and must be scheduled.
+	 *
+	 * Arguments:
+	 * - the timer object
+	 */
+	Signal<std::shared_ptr<Timer>> onTimerStart;
+
 	/**
 	 * Signal: onTimerSignal
 	 * ------------------------------------------------
@@ -93,9 +138,12 @@ private:
 	PluginConfig m_config;
 	Timers m_timers;
 
+	/* Bitmap of the defined handlers, read by the event loop before any marshalling */
+	std::atomic<std::uint32_t> m_handlers{0};
+
 	/* Private helpers */
 	std::string global(const std::string &name) const;
-	void call(const char *name, int nargs = 0);
+	void call(PluginHandler handler, int nargs = 0);
 
 public:
 	/**
@@ -120,6 +168,16 @@ public:
 	 */
 	void timerAdd(std::shared_ptr<Timer> timer) noexcept;
 
+	/**
+	 * Get the timers created by this plugin.
+	 *
+	 * @return the timers
+	 */
+	inline const Timers &timers() const noexcept
+	{
+		return m_timers;
+	}
+
 	/**
 	 * @brief timerRemove
 	 * @param timer
@@ -129,6 +187,29 @@ public:
 		m_timers.erase(timer);
 	}
 
+	/**
+	 * Check if the plugin defines a handler, the event can be skipped entirely otherwise.
+	 *
+	 * @param handler the handler
+	 * @return true if defined
+	 * @note Thread-safe
+	 */
+	inline bool implements(PluginHandler handler) const noexcept
+	{
+		return (m_handlers.load(std::memory_order_relaxed) & (1U << static_cast<unsigned>(handler))) != 0;
+	}
+
+	/**
+	 * Recompute the handlers bitmap.
+	 *
+	 * It is done after the plugin is evaluated, loaded and reloaded. Handlers assigned dynamically by other code
+	 * of the plugin are only taken into account on the next refresh, it must be called after running such code
+	 * (e.g. timers).
+	 *
+	 * @warning Must only be called from the thread that owns the plugin
+	 */
+	void refresh() noexcept;
+
 	/**
 	 * Access the Duktape context.
 	 *
@@ -186,6 +267,14 @@ public:
 	 */
 	void onJoin(std::shared_ptr<Server> server, std::string origin, std::string channel);
 
+	/**
+	 * On netjoin, the plugins that do not define onJoinBatch receive onJoin for each entry instead.
+	 *
+	 * @param server the server
+	 * @param batch the joins
+	 */
+	void onJoinBatch(std::shared_ptr<Server> server, const ArenaArray<ServerEventEntry> &batch);
+
 	/**
 	 * On kick.
 	 *
@@ -270,6 +359,14 @@ public:
 	 */
 	void onPart(std::shared_ptr<Server> server, std::string origin, std::string channel, std::string reason);
 
+	/**
+	 * On many parts at once, the plugins that do not define onPartBatch receive onPart for each entry instead.
+	 *
+	 * @param server the server
+	 * @param batch the parts
+	 */
+	void onPartBatch(std::shared_ptr<Server> server, const ArenaArray<ServerEventEntry> &batch);
+
 	/**
 	 * On user query.
 	 *
@@ -0,0 +1,91 @@
+/*
+ * PluginWorker.cpp -- thread dedicated to a group of plugins
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <Logger.h>
+
+#include "PluginWorker.h"
+
+namespace irccd {
+
+void PluginWorker::run()
+{
+	std::deque<Event> events;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			int timeout = m_timers.timeout();
+			auto ready = [&] () {
+				return !m_running || !m_events.empty();
+			};
+
+			if (timeout < 0) {
+				m_condition.wait(lock, ready);
+			} else {
+				m_condition.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+			}
+
+			if (!m_running) {
+				break;
+			}
+
+			events.swap(m_events);
+		}
+
+		for (auto &ev : events) {
+			try {
+				ev();
+			} catch (const std::exception &ex) {
+				Logger::warning() << "plugin: " << ex.what() << std::endl;
+			}
+		}
+
+		events.clear();
+		m_timers.process();
+	}
+}
+
+PluginWorker::PluginWorker()
+	: m_thread(std::bind(&PluginWorker::run, this))
+{
+}
+
+PluginWorker::~PluginWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_running = false;
+	}
+
+	m_condition.notify_one();
+	m_thread.join();
+}
+
+void PluginWorker::push(Event ev)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_events.push_back(std::move(ev));
+	}
+
+	m_condition.notify_one();
+}
+
+} // !irccd
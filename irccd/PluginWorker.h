@@ -0,0 +1,95 @@
+/*
+ * PluginWorker.h -- thread dedicated to a group of plugins
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_PLUGIN_WORKER_H_
+#define _IRCCD_PLUGIN_WORKER_H_
+
+/**
+ * @file PluginWorker.h
+ * @brief Thread dedicated to a group of plugins
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "EventQueue.h"
+#include "TimerQueue.h"
+
+namespace irccd {
+
+/**
+ * @class PluginWorker
+ * @brief Thread dedicated to a group of plugins
+ *
+ * Each plugin owns its own Duktape heap, so plugins that are pinned to different workers can run in parallel.
+ * A plugin is pinned to exactly one worker, all of its events are executed in the order they were pushed and its
+ * timers are scheduled in the worker own TimerQueue, so the plugin is never entered from two threads.
+ *
+ * The worker must not touch the event loop objects directly, calls to Server are queued and the event loop is
+ * woken up to flush them.
+ */
+class PluginWorker {
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<Event> m_events;
+	bool m_running{true};
+
+	/* Only used from the worker thread */
+	TimerQueue m_timers;
+
+	std::thread m_thread;
+
+	void run();
+
+public:
+	/**
+	 * Start the thread.
+	 */
+	PluginWorker();
+
+	/**
+	 * Stop the thread, the pending events are discarded.
+	 */
+	~PluginWorker();
+
+	/**
+	 * Append an event to the worker FIFO.
+	 *
+	 * @param ev the event
+	 * @note Thread-safe
+	 */
+	void push(Event ev);
+
+	/**
+	 * Access the timers of the plugins pinned to this worker.
+	 *
+	 * @return the timer queue
+	 * @warning Must only be used from the worker thread
+	 */
+	inline TimerQueue &timers() noexcept
+	{
+		return m_timers;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_PLUGIN_WORKER_H_
@@ -0,0 +1,200 @@
+/*
+ * Reactor.cpp -- event loop thread dedicated to a group of servers
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <Logger.h>
+
+#include "Reactor.h"
+
+namespace irccd {
+
+int Reactor::timeout() noexcept
+{
+	int result = -1;
+
+	for (const auto &server : m_servers) {
+		int value = server->timeout();
+
+		if (value >= 0 && (result < 0 || value < result)) {
+			result = value;
+		}
+	}
+
+	return result;
+}
+
+bool Reactor::flush() noexcept
+{
+	while (!m_backlog.empty() && m_outbox.offer(m_backlog.front())) {
+		m_backlog.pop_front();
+	}
+
+	return m_backlog.empty();
+}
+
+void Reactor::block() noexcept
+{
+	m_blocked = true;
+
+	/* The main loop may have made room before it could see the flag */
+	if (!flush()) {
+		try {
+			m_idle.waitMultiple(-1);
+		} catch (const SocketError &ex) {
+			if (m_running) {
+				Logger::warning() << "reactor: " << ex.what() << std::endl;
+			}
+		}
+
+		m_inbox.clear();
+	}
+
+	m_blocked = false;
+}
+
+void Reactor::poll()
+{
+	/* 1. Same as the main loop, the registrations are only updated when needed */
+	for (auto &server : m_servers) {
+		auto previous = server->socket().handle();
+
+		server->update();
+		server->prepare(m_listener);
+
+		auto current = server->socket().handle();
+
+		if (current != previous) {
+			m_lookup.erase(previous);
+
+			if (current != SocketAbstract::Invalid) {
+				m_lookup.emplace(current, server);
+			}
+		}
+	}
+
+	/* 2. Sync the ready servers */
+	try {
+		for (const SocketStatus &status : m_listener.waitMultiple(timeout())) {
+			if (!m_running) {
+				return;
+			}
+
+			auto handle = status.socket.handle();
+
+			if (handle == m_inbox.socket().handle()) {
+				m_inbox.clear();
+			} else {
+				auto server = m_lookup.find(handle);
+
+				if (server != m_lookup.end()) {
+					server->second->sync(status.flags);
+				}
+			}
+		}
+	} catch (const SocketError &ex) {
+		if (ex.code() != SocketError::Timeout && m_running) {
+			Logger::warning() << "reactor: " << ex.what() << std::endl;
+		}
+	}
+}
+
+void Reactor::exec()
+{
+	/*
+	 * 1-2. Read the servers unless the outbox is full, the sockets are then left alone so that the kernel buffers
+	 * and the TCP window throttle the peers instead of dropping their events.
+	 */
+	if (flush()) {
+		poll();
+	} else {
+		block();
+	}
+
+	if (!m_running) {
+		return;
+	}
+
+	/* 3. Run the events posted from other threads */
+	Event ev;
+
+	for (std::size_t i = 0; i < m_inbox.capacity() && m_inbox.pop(ev); ++i) {
+		try {
+			ev();
+		} catch (const std::exception &ex) {
+			Logger::warning() << "reactor: " << ex.what() << std::endl;
+		}
+	}
+
+	if (m_inbox.dropped() != m_dropped) {
+		Logger::warning() << "reactor: inbox full, " << (m_inbox.dropped() - m_dropped) << " event(s) dropped" << std::endl;
+		m_dropped = m_inbox.dropped();
+	}
+}
+
+void Reactor::run()
+{
+	m_current = this;
+
+	while (m_running) {
+		exec();
+	}
+}
+
+Reactor::Reactor()
+{
+	m_listener.set(m_inbox.socket(), SocketListener::Read);
+	m_idle.set(m_inbox.socket(), SocketListener::Read);
+	m_thread = std::thread(std::bind(&Reactor::run, this));
+}
+
+Reactor::~Reactor()
+{
+	stop();
+}
+
+void Reactor::stop() noexcept
+{
+	if (!m_thread.joinable()) {
+		return;
+	}
+
+	m_running = false;
+	m_inbox.wake();
+	m_thread.join();
+
+	/* The servers may hold resources of irccd, release them now */
+	m_lookup.clear();
+	m_servers.clear();
+}
+
+void Reactor::add(std::shared_ptr<Server> server)
+{
+	m_inbox.push([this, server] () {
+		m_servers.push_back(server);
+	});
+}
+
+void Reactor::forward(Event ev)
+{
+	if (!m_backlog.empty() || !m_outbox.offer(ev)) {
+		m_backlog.push_back(std::move(ev));
+	}
+}
+
+thread_local Reactor *Reactor::m_current{nullptr};
+
+} // !irccd
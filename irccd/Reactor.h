@@ -0,0 +1,180 @@
+/*
+ * Reactor.h -- event loop thread dedicated to a group of servers
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_REACTOR_H_
+#define _IRCCD_REACTOR_H_
+
+/**
+ * @file Reactor.h
+ * @brief Event loop thread dedicated to a group of servers
+ */
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <SocketListener.h>
+
+#include "EventQueue.h"
+#include "Server.h"
+
+namespace irccd {
+
+/**
+ * @class Reactor
+ * @brief Event loop thread dedicated to a group of servers
+ *
+ * With many servers, a single event loop spends most of its time parsing and flushing IRC traffic. A reactor owns
+ * a subset of the servers: their sockets, their ServerState machine and their outgoing queue are only touched
+ * from the reactor thread, so the servers of different reactors run in parallel.
+ *
+ * The events produced by the servers are forwarded to the main event loop through the outbox, the plugins and the
+ * transports are still only used from there. The operations that are not thread-safe on Server (e.g.
+ * disconnecting) are posted to the reactor with post().
+ *
+ * The outbox is bounded but no event is lost: when it is full, the events are kept in the reactor and its servers
+ * are not read anymore until the main loop has made room and called resume().
+ */
+class Reactor {
+private:
+	static thread_local Reactor *m_current;
+
+	/* Events to run in the reactor and events forwarded to the main loop */
+	EventQueue m_inbox;
+	EventQueue m_outbox;
+	std::size_t m_dropped{0};
+
+	/* Events that did not fit in the outbox, the servers are not read while there are some */
+	std::deque<Event> m_backlog;
+	std::atomic<bool> m_blocked{false};
+
+	/* Only used from the reactor thread, m_idle only watches the inbox */
+	SocketListener m_listener;
+	SocketListener m_idle;
+	std::vector<std::shared_ptr<Server>> m_servers;
+	std::unordered_map<SocketAbstract::Handle, std::shared_ptr<Server>> m_lookup;
+
+	std::atomic<bool> m_running{true};
+	std::thread m_thread;
+
+	int timeout() noexcept;
+	bool flush() noexcept;
+	void block() noexcept;
+	void poll();
+	void exec();
+	void run();
+
+public:
+	/**
+	 * Start the thread.
+	 *
+	 * @throw SocketError if the queues can not be created
+	 */
+	Reactor();
+
+	/**
+	 * Stop the thread if not already done.
+	 */
+	~Reactor();
+
+	/**
+	 * Stop the thread and release the servers, the pending events are discarded.
+	 *
+	 * @warning Must not be called from the reactor thread
+	 */
+	void stop() noexcept;
+
+	/**
+	 * Give a server to the reactor, it will be connected from the reactor thread.
+	 *
+	 * @param server the server
+	 * @note Thread-safe
+	 */
+	void add(std::shared_ptr<Server> server);
+
+	/**
+	 * Run an event in the reactor thread.
+	 *
+	 * @param ev the event
+	 * @return false if the inbox was full and the event dropped
+	 * @note Thread-safe
+	 */
+	inline bool post(Event ev) noexcept
+	{
+		return m_inbox.push(std::move(ev));
+	}
+
+	/**
+	 * Wake up the reactor, used when a command has been queued for one of its servers.
+	 *
+	 * @note Thread-safe
+	 */
+	inline void wake() noexcept
+	{
+		m_inbox.wake();
+	}
+
+	/**
+	 * Forward an event to the main event loop. If the outbox is full, the event is kept until the main loop makes
+	 * room, the order is preserved.
+	 *
+	 * @param ev the event
+	 * @warning Must only be called from the reactor thread
+	 */
+	void forward(Event ev);
+
+	/**
+	 * Tell the reactor that events have been popped from the outbox, it is woken up if it was waiting for room.
+	 *
+	 * @note Thread-safe
+	 */
+	inline void resume() noexcept
+	{
+		if (m_blocked.load()) {
+			m_inbox.wake();
+		}
+	}
+
+	/**
+	 * Get the queue of events forwarded to the main event loop, it must watch its socket, pop them and then call
+	 * resume().
+	 *
+	 * @return the outbox
+	 */
+	inline EventQueue &outbox() noexcept
+	{
+		return m_outbox;
+	}
+
+	/**
+	 * Get the reactor running in the calling thread.
+	 *
+	 * @return the reactor or null if not called from a reactor
+	 */
+	static inline Reactor *current() noexcept
+	{
+		return m_current;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_REACTOR_H_
@@ -0,0 +1,204 @@
+/*
+ * Resolver.cpp -- asynchronous host name resolution
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <IrccdConfig.h>
+
+#if !defined(_WIN32)
+#  include <sys/types.h>
+#  include <netinet/in.h>
+#  include <arpa/nameser.h>
+#  include <resolv.h>
+#endif
+
+#include <Socket.h>
+
+#include "Resolver.h"
+
+namespace irccd {
+
+namespace {
+
+std::string key(const std::string &host, std::uint16_t port, int domain)
+{
+	return std::to_string(domain) + ":" + std::to_string(port) + ":" + host;
+}
+
+} // !namespace
+
+void ResolverQuery::complete(ResolverResult result) noexcept
+{
+	result.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start);
+	m_result = std::move(result);
+	m_ready.store(true, std::memory_order_release);
+}
+
+void Resolver::run()
+{
+	for (;;) {
+		Request request;
+		std::string id;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_condition.wait(lock, [&] () {
+				return !m_running || !m_requests.empty();
+			});
+
+			if (!m_running) {
+				break;
+			}
+
+			id = std::move(m_requests.front());
+			m_requests.pop_front();
+
+			/* Copy the parameters only, queries may still join the request */
+			const Request &pending = m_pending.at(id);
+
+			request.host = pending.host;
+			request.port = pending.port;
+			request.domain = pending.domain;
+		}
+
+		/*
+		 * This is needed if irccd is started before DHCP or if
+		 * DNS cache is outdated.
+		 *
+		 * For more information see bug #190.
+		 */
+#if !defined(_WIN32)
+		(void)res_init();
+#endif
+
+		ResolverResult result;
+
+		try {
+			result.address = address::Ip(request.host, request.port, request.domain);
+		} catch (const SocketError &ex) {
+			result.error = ex.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_pending.find(id);
+
+			request.queries = std::move(it->second.queries);
+			m_pending.erase(it);
+
+			if (result.error.empty() && m_cacheTime.count() > 0) {
+				m_cache[id] = Entry{result.address, std::chrono::steady_clock::now() + m_cacheTime};
+			}
+		}
+
+		for (auto &query : request.queries) {
+			query->complete(result);
+		}
+
+		if (m_notify) {
+			m_notify();
+		}
+	}
+}
+
+Resolver::Resolver(Notify notify, unsigned threads)
+	: m_notify(std::move(notify))
+	, m_count(threads == 0 ? 1 : threads)
+{
+}
+
+Resolver::~Resolver()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_running = false;
+	}
+
+	/* A thread blocked in getaddrinfo is only joined once the lookup returns */
+	m_condition.notify_all();
+
+	for (std::thread &thread : m_threads) {
+		thread.join();
+	}
+}
+
+void Resolver::setCacheTime(std::chrono::seconds time) noexcept
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_cacheTime = time;
+
+	if (time.count() <= 0) {
+		m_cache.clear();
+	}
+}
+
+std::shared_ptr<const ResolverQuery> Resolver::resolve(const std::string &host, std::uint16_t port, int domain)
+{
+	auto query = std::make_shared<ResolverQuery>();
+	auto id = key(host, port, domain);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto cached = m_cache.find(id);
+
+		if (cached != m_cache.end()) {
+			if (cached->second.expires > std::chrono::steady_clock::now()) {
+				ResolverResult result;
+
+				result.address = cached->second.address;
+				result.cached = true;
+				query->complete(std::move(result));
+
+				return query;
+			}
+
+			m_cache.erase(cached);
+		}
+
+		auto pending = m_pending.find(id);
+
+		if (pending != m_pending.end()) {
+			pending->second.queries.push_back(query);
+
+			return query;
+		}
+
+		m_pending.emplace(id, Request{host, port, domain, {query}});
+		m_requests.push_back(std::move(id));
+
+		if (m_threads.empty()) {
+			for (unsigned i = 0; i < m_count; ++i) {
+				m_threads.emplace_back(std::bind(&Resolver::run, this));
+			}
+		}
+	}
+
+	m_condition.notify_one();
+
+	return query;
+}
+
+void Resolver::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_cache.clear();
+}
+
+} // !irccd
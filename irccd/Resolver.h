@@ -0,0 +1,187 @@
+/*
+ * Resolver.h -- asynchronous host name resolution
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_RESOLVER_H_
+#define _IRCCD_RESOLVER_H_
+
+/**
+ * @file Resolver.h
+ * @brief Asynchronous host name resolution
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <SocketAddress.h>
+
+namespace irccd {
+
+/**
+ * @class ResolverResult
+ * @brief Result of a host name resolution
+ */
+class ResolverResult {
+public:
+	address::Ip address;			//!< the first address found, only valid if error is empty
+	std::string error;			//!< the reason of the failure, empty on success
+	std::chrono::microseconds latency{0};	//!< time between the request and the result
+	bool cached{false};			//!< true if the address came from the cache
+};
+
+/**
+ * @class ResolverQuery
+ * @brief Pending resolution shared between the caller and the resolver threads
+ */
+class ResolverQuery {
+private:
+	friend class Resolver;
+
+	std::atomic<bool> m_ready{false};
+	std::chrono::steady_clock::time_point m_start{std::chrono::steady_clock::now()};
+	ResolverResult m_result;
+
+	void complete(ResolverResult result) noexcept;
+
+public:
+	/**
+	 * Check if the resolution is complete.
+	 *
+	 * @return true if result() can be used
+	 * @note Thread-safe
+	 */
+	inline bool ready() const noexcept
+	{
+		return m_ready.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Get the result, must only be called once ready() returned true.
+	 *
+	 * @return the result
+	 */
+	inline const ResolverResult &result() const noexcept
+	{
+		return m_result;
+	}
+};
+
+/**
+ * @class Resolver
+ * @brief Resolve host names in a small pool of threads
+ *
+ * The servers used to call getaddrinfo from the event loop, one slow DNS server was enough to stall every server
+ * and transport. The lookups now run in dedicated threads and the notify function is called from these threads
+ * when a query completes, Irccd uses it to wake up the event loop which then checks ready() on its queries.
+ *
+ * Successful results are kept in a cache for the configured time. getaddrinfo does not give the record TTL so the
+ * cache time is a setting, failures are never cached. Concurrent queries for the same host, port and family share
+ * the same lookup, which is common when several networks reconnect after an outage.
+ *
+ * The threads are only started on the first cache miss.
+ */
+class Resolver {
+public:
+	/**
+	 * Function called from a resolver thread when a query is complete.
+	 */
+	using Notify = std::function<void ()>;
+
+private:
+	class Request {
+	public:
+		std::string host;
+		std::uint16_t port;
+		int domain;
+		std::vector<std::shared_ptr<ResolverQuery>> queries;
+	};
+
+	class Entry {
+	public:
+		address::Ip address;
+		std::chrono::steady_clock::time_point expires;
+	};
+
+	Notify m_notify;
+	unsigned m_count;
+	std::chrono::seconds m_cacheTime{60};
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<std::string> m_requests;
+	std::unordered_map<std::string, Request> m_pending;
+	std::unordered_map<std::string, Entry> m_cache;
+	bool m_running{true};
+
+	std::vector<std::thread> m_threads;
+
+	void run();
+
+public:
+	/**
+	 * Create the resolver, no thread is started yet.
+	 *
+	 * @param notify the function to call when a query completes (may be null)
+	 * @param threads the number of threads
+	 */
+	Resolver(Notify notify = nullptr, unsigned threads = 2);
+
+	/**
+	 * Stop the threads, the pending queries are never completed.
+	 */
+	~Resolver();
+
+	/**
+	 * Set how long a successful result is kept, 0 disables the cache.
+	 *
+	 * @param time the cache time
+	 * @note Thread-safe
+	 */
+	void setCacheTime(std::chrono::seconds time) noexcept;
+
+	/**
+	 * Start resolving a host, the query is already ready if the result was in the cache.
+	 *
+	 * @param host the host name or address
+	 * @param port the port
+	 * @param domain AF_INET or AF_INET6
+	 * @return the query
+	 * @note Thread-safe
+	 */
+	std::shared_ptr<const ResolverQuery> resolve(const std::string &host, std::uint16_t port, int domain);
+
+	/**
+	 * Remove all the cached results.
+	 *
+	 * @note Thread-safe
+	 */
+	void clear();
+};
+
+} // !irccd
+
+#endif // !_IRCCD_RESOLVER_H_
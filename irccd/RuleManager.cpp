@@ -19,7 +19,6 @@
 #include <stdexcept>
 
 #include "RuleManager.h"
-#include "Logger.h"
 
 namespace irccd {
 
@@ -47,33 +46,108 @@ const std::unordered_set<std::string> RuleValidEvents {
 	"onWhois"
 };
 
+void RuleManager::Bucket::push(const Rule &rule)
+{
+	rules.push_back(&rule);
+
+	/* The last unconditional rule always wins */
+	if (rule.channels().empty() && rule.nicknames().empty() && rule.plugins().empty()) {
+		constant = true;
+		result = rule.action() == RuleAction::Accept;
+	} else {
+		constant = false;
+	}
+}
+
 void RuleManager::assertIndex(int index) const
 {
 	if (index < 0 || static_cast<size_t>(index) >= m_rules.size())
 		throw std::out_of_range(std::to_string(index) + " is out of range");
 }
 
-int RuleManager::add(const Rule &rule, int index)
+void RuleManager::compile() const
+{
+	m_index.clear();
+	m_any = EventIndex();
+
+	/*
+	 * First create all buckets so that the rules which apply to any event or any server can be appended to
+	 * all of them while keeping the declaration order.
+	 */
+	for (const auto &rule : m_rules) {
+		for (const auto &event : rule.events()) {
+			m_index[event];
+		}
+	}
+	for (const auto &rule : m_rules) {
+		for (const auto &server : rule.servers()) {
+			m_any.servers[server];
+
+			for (auto &pair : m_index) {
+				pair.second.servers[server];
+			}
+		}
+	}
+
+	auto fill = [] (EventIndex &index, const Rule &rule) {
+		if (rule.servers().empty()) {
+			index.any.push(rule);
+
+			for (auto &pair : index.servers) {
+				pair.second.push(rule);
+			}
+		} else {
+			for (const auto &server : rule.servers()) {
+				index.servers[server].push(rule);
+			}
+		}
+	};
+
+	for (const auto &rule : m_rules) {
+		if (rule.events().empty()) {
+			fill(m_any, rule);
+
+			for (auto &pair : m_index) {
+				fill(pair.second, rule);
+			}
+		} else {
+			for (const auto &event : rule.events()) {
+				fill(m_index[event], rule);
+			}
+		}
+	}
+
+	m_dirty = false;
+}
+
+const RuleManager::Bucket &RuleManager::bucket(const std::string &server, const std::string &event) const
 {
-	Lock lk(m_lock);
+	auto eit = m_index.find(event);
+	const EventIndex &index = (eit == m_index.end()) ? m_any : eit->second;
+	auto sit = index.servers.find(server);
+
+	return (sit == index.servers.end()) ? index.any : sit->second;
+}
+
+int RuleManager::add(Rule rule, int index)
+{
+	m_dirty = true;
 
 	if (index < 0) {
-		m_rules.push_back(rule);
+		m_rules.push_back(std::move(rule));
 		return m_rules.size() - 1;
 	}
 
 	if ((size_t)index >= m_rules.size())
 		throw std::out_of_range(std::to_string(index) + " is out of range");
 
-	m_rules.insert(m_rules.begin() + index, rule);
+	m_rules.insert(m_rules.begin() + index, std::move(rule));
 
 	return index;
 }
 
-Rule RuleManager::get(int index) const
+const Rule &RuleManager::get(int index) const
 {
-	Lock lk(m_lock);
-
 	assertIndex(index);
 
 	return m_rules[index];
@@ -81,17 +155,14 @@ Rule RuleManager::get(int index) const
 
 void RuleManager::remove(int index)
 {
-	Lock lk(m_lock);
-
 	assertIndex(index);
 
 	m_rules.erase(m_rules.begin() + index);
+	m_dirty = true;
 }
 
-unsigned RuleManager::count() const
+unsigned RuleManager::count() const noexcept
 {
-	Lock lk(m_lock);
-
 	return static_cast<unsigned>(m_rules.size());
 }
 
@@ -101,34 +172,43 @@ bool RuleManager::solve(const std::string &server,
 			const std::string &plugin,
 			const std::string &event) const
 {
-	Lock lock{m_lock};
-	bool result{true};
-
-#if !defined(NDEBUG)
-#if 0
-	Logger::debug("rule: checking match for:");
-	Logger::debug("    - server: %s", server.c_str());
-	Logger::debug("    - channel: %s", channel.c_str());
-	Logger::debug("    - nickname: %s", nickname.c_str());
-	Logger::debug("    - plugin: %s", plugin.c_str());
-	Logger::debug("    - event: %s", event.c_str());
-#endif
-#endif
-
-	for (const auto &r : m_rules) {
-		if (r.match(server, channel, nickname, plugin, event)) {
-			result = r.action() == RuleAction::Accept;
+	/* An empty server or event matches every rule, the index can not be used */
+	if (server.empty() || event.empty()) {
+		bool result{true};
+
+		for (const auto &r : m_rules) {
+			if (r.match(server, channel, nickname, plugin, event)) {
+				result = r.action() == RuleAction::Accept;
+			}
 		}
+
+		return result;
 	}
 
-	return result;
+	if (m_dirty) {
+		compile();
+	}
+
+	const Bucket &b = bucket(server, event);
+
+	if (b.constant) {
+		return b.result;
+	}
+
+	/* The bucket already matches the server and the event */
+	for (auto it = b.rules.rbegin(); it != b.rules.rend(); ++it) {
+		if ((*it)->match(/* server */ "", channel, nickname, plugin, /* event */ "")) {
+			return (*it)->action() == RuleAction::Accept;
+		}
+	}
+
+	return true;
 }
 
-void RuleManager::clear()
+void RuleManager::clear() noexcept
 {
-	Lock lk(m_lock);
-
 	m_rules.clear();
+	m_dirty = true;
 }
 
 } // !irccd
@@ -24,11 +24,10 @@
  * @brief Owner of rules and solver
  */
 
-#include <vector>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
-#include <mutex>
-
-#include <Singleton.h>
+#include <vector>
 
 #include "Rule.h"
 
@@ -53,24 +52,46 @@ public:
  * @class RuleManager
  * @brief Owner of rules and solver
  *
- * All functions are thread safe.
+ * The rules are compiled into buckets indexed by event and server, each bucket only contains the rules that
+ * may apply to that pair, in the declaration order. Solving a request then only scans that bucket backwards
+ * and stops at the first rule that matches, which is the one that would have won with a full scan.
+ *
+ * The index is rebuilt on the next call to solve() after the rules have changed.
+ *
+ * This class is not thread-safe, it is owned by the irccd event loop.
  */
-class RuleManager final : public Singleton<RuleManager> {
+class RuleManager final {
 private:
-	SINGLETON(RuleManager);
+	/*
+	 * Rules that apply to one event on one server. When the result does not depend on the channel, origin or
+	 * plugin, it is precomputed.
+	 */
+	class Bucket {
+	public:
+		std::vector<const Rule *> rules;
+		bool constant{true};
+		bool result{true};
+
+		void push(const Rule &rule);
+	};
 
-	using Lock		= std::lock_guard<std::mutex>;
+	/* Buckets for one event */
+	class EventIndex {
+	public:
+		std::unordered_map<std::string, Bucket> servers;
+		Bucket any;
+	};
 
-	std::vector<Rule>	m_rules;
-	mutable std::mutex	m_lock;
+	std::vector<Rule> m_rules;
 
-	RuleManager() = default;
-	RuleManager(const RuleManager &) = delete;
-	RuleManager(RuleManager &&) = delete;
-	RuleManager &operator=(const RuleManager &) = delete;
-	RuleManager &operator=(RuleManager &&) = delete;
+	/* Compiled index */
+	mutable std::unordered_map<std::string, EventIndex> m_index;
+	mutable EventIndex m_any;
+	mutable bool m_dirty{true};
 
 	void assertIndex(int index) const;
+	void compile() const;
+	const Bucket &bucket(const std::string &server, const std::string &event) const;
 
 public:
 	/**
@@ -81,16 +102,16 @@ public:
 	 * @return the inserted index
 	 * @throw std::out_of_range if index is out of bounds
 	 */
-	int add(const Rule &rule, int index = -1);
+	int add(Rule rule, int index = -1);
 
 	/**
-	 * Get a copy of a rule.
+	 * Get a rule.
 	 *
 	 * @param index the index
 	 * @return the rule
 	 * @throw std::out_of_range if index is out of bounds
 	 */
-	Rule get(int index) const;
+	const Rule &get(int index) const;
 
 	/**
 	 * Remove an existing rule.
@@ -105,13 +126,12 @@ public:
 	 *
 	 * @return the count.
 	 */
-	unsigned count() const;
+	unsigned count() const noexcept;
 
 	/**
 	 * Check the result of a plugin and event. We first make
-	 * the assumption that everything is valid and iterate over
-	 * all the rules to check if the rule disable the previous
-	 * one.
+	 * the assumption that everything is valid and the last
+	 * rule that matches decides.
 	 *
 	 * @param server the server name
 	 * @param channel the channel
@@ -129,7 +149,7 @@ public:
 	/**
 	 * Remove all rules.
 	 */
-	void clear();
+	void clear() noexcept;
 };
 
 } // !irccd
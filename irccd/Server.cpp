@@ -16,6 +16,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <stdexcept>
@@ -26,10 +27,58 @@
 
 namespace irccd {
 
-void Server::handleConnect(const char *, const char **) noexcept
+void Server::handleBatch(const IrcMessage &message)
 {
+	IrcView reference = message.param(0);
+
+	if (reference.length < 2) {
+		return;
+	}
+
+	std::string id(reference.data + 1, reference.length - 1);
+
+	/* Only netjoin batches have an event, the QUIT of a netsplit are only seen by the tracker */
+	if (reference.data[0] == '+') {
+		if (message.param(1) == "netjoin") {
+			m_batches.emplace(std::move(id), ServerBatch());
+		}
+	} else if (reference.data[0] == '-') {
+		auto it = m_batches.find(id);
+
+		if (it != m_batches.end()) {
+			ServerBatch batch = std::move(it->second);
+
+			m_batches.erase(it);
+
+			if (!batch.empty()) {
+				onJoinBatch(batch);
+			}
+		}
+	}
+}
+
+void Server::handleCap(const IrcMessage &message)
+{
+	/* Only requested while registering, the registration continues whether batch is supported or not */
+	if (m_state.type() == ServerState::Connecting && (message.param(1) == "ACK" || message.param(1) == "NAK")) {
+		m_connection.send("CAP END");
+	}
+}
+
+void Server::handleConnect(const IrcMessage &message)
+{
+	/* The server may have truncated our nickname */
+	if (!message.param(0).empty()) {
+		m_identity.nickname = message.param(0).str();
+	}
+
 	/* Reset the number of tried reconnection. */
 	m_settings.recocurrent = 0;
+	m_failures = 0;
+
+	/* The first probe is sent after one interval */
+	m_pingSent = m_lastReceived;
+	m_pingToken.clear();
 
 	/* Don't forget to change state and notify. */
 	next(ServerState::Connected);
@@ -42,199 +91,505 @@ void Server::handleConnect(const char *, const char **) noexcept
 	}
 }
 
-void Server::handleChannel(const char *orig, const char **params) noexcept
+void Server::handleInvite(const IrcMessage &message)
 {
-	onMessage(strify(orig), strify(params[0]), strify(params[1]));
+	/*
+	 * The invite contains the target nickname, it's quite uncommon to need it so it is passed as the last
+	 * argument to be optional in the plugin.
+	 */
+	onInvite(message.prefix.str(), message.param(1).str(), message.param(0).str());
 }
 
-void Server::handleChannelNotice(const char *orig, const char **params) noexcept
+void Server::handleJoin(const IrcMessage &message)
 {
-	onChannelNotice(strify(orig), strify(params[0]), strify(params[1]));
-}
+	const IrcTag *tag = message.tag("batch");
 
-void Server::handleCtcpAction(const char *orig, const char **params) noexcept
-{
-	onMe(strify(orig), strify(params[0]), strify(params[1]));
+	if (tag != nullptr) {
+		auto it = m_batches.find(tag->value.str());
+
+		if (it != m_batches.end()) {
+			it->second.push_back({message.prefix.str(), message.param(0).str(), ""});
+			return;
+		}
+	}
+
+	if (m_settings.batchsize == 0) {
+		onJoin(message.prefix.str(), message.param(0).str());
+	} else {
+		m_burstPart = false;
+		m_burst.push_back({message.prefix.str(), message.param(0).str(), ""});
+	}
 }
 
-void Server::handleInvite(const char *orig, const char **params) noexcept
+void Server::handleKick(const IrcMessage &message)
 {
 	/*
-	 * The libircclient says that invite contains the target nickname, it's quite
-	 * uncommon to need it so it is passed as the last argument to be
-	 * optional in the plugin.
+	 * Rejoin the channel if the option has been set and I was kicked.
 	 */
-	onInvite(strify(orig), strify(params[1]), strify(params[0]));
+	if (message.param(1) == m_identity.nickname && m_settings.autorejoin) {
+		join(message.param(0).str());
+	}
+
+	onKick(message.prefix.str(), message.param(0).str(), message.param(1).str(), message.param(2).str());
 }
 
-void Server::handleJoin(const char *orig, const char **params) noexcept
+void Server::handleMessage(const IrcMessage &message)
 {
-	onJoin(strify(orig), strify(params[0]));
+	m_lastReceived = std::chrono::steady_clock::now();
+
+	/* Before the events, a plugin may look at it from another thread */
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_status.lastReceived = m_lastReceived;
+	}
+
+	/* Any other message ends the burst, the plugins must see the events in order */
+	if (!m_burst.empty() && !(message.command == (m_burstPart ? "PART" : "JOIN"))) {
+		flushBurst();
+	}
+
+	/* Update the channels before the plugins are notified */
+	{
+		std::lock_guard<std::mutex> lock(m_trackerMutex);
+
+		m_tracker.update(message);
+	}
+
+	switch (message.numeric()) {
+	case 0:
+		break;
+	case 1:
+		handleConnect(message);
+		return;
+	case 5:
+		handleSupport(message);
+		return;
+	case 353:
+		handleNames(message);
+		return;
+	case 366:
+		handleEndOfNames(message);
+		return;
+	case 433:
+		handleNicknameInUse(message);
+		return;
+	default:
+		return;
+	}
+
+	const IrcView &command = message.command;
+
+	if (command == "PRIVMSG") {
+		handlePrivmsg(message);
+	} else if (command == "NOTICE") {
+		handleNotice(message);
+	} else if (command == "JOIN") {
+		handleJoin(message);
+	} else if (command == "PART") {
+		handlePart(message);
+	} else if (command == "MODE") {
+		handleMode(message);
+	} else if (command == "NICK") {
+		handleNick(message);
+	} else if (command == "KICK") {
+		handleKick(message);
+	} else if (command == "TOPIC") {
+		handleTopic(message);
+	} else if (command == "INVITE") {
+		handleInvite(message);
+	} else if (command == "BATCH") {
+		handleBatch(message);
+	} else if (command == "CAP") {
+		handleCap(message);
+	} else if (command == "PONG") {
+		handlePong(message);
+	}
 }
 
-void Server::handleKick(const char *orig, const char **params) noexcept
+void Server::handleMode(const IrcMessage &message)
 {
-	/*
-	 * Rejoin the channel if the option has been set and I was kicked.
-	 */
-	char target[32]{0};
+	if (!isChannel(message.param(0))) {
+		onUserMode(message.prefix.str(), message.param(1).str());
+		return;
+	}
 
-	irc_target_get_nick(orig, target, sizeof (target));
+	/* Several modes may have arguments, they are all given as one string */
+	std::string arguments;
 
-	if (m_identity.nickname == target && m_settings.autorejoin) {
-		join(strify(params[1]));
+	for (std::size_t i = 2; i < message.paramCount; ++i) {
+		if (i > 2) {
+			arguments.push_back(' ');
+		}
+
+		arguments.append(message.params[i].data, message.params[i].length);
 	}
 
-	onKick(strify(orig), strify(params[0]), strify(params[1]), strify(params[2]));
+	onMode(message.prefix.str(), message.param(0).str(), message.param(1).str(), arguments);
 }
 
-void Server::handleMode(const char *orig, const char **params) noexcept
+void Server::handleNames(const IrcMessage &message)
 {
-	onMode(strify(orig), strify(params[0]), strify(params[1]), strify(params[2]));
+	if (message.paramCount < 3) {
+		return;
+	}
+
+	const IrcView &list = message.params[message.paramCount - 1];
+	const char *end = list.data + list.length;
+	std::vector<std::string> &names = m_names[message.params[message.paramCount - 2].str()];
+
+	for (const char *p = list.data; p < end; ) {
+		const char *space = std::find(p, end, ' ');
+		IrcView nickname = m_tracker.strip(IrcView(p, space - p));
+
+		if (nickname.length > 0) {
+			names.push_back(nickname.str());
+		}
+
+		p = space + 1;
+	}
 }
 
-void Server::handleNick(const char *orig, const char **params) noexcept
+void Server::handleEndOfNames(const IrcMessage &message)
+{
+	auto it = m_names.find(message.param(1).str());
+
+	if (it == m_names.end()) {
+		return;
+	}
+
+	std::pair<std::string, std::vector<std::string>> names = std::move(*it);
+
+	m_names.erase(it);
+	onNames(std::move(names.first), std::move(names.second));
+}
+
+void Server::handleNick(const IrcMessage &message)
 {
 	/*
 	 * Update our nickname.
 	 */
-	char target[32]{0};
+	if (message.nickname() == m_identity.nickname) {
+		m_identity.nickname = message.param(0).str();
+	}
 
-	irc_target_get_nick(orig, target, sizeof (target));
+	onNick(message.prefix.str(), message.param(0).str());
+}
 
-	if (m_identity.nickname == target) {
-		m_identity.nickname = strify(params[0]);
+void Server::handleNicknameInUse(const IrcMessage &)
+{
+	/* Once registered, the server keeps our nickname so there is nothing to do */
+	if (m_state.type() != ServerState::Connecting) {
+		return;
 	}
 
-	onNick(strify(orig), strify(params[0]));
+	m_identity.nickname.push_back('_');
+
+	Logger::warning() << "server " << m_info.name << ": nickname in use, trying " << m_identity.nickname << std::endl;
+
+	m_connection.send("NICK " + m_identity.nickname);
 }
 
-void Server::handleNotice(const char *orig, const char **params) noexcept
+void Server::handleNotice(const IrcMessage &message)
 {
+	IrcView target = message.param(0);
+	IrcView text = message.param(1);
+
+	/* CTCP replies */
+	if (text.length > 0 && text.data[0] == '\001') {
+		return;
+	}
+
 	/*
-	 * As for handleInvite, the notice provides the target nickname, we discard it.
+	 * The private notice provides the target nickname, we discard it.
 	 */
-	onNotice(strify(orig), strify(params[1]));
+	if (isChannel(target)) {
+		onChannelNotice(message.prefix.str(), target.str(), text.str());
+	} else {
+		onNotice(message.prefix.str(), text.str());
+	}
 }
 
-void Server::handlePart(const char *orig, const char **params) noexcept
+void Server::handlePart(const IrcMessage &message)
 {
-	onPart(strify(orig), strify(params[0]), strify(params[1]));
+	if (m_settings.batchsize == 0) {
+		onPart(message.prefix.str(), message.param(0).str(), message.param(1).str());
+	} else {
+		m_burstPart = true;
+		m_burst.push_back({message.prefix.str(), message.param(0).str(), message.param(1).str()});
+	}
 }
 
-void Server::handleQuery(const char *orig, const char **params) noexcept
+void Server::handlePong(const IrcMessage &message)
 {
-	onQuery(strify(orig), strify(params[1]));
+	/* The token is usually the second parameter, some servers only send it back */
+	if (m_pingToken.empty() || !(message.param(1) == m_pingToken || message.param(0) == m_pingToken)) {
+		return;
+	}
+
+	auto rtt = std::chrono::duration_cast<std::chrono::milliseconds>(m_lastReceived - m_pingSent);
+
+	m_pingToken.clear();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_latency.record(rtt);
 }
 
-void Server::handleTopic(const char *orig, const char **params) noexcept
+void Server::handlePrivmsg(const IrcMessage &message)
 {
-	onTopic(strify(orig), strify(params[0]), strify(params[1]));
+	IrcView target = message.param(0);
+	IrcView text = message.param(1);
+
+	if (text.length == 0 || text.data[0] != '\001') {
+		if (isChannel(target)) {
+			onMessage(message.prefix.str(), target.str(), text.str());
+		} else {
+			onQuery(message.prefix.str(), text.str());
+		}
+
+		return;
+	}
+
+	/* CTCP request, \001COMMAND arguments\001 */
+	std::string ctcp(text.data + 1, text.length - 1);
+
+	if (!ctcp.empty() && ctcp.back() == '\001') {
+		ctcp.pop_back();
+	}
+
+	std::string::size_type space = ctcp.find(' ');
+	std::string command = ctcp.substr(0, space);
+	std::string arguments = (space == std::string::npos) ? "" : ctcp.substr(space + 1);
+
+	if (command == "ACTION") {
+		onMe(message.prefix.str(), target.str(), arguments);
+	} else if (command == "VERSION") {
+		notice(message.nickname().str(), "\001VERSION " + m_identity.ctcpversion + "\001");
+	} else if (command == "PING") {
+		notice(message.nickname().str(), "\001PING " + arguments + "\001");
+	}
 }
 
-void Server::handleUserMode(const char *orig, const char **params) noexcept
+void Server::handleSupport(const IrcMessage &message)
 {
-	onUserMode(strify(orig), strify(params[1]));
+	/* The first parameter is our nickname and the last one is the human readable text */
+	for (std::size_t i = 1; i + 1 < message.paramCount; ++i) {
+		const IrcView &token = message.params[i];
+
+		if (token.length > 10 && std::memcmp(token.data, "CHANTYPES=", 10) == 0) {
+			m_chantypes.assign(token.data + 10, token.length - 10);
+		}
+	}
+}
+
+void Server::handleTopic(const IrcMessage &message)
+{
+	onTopic(message.prefix.str(), message.param(0).str(), message.param(1).str());
+}
+
+void Server::flushBurst()
+{
+	ServerBatch burst;
+
+	burst.swap(m_burst);
+
+	if (burst.size() >= m_settings.batchsize) {
+		if (m_burstPart) {
+			onPartBatch(burst);
+		} else {
+			onJoinBatch(burst);
+		}
+	} else {
+		for (const ServerBatchEntry &entry : burst) {
+			if (m_burstPart) {
+				onPart(entry.origin, entry.channel, entry.reason);
+			} else {
+				onJoin(entry.origin, entry.channel);
+			}
+		}
+	}
 }
 
 Server::Server(ServerInfo info, ServerIdentity identity, ServerSettings settings)
 	: m_info(std::move(info))
 	, m_settings(std::move(settings))
 	, m_identity(std::move(identity))
-	, m_session{nullptr, nullptr}
+	, m_connection{std::bind(&Server::handleMessage, this, std::placeholders::_1)}
 	, m_state{ServerState::Connecting}
 	, m_next{ServerState::Undefined}
+	, m_queue{m_settings.floodburst, m_settings.flooddelay, m_settings.queuesize, m_settings.queueoverflow}
 {
-	irc_callbacks_t callbacks;
+}
 
-	/*
-	 * GCC 4.9.2 triggers some missing-field-initializers warnings when
-	 * using uniform initialization so use a std::memset as a workaround.
-	 */
-	std::memset(&callbacks, 0, sizeof (irc_callbacks_t));
+Server::~Server()
+{
+	Logger::debug() << "server " << m_info.name << ": disconnecting..." << std::endl;
 
-	/*
-	 * Convert the raw pointer functions from libircclient to Server member
-	 * function.
-	 *
-	 * While doing this, discard useless arguments.
-	 */
-	callbacks.event_channel = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleChannel(orig, params);
-	};
-	callbacks.event_channel_notice = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleChannelNotice(orig, params);
-	};
-	callbacks.event_connect = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleConnect(orig, params);
-	};
-	callbacks.event_ctcp_action = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleCtcpAction(orig, params);
-	};
-	callbacks.event_invite = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleInvite(orig, params);
-	};
-	callbacks.event_join = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleJoin(orig, params);
-	};
-	callbacks.event_kick = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleKick(orig, params);
-	};
-	callbacks.event_mode = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleMode(orig, params);
-	};
-	callbacks.event_nick = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleNick(orig, params);
-	};
-	callbacks.event_notice = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleNotice(orig, params);
-	};
-	callbacks.event_part = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handlePart(orig, params);
-	};
-	callbacks.event_privmsg = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleQuery(orig, params);
-	};
-	callbacks.event_topic = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleTopic(orig, params);
-	};
-	callbacks.event_umode = [] (auto session, auto, auto orig, auto params, auto) {
-		static_cast<Server *>(irc_get_ctx(session))->handleUserMode(orig, params);
+	m_connection.disconnect();
+}
+
+void Server::flush() noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_queue.flush();
+
+		ServerQueueStats stats = m_queue.stats();
+
+		if (stats.dropped != m_dropped) {
+			Logger::warning() << "server " << m_info.name << ": outgoing queue full, "
+					  << (stats.dropped - m_dropped) << " command(s) dropped" << std::endl;
+			m_dropped = stats.dropped;
+		}
+	}
+
+	/* All the commands allowed by the rate limit go out in one write */
+	m_connection.flush();
+}
+
+void Server::keepalive()
+{
+	if (m_settings.pinginterval <= 0) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+
+	if (now - m_pingSent < std::chrono::seconds(m_settings.pinginterval)) {
+		return;
+	}
+
+	/* Bypass the queue, the rate limit would be measured instead of the lag; an unanswered probe is forgotten */
+	m_pingToken = "irccd-" + std::to_string(++ m_pingCounter);
+	m_pingSent = now;
+	m_connection.send("PING :" + m_pingToken);
+}
+
+bool Server::stale() const noexcept
+{
+	if (m_settings.pingtimeout <= 0) {
+		return false;
+	}
+
+	return std::chrono::steady_clock::now() - m_lastReceived >= std::chrono::seconds(m_settings.pingtimeout);
+}
+
+int Server::keepaliveTimeout() const noexcept
+{
+	using namespace std::chrono;
+
+	auto now = steady_clock::now();
+	int result = -1;
+
+	auto merge = [&] (steady_clock::time_point deadline) {
+		int value = static_cast<int>(std::max<long long>(0, duration_cast<milliseconds>(deadline - now).count()));
+
+		if (result < 0 || value < result) {
+			result = value;
+		}
 	};
 
-	m_session = Session{irc_create_session(&callbacks), irc_destroy_session};
+	if (m_settings.pinginterval > 0) {
+		merge(m_pingSent + seconds(m_settings.pinginterval));
+	}
+	if (m_settings.pingtimeout > 0) {
+		merge(m_lastReceived + seconds(m_settings.pingtimeout));
+	}
 
-	/* Save this to the session */
-	irc_set_ctx(m_session.get(), this);
+	return result;
 }
 
-Server::~Server()
+void Server::prepare(SocketListener &listener) noexcept
 {
-	Logger::debug() << "server " << m_info.name << ": disconnecting..." << std::endl;
+	flush();
+	m_state.prepare(*this, listener);
+
+	/* Snapshot for the transports, they may run in another thread than the server */
+	ServerStatus status;
+	std::uint64_t bytes = m_connection.stats().bytes;
+
+	if (bytes != m_bytes) {
+		m_bytes = bytes;
+		m_lastSent = std::chrono::steady_clock::now();
+	}
+
+	status.state = m_state.type();
+	status.waiting = m_state.waiting();
+	status.failures = m_failures;
+	status.lastReceived = m_lastReceived;
+	status.lastSent = m_lastSent;
+
+	if (status.state == ServerState::Disconnected) {
+		status.retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(m_state.timeout(*this), 0));
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
 
-	irc_disconnect(m_session.get());
+	m_status = status;
 }
 
-void Server::sync(fd_set &setinput, fd_set &setoutput) noexcept
+void Server::sync(int flags) noexcept
 {
-	/*
-	 * 1. Send maximum of command possible if available for write */
-	/*
-	 * Break on the first failure to avoid changing the order of the
-	 * commands if any of them fails.
-	 */
-	bool done = false;
+	m_connection.sync(flags);
 
-	while (!m_queue.empty() && !done) {
-		if (m_queue.front()()) {
-			m_queue.pop();
-		} else {
-			done = true;
+	/* The lines read at once are a burst */
+	if (!m_burst.empty()) {
+		flushBurst();
+	}
+
+	if (m_connection.state() == IrcConnection::Disconnected) {
+		std::lock_guard<std::mutex> lock(m_trackerMutex);
+
+		m_tracker.clear();
+		m_names.clear();
+		m_batches.clear();
+	}
+}
+
+void Server::watch(SocketListener &listener) noexcept
+{
+	SocketAbstract::Handle handle = m_connection.handle();
+
+	if (handle == SocketAbstract::Invalid) {
+		unwatch(listener);
+		return;
+	}
+
+	/* The connection created a new socket since the last registration */
+	if (handle != m_socket.handle()) {
+		unwatch(listener);
+		m_socket.reset(handle);
+	}
+
+	int flags = m_connection.flags();
+
+	try {
+		/* Both functions are no-op if the socket is already in that state */
+		if (flags != 0) {
+			listener.set(m_socket, flags);
 		}
+
+		listener.unset(m_socket, ~flags & (SocketListener::Read | SocketListener::Write));
+	} catch (const std::exception &ex) {
+		Logger::warning() << "server " << m_info.name << ": " << ex.what() << std::endl;
+	}
+}
+
+void Server::unwatch(SocketListener &listener) noexcept
+{
+	if (m_socket.handle() == SocketAbstract::Invalid) {
+		return;
+	}
+
+	try {
+		listener.remove(m_socket);
+	} catch (const std::exception &ex) {
+		Logger::warning() << "server " << m_info.name << ": " << ex.what() << std::endl;
 	}
 
-	/* 2. Read data */
-	irc_process_select_descriptors(m_session.get(), &setinput, &setoutput);
+	m_socket.reset(SocketAbstract::Invalid);
 }
 
 #if 0
@@ -19,24 +19,72 @@
 #ifndef _IRCCD_SERVER_H_
 #define _IRCCD_SERVER_H_
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include <libircclient.h>
-
 #include <IrccdConfig.h>
 #include <Logger.h>
 #include <Signals.h>
+#include <SocketListener.h>
 
+#include "IrcConnection.h"
+#include "Resolver.h"
+#include "ServerLatency.h"
+#include "ServerQueue.h"
 #include "ServerState.h"
+#include "ServerTracker.h"
 
 namespace irccd {
 
+/**
+ * @class ServerSocket
+ * @brief Non-owning socket for the IrcConnection descriptor
+ *
+ * The descriptor is created and closed by IrcConnection, this class only exists so that the server can be
+ * registered into a SocketListener. Closing or destroying it never closes the descriptor.
+ */
+class ServerSocket : public SocketAbstract {
+public:
+	/**
+	 * Create an invalid socket.
+	 */
+	ServerSocket() = default;
+
+	/**
+	 * Forget the descriptor without closing it.
+	 */
+	inline ~ServerSocket()
+	{
+		m_handle = Invalid;
+	}
+
+	/**
+	 * Forget the descriptor without closing it.
+	 */
+	inline void close() override
+	{
+		m_handle = Invalid;
+	}
+
+	/**
+	 * Set the descriptor used by IrcConnection.
+	 *
+	 * @param handle the new descriptor
+	 */
+	inline void reset(Handle handle) noexcept
+	{
+		m_handle = handle;
+	}
+};
+
 /**
  * @class ServerIdentity
  * @brief Identity to use when connecting
@@ -123,17 +171,50 @@ public:
 	std::string command{"!"};	//!< the command character to trigger plugin command
 	int recotries{3};		//!< number of tries to reconnect before giving up
 	int recotimeout{30};		//!< number of seconds to wait before trying to connect
+	int recomaxtimeout{300};	//!< maximum number of seconds to wait after consecutive failures
 	int recocurrent{1};		//!< number of tries tested
 	bool autorejoin{false};		//!< auto rejoin after a kick?
+	unsigned floodburst{5};		//!< number of commands sent at once before rate limiting (0 to disable)
+	unsigned flooddelay{2000};	//!< milliseconds to earn one more command
+	unsigned queuesize{512};	//!< maximum number of pending commands (0 for unbounded)
+	ServerOverflow queueoverflow{ServerOverflow::DropOldest};	//!< what to do when the queue is full
+	unsigned batchsize{8};		//!< consecutive JOIN or PART received at once delivered as one event (0 to disable)
+	int pinginterval{30};		//!< number of seconds between two PING probes (0 to disable)
+	int pingtimeout{90};		//!< number of seconds without data before reconnecting (0 to disable)
+};
+
+/**
+ * @class ServerBatchEntry
+ * @brief One JOIN or PART of a batch
+ */
+class ServerBatchEntry {
+public:
+	std::string origin;		//!< who joined or left
+	std::string channel;		//!< the channel
+	std::string reason;		//!< the part reason, always empty for a join
 };
 
 /**
- * Deferred command to send to the server.
+ * List of JOIN or PART received together.
+ */
+using ServerBatch = std::vector<ServerBatchEntry>;
+
+/**
+ * @class ServerStatus
+ * @brief Snapshot of the server state
  *
- * If the command returns true, it has been correctly buffered for outgoing
- * and removed from the queue.
+ * The state belongs to the thread running the server, this copy is updated on each iteration and can be read
+ * from any thread.
  */
-using ServerCommand = std::function<bool ()>;
+class ServerStatus {
+public:
+	ServerState::Type state{ServerState::Undefined};	//!< current state
+	bool waiting{false};					//!< waiting for a connection slot
+	unsigned failures{0};					//!< number of consecutive failures
+	std::chrono::steady_clock::time_point retry;		//!< next reconnection attempt when disconnected
+	std::chrono::steady_clock::time_point lastReceived;	//!< last time a message was received when connected
+	std::chrono::steady_clock::time_point lastSent;		//!< last time data was written when connected
+};
 
 /**
  * @class Server
@@ -149,7 +230,7 @@ using ServerCommand = std::function<bool ()>;
  *
  * Note: the server is set in non blocking mode, commands are placed in a queue and sent when only when they are ready.
  */
-class Server {
+class Server : public std::enable_shared_from_this<Server> {
 public:
 #if defined(WITH_JS)
 	/**
@@ -208,6 +289,18 @@ public:
 	 */
 	Signal<std::string, std::string> onJoin;
 
+	/**
+	 * Signal: onJoinBatch
+	 * ------------------------------------------------
+	 *
+	 * Triggered instead of onJoin on netjoins: when at least batchsize JOIN are received in a row at once or for
+	 * an IRCv3 netjoin batch.
+	 *
+	 * Arguments:
+	 * - the joins, in order
+	 */
+	Signal<const ServerBatch &> onJoinBatch;
+
 	/**
 	 * Signal: onKick
 	 * ------------------------------------------------
@@ -265,6 +358,18 @@ public:
 	 */
 	Signal<std::string, std::string, std::string, std::string> onMode;
 
+	/**
+	 * Signal: onNames
+	 * ------------------------------------------------
+	 *
+	 * Triggered when the list of users of a channel has been received, after joining or on request.
+	 *
+	 * Arguments:
+	 * - the channel
+	 * - the nicknames without their prefixes
+	 */
+	Signal<std::string, std::vector<std::string>> onNames;
+
 	/**
 	 * Signal: onNick
 	 * ------------------------------------------------
@@ -302,6 +407,17 @@ public:
 	 */
 	Signal<std::string, std::string, std::string> onPart;
 
+	/**
+	 * Signal: onPartBatch
+	 * ------------------------------------------------
+	 *
+	 * Triggered instead of onPart when at least batchsize PART are received in a row at once.
+	 *
+	 * Arguments:
+	 * - the parts, in order
+	 */
+	Signal<const ServerBatch &> onPartBatch;
+
 	/**
 	 * Signal: onQuery
 	 * ------------------------------------------------
@@ -339,40 +455,95 @@ public:
 	 */
 	Signal<std::string, std::string> onUserMode;
 
-private:
-	using Session = std::unique_ptr<irc_session_t, void (*)(irc_session_t *)>;
-	using Queue = std::queue<ServerCommand>;
+	/**
+	 * Signal: onQueued
+	 * ------------------------------------------------
+	 *
+	 * Triggered when a command has been queued, possibly from another thread. The event loop uses it to know
+	 * that it must flush the server.
+	 */
+	Signal<> onQueued;
 
 private:
 	ServerInfo m_info;
 	ServerSettings m_settings;
 	ServerIdentity m_identity;
-	Session m_session;
+	IrcConnection m_connection;
+	Resolver *m_resolver{nullptr};
+	ConnectScheduler *m_scheduler{nullptr};
+	unsigned m_failures{0};
+	std::atomic<std::int64_t> m_resolveTime{0};
+	std::string m_chantypes{"#&"};
+	ServerSocket m_socket;
 	ServerState m_state;
 	ServerState m_next;
-	Queue m_queue;
-
-	void handleChannel(const char *, const char **) noexcept;
-	void handleChannelNotice(const char *, const char **) noexcept;
-	void handleConnect(const char *, const char **) noexcept;
-	void handleCtcpAction(const char *, const char **) noexcept;
-	void handleInvite(const char *, const char **) noexcept;
-	void handleJoin(const char *, const char **) noexcept;
-	void handleKick(const char *, const char **) noexcept;
-	void handleMode(const char *, const char **) noexcept;
-	void handleNick(const char *, const char **) noexcept;
-	void handleNotice(const char *, const char **) noexcept;
-	void handlePart(const char *, const char **) noexcept;
-	void handleQuery(const char *, const char **) noexcept;
-	void handleTopic(const char *, const char **) noexcept;
-	void handleUserMode(const char *, const char **) noexcept;
+	ServerQueue m_queue;
+	std::size_t m_dropped{0};
+	ServerStatus m_status;
+	mutable std::mutex m_mutex;
+
+	/* Channels we are in, read by the plugins from other threads */
+	ServerTracker m_tracker;
+	mutable std::mutex m_trackerMutex;
+
+	/* NAMES replies being received, by channel */
+	std::unordered_map<std::string, std::vector<std::string>> m_names;
+
+	/* JOIN or PART received in a row, delivered at the end of the run */
+	ServerBatch m_burst;
+	bool m_burstPart{false};
+
+	/* IRCv3 netjoin batches being received, by reference */
+	std::unordered_map<std::string, ServerBatch> m_batches;
+
+	/* Keepalive, the round trips are read from other threads under m_mutex */
+	std::chrono::steady_clock::time_point m_lastReceived;
+	std::chrono::steady_clock::time_point m_lastSent;
+	std::chrono::steady_clock::time_point m_pingSent;
+	std::string m_pingToken;
+	unsigned m_pingCounter{0};
+	std::uint64_t m_bytes{0};
+	ServerLatency m_latency;
+
+	inline void enqueue(ServerLane lane, ServerCommand command)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (!m_queue.push(lane, std::move(command))) {
+				return;
+			}
+		}
+
+		onQueued();
+	}
+
+	void handleBatch(const IrcMessage &message);
+	void handleCap(const IrcMessage &message);
+	void handleConnect(const IrcMessage &message);
+	void handleInvite(const IrcMessage &message);
+	void handleJoin(const IrcMessage &message);
+	void handleKick(const IrcMessage &message);
+	void handleMessage(const IrcMessage &message);
+	void handleMode(const IrcMessage &message);
+	void handleNames(const IrcMessage &message);
+	void handleEndOfNames(const IrcMessage &message);
+	void handleNick(const IrcMessage &message);
+	void handleNicknameInUse(const IrcMessage &message);
+	void handleNotice(const IrcMessage &message);
+	void handlePart(const IrcMessage &message);
+	void handlePong(const IrcMessage &message);
+	void handlePrivmsg(const IrcMessage &message);
+	void handleSupport(const IrcMessage &message);
+	void handleTopic(const IrcMessage &message);
+	void flushBurst();
 
 	/*
-	 * Return a string even if s is nullptr.
+	 * Tells if the target is a channel according to the CHANTYPES announced by the server.
 	 */
-	inline std::string strify(const char *s)
+	inline bool isChannel(const IrcView &target) const noexcept
 	{
-		return (s == nullptr) ? "" : std::string(s);
+		return target.length > 0 && m_chantypes.find(target.data[0]) != std::string::npos;
 	}
 
 public:
@@ -444,14 +615,13 @@ public:
 	 * Request to disconnect. This function does not notify the
 	 * ServerService.
 	 *
+	 * The connection is closed by the Dead state on the next loop iteration so that the socket is
+	 * removed from the listener first.
+	 *
 	 * @see Irccd::serverDisconnect
-	 * @note Thread-safe
 	 */
 	inline void disconnect() noexcept
 	{
-		using namespace std::placeholders;
-
-		irc_disconnect(m_session.get());
 		next(ServerState::Type::Dead);
 	}
 
@@ -460,49 +630,241 @@ public:
 	 * ServerService.
 	 *
 	 * @see Irccd::serverReconnect
-	 * @note Thread-safe
 	 */
 	inline void reconnect() noexcept
 	{
-		irc_disconnect(m_session.get());
 		next(ServerState::Type::Connecting);
 	}
 
 	/**
 	 * Flush the pending commands if possible. This function will send
-	 * as much as possible commands.
+	 * as much commands as the rate limit allows, see ServerQueue. The
+	 * lines are written together with one system call.
 	 *
 	 * If the server is installed into the ServerManager, it is called
 	 * automatically.
 	 *
-	 * @note Thread-safe
+	 * @warning Not thread-safe, the lines are written from the calling thread
 	 */
 	void flush() noexcept;
 
 	/**
-	 * Prepare the IRC Session to the socket.
+	 * Flush the pending commands and run the current state, the server socket is registered,
+	 * updated or removed from the listener as needed.
 	 *
-	 * If the server is installed into the ServerManager, it is called
-	 * automatically.
+	 * If the server is installed into Irccd, it is called automatically.
 	 *
+	 * @param listener the event loop listener
 	 * @warning Not thread-safe
 	 */
-	inline void prepare(fd_set &setinput, fd_set &setoutput, int &maxfd) noexcept
+	void prepare(SocketListener &listener) noexcept;
+
+	/**
+	 * Get the number of milliseconds before the server must be prepared again even if its socket is idle.
+	 *
+	 * @return the timeout or -1 if there is no deadline
+	 */
+	inline int timeout() noexcept
+	{
+		/* A pending state switch must be applied on the next iteration */
+		if (m_next.type() != ServerState::Undefined) {
+			return 0;
+		}
+
+		int result = m_state.timeout(*this);
+
+		/* Commands held back by the rate limit */
+		if (m_state.type() == ServerState::Connected) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			int queue = m_queue.timeout();
+
+			if (queue >= 0 && (result < 0 || queue < result)) {
+				result = queue;
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * Get the outgoing queue metrics.
+	 *
+	 * @return the metrics
+	 * @note Thread-safe
+	 */
+	inline ServerQueueStats queueStats() const noexcept
 	{
-		m_state.prepare(*this, setinput, setoutput, maxfd);
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_queue.stats();
 	}
 
 	/**
-	 * Process incoming/outgoing data after selection.
+	 * Get the round trip times of the PING probes.
 	 *
-	 * If the server is installed into the ServerManager, it is called
-	 * automatically.
+	 * @return the histogram
+	 * @note Thread-safe
+	 */
+	inline ServerLatency latency() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_latency;
+	}
+
+	/**
+	 * Send a PING probe if the interval has elapsed since the previous one.
+	 *
+	 * @warning Do not use this function, it is only required for ServerState's
+	 */
+	void keepalive();
+
+	/**
+	 * Tell if nothing has been received for longer than the ping timeout, the connection is probably dead even
+	 * if the socket is still open.
+	 *
+	 * @return true if stale
+	 */
+	bool stale() const noexcept;
+
+	/**
+	 * Get the number of milliseconds before the next probe or the stale deadline.
+	 *
+	 * @return the timeout or -1 if the keepalive is disabled
+	 */
+	int keepaliveTimeout() const noexcept;
+
+	/**
+	 * Set the resolver used when connecting, without resolver the host name is resolved synchronously.
+	 *
+	 * @param resolver the resolver (may be null)
+	 * @warning The resolver must outlive the server
+	 */
+	inline void setResolver(Resolver *resolver) noexcept
+	{
+		m_resolver = resolver;
+	}
+
+	/**
+	 * Get the resolver.
+	 *
+	 * @return the resolver or null
+	 */
+	inline Resolver *resolver() const noexcept
+	{
+		return m_resolver;
+	}
+
+	/**
+	 * Set the scheduler that limits the concurrent connection attempts, without scheduler the server connects
+	 * immediately.
+	 *
+	 * @param scheduler the scheduler (may be null)
+	 * @warning The scheduler must outlive the server
+	 */
+	inline void setScheduler(ConnectScheduler *scheduler) noexcept
+	{
+		m_scheduler = scheduler;
+	}
+
+	/**
+	 * Get the scheduler.
+	 *
+	 * @return the scheduler or null
+	 */
+	inline ConnectScheduler *scheduler() const noexcept
+	{
+		return m_scheduler;
+	}
+
+	/**
+	 * Get the number of consecutive disconnections since the last successful connection, used for the
+	 * reconnection delay.
+	 *
+	 * @return the number of failures
+	 */
+	inline unsigned failures() const noexcept
+	{
+		return m_failures;
+	}
+
+	/**
+	 * Set the number of consecutive disconnections, called by the Disconnected state.
+	 *
+	 * @param failures the number of failures
+	 */
+	inline void setFailures(unsigned failures) noexcept
+	{
+		m_failures = failures;
+	}
+
+	/**
+	 * Get the time spent resolving the host name for the last connection attempt.
+	 *
+	 * @return the latency, 0 if never resolved
+	 * @note Thread-safe
+	 */
+	inline std::chrono::microseconds resolveTime() const noexcept
+	{
+		return std::chrono::microseconds(m_resolveTime.load(std::memory_order_relaxed));
+	}
+
+	/**
+	 * Set the time spent resolving the host name, called by the Connecting state.
+	 *
+	 * @param latency the latency
+	 */
+	inline void setResolveTime(std::chrono::microseconds latency) noexcept
+	{
+		m_resolveTime.store(latency.count(), std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get the output metrics of the connection, including the number of write system calls per line.
 	 *
-	 * @param setinput
-	 * @param setoutput
-	 * @throw any exception that have been throw from user functions
+	 * @return the metrics
+	 * @note Thread-safe
+	 */
+	inline IrcConnectionStats connectionStats() const noexcept
+	{
+		return m_connection.stats();
+	}
+
+	/**
+	 * Process incoming/outgoing data when the socket is ready.
+	 *
+	 * If the server is installed into Irccd, it is called automatically.
+	 *
+	 * @param flags the ready directions (SocketListener::Read, SocketListener::Write)
+	 */
+	void sync(int flags) noexcept;
+
+	/**
+	 * Register the connection socket into the listener with the directions it currently needs.
+	 *
+	 * @param listener the listener
+	 * @warning Do not use this function, it is only required for ServerState's
+	 */
+	void watch(SocketListener &listener) noexcept;
+
+	/**
+	 * Remove the connection socket from the listener. Must be called before the connection
+	 * closes it.
+	 *
+	 * @param listener the listener
+	 * @warning Do not use this function, it is only required for ServerState's
+	 */
+	void unwatch(SocketListener &listener) noexcept;
+
+	/**
+	 * Get the socket currently registered for that server, it may be invalid.
+	 *
+	 * @return the socket
 	 */
-	void sync(fd_set &setinput, fd_set &setoutput) noexcept;
+	inline SocketAbstract &socket() noexcept
+	{
+		return m_socket;
+	}
 
 	/**
 	 * Get the server information.
@@ -579,14 +941,66 @@ public:
 	}
 
 	/**
-	 * Get the libircclient session.
+	 * Get the current state. Should not be used by user code.
+	 *
+	 * @return the state
+	 * @warning Not thread-safe
+	 */
+	inline const ServerState &state() const noexcept
+	{
+		return m_state;
+	}
+
+	/**
+	 * Get a snapshot of the state as of the last prepare().
+	 *
+	 * @return the status
+	 * @note Thread-safe
+	 */
+	inline ServerStatus status() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_status;
+	}
+
+	/**
+	 * Get the names of the channels we are currently in.
+	 *
+	 * @return the channels
+	 * @note Thread-safe
+	 */
+	inline std::vector<std::string> channels() const
+	{
+		std::lock_guard<std::mutex> lock(m_trackerMutex);
+
+		return m_tracker.channels();
+	}
+
+	/**
+	 * Get a snapshot of a channel we are in, with its topic and its users.
+	 *
+	 * @param name the channel
+	 * @return the snapshot
+	 * @throw std::out_of_range if we are not in that channel
+	 * @note Thread-safe
+	 */
+	inline ServerChannelInfo channel(const std::string &name) const
+	{
+		std::lock_guard<std::mutex> lock(m_trackerMutex);
+
+		return m_tracker.channel(name);
+	}
+
+	/**
+	 * Get the IRC connection.
 	 *
 	 * @warning Do not use this function, it is only required for ServerState's
-	 * @return the session
+	 * @return the connection
 	 */
-	inline irc_session_t *session() noexcept
+	inline IrcConnection &connection() noexcept
 	{
-		return m_session.get();
+		return m_connection;
 	}
 
 	/**
@@ -598,8 +1012,8 @@ public:
 	 */
 	inline void cnotice(std::string channel, std::string message) noexcept
 	{
-		m_queue.push([=] () {
-			return irc_cmd_notice(this->m_session.get(), channel.c_str(), message.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("NOTICE " + channel + " :" + message);
 		});
 	}
 
@@ -612,8 +1026,8 @@ public:
 	 */
 	inline void invite(std::string target, std::string channel) noexcept
 	{
-		m_queue.push([=] () {
-			return irc_cmd_invite(this->m_session.get(), target.c_str(), channel.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("INVITE " + target + " " + channel);
 		});
 	}
 
@@ -626,10 +1040,8 @@ public:
 	 */
 	inline void join(std::string channel, std::string password = "") noexcept
 	{
-		m_queue.push([=] () {
-			const char *ptr = password.empty() ? nullptr : password.c_str();
-
-			return irc_cmd_join(this->m_session.get(), channel.c_str(), ptr) == 0;
+		enqueue(ServerLane::Control, [=] () {
+			return m_connection.send(password.empty() ? "JOIN " + channel : "JOIN " + channel + " " + password);
 		});
 	}
 
@@ -644,8 +1056,8 @@ public:
 	 */
 	inline void kick(std::string target, std::string channel, std::string reason = "") noexcept
 	{
-		m_queue.push([=] () {
-			return irc_cmd_kick(this->m_session.get(), target.c_str(), channel.c_str(), reason.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("KICK " + channel + " " + target + " :" + reason);
 		});
 	}
 
@@ -659,8 +1071,8 @@ public:
 	 */
 	inline void me(std::string target, std::string message)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_me(m_session.get(), target.c_str(), message.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("PRIVMSG " + target + " :\001ACTION " + message + "\001");
 		});
 	}
 
@@ -673,8 +1085,8 @@ public:
 	 */
 	inline void message(std::string target, std::string message)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_msg(m_session.get(), target.c_str(), message.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("PRIVMSG " + target + " :" + message);
 		});
 	}
 
@@ -687,8 +1099,8 @@ public:
 	 */
 	inline void mode(std::string channel, std::string mode)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_channel_mode(m_session.get(), channel.c_str(), mode.c_str()) == 0;
+		enqueue(ServerLane::Control, [=] () {
+			return m_connection.send("MODE " + channel + " " + mode);
 		});
 	}
 
@@ -700,8 +1112,8 @@ public:
 	 */
 	inline void names(std::string channel)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_names(m_session.get(), channel.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("NAMES " + channel);
 		});
 	}
 
@@ -713,8 +1125,8 @@ public:
 	 */
 	inline void nick(std::string newnick)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_nick(m_session.get(), newnick.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("NICK " + newnick);
 		});
 	}
 
@@ -727,8 +1139,8 @@ public:
 	 */
 	inline void notice(std::string target, std::string message)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_notice(m_session.get(), target.c_str(), message.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("NOTICE " + target + " :" + message);
 		});
 	}
 
@@ -742,10 +1154,10 @@ public:
 	 * @param reason the optional reason
 	 * @note Thread-safe
 	 */
-	inline void part(std::string channel, std::string /*reason = ""*/)
+	inline void part(std::string channel, std::string reason = "")
 	{
-		m_queue.push([=] () {
-			return irc_cmd_part(m_session.get(), channel.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send(reason.empty() ? "PART " + channel : "PART " + channel + " :" + reason);
 		});
 	}
 
@@ -759,8 +1171,8 @@ public:
 	 */
 	inline void send(std::string raw)
 	{
-		m_queue.push([=] () {
-			return irc_send_raw(m_session.get(), raw.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send(raw);
 		});
 	}
 
@@ -773,8 +1185,8 @@ public:
 	 */
 	inline void topic(std::string channel, std::string topic)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_topic(m_session.get(), channel.c_str(), topic.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("TOPIC " + channel + " :" + topic);
 		});
 	}
 
@@ -786,8 +1198,8 @@ public:
 	 */
 	inline void umode(std::string mode)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_user_mode(m_session.get(), mode.c_str()) == 0;
+		enqueue(ServerLane::Control, [=] () {
+			return m_connection.send("MODE " + m_identity.nickname + " " + mode);
 		});
 	}
 
@@ -799,8 +1211,8 @@ public:
 	 */
 	inline void whois(std::string target)
 	{
-		m_queue.push([=] () {
-			return irc_cmd_whois(this->m_session.get(), target.c_str()) == 0;
+		enqueue(ServerLane::Message, [=] () {
+			return m_connection.send("WHOIS " + target);
 		});
 	}
 };
@@ -0,0 +1,281 @@
+/*
+ * ServerEvent.cpp -- typed IRC events dispatched to plugins and transports
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <Json.h>
+
+#include "MsgPack.h"
+#include "Server.h"
+#include "ServerEvent.h"
+
+namespace irccd {
+
+namespace {
+
+/*
+ * Names of the events and of the JSON keys for each field, nullptr when the field is not used. Indexed by
+ * ServerEventType.
+ */
+struct Description {
+	const char *name;
+	const char *command;
+	const char *channel;
+	const char *message;
+	const char *extra;
+};
+
+const Description descriptions[] = {
+	{ "onChannelNotice",	nullptr,		"channel",	"notice",	nullptr		},
+	{ "onConnect",		nullptr,		nullptr,	nullptr,	nullptr		},
+	{ "onInvite",		nullptr,		"channel",	"target",	nullptr		},
+	{ "onJoin",		nullptr,		"channel",	nullptr,	nullptr		},
+	{ "onJoinBatch",	nullptr,		nullptr,	"joins",	nullptr		},
+	{ "onKick",		nullptr,		"channel",	"target",	"reason"	},
+	{ "onMessage",		"onCommand",		"channel",	"message",	nullptr		},
+	{ "onMe",		nullptr,		"target",	"message",	nullptr		},
+	{ "onMode",		nullptr,		"channel",	"mode",		"argument"	},
+	{ "onNames",		nullptr,		"channel",	"names",	nullptr		},
+	{ "onNick",		nullptr,		nullptr,	"nickname",	nullptr		},
+	{ "onNotice",		nullptr,		nullptr,	"notice",	nullptr		},
+	{ "onPart",		nullptr,		"channel",	"reason",	nullptr		},
+	{ "onPartBatch",	nullptr,		nullptr,	"parts",	nullptr		},
+	{ "onQuery",		"onQueryCommand",	nullptr,	"message",	nullptr		},
+	{ "onTopic",		nullptr,		"channel",	"topic",	nullptr		},
+	{ "onUserMode",		nullptr,		nullptr,	"mode",		nullptr		}
+};
+
+static_assert(sizeof (descriptions) / sizeof (descriptions[0]) == static_cast<int>(ServerEventType::UserMode) + 1,
+	"missing event description");
+
+inline const Description &describe(ServerEventType type) noexcept
+{
+	return descriptions[static_cast<int>(type)];
+}
+
+void append(std::ostringstream &json, const char *key, const ArenaString &value)
+{
+	if (key != nullptr) {
+		json << ",\"" << key << "\":\"" << JsonValue::escape(value.str()) << "\"";
+	}
+}
+
+void append(MsgPackWriter &writer, const char *key, const ArenaString &value)
+{
+	if (key != nullptr) {
+		writer.string(key, std::strlen(key));
+		writer.string(value.data, value.length);
+	}
+}
+
+} // !namespace
+
+ServerEvent *ServerEvent::create(Arena &arena, ServerEventType type, Server *server, const std::vector<ServerBatchEntry> &batch)
+{
+	std::string channel;
+
+	/* The rules can still match the channel when the batch is for one channel only */
+	if (!batch.empty() && std::all_of(batch.begin(), batch.end(), [&] (const ServerBatchEntry &entry) {
+		return entry.channel == batch.front().channel;
+	})) {
+		channel = batch.front().channel;
+	}
+
+	ServerEvent *event = create(arena, type, server, "", channel);
+
+	event->entries = arena.array<ServerEventEntry>(batch.size());
+
+	for (std::size_t i = 0; i < batch.size(); ++i) {
+		event->entries[i].origin = arena.copy(batch[i].origin);
+		event->entries[i].channel = arena.copy(batch[i].channel);
+		event->entries[i].reason = arena.copy(type == ServerEventType::PartBatch ? batch[i].reason : "");
+	}
+
+	return event;
+}
+
+const char *ServerEvent::name(bool command) const noexcept
+{
+	const Description &desc = describe(type);
+
+	return (command && desc.command != nullptr) ? desc.command : desc.name;
+}
+
+const char *ServerEvent::typeName(ServerEventType type) noexcept
+{
+	return describe(type).name;
+}
+
+void ServerEvent::parseCommand(Arena &arena, const std::string &prefix)
+{
+	if (prefix.empty() || message.length < prefix.length() || prefix.compare(0, prefix.length(), message.data, prefix.length()) != 0) {
+		return;
+	}
+
+	/*
+	 * The command is the whole first word so that `!foo123' does not trigger foo, if there is no space the
+	 * arguments are empty.
+	 */
+	const char *begin = message.data + prefix.length();
+	const char *end = message.data + message.length;
+	const char *space = std::find_if(begin, end, [] (char c) {
+		return c == ' ' || c == '\t';
+	});
+
+	if (space == begin) {
+		return;
+	}
+
+	plugin = arena.copy(begin, space - begin);
+
+	if (space != end) {
+		command.data = space + 1;
+		command.length = end - space - 1;
+	}
+}
+
+std::string ServerEvent::json() const
+{
+	const Description &desc = describe(type);
+	std::ostringstream json;
+
+	json << "{"
+	     << "\"event\":\"" << desc.name << "\","
+	     << "\"server\":\"" << JsonValue::escape(server->info().name) << "\"";
+
+	if (type != ServerEventType::Connect && !isBatch()) {
+		append(json, "origin", origin);
+	}
+
+	append(json, desc.channel, channel);
+
+	if (isBatch()) {
+		json << ",\"" << desc.message << "\":[";
+
+		for (std::size_t i = 0; i < entries.length; ++i) {
+			json << (i > 0 ? "," : "") << "{"
+			     << "\"origin\":\"" << JsonValue::escape(entries[i].origin.str()) << "\","
+			     << "\"channel\":\"" << JsonValue::escape(entries[i].channel.str()) << "\"";
+
+			if (type == ServerEventType::PartBatch) {
+				json << ",\"reason\":\"" << JsonValue::escape(entries[i].reason.str()) << "\"";
+			}
+
+			json << "}";
+		}
+
+		json << "]";
+	} else {
+		append(json, desc.message, message);
+	}
+
+	append(json, desc.extra, extra);
+
+	json << "}";
+
+	return json.str();
+}
+
+std::string ServerEvent::msgpack() const
+{
+	const Description &desc = describe(type);
+	const bool hasOrigin = type != ServerEventType::Connect && !isBatch();
+	MsgPackWriter writer;
+
+	/* Same fields as json() */
+	writer.map(2 + hasOrigin + (desc.channel != nullptr) + (desc.message != nullptr) + (desc.extra != nullptr));
+	writer.string("event", 5);
+	writer.string(desc.name, std::strlen(desc.name));
+	writer.string("server", 6);
+	writer.string(server->info().name);
+
+	if (hasOrigin) {
+		append(writer, "origin", origin);
+	}
+
+	append(writer, desc.channel, channel);
+
+	if (isBatch()) {
+		writer.string(desc.message, std::strlen(desc.message));
+		writer.array(entries.length);
+
+		for (const ServerEventEntry &entry : entries) {
+			writer.map(type == ServerEventType::PartBatch ? 3 : 2);
+			writer.string("origin", 6);
+			writer.string(entry.origin.data, entry.origin.length);
+			writer.string("channel", 7);
+			writer.string(entry.channel.data, entry.channel.length);
+
+			if (type == ServerEventType::PartBatch) {
+				writer.string("reason", 6);
+				writer.string(entry.reason.data, entry.reason.length);
+			}
+		}
+	} else {
+		append(writer, desc.message, message);
+	}
+
+	append(writer, desc.extra, extra);
+
+	return writer.data();
+}
+
+ServerEventCopy::ServerEventCopy(const ServerEvent &event)
+	: m_server(event.server->shared_from_this())
+	, m_event(event)
+{
+	const auto strings = { &m_event.origin, &m_event.channel, &m_event.message, &m_event.extra, &m_event.plugin, &m_event.command };
+	const std::size_t count = event.entries.length;
+	std::size_t total = sizeof (ServerEventEntry) * count;
+
+	for (ArenaString *string : strings) {
+		total += string->length + 1;
+	}
+	for (const ServerEventEntry &entry : event.entries) {
+		total += entry.origin.length + entry.channel.length + entry.reason.length + 3;
+	}
+
+	/* The entries go first, the buffer is suitably aligned for them */
+	m_buffer.reset(new char[total]);
+	m_event.entries.data = reinterpret_cast<ServerEventEntry *>(m_buffer.get());
+
+	for (std::size_t i = 0; i < count; ++i) {
+		new (&m_event.entries[i]) ServerEventEntry(event.entries[i]);
+	}
+
+	char *data = m_buffer.get() + sizeof (ServerEventEntry) * count;
+
+	auto relocate = [&] (ArenaString &string) {
+		std::memcpy(data, string.data, string.length + 1);
+		string.data = data;
+		data += string.length + 1;
+	};
+
+	for (ArenaString *string : strings) {
+		relocate(*string);
+	}
+	for (ServerEventEntry &entry : m_event.entries) {
+		relocate(entry.origin);
+		relocate(entry.channel);
+		relocate(entry.reason);
+	}
+}
+
+} // !irccd
@@ -0,0 +1,239 @@
+/*
+ * ServerEvent.h -- typed IRC events dispatched to plugins and transports
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_SERVER_EVENT_H_
+#define _IRCCD_SERVER_EVENT_H_
+
+/**
+ * @file ServerEvent.h
+ * @brief Typed IRC events dispatched to plugins and transports
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+
+namespace irccd {
+
+class Server;
+class ServerBatchEntry;
+
+/**
+ * @enum ServerEventType
+ * @brief Kind of IRC event, it tells which fields of ServerEvent are used
+ */
+enum class ServerEventType {
+	ChannelNotice,		//!< origin, channel, message (notice)
+	Connect,		//!< nothing
+	Invite,			//!< origin, channel, message (target)
+	Join,			//!< origin, channel
+	JoinBatch,		//!< channel (if they all have the same), entries
+	Kick,			//!< origin, channel, message (target), extra (reason)
+	Message,		//!< origin, channel, message, may be a command
+	Me,			//!< origin, channel (target), message
+	Mode,			//!< origin, channel, message (mode), extra (argument)
+	Names,			//!< channel, message (nicknames separated by spaces)
+	Nick,			//!< origin, message (nickname)
+	Notice,			//!< origin, message (notice)
+	Part,			//!< origin, channel, message (reason)
+	PartBatch,		//!< channel (if they all have the same), entries
+	Query,			//!< origin, message, may be a command
+	Topic,			//!< origin, channel, message (topic)
+	UserMode		//!< origin, message (mode)
+};
+
+/**
+ * @class ServerEventEntry
+ * @brief One JOIN or PART of a batch event, stored in the arena
+ */
+class ServerEventEntry {
+public:
+	ArenaString origin;		//!< who joined or left
+	ArenaString channel;		//!< the channel
+	ArenaString reason;		//!< the part reason, always empty for a join
+};
+
+/**
+ * @class ServerEvent
+ * @brief Structure that owns several informations about an IRC event
+ *
+ * This structure is used to dispatch the IRC event to the plugins and the transports. It is allocated in the event
+ * loop arena along with its strings and is only valid until the end of Irccd::dispatch.
+ *
+ * The JSON representation is only generated when at least one transport client is connected, it is then built
+ * once and shared by all clients.
+ */
+class ServerEvent {
+public:
+	ServerEventType type;		//!< the kind of event
+	Server *server;			//!< the server, it outlives the event
+	ArenaString origin;		//!< the originator
+	ArenaString channel;		//!< the channel or target, used by the rules
+	ArenaString message;		//!< the main argument, see ServerEventType
+	ArenaString extra;		//!< the second argument, see ServerEventType
+	ArenaString plugin;		//!< the plugin named by a command (e.g. !foo), empty otherwise
+	ArenaString command;		//!< the message without the command prefix
+	ArenaArray<ServerEventEntry> entries;	//!< the joins or parts of a batch, empty otherwise
+
+	/**
+	 * Create an event in the arena.
+	 *
+	 * @param arena the arena
+	 * @param type the type
+	 * @param server the server
+	 * @param origin the originator
+	 * @param channel the channel or target
+	 * @param message the main argument
+	 * @param extra the second argument
+	 * @return the event, valid until the arena is reset
+	 * @throw std::bad_alloc on failures
+	 */
+	static inline ServerEvent *create(Arena &arena,
+					  ServerEventType type,
+					  Server *server,
+					  const std::string &origin = "",
+					  const std::string &channel = "",
+					  const std::string &message = "",
+					  const std::string &extra = "")
+	{
+		ServerEvent *event = arena.make<ServerEvent>();
+
+		event->type = type;
+		event->server = server;
+		event->origin = arena.copy(origin);
+		event->channel = arena.copy(channel);
+		event->message = arena.copy(message);
+		event->extra = arena.copy(extra);
+
+		return event;
+	}
+
+	/**
+	 * Create a JoinBatch or PartBatch event in the arena.
+	 *
+	 * @param arena the arena
+	 * @param type JoinBatch or PartBatch
+	 * @param server the server
+	 * @param batch the entries
+	 * @return the event, valid until the arena is reset
+	 * @throw std::bad_alloc on failures
+	 */
+	static ServerEvent *create(Arena &arena, ServerEventType type, Server *server, const std::vector<ServerBatchEntry> &batch);
+
+	/**
+	 * Tells if the event is a JoinBatch or PartBatch.
+	 *
+	 * @return true if batch
+	 */
+	inline bool isBatch() const noexcept
+	{
+		return type == ServerEventType::JoinBatch || type == ServerEventType::PartBatch;
+	}
+
+	/**
+	 * Detect if a message or a query is a plugin command such as `!foo arguments'.
+	 *
+	 * The message is only parsed once, the plugin field then contains the word that follows the command prefix (foo)
+	 * and the command field the remaining arguments. Only the plugin with that name receives the command, the
+	 * others receive the plain message.
+	 *
+	 * @param arena the arena
+	 * @param prefix the server command prefix
+	 * @throw std::bad_alloc on failures
+	 */
+	void parseCommand(Arena &arena, const std::string &prefix);
+
+	/**
+	 * Check if the event is a command for the given plugin.
+	 *
+	 * @param name the plugin name
+	 * @return true if it is
+	 */
+	inline bool isCommandFor(const std::string &name) const noexcept
+	{
+		return plugin.length > 0 && name.length() == plugin.length && name.compare(0, plugin.length, plugin.data) == 0;
+	}
+
+	/**
+	 * Get the event name as used by the plugins and the rules.
+	 *
+	 * @param command true if the message was detected as a plugin command
+	 * @return the name (e.g. onMessage)
+	 */
+	const char *name(bool command = false) const noexcept;
+
+	/**
+	 * Get the name of a kind of event, as used in the JSON representation.
+	 *
+	 * @param type the type
+	 * @return the name (e.g. onMessage)
+	 */
+	static const char *typeName(ServerEventType type) noexcept;
+
+	/**
+	 * Build the JSON representation for the transports.
+	 *
+	 * @return the JSON object
+	 */
+	std::string json() const;
+
+	/**
+	 * Build the MessagePack representation for the transports, a map with the same keys as the JSON object.
+	 *
+	 * @return the encoded map
+	 */
+	std::string msgpack() const;
+};
+
+/**
+ * @class ServerEventCopy
+ * @brief Heap copy of a ServerEvent that outlives the arena
+ *
+ * Plugins running in a PluginWorker execute the event after the arena has been reset, the event is then copied
+ * once into a single buffer shared by all the workers that need it.
+ */
+class ServerEventCopy {
+private:
+	std::shared_ptr<Server> m_server;
+	std::unique_ptr<char[]> m_buffer;
+	ServerEvent m_event;
+
+public:
+	/**
+	 * Copy the event, its entries and its strings.
+	 *
+	 * @param event the event
+	 */
+	explicit ServerEventCopy(const ServerEvent &event);
+
+	/**
+	 * Get the copied event.
+	 *
+	 * @return the event
+	 */
+	inline const ServerEvent &event() const noexcept
+	{
+		return m_event;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_SERVER_EVENT_H_
@@ -0,0 +1,75 @@
+/*
+ * ServerLatency.cpp -- round trip time histogram of a server
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "ServerLatency.h"
+
+namespace irccd {
+
+using namespace std::chrono;
+
+milliseconds ServerLatency::bound(std::size_t index) noexcept
+{
+	if (index + 1 >= Buckets) {
+		return milliseconds::max();
+	}
+
+	return milliseconds(1LL << index);
+}
+
+void ServerLatency::record(milliseconds rtt) noexcept
+{
+	rtt = std::max(rtt, milliseconds(0));
+
+	std::size_t index = 0;
+
+	while (index + 1 < Buckets && rtt >= bound(index)) {
+		++ index;
+	}
+
+	m_buckets[index] ++;
+	m_min = (m_count == 0) ? rtt : std::min(m_min, rtt);
+	m_max = std::max(m_max, rtt);
+	m_last = rtt;
+	m_total += rtt;
+	m_count ++;
+}
+
+milliseconds ServerLatency::percentile(unsigned percent) const noexcept
+{
+	if (m_count == 0) {
+		return milliseconds(0);
+	}
+
+	/* Rank of the sample, rounded up so that the 100th percentile is the last one */
+	std::uint64_t rank = (m_count * std::min(percent, 100U) + 99) / 100;
+	std::uint64_t seen = 0;
+
+	for (std::size_t i = 0; i < Buckets; ++i) {
+		seen += m_buckets[i];
+
+		if (seen >= rank && seen > 0) {
+			return std::min(bound(i), m_max);
+		}
+	}
+
+	return m_max;
+}
+
+} // !irccd
@@ -0,0 +1,146 @@
+/*
+ * ServerLatency.h -- round trip time histogram of a server
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_SERVER_LATENCY_H_
+#define _IRCCD_SERVER_LATENCY_H_
+
+/**
+ * @file ServerLatency.h
+ * @brief Round trip time histogram of a server
+ */
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace irccd {
+
+/**
+ * @class ServerLatency
+ * @brief Round trip time histogram of a server
+ *
+ * The samples are the PING/PONG round trips measured by the server. They are counted in buckets whose bounds
+ * double each time (1 ms, 2 ms, 4 ms, ...), which is precise enough for lag while using a fixed amount of memory.
+ * The class is a plain value so that a copy can be taken as a snapshot.
+ */
+class ServerLatency {
+public:
+	/**
+	 * Number of buckets, the last one counts everything above 16 seconds.
+	 */
+	static constexpr std::size_t Buckets{16};
+
+private:
+	std::array<std::uint64_t, Buckets> m_buckets{};
+	std::uint64_t m_count{0};
+	std::chrono::milliseconds m_last{0};
+	std::chrono::milliseconds m_min{0};
+	std::chrono::milliseconds m_max{0};
+	std::chrono::milliseconds m_total{0};
+
+public:
+	/**
+	 * Get the upper bound (exclusive) of a bucket.
+	 *
+	 * @param index the bucket index
+	 * @return the bound, std::chrono::milliseconds::max() for the last bucket
+	 */
+	static std::chrono::milliseconds bound(std::size_t index) noexcept;
+
+	/**
+	 * Add a sample.
+	 *
+	 * @param rtt the round trip time
+	 */
+	void record(std::chrono::milliseconds rtt) noexcept;
+
+	/**
+	 * Get the number of samples.
+	 *
+	 * @return the count
+	 */
+	inline std::uint64_t count() const noexcept
+	{
+		return m_count;
+	}
+
+	/**
+	 * Get the number of samples in a bucket.
+	 *
+	 * @pre index < Buckets
+	 * @param index the bucket index
+	 * @return the count
+	 */
+	inline std::uint64_t bucket(std::size_t index) const noexcept
+	{
+		return m_buckets[index];
+	}
+
+	/**
+	 * Get the last sample, this is the current lag.
+	 *
+	 * @return the last round trip time, 0 if none
+	 */
+	inline std::chrono::milliseconds last() const noexcept
+	{
+		return m_last;
+	}
+
+	/**
+	 * Get the smallest sample.
+	 *
+	 * @return the minimum, 0 if none
+	 */
+	inline std::chrono::milliseconds min() const noexcept
+	{
+		return m_min;
+	}
+
+	/**
+	 * Get the largest sample.
+	 *
+	 * @return the maximum, 0 if none
+	 */
+	inline std::chrono::milliseconds max() const noexcept
+	{
+		return m_max;
+	}
+
+	/**
+	 * Get the average of the samples.
+	 *
+	 * @return the average, 0 if none
+	 */
+	inline std::chrono::milliseconds average() const noexcept
+	{
+		return (m_count == 0) ? std::chrono::milliseconds(0) : m_total / static_cast<std::chrono::milliseconds::rep>(m_count);
+	}
+
+	/**
+	 * Get an estimation of a percentile, the upper bound of the bucket that contains it.
+	 *
+	 * @param percent the percentile (e.g. 99)
+	 * @return the estimation capped to the maximum, 0 if there is no sample
+	 */
+	std::chrono::milliseconds percentile(unsigned percent) const noexcept;
+};
+
+} // !irccd
+
+#endif // !_IRCCD_SERVER_LATENCY_H_
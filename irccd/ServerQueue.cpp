@@ -0,0 +1,136 @@
+/*
+ * ServerQueue.cpp -- rate limited queue of outgoing IRC commands
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "ServerQueue.h"
+
+namespace irccd {
+
+using namespace std::chrono;
+
+ServerQueue::ServerQueue(std::size_t burst, unsigned delay, std::size_t capacity, ServerOverflow overflow) noexcept
+	: m_burst(burst)
+	, m_delay(milliseconds(std::max(delay, 1U)))
+	, m_capacity(capacity)
+	, m_overflow(overflow)
+	, m_tokens(burst)
+	, m_refilled(Clock::now())
+{
+}
+
+void ServerQueue::refill(Clock::time_point now) noexcept
+{
+	/* A full bucket earns nothing, the delay starts when a token is spent */
+	if (m_tokens >= m_burst) {
+		m_refilled = now;
+		return;
+	}
+
+	if (now < m_refilled) {
+		return;
+	}
+
+	auto earned = static_cast<std::size_t>((now - m_refilled) / m_delay);
+
+	if (m_tokens + earned >= m_burst) {
+		m_tokens = m_burst;
+		m_refilled = now;
+	} else {
+		/* Keep the remainder for the next token */
+		m_tokens += earned;
+		m_refilled += earned * m_delay;
+	}
+}
+
+bool ServerQueue::push(ServerLane lane, ServerCommand command, Clock::time_point now)
+{
+	auto &messages = m_lanes[static_cast<int>(ServerLane::Message)];
+
+	if (m_capacity > 0 && size() >= m_capacity) {
+		/*
+		 * With DropOldest, the oldest message makes room. If there are only control commands, a new message is
+		 * discarded instead while a new control command replaces the oldest one.
+		 */
+		if (m_overflow == ServerOverflow::DropNew || (messages.empty() && lane == ServerLane::Message)) {
+			m_stats.dropped ++;
+
+			return false;
+		}
+
+		auto &victim = messages.empty() ? m_lanes[static_cast<int>(ServerLane::Control)] : messages;
+
+		victim.pop_front();
+		m_stats.dropped ++;
+	}
+
+	m_lanes[static_cast<int>(lane)].push_back(Entry{std::move(command), now});
+	m_stats.highWater = std::max(m_stats.highWater, size());
+
+	return true;
+}
+
+void ServerQueue::flush(Clock::time_point now)
+{
+	refill(now);
+
+	for (auto &lane : m_lanes) {
+		while (!lane.empty()) {
+			if (m_burst > 0 && m_tokens == 0) {
+				return;
+			}
+
+			/* Break on the first failure to avoid changing the order of the commands */
+			if (!lane.front().command()) {
+				return;
+			}
+
+			auto wait = duration_cast<milliseconds>(now - lane.front().queued);
+
+			m_stats.sent ++;
+			m_stats.totalWait += wait;
+			m_stats.maxWait = std::max(m_stats.maxWait, wait);
+
+			if (m_burst > 0) {
+				m_tokens --;
+			}
+
+			lane.pop_front();
+		}
+	}
+}
+
+int ServerQueue::timeout(Clock::time_point now) noexcept
+{
+	if (size() == 0 || m_burst == 0) {
+		return -1;
+	}
+
+	refill(now);
+
+	if (m_tokens > 0) {
+		return -1;
+	}
+
+	/* Round up so that the token is really earned when the loop wakes up */
+	auto remaining = duration_cast<milliseconds>(m_refilled + m_delay - now + milliseconds(1) - nanoseconds(1));
+
+	return static_cast<int>(std::max<milliseconds::rep>(remaining.count(), 0));
+}
+
+} // !irccd
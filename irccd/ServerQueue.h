@@ -0,0 +1,186 @@
+/*
+ * ServerQueue.h -- rate limited queue of outgoing IRC commands
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_SERVER_QUEUE_H_
+#define _IRCCD_SERVER_QUEUE_H_
+
+/**
+ * @file ServerQueue.h
+ * @brief Rate limited queue of outgoing IRC commands
+ */
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+namespace irccd {
+
+/**
+ * Deferred command to send to the server.
+ *
+ * If the command returns true, it has been correctly buffered for outgoing
+ * and removed from the queue.
+ */
+using ServerCommand = std::function<bool ()>;
+
+/**
+ * @enum ServerLane
+ * @brief Priority of a command, lanes are served in that order
+ */
+enum class ServerLane {
+	Control,		//!< joins and mode changes
+	Message			//!< everything that must keep its order with the messages (privmsg, part, kick, ...)
+};
+
+/**
+ * @enum ServerOverflow
+ * @brief What to do when the queue is full
+ */
+enum class ServerOverflow {
+	DropNew,		//!< the new command is discarded
+	DropOldest		//!< the oldest message is discarded, control commands are kept if possible
+};
+
+/**
+ * @class ServerQueueStats
+ * @brief Metrics of a ServerQueue
+ */
+class ServerQueueStats {
+public:
+	std::size_t depth{0};				//!< number of pending commands
+	std::size_t highWater{0};			//!< maximum number of pending commands
+	std::size_t sent{0};				//!< number of commands sent
+	std::size_t dropped{0};				//!< number of commands discarded on overflow
+	std::chrono::milliseconds maxWait{0};		//!< longest time a command waited in the queue
+	std::chrono::milliseconds totalWait{0};		//!< sum of the waits of all sent commands
+};
+
+/**
+ * @class ServerQueue
+ * @brief Rate limited queue of outgoing IRC commands
+ *
+ * Commands are sent according to a token bucket: up to burst commands can be sent at once, then one token is
+ * given back every delay. This is the flood control of RFC 1459 (section 8.10), sending faster gets the client
+ * disconnected for excess flood.
+ *
+ * The control lane is always served before the message lane so that a long batch of messages does not delay a
+ * join or a mode change. Commands that depend on what was sent before them (a part after a goodbye message, a
+ * kick after a warning) must stay in the message lane.
+ *
+ * The queue is bounded, see ServerOverflow for the policy when it is full.
+ *
+ * This class is not thread-safe, Server protects it with its mutex.
+ */
+class ServerQueue {
+public:
+	/**
+	 * Clock used for the deadlines.
+	 */
+	using Clock = std::chrono::steady_clock;
+
+private:
+	struct Entry {
+		ServerCommand command;
+		Clock::time_point queued;
+	};
+
+	std::array<std::deque<Entry>, 2> m_lanes;
+	std::size_t m_burst;
+	Clock::duration m_delay;
+	std::size_t m_capacity;
+	ServerOverflow m_overflow;
+
+	/* Token bucket */
+	std::size_t m_tokens;
+	Clock::time_point m_refilled;
+
+	ServerQueueStats m_stats;
+
+	void refill(Clock::time_point now) noexcept;
+
+public:
+	/**
+	 * Create a queue.
+	 *
+	 * @param burst the number of commands that can be sent at once (0 to disable the rate limit)
+	 * @param delay the delay in milliseconds to earn one more command
+	 * @param capacity the maximum number of pending commands (0 for unbounded)
+	 * @param overflow the overflow policy
+	 */
+	ServerQueue(std::size_t burst = 5,
+		    unsigned delay = 2000,
+		    std::size_t capacity = 512,
+		    ServerOverflow overflow = ServerOverflow::DropOldest) noexcept;
+
+	/**
+	 * Queue a command.
+	 *
+	 * @param lane the priority lane
+	 * @param command the command
+	 * @param now the current time
+	 * @return false if the command was discarded because the queue is full
+	 */
+	bool push(ServerLane lane, ServerCommand command, Clock::time_point now = Clock::now());
+
+	/**
+	 * Send as many commands as allowed.
+	 *
+	 * It stops on the first command that fails so that the order is kept, it is retried on the next call.
+	 *
+	 * @param now the current time
+	 */
+	void flush(Clock::time_point now = Clock::now());
+
+	/**
+	 * Get the number of milliseconds before the rate limit allows the next command.
+	 *
+	 * @param now the current time
+	 * @return the timeout or -1 if the queue is empty or not limited (the commands then only wait for the socket)
+	 */
+	int timeout(Clock::time_point now = Clock::now()) noexcept;
+
+	/**
+	 * Get the number of pending commands.
+	 *
+	 * @return the number of commands
+	 */
+	inline std::size_t size() const noexcept
+	{
+		return m_lanes[0].size() + m_lanes[1].size();
+	}
+
+	/**
+	 * Get the metrics.
+	 *
+	 * @return the metrics
+	 */
+	inline ServerQueueStats stats() const noexcept
+	{
+		ServerQueueStats stats = m_stats;
+
+		stats.depth = size();
+
+		return stats;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_SERVER_QUEUE_H_
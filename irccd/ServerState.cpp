@@ -16,7 +16,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <random>
 
 #include <IrccdConfig.h>
 
@@ -32,120 +34,229 @@
 
 namespace irccd {
 
-bool ServerState::connect(Server &server)
+namespace {
+
+/*
+ * Delay before the next reconnection: recotimeout doubled for each consecutive failure up to recomaxtimeout,
+ * plus up to 50% of random so that the servers lost at the same time do not come back at the same time. The
+ * jitter only adds time, a retry never happens sooner than recotimeout.
+ */
+std::chrono::milliseconds backoff(const ServerSettings &settings, unsigned failures)
+{
+	static thread_local std::minstd_rand engine{std::random_device{}()};
+
+	std::chrono::milliseconds delay = std::chrono::seconds(std::max(settings.recotimeout, 0));
+	std::chrono::milliseconds cap = std::chrono::seconds(std::max(settings.recomaxtimeout, settings.recotimeout));
+
+	for (unsigned i = 0; i < failures && delay < cap; ++i) {
+		delay *= 2;
+	}
+
+	delay = std::min(delay, cap);
+
+	return delay + std::chrono::milliseconds(std::uniform_int_distribution<long long>(0, delay.count() / 2)(engine));
+}
+
+} // !namespace
+
+bool ServerState::expired(std::chrono::milliseconds delay) const noexcept
+{
+	return remaining(delay) == 0;
+}
+
+int ServerState::remaining(std::chrono::milliseconds delay) const noexcept
+{
+	auto elapsed = std::chrono::steady_clock::now() - m_since;
+
+	if (elapsed >= delay) {
+		return 0;
+	}
+
+	/* Round up so that the loop does not wake up just before the deadline */
+	return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(delay - elapsed).count()) + 1;
+}
+
+void ServerState::connect(Server &server, const ResolverResult &result, SocketListener &listener)
 {
 	const ServerInfo &info = server.info();
 	const ServerIdentity &identity = server.identity();
-	const char *password = info.password.empty() ? nullptr : info.password.c_str();
-	std::string host = info.host;
-	int code;
+	IrcConnection &connection = server.connection();
 
-	// libircclient requires # for SSL connection
-	if (info.ssl) {
-		host.insert(0, 1, '#');
+	server.setResolveTime(result.latency);
+
+	if (!result.error.empty()) {
+		Logger::warning() << "server " << info.name << ": could not resolve " << info.host << ": " << result.error << std::endl;
+		server.next(ServerState::Disconnected);
+		return;
 	}
 
-	if (info.ipv6) {
-		code = irc_connect6(server.session(), host.c_str(), info.port, password,
-				    identity.nickname.c_str(),
-				    identity.username.c_str(),
-				    identity.realname.c_str());
-	} else {
-		code = irc_connect(server.session(), host.c_str(), info.port, password,
-				   identity.nickname.c_str(),
-				   identity.username.c_str(),
-				   identity.realname.c_str());
+	Logger::debug() << "server " << info.name << ": " << info.host << " resolved to " << result.address.ip()
+			<< " in " << result.latency.count() / 1000 << " ms" << (result.cached ? " (cached)" : "") << std::endl;
+
+	try {
+		connection.connect(result.address, info.host, info.ssl, info.sslverify);
+		m_started = true;
+	} catch (const std::exception &ex) {
+		Logger::warning() << "server " << info.name << ": disconnected while connecting: " << ex.what() << std::endl;
+		server.next(ServerState::Disconnected);
+		return;
 	}
 
-	return code == 0;
+	/* Sent as soon as the connection is established, batch is used to group the netjoins */
+	connection.send("CAP REQ :batch");
+
+	if (!info.password.empty()) {
+		connection.send("PASS " + info.password);
+	}
+
+	connection.send("NICK " + identity.nickname);
+	connection.send("USER " + identity.username + " 0 * :" + identity.realname);
+
+	/* Wait for the connection to complete right now */
+	server.watch(listener);
 }
 
-void ServerState::prepareConnected(Server &server, fd_set &setinput, fd_set &setoutput, int &maxfd)
+void ServerState::prepareConnected(Server &server, SocketListener &listener)
 {
-	if (!irc_is_connected(server.session())) {
-		const ServerSettings &settings = server.settings();
+	if (server.connection().state() == IrcConnection::Disconnected) {
+		Logger::warning() << "server " << server.info().name << ": disconnected: " << server.connection().error() << std::endl;
 
-		Logger::warning() << "server " << server.info().name << ": disconnected" << std::endl;
-
-		if (settings.recotimeout > 0) {
-			Logger::warning() << "server " << server.info().name << ": retrying in "
-					  << settings.recotimeout << " seconds" << std::endl;
-		}
+		server.unwatch(listener);
+		server.next(ServerState::Disconnected);
+	} else if (server.stale()) {
+		/* The peer may be gone without a FIN, the kernel would only notice after minutes of retransmissions */
+		Logger::warning() << "server " << server.info().name << ": no data received for "
+				  << server.settings().pingtimeout << " seconds, reconnecting" << std::endl;
 
+		server.unwatch(listener);
 		server.next(ServerState::Disconnected);
 	} else {
-		irc_add_select_descriptors(server.session(), &setinput, &setoutput, &maxfd);
+		server.keepalive();
+		server.watch(listener);
 	}
 }
 
-void ServerState::prepareConnecting(Server &server, fd_set &setinput, fd_set &setoutput, int &maxfd)
+void ServerState::prepareConnecting(Server &server, SocketListener &listener)
 {
 	/*
-	 * The connect function will either fail if the hostname wasn't resolved
-	 * or if any of the internal functions fail.
+	 * The hostname is first resolved by the Resolver threads, the event
+	 * loop is woken up when the result is available.
 	 *
-	 * It returns success if the connection was successful but it does not
+	 * Then the connect function starts the connection but it does not
 	 * mean that connection is established.
 	 *
 	 * Because this function will be called repeatidly from the
 	 * ServerManager, if the connection was started and we're still not
 	 * connected in the specified timeout time, we mark the server
-	 * as disconnected.
+	 * as disconnected. The resolution counts in that timeout too.
+	 *
+	 * Before all of that, the server waits for a slot in the
+	 * ConnectScheduler if there are too many connections in progress,
+	 * the wait does not count in the timeout. The slot is given back
+	 * once the connection (and the TLS handshake) is established.
 	 *
-	 * Otherwise, the libircclient event_connect will change the state.
+	 * Otherwise, the welcome message (001) will change the state.
 	 */
 	const ServerInfo &info = server.info();
+	const std::chrono::seconds timeout(server.settings().recotimeout);
 
 	if (m_started) {
-		const ServerSettings &settings = server.settings();
-
-		if (m_timer.elapsed() > static_cast<unsigned>(settings.recotimeout * 1000)) {
+		if (expired(timeout)) {
 			Logger::warning() << "server " << info.name << ": timeout while connecting" << std::endl;
 			server.next(ServerState::Disconnected);
-		} else if (!irc_is_connected(server.session())) {
+		} else if (server.connection().state() == IrcConnection::Disconnected) {
 			Logger::warning() << "server " << info.name << ": error while connecting: "
-					  << irc_strerror(irc_errno(server.session())) << std::endl;
-
-			if (settings.recotimeout > 0) {
-				Logger::warning() << "server " << info.name << ": retrying in " << settings.recotimeout << " seconds" << std::endl;
+					  << server.connection().error() << std::endl;
+			server.next(ServerState::Disconnected);
+		} else {
+			if (server.connection().state() == IrcConnection::Connected) {
+				m_ticket.reset();
 			}
 
+			server.watch(listener);
+		}
+	} else if (m_query) {
+		if (m_query->ready()) {
+			connect(server, m_query->result(), listener);
+		} else if (expired(timeout)) {
+			Logger::warning() << "server " << info.name << ": timeout while resolving " << info.host << std::endl;
 			server.next(ServerState::Disconnected);
-		} else {
-			irc_add_select_descriptors(server.session(), &setinput, &setoutput, &maxfd);
 		}
 	} else {
+		ConnectScheduler *scheduler = server.scheduler();
+
+		if (scheduler) {
+			if (!m_ticket) {
+				m_ticket = std::make_unique<ConnectTicket>(*scheduler, info.name);
+
+				if (!m_ticket->acquire()) {
+					Logger::info() << "server " << info.name << ": waiting, " << scheduler->active().size()
+						       << " connections in progress" << std::endl;
+				}
+			}
+
+			if (!m_ticket->acquire()) {
+				return;
+			}
+
+			m_since = std::chrono::steady_clock::now();
+		}
+
+		Logger::info() << "server " << info.name << ": trying to connect to " << info.host << ", port " << info.port << std::endl;
+
 		/*
-		 * This is needed if irccd is started before DHCP or if
-		 * DNS cache is outdated.
-		 *
-		 * For more information see bug #190.
+		 * The previous descriptor, if any, must leave the listener before
+		 * the connection closes it because the number may be reused.
 		 */
+		server.unwatch(listener);
+		server.connection().disconnect();
+
+		Resolver *resolver = server.resolver();
+		int domain = info.ipv6 ? AF_INET6 : AF_INET;
+
+		if (resolver) {
+			m_query = resolver->resolve(info.host, info.port, domain);
+
+			/* Found in the cache */
+			if (m_query->ready()) {
+				connect(server, m_query->result(), listener);
+			}
+		} else {
+			/* Not managed by Irccd, resolve in place */
+			auto start = std::chrono::steady_clock::now();
+			ResolverResult result;
+
+			try {
 #if !defined(_WIN32)
-		(void)res_init();
+				(void)res_init();
 #endif
-		Logger::info() << "server " << info.name << ": trying to connect to " << info.host << ", port " << info.port << std::endl;
+				result.address = address::Ip(info.host, info.port, domain);
+			} catch (const SocketError &ex) {
+				result.error = ex.what();
+			}
 
-		if (!connect(server)) {
-			Logger::warning() << "server " << info.name << ": disconnected while connecting: "
-					  << irc_strerror(irc_errno(server.session())) << std::endl;
-			server.next(ServerState::Disconnected);
-		} else {
-			m_started = true;
+			result.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+			connect(server, result, listener);
 		}
 	}
 }
 
-void ServerState::prepareDead(Server &, fd_set &, fd_set &, int &)
+void ServerState::prepareDead(Server &server, SocketListener &listener)
 {
-	// nothing to do, the ServerManager will remove the server.
+	/* Nothing else to do, the server will never be polled again */
+	server.unwatch(listener);
+	server.connection().disconnect();
 }
 
-void ServerState::prepareDisconnected(Server &server, fd_set &, fd_set &, int &)
+void ServerState::prepareDisconnected(Server &server, SocketListener &listener)
 {
 	const ServerInfo &info = server.info();
 	ServerSettings &settings = server.settings();
 
+	/* Leave the listener before closing the descriptor, its number may be reused right after */
+	server.unwatch(listener);
+	server.connection().disconnect();
+
 	// if ServerSettings::recotries it set to -1, reconnection is completely disabled.
 	if (settings.recotries < 0) {
 		Logger::warning() << "server " << info.name << ": reconnection disabled, skipping" << std::endl;
@@ -154,15 +265,28 @@ void ServerState::prepareDisconnected(Server &server, fd_set &, fd_set &, int &)
 		Logger::warning() << "server " << info.name << ": giving up" << std::endl;
 		server.next(ServerState::Dead);
 	} else {
-		if (m_timer.elapsed() > static_cast<unsigned>(settings.recotimeout * 1000)) {
-			irc_disconnect(server.session());
+		if (m_delay.count() < 0) {
+			m_delay = backoff(settings, server.failures());
+			server.setFailures(server.failures() + 1);
 
+			if (m_delay.count() > 0) {
+				Logger::warning() << "server " << info.name << ": retrying in "
+						  << (m_delay.count() + 500) / 1000 << " seconds" << std::endl;
+			}
+		}
+
+		if (expired(m_delay)) {
 			settings.recocurrent ++;
 			server.next(ServerState::Connecting);
 		}
 	}
 }
 
+bool ServerState::waiting() const noexcept
+{
+	return m_type == Connecting && m_ticket && !m_ticket->active();
+}
+
 ServerState::ServerState(Type type)
 	: m_type(type)
 {
@@ -170,24 +294,57 @@ ServerState::ServerState(Type type)
 	assert(static_cast<int>(m_type) <= static_cast<int>(ServerState::Dead));
 }
 
-void ServerState::prepare(Server &server, fd_set &setinput, fd_set &setoutput, int &maxfd)
+void ServerState::prepare(Server &server, SocketListener &listener)
 {
 	switch (m_type) {
 	case Connecting:
-		prepareConnecting(server, setinput, setoutput, maxfd);
+		prepareConnecting(server, listener);
 		break;
 	case Connected:
-		prepareConnected(server, setinput, setoutput, maxfd);
+		prepareConnected(server, listener);
 		break;
 	case Disconnected:
-		prepareDisconnected(server, setinput, setoutput, maxfd);
+		prepareDisconnected(server, listener);
 		break;
 	case Dead:
-		prepareDead(server, setinput, setoutput, maxfd);
+		prepareDead(server, listener);
 		break;
 	default:
 		break;
 	}
 }
 
+int ServerState::timeout(const Server &server) const noexcept
+{
+	const ServerSettings &settings = server.settings();
+
+	switch (m_type) {
+	case Connecting:
+		/* Not yet started, prepare() must be called immediately unless we wait for the resolver */
+		if (m_started || (m_query && !m_query->ready())) {
+			return remaining(std::chrono::seconds(settings.recotimeout));
+		}
+
+		/* Waiting for a slot, try again as soon as one is free */
+		if (waiting()) {
+			return server.scheduler()->available() ? 0 : -1;
+		}
+
+		return 0;
+	case Disconnected:
+		/* Going to the Dead state immediately */
+		if (settings.recotries < 0 || (settings.recocurrent + 1) > settings.recotries || m_delay.count() < 0) {
+			return 0;
+		}
+
+		return remaining(m_delay);
+	case Connected:
+		/* Next PING probe or stale deadline */
+		return server.keepaliveTimeout();
+	default:
+		/* Dead only depends on the socket */
+		return -1;
+	}
+}
+
 } // !irccd
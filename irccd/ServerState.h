@@ -19,18 +19,18 @@
 #ifndef _IRCCD_SERVER_STATE_H_
 #define _IRCCD_SERVER_STATE_H_
 
-#include <ElapsedTimer.h>
+#include <chrono>
+#include <memory>
+
 #include <IrccdConfig.h>
+#include <SocketListener.h>
 
-#if defined(IRCCD_SYSTEM_WINDOWS)
-#  include <Winsock2.h>
-#else
-#  include <sys/types.h>
-#  include <sys/select.h>
-#endif
+#include "ConnectScheduler.h"
 
 namespace irccd {
 
+class ResolverQuery;
+class ResolverResult;
 class Server;
 
 /**
@@ -63,7 +63,8 @@ class Server;
  *
  * The server is not connected to the IRC server, it just try to resolve
  * the hostname and connect, it does not mean that the connection is
- * established.
+ * established. The hostname is resolved by the Resolver threads so that
+ * the event loop never waits for the DNS.
  *
  * The Connected state
  * -------------------
@@ -74,8 +75,10 @@ class Server;
  * ----------------------
  *
  * The server has been disconnected by a network failure or a server shutdown.
- * This state will track the elapsed time until the user specified time has
- * been elapsed to try a reconnection.
+ * This state will track the elapsed time until the reconnection delay has
+ * been elapsed to try a reconnection. The delay starts at the user specified
+ * time and doubles for each consecutive failure up to a maximum, plus a random
+ * part so that the servers do not all reconnect at the same time.
  *
  * If reconnection is completely disabled, this state switch immediately to
  * Dead. Otherwise, it will switch to connecting again.
@@ -105,26 +108,60 @@ private:
 
 	/* For ServerState::Connecting */
 	bool m_started{false};
-	ElapsedTimer m_timer;
+	std::unique_ptr<ConnectTicket> m_ticket;
+	std::shared_ptr<const ResolverQuery> m_query;
+
+	/* For ServerState::Disconnected, computed on the first prepare */
+	std::chrono::milliseconds m_delay{-1};
+
+	/* Creation time, used for the connect and reconnect delays */
+	std::chrono::steady_clock::time_point m_since{std::chrono::steady_clock::now()};
 
 	/* Private helpers */
-	bool connect(Server &server);
+	void connect(Server &server, const ResolverResult &result, SocketListener &listener);
+	bool expired(std::chrono::milliseconds delay) const noexcept;
+	int remaining(std::chrono::milliseconds delay) const noexcept;
 
 	/* Different preparation */
-	void prepareConnected(Server &, fd_set &setinput, fd_set &setoutput, int &maxfd);
-	void prepareConnecting(Server &, fd_set &setinput, fd_set &setoutput, int &maxfd);
-	void prepareDead(Server &, fd_set &setinput, fd_set &setoutput, int &maxfd);
-	void prepareDisconnected(Server &, fd_set &setinput, fd_set &setoutput, int &maxfd);
+	void prepareConnected(Server &, SocketListener &listener);
+	void prepareConnecting(Server &, SocketListener &listener);
+	void prepareDead(Server &, SocketListener &listener);
+	void prepareDisconnected(Server &, SocketListener &listener);
 
 public:
 	ServerState(Type type);
 
-	void prepare(Server &server, fd_set &setinput, fd_set &setoutput, int &maxfd);
+	/**
+	 * Run the state and update the server registration in the listener.
+	 *
+	 * The listener is persistent, the server socket is only added, modified or removed when its
+	 * interest changes.
+	 *
+	 * @param server the server
+	 * @param listener the event loop listener
+	 */
+	void prepare(Server &server, SocketListener &listener);
+
+	/**
+	 * Get the number of milliseconds before this state needs to be prepared again regardless of the socket
+	 * activity, this is used to compute the event loop timeout.
+	 *
+	 * @param server the server
+	 * @return the timeout or -1 if the state only depends on the socket
+	 */
+	int timeout(const Server &server) const noexcept;
 
 	inline Type type() const noexcept
 	{
 		return m_type;
 	}
+
+	/**
+	 * Tells if the server is waiting for a slot in the ConnectScheduler.
+	 *
+	 * @return true if waiting
+	 */
+	bool waiting() const noexcept;
 };
 
 } // !irccd
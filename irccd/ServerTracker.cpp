@@ -0,0 +1,622 @@
+/*
+ * ServerTracker.cpp -- channel membership tracking
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "ServerTracker.h"
+
+namespace irccd {
+
+namespace {
+
+inline char lower(char c, ServerTracker::CaseMapping casemapping) noexcept
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c + ('a' - 'A');
+	}
+	if (casemapping == ServerTracker::CaseMapping::Ascii) {
+		return c;
+	}
+
+	switch (c) {
+	case '[':
+		return '{';
+	case ']':
+		return '}';
+	case '\\':
+		return '|';
+	case '~':
+		return (casemapping == ServerTracker::CaseMapping::Rfc1459) ? '^' : c;
+	default:
+		return c;
+	}
+}
+
+/*
+ * Check if the ISUPPORT token starts with the given key (e.g. PREFIX=) and returns the value.
+ */
+bool support(const IrcView &token, const char *key, IrcView &value) noexcept
+{
+	std::size_t length = std::strlen(key);
+
+	if (token.length < length || std::memcmp(token.data, key, length) != 0) {
+		return false;
+	}
+
+	value = IrcView(token.data + length, token.length - length);
+
+	return true;
+}
+
+} // !namespace
+
+const std::string &ServerTracker::fold(const IrcView &name)
+{
+	m_key.resize(name.length);
+
+	for (std::size_t i = 0; i < name.length; ++i) {
+		m_key[i] = lower(name.data[i], m_casemapping);
+	}
+
+	return m_key;
+}
+
+std::string ServerTracker::fold(const std::string &name) const
+{
+	std::string key(name);
+
+	for (char &c : key) {
+		c = lower(c, m_casemapping);
+	}
+
+	return key;
+}
+
+std::uint32_t ServerTracker::acquire(const IrcView &nickname)
+{
+	auto it = m_nicknameIds.find(fold(nickname));
+
+	if (it != m_nicknameIds.end()) {
+		m_nicknames[it->second].refs ++;
+
+		return it->second;
+	}
+
+	std::uint32_t id;
+
+	if (m_free.empty()) {
+		id = static_cast<std::uint32_t>(m_nicknames.size());
+		m_nicknames.emplace_back();
+	} else {
+		id = m_free.back();
+		m_free.pop_back();
+	}
+
+	m_nicknames[id].name.assign(nickname.data, nickname.length);
+	m_nicknames[id].refs = 1;
+	m_nicknameIds.emplace(m_key, id);
+
+	return id;
+}
+
+void ServerTracker::release(std::uint32_t id)
+{
+	Nickname &nickname = m_nicknames[id];
+
+	if (-- nickname.refs > 0) {
+		return;
+	}
+
+	auto it = m_nicknameIds.find(fold(IrcView(nickname.name.c_str(), nickname.name.length())));
+
+	/* Two nicknames may share the key if the casemapping changed while both were tracked */
+	if (it != m_nicknameIds.end() && it->second == id) {
+		m_nicknameIds.erase(it);
+	}
+
+	m_free.push_back(id);
+	nickname.name.clear();
+}
+
+std::uint32_t ServerTracker::findNickname(const IrcView &nickname)
+{
+	auto it = m_nicknameIds.find(fold(nickname));
+
+	return (it == m_nicknameIds.end()) ? None : it->second;
+}
+
+ServerTracker::Channel *ServerTracker::findChannel(const IrcView &name)
+{
+	auto it = m_channelIds.find(fold(name));
+
+	return (it == m_channelIds.end()) ? nullptr : &m_channels[it->second];
+}
+
+std::size_t ServerTracker::findMember(const Channel &channel, std::uint32_t id) const noexcept
+{
+	if (channel.listing) {
+		return std::find(channel.members.begin(), channel.members.end(), id) - channel.members.begin();
+	}
+
+	auto it = std::lower_bound(channel.members.begin(), channel.members.end(), id);
+
+	if (it == channel.members.end() || *it != id) {
+		return channel.members.size();
+	}
+
+	return it - channel.members.begin();
+}
+
+void ServerTracker::addMember(Channel &channel, std::uint32_t id, std::uint8_t modes)
+{
+	/* Sorted once the list is complete */
+	if (channel.listing) {
+		channel.members.push_back(id);
+		channel.modes.push_back(modes);
+		return;
+	}
+
+	auto it = std::lower_bound(channel.members.begin(), channel.members.end(), id);
+	auto index = it - channel.members.begin();
+
+	if (it != channel.members.end() && *it == id) {
+		channel.modes[index] |= modes;
+		release(id);
+	} else {
+		channel.members.insert(it, id);
+		channel.modes.insert(channel.modes.begin() + index, modes);
+	}
+}
+
+void ServerTracker::refold()
+{
+	/* Our own nickname is interned on 001, before the CASEMAPPING token is received */
+	m_nicknameIds.clear();
+	m_channelIds.clear();
+
+	for (std::uint32_t id = 0; id < m_nicknames.size(); ++id) {
+		const Nickname &nickname = m_nicknames[id];
+
+		if (nickname.refs > 0) {
+			m_nicknameIds.emplace(fold(IrcView(nickname.name.c_str(), nickname.name.length())), id);
+		}
+	}
+
+	for (std::uint32_t index = 0; index < m_channels.size(); ++index) {
+		const Channel &channel = m_channels[index];
+
+		m_channelIds.emplace(fold(IrcView(channel.name.c_str(), channel.name.length())), index);
+	}
+}
+
+void ServerTracker::removeMember(Channel &channel, std::size_t index)
+{
+	release(channel.members[index]);
+	channel.members.erase(channel.members.begin() + index);
+	channel.modes.erase(channel.modes.begin() + index);
+}
+
+void ServerTracker::removeChannel(const IrcView &name)
+{
+	auto it = m_channelIds.find(fold(name));
+
+	if (it == m_channelIds.end()) {
+		return;
+	}
+
+	std::uint32_t index = it->second;
+
+	m_channelIds.erase(it);
+
+	for (std::uint32_t id : m_channels[index].members) {
+		release(id);
+	}
+
+	if (index != m_channels.size() - 1) {
+		m_channels[index] = std::move(m_channels.back());
+		m_channelIds[fold(IrcView(m_channels[index].name.c_str(), m_channels[index].name.length()))] = index;
+	}
+
+	m_channels.pop_back();
+}
+
+void ServerTracker::handleSupport(const IrcMessage &message)
+{
+	/* The first parameter is our nickname and the last one is the human readable text */
+	for (std::size_t i = 1; i + 1 < message.paramCount; ++i) {
+		const IrcView &token = message.params[i];
+		IrcView value;
+
+		if (support(token, "PREFIX=", value)) {
+			/* PREFIX=(ov)@+ */
+			const char *end = value.data + value.length;
+			const char *close = std::find(value.data, end, ')');
+
+			if (value.length == 0) {
+				m_prefixModes.clear();
+				m_prefixSymbols.clear();
+			} else if (value.data[0] == '(' && close != end && close - value.data - 1 == end - close - 1) {
+				m_prefixModes.assign(value.data + 1, close);
+				m_prefixSymbols.assign(close + 1, end);
+			}
+		} else if (support(token, "CHANMODES=", value)) {
+			/* CHANMODES=A,B,C,D: lists and keys always take an argument, C only when set */
+			const char *p = value.data;
+			const char *end = value.data + value.length;
+
+			m_argumentModes.clear();
+			m_setArgumentModes.clear();
+
+			for (int type = 0; type < 3 && p <= end; ++type) {
+				const char *comma = std::find(p, end, ',');
+
+				(type < 2 ? m_argumentModes : m_setArgumentModes).append(p, comma);
+				p = comma + 1;
+			}
+		} else if (support(token, "CASEMAPPING=", value)) {
+			CaseMapping casemapping = CaseMapping::Rfc1459;
+
+			if (value == "ascii") {
+				casemapping = CaseMapping::Ascii;
+			} else if (value == "strict-rfc1459") {
+				casemapping = CaseMapping::StrictRfc1459;
+			}
+
+			if (casemapping != m_casemapping) {
+				m_casemapping = casemapping;
+				refold();
+			}
+		}
+	}
+}
+
+void ServerTracker::handleJoin(const IrcMessage &message)
+{
+	IrcView nickname = message.nickname();
+	IrcView name = message.param(0);
+
+	if (m_self != None && findNickname(nickname) == m_self && findChannel(name) == nullptr) {
+		m_channelIds.emplace(fold(name), static_cast<std::uint32_t>(m_channels.size()));
+		m_channels.emplace_back();
+		m_channels.back().name = name.str();
+	}
+
+	Channel *channel = findChannel(name);
+
+	if (channel != nullptr) {
+		addMember(*channel, acquire(nickname), 0);
+	}
+}
+
+void ServerTracker::handlePart(const IrcView &nickname, const IrcView &name)
+{
+	std::uint32_t id = findNickname(nickname);
+
+	if (id == None) {
+		return;
+	}
+	if (id == m_self) {
+		removeChannel(name);
+		return;
+	}
+
+	Channel *channel = findChannel(name);
+
+	if (channel != nullptr) {
+		std::size_t index = findMember(*channel, id);
+
+		if (index != channel->members.size()) {
+			removeMember(*channel, index);
+		}
+	}
+}
+
+void ServerTracker::handleQuit(const IrcMessage &message)
+{
+	std::uint32_t id = findNickname(message.nickname());
+
+	if (id == None || id == m_self) {
+		return;
+	}
+
+	for (Channel &channel : m_channels) {
+		std::size_t index = findMember(channel, id);
+
+		if (index != channel.members.size()) {
+			removeMember(channel, index);
+		}
+	}
+}
+
+void ServerTracker::handleNick(const IrcMessage &message)
+{
+	auto it = m_nicknameIds.find(fold(message.nickname()));
+
+	if (it == m_nicknameIds.end()) {
+		return;
+	}
+
+	/* The identifier does not change so the channels are still sorted */
+	std::uint32_t id = it->second;
+	IrcView nickname = message.param(0);
+
+	m_nicknameIds.erase(it);
+	m_nicknameIds[fold(nickname)] = id;
+	m_nicknames[id].name.assign(nickname.data, nickname.length);
+}
+
+void ServerTracker::handleMode(const IrcMessage &message)
+{
+	Channel *channel = findChannel(message.param(0));
+
+	if (channel == nullptr) {
+		return;
+	}
+
+	IrcView modes = message.param(1);
+	std::size_t argument = 2;
+	bool adding = true;
+
+	for (std::size_t i = 0; i < modes.length; ++i) {
+		char mode = modes.data[i];
+
+		if (mode == '+' || mode == '-') {
+			adding = mode == '+';
+			continue;
+		}
+
+		std::size_t position = m_prefixModes.find(mode);
+
+		if (position == std::string::npos) {
+			/* Skip the argument of the other modes */
+			if (m_argumentModes.find(mode) != std::string::npos ||
+			    (adding && m_setArgumentModes.find(mode) != std::string::npos)) {
+				++ argument;
+			}
+
+			continue;
+		}
+
+		std::uint32_t id = findNickname(message.param(argument++));
+		std::size_t index = (id == None) ? channel->members.size() : findMember(*channel, id);
+
+		if (index == channel->members.size() || position >= MaxPrefixes) {
+			continue;
+		}
+
+		if (adding) {
+			channel->modes[index] |= (1 << position);
+		} else {
+			channel->modes[index] &= ~(1 << position);
+		}
+	}
+}
+
+void ServerTracker::handleTopic(const IrcView &name, const IrcView &topic)
+{
+	Channel *channel = findChannel(name);
+
+	if (channel != nullptr) {
+		channel->topic.assign(topic.data, topic.length);
+	}
+}
+
+void ServerTracker::handleNames(const IrcMessage &message)
+{
+	/* 353 me = #channel :names, the symbol is missing on some old servers */
+	if (message.paramCount < 3) {
+		return;
+	}
+
+	Channel *channel = findChannel(message.params[message.paramCount - 2]);
+
+	if (channel == nullptr) {
+		return;
+	}
+
+	/* The reply is authoritative, start again from an empty list */
+	if (!channel->listing) {
+		for (std::uint32_t id : channel->members) {
+			release(id);
+		}
+
+		channel->members.clear();
+		channel->modes.clear();
+		channel->listing = true;
+	}
+
+	const IrcView &list = message.params[message.paramCount - 1];
+	const char *end = list.data + list.length;
+
+	for (const char *p = list.data; p < end; ) {
+		const char *space = std::find(p, end, ' ');
+		std::uint8_t modes = 0;
+		IrcView nickname = strip(IrcView(p, space - p), &modes);
+
+		if (nickname.length > 0) {
+			addMember(*channel, acquire(nickname), modes);
+		}
+
+		p = space + 1;
+	}
+}
+
+void ServerTracker::handleEndOfNames(const IrcMessage &message)
+{
+	Channel *channel = findChannel(message.param(1));
+
+	if (channel == nullptr || !channel->listing) {
+		return;
+	}
+
+	/* Sort the identifiers and their modes together, then merge the duplicates */
+	std::vector<std::uint64_t> packed(channel->members.size());
+
+	for (std::size_t i = 0; i < packed.size(); ++i) {
+		packed[i] = (static_cast<std::uint64_t>(channel->members[i]) << 8) | channel->modes[i];
+	}
+
+	std::sort(packed.begin(), packed.end());
+
+	channel->members.clear();
+	channel->modes.clear();
+	channel->listing = false;
+
+	for (std::uint64_t value : packed) {
+		std::uint32_t id = static_cast<std::uint32_t>(value >> 8);
+		std::uint8_t modes = static_cast<std::uint8_t>(value & 0xff);
+
+		if (!channel->members.empty() && channel->members.back() == id) {
+			channel->modes.back() |= modes;
+			release(id);
+		} else {
+			channel->members.push_back(id);
+			channel->modes.push_back(modes);
+		}
+	}
+}
+
+void ServerTracker::update(const IrcMessage &message)
+{
+	switch (message.numeric()) {
+	case 0:
+		break;
+	case 1:
+		clear();
+		m_self = acquire(message.param(0));
+		return;
+	case 5:
+		handleSupport(message);
+		return;
+	case 331:
+		handleTopic(message.param(1), IrcView());
+		return;
+	case 332:
+		handleTopic(message.param(1), message.param(2));
+		return;
+	case 353:
+		handleNames(message);
+		return;
+	case 366:
+		handleEndOfNames(message);
+		return;
+	default:
+		return;
+	}
+
+	const IrcView &command = message.command;
+
+	if (command == "JOIN") {
+		handleJoin(message);
+	} else if (command == "PART") {
+		handlePart(message.nickname(), message.param(0));
+	} else if (command == "KICK") {
+		handlePart(message.param(1), message.param(0));
+	} else if (command == "QUIT") {
+		handleQuit(message);
+	} else if (command == "NICK") {
+		handleNick(message);
+	} else if (command == "MODE") {
+		handleMode(message);
+	} else if (command == "TOPIC") {
+		handleTopic(message.param(0), message.param(1));
+	}
+}
+
+void ServerTracker::clear()
+{
+	m_casemapping = CaseMapping::Rfc1459;
+	m_prefixModes = "ov";
+	m_prefixSymbols = "@+";
+	m_argumentModes = "beIk";
+	m_setArgumentModes = "l";
+	m_nicknames.clear();
+	m_free.clear();
+	m_nicknameIds.clear();
+	m_self = None;
+	m_channels.clear();
+	m_channelIds.clear();
+}
+
+IrcView ServerTracker::strip(IrcView name, std::uint8_t *modes) const noexcept
+{
+	std::size_t position;
+
+	while (name.length > 0 && (position = m_prefixSymbols.find(name.data[0])) != std::string::npos) {
+		if (modes != nullptr && position < MaxPrefixes) {
+			*modes |= (1 << position);
+		}
+
+		++ name.data;
+		-- name.length;
+	}
+
+	/* userhost-in-names */
+	name.length = std::find(name.data, name.data + name.length, '!') - name.data;
+
+	return name;
+}
+
+std::vector<std::string> ServerTracker::channels() const
+{
+	std::vector<std::string> list;
+
+	list.reserve(m_channels.size());
+
+	for (const Channel &channel : m_channels) {
+		list.push_back(channel.name);
+	}
+
+	return list;
+}
+
+ServerChannelInfo ServerTracker::channel(const std::string &name) const
+{
+	auto it = m_channelIds.find(fold(name));
+
+	if (it == m_channelIds.end()) {
+		throw std::out_of_range("channel " + name + " not found");
+	}
+
+	const Channel &channel = m_channels[it->second];
+	ServerChannelInfo info;
+
+	info.name = channel.name;
+	info.topic = channel.topic;
+	info.members.resize(channel.members.size());
+
+	for (std::size_t i = 0; i < channel.members.size(); ++i) {
+		info.members[i].nickname = m_nicknames[channel.members[i]].name;
+
+		for (std::size_t bit = 0; bit < m_prefixSymbols.size() && bit < MaxPrefixes; ++bit) {
+			if (channel.modes[i] & (1 << bit)) {
+				info.members[i].modes.push_back(m_prefixSymbols[bit]);
+			}
+		}
+	}
+
+	std::sort(info.members.begin(), info.members.end(), [] (const ServerMember &m1, const ServerMember &m2) {
+		return m1.nickname < m2.nickname;
+	});
+
+	return info;
+}
+
+} // !irccd
@@ -0,0 +1,203 @@
+/*
+ * ServerTracker.h -- channel membership tracking
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_SERVER_TRACKER_H_
+#define _IRCCD_SERVER_TRACKER_H_
+
+/**
+ * @file ServerTracker.h
+ * @brief Channel membership tracking
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IrcMessage.h"
+
+namespace irccd {
+
+/**
+ * @class ServerMember
+ * @brief A user in a channel snapshot
+ */
+class ServerMember {
+public:
+	std::string nickname;		//!< the nickname
+	std::string modes;		//!< the prefixes, highest first (e.g. @+)
+};
+
+/**
+ * @class ServerChannelInfo
+ * @brief Read-only snapshot of a joined channel
+ */
+class ServerChannelInfo {
+public:
+	std::string name;			//!< the channel name
+	std::string topic;			//!< the topic, empty if not set
+	std::vector<ServerMember> members;	//!< the users sorted by nickname
+};
+
+/**
+ * @class ServerTracker
+ * @brief Keep the channels we are in, their members, prefixes and topic
+ *
+ * The tracker is updated from every message received (JOIN, PART, KICK, NICK, QUIT, MODE, TOPIC, 332, 353, 366
+ * and the ISUPPORT tokens PREFIX, CHANMODES and CASEMAPPING).
+ *
+ * Nicknames are interned once per server and referenced by a 32 bits identifier, the key is the nickname folded
+ * with the server casemapping so that `Jean' and `jean' are the same user. Each channel stores its members as two
+ * flat arrays sorted by identifier: the identifiers and the prefix modes as a bit set. A user renaming only changes
+ * the interned string and a QUIT is a binary search per channel.
+ *
+ * While a NAMES reply is being received, members are appended unsorted and the arrays are sorted once on 366.
+ *
+ * @warning Not thread-safe, Server protects it with a mutex
+ */
+class ServerTracker {
+public:
+	/**
+	 * @enum CaseMapping
+	 * @brief How nicknames and channels are compared
+	 */
+	enum class CaseMapping {
+		Ascii,			//!< only A-Z
+		Rfc1459,		//!< also []\~ and {}|^ (default)
+		StrictRfc1459		//!< also []\ and {}|
+	};
+
+	/**
+	 * Maximum number of prefix modes tracked, the following ones are ignored.
+	 */
+	static constexpr std::size_t MaxPrefixes{8};
+
+private:
+	static constexpr std::uint32_t None{UINT32_MAX};
+
+	class Nickname {
+	public:
+		std::string name;
+		unsigned refs{0};
+	};
+
+	class Channel {
+	public:
+		std::string name;
+		std::string topic;
+		std::vector<std::uint32_t> members;
+		std::vector<std::uint8_t> modes;
+		bool listing{false};
+	};
+
+	CaseMapping m_casemapping{CaseMapping::Rfc1459};
+	std::string m_prefixModes{"ov"};
+	std::string m_prefixSymbols{"@+"};
+	std::string m_argumentModes{"beIk"};
+	std::string m_setArgumentModes{"l"};
+
+	/* Interned nicknames, m_free contains the unused slots */
+	std::vector<Nickname> m_nicknames;
+	std::vector<std::uint32_t> m_free;
+	std::unordered_map<std::string, std::uint32_t> m_nicknameIds;
+	std::uint32_t m_self{None};
+
+	/* Channels we are in, removed by swapping with the last one */
+	std::vector<Channel> m_channels;
+	std::unordered_map<std::string, std::uint32_t> m_channelIds;
+
+	/* Reused for the folded keys */
+	std::string m_key;
+
+	const std::string &fold(const IrcView &name);
+	std::string fold(const std::string &name) const;
+
+	std::uint32_t acquire(const IrcView &nickname);
+	void release(std::uint32_t id);
+	std::uint32_t findNickname(const IrcView &nickname);
+	Channel *findChannel(const IrcView &name);
+	void refold();
+
+	std::size_t findMember(const Channel &channel, std::uint32_t id) const noexcept;
+	void addMember(Channel &channel, std::uint32_t id, std::uint8_t modes);
+	void removeMember(Channel &channel, std::size_t index);
+	void removeChannel(const IrcView &name);
+
+	void handleSupport(const IrcMessage &message);
+	void handleJoin(const IrcMessage &message);
+	void handlePart(const IrcView &nickname, const IrcView &channel);
+	void handleQuit(const IrcMessage &message);
+	void handleNick(const IrcMessage &message);
+	void handleMode(const IrcMessage &message);
+	void handleTopic(const IrcView &channel, const IrcView &topic);
+	void handleNames(const IrcMessage &message);
+	void handleEndOfNames(const IrcMessage &message);
+
+public:
+	/**
+	 * Update the state from a message received from the server, other messages are ignored.
+	 *
+	 * @param message the message
+	 */
+	void update(const IrcMessage &message);
+
+	/**
+	 * Forget everything, used when the connection is lost.
+	 */
+	void clear();
+
+	/**
+	 * Remove the prefixes and the optional user@host from a nickname as sent in a NAMES reply.
+	 *
+	 * @param name the name (e.g. @+jean or @jean!~jean@localhost)
+	 * @param modes set to the prefix modes as a bit set if not null
+	 * @return the nickname without prefix
+	 */
+	IrcView strip(IrcView name, std::uint8_t *modes = nullptr) const noexcept;
+
+	/**
+	 * Get the number of interned nicknames, including ours.
+	 *
+	 * @return the number of users known
+	 */
+	inline std::size_t users() const noexcept
+	{
+		return m_nicknameIds.size();
+	}
+
+	/**
+	 * Get the names of the channels we are in.
+	 *
+	 * @return the list of channels
+	 */
+	std::vector<std::string> channels() const;
+
+	/**
+	 * Get a snapshot of a channel.
+	 *
+	 * @param name the channel name, compared with the server casemapping
+	 * @return the snapshot
+	 * @throw std::out_of_range if we are not in that channel
+	 */
+	ServerChannelInfo channel(const std::string &name) const;
+};
+
+} // !irccd
+
+#endif // !_IRCCD_SERVER_TRACKER_H_
@@ -1,5 +1,5 @@
 /*
- * Timer.cpp -- Lua timers
+ * Timer.cpp -- JS API timers
  *
  * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
  *
@@ -16,38 +16,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <chrono>
-
-#include <Logger.h>
-
 #include "Timer.h"
 
 namespace irccd {
 
-void Timer::run()
-{
-	while (m_running) {
-		std::unique_lock<std::mutex> lock(m_mutex);
-
-		// Wait the timer delay or the interrupt
-		m_condition.wait_for(lock, std::chrono::milliseconds(m_delay), [&] () {
-			return m_running == false;
-		});
-
-		if (m_running) {
-			// Signal process
-			onSignal();
-
-			if (m_type == TimerType::Single) {
-				m_running = false;
-			}
-		}
-	}
-
-	// Finished
-	onEnd();
-}
-
 Timer::Timer(TimerType type, int delay)
 	: m_type(type)
 	, m_delay(delay)
@@ -55,28 +27,15 @@ Timer::Timer(TimerType type, int delay)
 	assert(!m_running);
 }
 
-Timer::~Timer()
-{
-	Logger::debug() << "timer: destroyed" << std::endl;
-
-	try {
-		if (m_running) {
-			m_running = false;
-			m_condition.notify_one();
-		}
-
-		m_thread.join();
-	} catch (const std::exception &ex) {
-		Logger::debug() << "timer: error: " << ex.what() << std::endl;
-	}
-}
-
 void Timer::start()
 {
 	assert(!m_running);
 
 	m_running = true;
-	m_thread = std::thread(std::bind(&Timer::run, this));
+	m_generation ++;
+	m_deadline = Clock::now() + std::chrono::milliseconds(m_delay);
+
+	onStart();
 
 	assert(m_running);
 }
@@ -86,9 +45,44 @@ void Timer::stop()
 	assert(m_running);
 
 	m_running = false;
-	m_condition.notify_one();
+	m_generation ++;
+
+	onEnd();
 
 	assert(!m_running);
 }
 
+bool Timer::expire(Clock::time_point now)
+{
+	assert(m_running);
+
+	unsigned generation = m_generation;
+
+	onSignal();
+
+	/* The callback may have stopped or restarted the timer */
+	if (!m_running || m_generation != generation) {
+		return false;
+	}
+
+	if (m_type == TimerType::Single) {
+		m_running = false;
+		m_generation ++;
+		onEnd();
+
+		return false;
+	}
+
+	/* Advance from the previous deadline rather than now to avoid drift */
+	auto delay = std::chrono::milliseconds(m_delay > 0 ? m_delay : 1);
+
+	m_deadline += delay;
+
+	if (m_deadline <= now) {
+		m_deadline += ((now - m_deadline) / delay + 1) * delay;
+	}
+
+	return true;
+}
+
 } // !irccd
@@ -24,13 +24,10 @@
  * @brief Provides interval based timers for JavaScript
  */
 
-#include <atomic>
 #include <cassert>
-#include <condition_variable>
+#include <chrono>
 #include <functional>
 #include <memory>
-#include <mutex>
-#include <thread>
 #include <unordered_set>
 
 #include <Signals.h>
@@ -57,11 +54,26 @@ enum class TimerType {
  * The delay is configured in milliseconds and the user has choice to use any
  * delay needed.
  *
- * We use a condition variable to wait for the specified delay unless the timer
- * must be stopped.
+ * The timer does not own any thread, it only stores an absolute deadline. The
+ * owner is notified through onStart and is responsible of calling expire() once
+ * the deadline is reached, this is done by the TimerQueue owned by the irccd
+ * event loop.
  */
 class Timer final {
 public:
+	/**
+	 * The clock used for deadlines.
+	 */
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * Signal: onStart
+	 * ------------------------------------------------
+	 *
+	 * Called when the timer has been started, the owner must schedule it.
+	 */
+	Signal<> onStart;
+
 	/**
 	 * Signal: onSignal
 	 * ------------------------------------------------
@@ -81,14 +93,9 @@ public:
 private:
 	TimerType m_type;
 	int m_delay;
-
-	/* Thread management */
-	std::atomic<bool> m_running{false};
-	std::mutex m_mutex;
-	std::condition_variable m_condition;
-	std::thread m_thread;
-
-	void run();
+	bool m_running{false};
+	unsigned m_generation{0};
+	Clock::time_point m_deadline;
 
 public:
 	/**
@@ -102,11 +109,6 @@ public:
 	 */
 	Timer(TimerType type, int delay);
 
-	/**
-	 * Destructor, closes the thread.
-	 */
-	~Timer();
-
 	/**
 	 * Get the type of timer.
 	 *
@@ -118,14 +120,32 @@ public:
 	}
 
 	/**
-	 * Start the thread.
+	 * Get the absolute deadline of the next expiration.
+	 *
+	 * @return the deadline
+	 */
+	inline Clock::time_point deadline() const noexcept
+	{
+		return m_deadline;
+	}
+
+	/**
+	 * Get the timer generation, it is incremented each time the timer is
+	 * started or stopped so that outdated schedules can be detected.
+	 *
+	 * @return the generation
+	 */
+	inline unsigned generation() const noexcept
+	{
+		return m_generation;
+	}
+
+	/**
+	 * Start the timer, the deadline is computed from now.
 	 *
 	 * This function should only be called from the irccd's event loop.
 	 *
 	 * @pre isRunning() must return false
-	 * @pre onSignal() must have been called
-	 * @pre onEnd() must have been called
-	 * @note Not thread-safe
 	 * @post isRunning() returns true
 	 */
 	void start();
@@ -135,15 +155,25 @@ public:
 	 *
 	 * @pre isRunning() must return true
 	 * @post isRunning() returns false
-	 * @note Thread-safe
 	 */
 	void stop();
 
 	/**
-	 * Tells if the timer has still a running thread.
+	 * Call the timer because its deadline has been reached.
+	 *
+	 * A repeat timer advances its deadline by a multiple of the delay so that it
+	 * never drifts, missed periods are skipped. A single timer ends.
+	 *
+	 * @pre isRunning() must return true
+	 * @param now the current time
+	 * @return true if the timer must be scheduled again
+	 */
+	bool expire(Clock::time_point now);
+
+	/**
+	 * Tells if the timer is still scheduled.
 	 *
 	 * @return true if still alive
-	 * @note Thread-safe
 	 */
 	inline bool isRunning() const noexcept
 	{
@@ -0,0 +1,84 @@
+/*
+ * TimerQueue.cpp -- timers scheduled by the event loop
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cassert>
+
+#include "TimerQueue.h"
+
+namespace irccd {
+
+void TimerQueue::prune()
+{
+	while (!m_heap.empty()) {
+		const Entry &entry = m_heap.top();
+		auto timer = entry.timer.lock();
+
+		if (timer && timer->isRunning() && timer->generation() == entry.generation) {
+			break;
+		}
+
+		m_heap.pop();
+	}
+}
+
+void TimerQueue::add(const std::shared_ptr<Timer> &timer)
+{
+	assert(timer->isRunning());
+
+	m_heap.push(Entry{timer->deadline(), timer->generation(), timer});
+}
+
+int TimerQueue::timeout(int max)
+{
+	prune();
+
+	if (m_heap.empty()) {
+		return max;
+	}
+
+	auto now = Timer::Clock::now();
+	auto deadline = m_heap.top().deadline;
+
+	if (deadline <= now) {
+		return 0;
+	}
+
+	/* Round up so that we don't wake up just before the deadline */
+	auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now + std::chrono::milliseconds(1) - Timer::Clock::duration(1));
+	int ms = static_cast<int>(remaining.count());
+
+	return (max >= 0 && ms > max) ? max : ms;
+}
+
+void TimerQueue::process()
+{
+	auto now = Timer::Clock::now();
+
+	for (prune(); !m_heap.empty() && m_heap.top().deadline <= now; prune()) {
+		Entry entry = m_heap.top();
+		auto timer = entry.timer.lock();
+
+		m_heap.pop();
+
+		if (timer->expire(now)) {
+			add(timer);
+		}
+	}
+}
+
+} // !irccd
@@ -0,0 +1,101 @@
+/*
+ * TimerQueue.h -- timers scheduled by the event loop
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_TIMER_QUEUE_H_
+#define _IRCCD_TIMER_QUEUE_H_
+
+/**
+ * @file TimerQueue.h
+ * @brief Schedule timers from the event loop
+ */
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "Timer.h"
+
+namespace irccd {
+
+/**
+ * @class TimerQueue
+ * @brief Min-heap of timer deadlines
+ *
+ * This class is owned by the irccd event loop, it stores the deadlines of all
+ * running timers and expires them when due. The event loop uses timeout() to
+ * know how long it may sleep.
+ *
+ * Stopped timers are not removed immediately, their entries are discarded when
+ * they reach the top of the heap by comparing the timer generation.
+ *
+ * Adding a timer and expiring one are both O(log n), there is no thread per
+ * timer.
+ */
+class TimerQueue {
+private:
+	struct Entry {
+		Timer::Clock::time_point deadline;
+		unsigned generation;
+		std::weak_ptr<Timer> timer;
+
+		inline bool operator>(const Entry &other) const noexcept
+		{
+			return deadline > other.deadline;
+		}
+	};
+
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_heap;
+
+	void prune();
+
+public:
+	/**
+	 * Schedule a running timer at its current deadline.
+	 *
+	 * @pre timer->isRunning() must return true
+	 * @param timer the timer
+	 */
+	void add(const std::shared_ptr<Timer> &timer);
+
+	/**
+	 * Compute the number of milliseconds until the next deadline.
+	 *
+	 * @param max the maximum value to return (-1 for no limit)
+	 * @return 0 if a timer is already due, max if there are no timers
+	 */
+	int timeout(int max = -1);
+
+	/**
+	 * Expire all timers whose deadline is reached.
+	 */
+	void process();
+
+	/**
+	 * Get the number of scheduled entries, including outdated ones.
+	 *
+	 * @return the size
+	 */
+	inline std::size_t size() const noexcept
+	{
+		return m_heap.size();
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_TIMER_QUEUE_H_
@@ -0,0 +1,151 @@
+/*
+ * TransportBuffer.cpp -- input buffer and frame scanner of transport clients
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "TransportBuffer.h"
+
+namespace irccd {
+
+namespace {
+
+const std::size_t delimiterLength{4};
+const std::size_t prefixLength{4};
+
+} // !namespace
+
+constexpr std::size_t TransportBuffer::MinRead;
+constexpr std::size_t TransportBuffer::MaxRead;
+
+TransportBuffer::TransportBuffer(std::size_t limit) noexcept
+	: m_limit(limit)
+{
+}
+
+char *TransportBuffer::reserve(std::size_t &length)
+{
+	/* Everything consumed, start again at the front */
+	if (m_begin == m_end) {
+		m_begin = m_end = m_scan = 0;
+	}
+
+	if (m_capacity - m_end < m_read) {
+		/* Move the pending data to the front, only when needed so that each byte moves at most once per read */
+		if (m_begin > 0) {
+			std::memmove(&m_data[0], &m_data[m_begin], m_end - m_begin);
+			m_end -= m_begin;
+			m_scan -= m_begin;
+			m_begin = 0;
+		}
+
+		/* Grow for a frame larger than the buffer, next() fails before it exceeds the limit */
+		if (m_capacity - m_end < m_read) {
+			std::size_t capacity = std::max(m_capacity * 2, m_end + m_read);
+			std::unique_ptr<char[]> data(new char[capacity]);
+
+			if (m_end > 0) {
+				std::memcpy(&data[0], &m_data[0], m_end);
+			}
+
+			m_data = std::move(data);
+			m_capacity = capacity;
+		}
+	}
+
+	length = m_read;
+
+	return &m_data[m_end];
+}
+
+void TransportBuffer::commit(std::size_t length) noexcept
+{
+	/* Large reads when the client sends a lot, small ones when it is mostly idle */
+	if (length >= m_read) {
+		m_read = std::min(m_read * 2, MaxRead);
+	} else if (length < m_read / 4) {
+		m_read = std::max(m_read / 2, MinRead);
+	}
+
+	m_end += length;
+}
+
+bool TransportBuffer::next(const char *&data, std::size_t &length)
+{
+	while (m_scan + delimiterLength <= m_end) {
+		const char *start = &m_data[m_scan];
+		const char *found = static_cast<const char *>(std::memchr(start, '\r', m_end - m_scan - delimiterLength + 1));
+
+		if (found == nullptr) {
+			break;
+		}
+
+		m_scan = static_cast<std::size_t>(found - &m_data[0]);
+
+		if (std::memcmp(found, Delimiter, delimiterLength) != 0) {
+			++ m_scan;
+			continue;
+		}
+
+		data = &m_data[m_begin];
+		length = m_scan - m_begin;
+		m_begin = m_scan = m_scan + delimiterLength;
+
+		return true;
+	}
+
+	/* The last bytes may be the start of a delimiter, they are scanned again with the next read */
+	m_scan = std::max(m_begin, (m_end >= delimiterLength) ? m_end - delimiterLength + 1 : 0);
+
+	if (m_end - m_begin > m_limit) {
+		throw std::length_error("message larger than " + std::to_string(m_limit) + " bytes");
+	}
+
+	return false;
+}
+
+bool TransportBuffer::nextPrefixed(const char *&data, std::size_t &length)
+{
+	/* The delimiter scan position is meaningless here, keep it valid if the client switches back */
+	m_scan = m_begin;
+
+	if (m_end - m_begin < prefixLength) {
+		return false;
+	}
+
+	const unsigned char *prefix = reinterpret_cast<const unsigned char *>(&m_data[m_begin]);
+	std::size_t size = (static_cast<std::size_t>(prefix[0]) << 24) | (prefix[1] << 16) | (prefix[2] << 8) | prefix[3];
+
+	/* Known before the frame is received */
+	if (size > m_limit) {
+		throw std::length_error("message larger than " + std::to_string(m_limit) + " bytes");
+	}
+	if (m_end - m_begin - prefixLength < size) {
+		return false;
+	}
+
+	data = &m_data[m_begin + prefixLength];
+	length = size;
+	m_begin = m_scan = m_begin + prefixLength + size;
+
+	return true;
+}
+
+} // !irccd
@@ -0,0 +1,147 @@
+/*
+ * TransportBuffer.h -- input buffer and frame scanner of transport clients
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_TRANSPORT_BUFFER_H_
+#define _IRCCD_TRANSPORT_BUFFER_H_
+
+/**
+ * @file TransportBuffer.h
+ * @brief Input buffer and frame scanner of transport clients
+ */
+
+#include <cstddef>
+#include <memory>
+
+namespace irccd {
+
+/**
+ * @class TransportBuffer
+ * @brief Input buffer and frame scanner of transport clients
+ *
+ * The transport messages are separated by "\r\n\r\n". The data is read directly at the end of the buffer and the
+ * delimiter is searched only in the bytes that have not been scanned yet, so pipelined commands and large payloads
+ * are processed in linear time. The frames are returned as views into the buffer.
+ *
+ * The unread data is moved to the front only when there is not enough room at the end for the next read, so a
+ * frame is always contiguous. The size of the reads adapts to the traffic: it doubles when a read fills the space
+ * given and shrinks when the reads are small.
+ */
+class TransportBuffer {
+public:
+	/**
+	 * The delimiter of the frames.
+	 */
+	static constexpr const char *Delimiter{"\r\n\r\n"};
+
+	/**
+	 * Size of the first read and minimum size of a read.
+	 */
+	static constexpr std::size_t MinRead{4096};
+
+	/**
+	 * Maximum size of a read.
+	 */
+	static constexpr std::size_t MaxRead{65536};
+
+private:
+	std::unique_ptr<char[]> m_data;
+	std::size_t m_capacity{0};
+	std::size_t m_begin{0};
+	std::size_t m_end{0};
+	std::size_t m_scan{0};
+	std::size_t m_read{MinRead};
+	std::size_t m_limit;
+
+public:
+	/**
+	 * Create an empty buffer, nothing is allocated until the first read.
+	 *
+	 * @param limit the maximum size of a frame
+	 */
+	TransportBuffer(std::size_t limit = 1024 * 1024) noexcept;
+
+	/**
+	 * Get the room for the next read, the data already buffered may be moved.
+	 *
+	 * @param length the number of bytes that can be written
+	 * @return the address where to write
+	 * @warning The frames previously returned by next() are invalidated
+	 */
+	char *reserve(std::size_t &length);
+
+	/**
+	 * Tell how many bytes have been written after reserve().
+	 *
+	 * @param length the number of bytes written
+	 */
+	void commit(std::size_t length) noexcept;
+
+	/**
+	 * Get the next complete frame, without the delimiter.
+	 *
+	 * @param data the frame address, valid until the next reserve()
+	 * @param length the frame length
+	 * @return false if there is no complete frame
+	 * @throw std::length_error if the pending frame is larger than the limit
+	 */
+	bool next(const char *&data, std::size_t &length);
+
+	/**
+	 * Get the next complete frame prefixed by its length (32 bits, big endian), without the prefix.
+	 *
+	 * @param data the frame address, valid until the next reserve()
+	 * @param length the frame length
+	 * @return false if there is no complete frame
+	 * @throw std::length_error if the frame is larger than the limit
+	 */
+	bool nextPrefixed(const char *&data, std::size_t &length);
+
+	/**
+	 * Get the number of bytes buffered and not yet returned as frames.
+	 *
+	 * @return the size
+	 */
+	inline std::size_t size() const noexcept
+	{
+		return m_end - m_begin;
+	}
+
+	/**
+	 * Get the number of bytes allocated.
+	 *
+	 * @return the capacity
+	 */
+	inline std::size_t capacity() const noexcept
+	{
+		return m_capacity;
+	}
+
+	/**
+	 * Get the size of the next read.
+	 *
+	 * @return the size
+	 */
+	inline std::size_t readSize() const noexcept
+	{
+		return m_read;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_TRANSPORT_BUFFER_H_
@@ -20,11 +20,37 @@
 
 #include <Logger.h>
 
+#include "MsgPack.h"
 #include "SocketListener.h"
 #include "TransportClient.h"
 
 namespace irccd {
 
+namespace {
+
+/*
+ * Add the request identifier as the last property of a JSON object.
+ */
+std::string tag(const std::string &message, const std::string &id)
+{
+	std::size_t end = message.rfind('}');
+
+	if (end == std::string::npos) {
+		return message;
+	}
+
+	std::size_t last = message.find_last_not_of(" \t\r\n", end - 1);
+	std::string result = message.substr(0, end);
+
+	if (last != std::string::npos && message[last] != '{') {
+		result += ",";
+	}
+
+	return result + "\"id\":" + id + message.substr(end);
+}
+
+} // !namespace
+
 JsonValue TransportClientAbstract::value(const JsonObject &object, const std::string &key) const
 {
 	if (!object.contains(key)) {
@@ -39,15 +65,13 @@ JsonValue TransportClientAbstract::valueOr(const JsonObject &object, const std::
 	return (object.contains(key)) ? object[key] : def;
 }
 
-void TransportClientAbstract::sync(fd_set &setinput, fd_set &setoutput)
+void TransportClientAbstract::sync(int flags)
 {
-	auto h = socket().handle();
-
-	if (FD_ISSET(h, &setinput)) {
+	if (flags & SocketListener::Read) {
 		Logger::debug() << "transport: receiving to input buffer" << std::endl;
 		receive();
 	}
-	if (FD_ISSET(h, &setoutput)) {
+	if (flags & SocketListener::Write) {
 		Logger::debug() << "transport: sending outgoing buffer" << std::endl;
 		send();
 	}
@@ -75,6 +99,55 @@ void TransportClientAbstract::parseChannelNotice(const JsonObject &object) const
 	);
 }
 
+/*
+ * Get the channels
+ * --------------------------------------------------------
+ *
+ * Get the channels we are in, or the users and the topic of one channel.
+ *
+ * {
+ *   "command": "channels",
+ *   "server: "the server name",
+ *   "channel": "the channel name (Optional)"
+ * }
+ *
+ * Responses:
+ *   - { "response": "channels", "server": "...", "channels": [ "#a", "#b" ] } without channel
+ *   - { "response": "channels", "server": "...", "channel": { "name": "...", "topic": "...",
+ *       "users": [ { "nickname": "...", "modes": "@" } ] } } with a channel
+ *   - Error if the server does not exist or if we are not in that channel
+ */
+void TransportClientAbstract::parseChannels(const JsonObject &object) const
+{
+	onChannels(
+		value(object, "server").toString(),
+		valueOr(object, "channel", "").toString()
+	);
+}
+
+/*
+ * Get the transport clients statistics
+ * --------------------------------------------------------
+ *
+ * Get the output queue of every client connected to irccd, the slow consumers can be spotted with the number of
+ * bytes pending and the messages discarded.
+ *
+ * {
+ *   "command": "clients"
+ * }
+ *
+ * Responses:
+ *   - { "response": "clients", "clients": [ { "self": true, "pending": 0, "bytes": 0, "sent": 120,
+ *       "dropped": 0, "writes": 80, "limit": 4194304, "overflow": "drop-oldest" } ] }
+ *
+ * The client that sent the command has self set to true, pending and bytes are the messages and the bytes waiting
+ * to be written.
+ */
+void TransportClientAbstract::parseClients(const JsonObject &) const
+{
+	onClients();
+}
+
 /*
  * Connect to a server
  * --------------------------------------------------------
@@ -100,6 +173,9 @@ void TransportClientAbstract::parseChannelNotice(const JsonObject &object) const
  *     "command-char": "the command character",
  *     "reconnect-tries": number of reconnection
  *     "reconnect-timeout": number of seconds to wait
+ *     "reconnect-max-timeout": maximum number of seconds to wait after consecutive failures
+ *     "ping-interval": number of seconds between two PING probes
+ *     "ping-timeout": number of seconds without data before reconnecting
  *   }
  * }
  *
@@ -133,11 +209,73 @@ void TransportClientAbstract::parseConnect(const JsonObject &object) const
 		settings.command = valueOr(settingsObject, "command-char", settings.command).toString();
 		settings.recotries = valueOr(settingsObject, "reconnect-tries", settings.recotries).toInteger();
 		settings.recotimeout = valueOr(settingsObject, "reconnect-timeout", settings.recotimeout).toInteger();
+		settings.recomaxtimeout = valueOr(settingsObject, "reconnect-max-timeout", settings.recomaxtimeout).toInteger();
+		settings.pinginterval = valueOr(settingsObject, "ping-interval", settings.pinginterval).toInteger();
+		settings.pingtimeout = valueOr(settingsObject, "ping-timeout", settings.pingtimeout).toInteger();
 	}
 
+	require(onConnect);
 	onConnect(std::move(info), std::move(identity), std::move(settings));
 }
 
+/*
+ * Change the message format
+ * --------------------------------------------------------
+ *
+ * Select how the messages are encoded from now, in both directions. The response is the last message in the
+ * previous format.
+ *
+ * {
+ *   "command": "format",
+ *   "format": "msgpack"
+ * }
+ *
+ * Responses:
+ *   - { "response": "format", "format": "msgpack" }
+ *   - Error if the format is not json or msgpack
+ *
+ * With msgpack, every message is a MessagePack map prefixed by its length as a 32 bits big endian integer. The maps
+ * have the same keys as the JSON objects, this applies to the commands, the responses and the events.
+ */
+void TransportClientAbstract::parseFormat(const JsonObject &object)
+{
+	std::string name = value(object, "format").toString();
+	TransportFormat format;
+
+	if (name == "json") {
+		format = TransportFormat::Json;
+	} else if (name == "msgpack") {
+		format = TransportFormat::MsgPack;
+	} else {
+		throw std::invalid_argument("invalid format: " + name);
+	}
+
+	send("{\"response\":\"format\",\"format\":\"" + name + "\"}");
+	m_format = format;
+}
+
+/*
+ * Get the connection scheduler state
+ * --------------------------------------------------------
+ *
+ * Get the servers connecting, waiting for a connection slot and the reconnection delays.
+ *
+ * {
+ *   "command": "connections"
+ * }
+ *
+ * Responses:
+ *   - { "response": "connections", "limit": 4, "active": [ "a" ], "waiting": [ "b" ],
+ *       "servers": [ { "name": "c", "state": "disconnected", "failures": 2, "retry": 84000 } ] }
+ *
+ * The state is one of connecting, waiting, connected, disconnected or dead and retry is the number of
+ * milliseconds before the next reconnection.
+ */
+void TransportClientAbstract::parseConnections(const JsonObject &) const
+{
+	onConnections();
+}
+
 /*
  * Disconnect a server
  * --------------------------------------------------------
@@ -242,7 +380,10 @@ void TransportClientAbstract::parseKick(const JsonObject &object) const
  */
 void TransportClientAbstract::parseLoad(const JsonObject &object) const
 {
-	onLoad(value(object, "plugin").toString());
+	std::string plugin = value(object, "plugin").toString();
+
+	require(onLoad);
+	onLoad(std::move(plugin));
 }
 
 /*
@@ -395,6 +536,7 @@ void TransportClientAbstract::parsePart(const JsonObject &object) const
  */
 void TransportClientAbstract::parseReconnect(const JsonObject &object) const
 {
+	require(onReconnect);
 	onReconnect(valueOr(object, "server", "").toString());
 }
 
@@ -415,7 +557,99 @@ void TransportClientAbstract::parseReconnect(const JsonObject &object) const
  */
 void TransportClientAbstract::parseReload(const JsonObject &object) const
 {
-	onReload(value(object, "plugin").toString());
+	std::string plugin = value(object, "plugin").toString();
+
+	require(onReload);
+	onReload(std::move(plugin));
+}
+
+/*
+ * Get the server statistics
+ * --------------------------------------------------------
+ *
+ * Get the lag measured by the PING probes, the last activity and the outgoing queue metrics of one server
+ * or all of them.
+ *
+ * {
+ *   "command": "stats",
+ *   "server": "the server name"	(Optional)
+ * }
+ *
+ * Responses:
+ *   - { "response": "stats", "servers": [ { "name": "...", "state": "connected", "lag": 42,
+ *       "rtt": { "count": 10, "min": 38, "avg": 45, "max": 80, "p50": 64, "p99": 80, "buckets": [ ... ] },
+ *       "lastReceived": 1200, "lastSent": 30000,
+ *       "queue": { "depth": 0, "sent": 12, "dropped": 0, "maxWait": 2000, "avgWait": 150 },
+ *       "output": { "lines": 14, "writes": 9, "bytes": 620 }, "tls": { "handshakes": 3, "resumed": 2 } } ]
+ *   - Error if the server does not exist
+ *
+ * All times are in milliseconds, lastReceived and lastSent are the time elapsed since the last message received
+ * and the last write (-1 if none). The bucket i counts the round trips below 2^i ms, the last one the others.
+ */
+void TransportClientAbstract::parseStats(const JsonObject &object) const
+{
+	onStats(valueOr(object, "server", "").toString());
+}
+
+/*
+ * Subscribe to the events
+ * --------------------------------------------------------
+ *
+ * Select the events sent to this client, by default a client receives all of them. Each property is optional and
+ * restricts the events to the ones listed, an empty list means none. Sending the command again replaces the
+ * previous subscription, without any property it restores the default.
+ *
+ * {
+ *   "command": "subscribe",
+ *   "events": [ "onMessage", "onJoin" ],	(Optional)
+ *   "servers": [ "freenode" ],			(Optional)
+ *   "channels": [ "#staff" ],			(Optional)
+ *   "origins": [ "jean", "adm*" ]		(Optional)
+ * }
+ *
+ * The channels are case-insensitive, the origins are wildcard patterns on the nickname. The events without
+ * channel (e.g. onQuery) or without origin (e.g. onNames) are not restricted by these properties.
+ *
+ * Responses:
+ *   - Error if an event does not exist or a property is not a list of strings
+ */
+void TransportClientAbstract::parseSubscribe(const JsonObject &object) const
+{
+	auto list = [&] (const std::string &key) {
+		std::vector<std::string> result;
+		JsonValue array = object[key];
+
+		if (!array.isArray()) {
+			throw std::invalid_argument("`" + key + "' property must be an array");
+		}
+
+		for (const JsonValue &value : array.toArray()) {
+			if (!value.isString()) {
+				throw std::invalid_argument("`" + key + "' property must only contain strings");
+			}
+
+			result.push_back(value.toString());
+		}
+
+		return result;
+	};
+
+	TransportFilter filter;
+
+	if (object.contains("events")) {
+		filter.setEvents(list("events"));
+	}
+	if (object.contains("servers")) {
+		filter.setServers(list("servers"));
+	}
+	if (object.contains("channels")) {
+		filter.setChannels(list("channels"));
+	}
+	if (object.contains("origins")) {
+		filter.setOrigins(list("origins"));
+	}
+
+	onSubscribe(std::move(filter));
 }
 
 /*
@@ -457,7 +691,10 @@ void TransportClientAbstract::parseTopic(const JsonObject &object) const
  */
 void TransportClientAbstract::parseUnload(const JsonObject &object) const
 {
-	onUnload(value(object, "plugin").toString());
+	std::string plugin = value(object, "plugin").toString();
+
+	require(onUnload);
+	onUnload(std::move(plugin));
 }
 
 /*
@@ -480,62 +717,207 @@ void TransportClientAbstract::parseUserMode(const JsonObject &object) const
 	);
 }
 
-void TransportClientAbstract::parse(const std::string &message) const
-{
-	using namespace std;
-	using namespace std::placeholders;
-
-	static std::unordered_map<std::string, std::function<void (const JsonObject &)>> parsers{
-		{ "cnotice",	bind(&TransportClientAbstract::parseChannelNotice, this, _1)	},
-		{ "connect",	bind(&TransportClientAbstract::parseConnect, this, _1)		},
-		{ "disconnect",	bind(&TransportClientAbstract::parseDisconnect, this, _1)	},
-		{ "invite",	bind(&TransportClientAbstract::parseInvite, this, _1)		},
-		{ "join",	bind(&TransportClientAbstract::parseJoin, this, _1)		},
-		{ "kick",	bind(&TransportClientAbstract::parseKick, this, _1)		},
-		{ "load",	bind(&TransportClientAbstract::parseLoad, this, _1)		},
-		{ "me",		bind(&TransportClientAbstract::parseMe, this, _1)		},
-		{ "message",	bind(&TransportClientAbstract::parseMessage, this, _1)		},
-		{ "mode",	bind(&TransportClientAbstract::parseMode, this, _1)		},
-		{ "nick",	bind(&TransportClientAbstract::parseNick, this, _1)		},
-		{ "notice",	bind(&TransportClientAbstract::parseNotice, this, _1)		},
-		{ "part",	bind(&TransportClientAbstract::parsePart, this, _1)		},
-		{ "reconnect",	bind(&TransportClientAbstract::parseReconnect, this, _1)	},
-		{ "reload",	bind(&TransportClientAbstract::parseReload, this, _1)		},
-		{ "topic",	bind(&TransportClientAbstract::parseTopic, this, _1)		},
-		{ "unload",	bind(&TransportClientAbstract::parseUnload, this, _1)		},
-		{ "umode",	bind(&TransportClientAbstract::parseUserMode, this, _1)		}
+bool TransportClientAbstract::next(const char *&data, std::size_t &length)
+{
+	if (m_format == TransportFormat::MsgPack) {
+		return m_input.nextPrefixed(data, length);
+	}
+
+	return m_input.next(data, length);
+}
+
+/*
+ * Send several commands
+ * --------------------------------------------------------
+ *
+ * Every command may have an identifier, a string or an integer chosen by the client. It is added to the response
+ * or to the error of that command so the client can send many commands without waiting for each reply:
+ *
+ * {
+ *   "command": "message",
+ *   "id": 42,
+ *   ...
+ * }
+ *
+ * Several commands can also be sent in one message as an array, they are executed in order and each one gets its
+ * own reply. An invalid command does not prevent the next ones from being executed.
+ *
+ * [
+ *   { "command": "message", "id": 1, ... },
+ *   { "command": "notice", "id": 2, ... }
+ * ]
+ *
+ * Responses:
+ *   - The response of the command with "id" added, e.g. { "response": "stats", "servers": [ ... ], "id": 42 }
+ *   - { "response": "message", "id": 42 } once executed for the commands without response
+ *   - { "error": "...", "id": 42 } if the command failed
+ *
+ * Without identifier, the commands without response are not acknowledged. The replies of different commands may
+ * not arrive in the same order as the commands.
+ */
+void TransportClientAbstract::parseBatch(const JsonArray &array)
+{
+	for (const JsonValue &value : array) {
+		if (value.isObject()) {
+			dispatch(value.toObject());
+		} else {
+			error("invalid message: a batch must only contain objects");
+		}
+	}
+}
+
+void TransportClientAbstract::dispatch(const JsonObject &object)
+{
+	/* Shared by all clients, the handler is called on this client */
+	static const std::unordered_map<std::string, void (TransportClientAbstract::*)(const JsonObject &) const> parsers{
+		{ "cnotice",	&TransportClientAbstract::parseChannelNotice	},
+		{ "channels",	&TransportClientAbstract::parseChannels		},
+		{ "clients",	&TransportClientAbstract::parseClients		},
+		{ "connect",	&TransportClientAbstract::parseConnect		},
+		{ "connections",	&TransportClientAbstract::parseConnections	},
+		{ "disconnect",	&TransportClientAbstract::parseDisconnect	},
+		{ "invite",	&TransportClientAbstract::parseInvite		},
+		{ "join",	&TransportClientAbstract::parseJoin		},
+		{ "kick",	&TransportClientAbstract::parseKick		},
+		{ "load",	&TransportClientAbstract::parseLoad		},
+		{ "me",		&TransportClientAbstract::parseMe		},
+		{ "message",	&TransportClientAbstract::parseMessage		},
+		{ "mode",	&TransportClientAbstract::parseMode		},
+		{ "nick",	&TransportClientAbstract::parseNick		},
+		{ "notice",	&TransportClientAbstract::parseNotice		},
+		{ "part",	&TransportClientAbstract::parsePart		},
+		{ "reconnect",	&TransportClientAbstract::parseReconnect	},
+		{ "reload",	&TransportClientAbstract::parseReload		},
+		{ "stats",	&TransportClientAbstract::parseStats		},
+		{ "subscribe",	&TransportClientAbstract::parseSubscribe	},
+		{ "topic",	&TransportClientAbstract::parseTopic		},
+		{ "unload",	&TransportClientAbstract::parseUnload		},
+		{ "umode",	&TransportClientAbstract::parseUserMode		}
 	};
 
-	JsonDocument document(message);
-	if (!document.isObject()) {
-		throw std::invalid_argument("the message is not a valid JSON object");
+	m_request = TransportRequest();
+
+	try {
+		if (object.contains("id")) {
+			JsonValue id = object["id"];
+
+			if (!id.isString() && !id.isInteger()) {
+				throw std::invalid_argument("invalid message: `id' property must be a string or an integer");
+			}
+
+			m_request.id = id.dump(JSON_ENCODE_ANY);
+		}
+
+		if (!object.contains("command")) {
+			throw std::invalid_argument("invalid message: missing `command' property");
+		}
+
+		m_request.command = object["command"].toString();
+
+		/* Changes how the next frames are read, can not be deferred */
+		if (m_request.command == "format") {
+			parseFormat(object);
+		} else {
+			auto it = parsers.find(m_request.command);
+
+			if (it == parsers.end()) {
+				throw std::invalid_argument("invalid command: " + m_request.command);
+			}
+
+			(this->*it->second)(object);
+		}
+	} catch (const std::exception &ex) {
+		Logger::warning() << "transport: " << ex.what() << std::endl;
+		error(ex.what());
 	}
 
-	JsonObject object = document.toObject();
-	if (!object.contains("command")) {
-		throw std::invalid_argument("invalid message: missing `command' property");
+	complete();
+}
+
+void TransportClientAbstract::parse(const char *data, std::size_t length)
+{
+	if (m_format == TransportFormat::MsgPack) {
+		JsonValue value = MsgPackReader(data, length).read();
+
+		if (value.isArray()) {
+			parseBatch(value.toArray());
+		} else if (value.isObject()) {
+			dispatch(value.toObject());
+		} else {
+			throw std::invalid_argument("the message is not a valid MessagePack map or array");
+		}
+	} else {
+		JsonDocument document(data, length);
+
+		if (document.isArray()) {
+			parseBatch(document.toArray());
+		} else if (document.isObject()) {
+			dispatch(document.toObject());
+		} else {
+			throw std::invalid_argument("the message is not a valid JSON object or array");
+		}
 	}
+}
+
+TransportRequest TransportClientAbstract::defer() noexcept
+{
+	TransportRequest request = std::move(m_request);
+
+	m_request = TransportRequest();
+
+	return request;
+}
+
+void TransportClientAbstract::resume(TransportRequest request) noexcept
+{
+	m_request = std::move(request);
+}
 
-	auto it = parsers.find(object["command"].toString());
-	if (it == parsers.end()) {
-		throw std::invalid_argument("invalid command: " + object["command"].toString());
+void TransportClientAbstract::complete()
+{
+	if (!m_request.id.empty() && !m_request.answered) {
+		send("{\"response\":\"" + JsonValue::escape(m_request.command) + "\"}");
 	}
 
-	it->second(object);
+	m_request = TransportRequest();
 }
 
 void TransportClientAbstract::error(std::string message)
 {
-	m_output += "{";
-	m_output += "\"error\":";
-	m_output += "\"" + JsonValue::escape(message) + "\"";
-	m_output += "}\r\n\r\n";
+	send("{\"error\":\"" + JsonValue::escape(message) + "\"}");
+}
+
+void TransportClientAbstract::send(const std::string &message)
+{
+	std::string reply = m_request.id.empty() ? message : tag(message, m_request.id);
+
+	m_request.answered = true;
+
+	if (m_format == TransportFormat::MsgPack) {
+		/* Only the responses, the events are encoded directly */
+		MsgPackWriter writer;
+
+		writer.value(JsonDocument(std::move(reply)).toObject());
+		send(TransportOutput::makeFrame(writer.data()));
+	} else {
+		send(TransportOutput::make(std::move(reply)));
+	}
 }
 
-void TransportClientAbstract::send(std::string message)
+void TransportClientAbstract::send(TransportOutput::Message message)
 {
-	m_output += message;
-	m_output += "\r\n\r\n";
+	bool overflowed = m_output.isOverflowed();
+	std::size_t dropped = m_output.dropped();
+
+	if (!m_output.push(std::move(message))) {
+		if (!overflowed) {
+			Logger::warning() << "transport: client too slow, " << m_output.dropped() << " message(s) discarded, closing the client" << std::endl;
+			onOverflow();
+		}
+	} else if (m_output.dropped() != dropped && !m_dropping) {
+		Logger::warning() << "transport: client too slow, discarding the oldest messages" << std::endl;
+		m_dropping = true;
+	}
 }
 
 } // !irccd
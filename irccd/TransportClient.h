@@ -24,17 +24,36 @@
  * @brief Client connected to irccd
  */
 
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
 
 #include <Json.h>
 #include <Signals.h>
 
 #include "Server.h"
+#include "TransportBuffer.h"
+#include "TransportFilter.h"
+#include "TransportOutput.h"
 
 namespace irccd {
 
+/**
+ * @class TransportRequest
+ * @brief Command being executed for a client
+ *
+ * The identifier is copied as is in the replies so that a client sending several commands without waiting can
+ * match them.
+ */
+class TransportRequest {
+public:
+	std::string command;			//!< the command name
+	std::string id;				//!< the JSON encoded identifier, empty if not set
+	bool answered{false};			//!< a response or an error has been sent
+};
+
 /**
  * @class TransportClient
  * @brief Client connected to irccd
@@ -54,6 +73,18 @@ public:
 	 */
 	Signal<std::string, std::string, std::string> onChannelNotice;
 
+	/**
+	 * Signal: onChannels
+	 * --------------------------------------------------------
+	 *
+	 * Request the channels we are in or the snapshot of one channel.
+	 *
+	 * Arguments:
+	 * - the server name
+	 * - the channel, empty to list the channels
+	 */
+	Signal<std::string, std::string> onChannels;
+
 	/**
 	 * Signal: onConnect
 	 * ------------------------------------------------
@@ -67,6 +98,14 @@ public:
 	 */
 	Signal<ServerInfo, ServerIdentity, ServerSettings> onConnect;
 
+	/**
+	 * Signal: onConnections
+	 * ------------------------------------------------
+	 *
+	 * Request the state of the connection scheduler and the reconnection delays.
+	 */
+	Signal<> onConnections;
+
 	/**
 	 * TODO
 	 */
@@ -222,6 +261,28 @@ public:
 	 */
 	Signal<std::string> onReload;
 
+	/**
+	 * Signal: onStats
+	 * ------------------------------------------------
+	 *
+	 * Request the lag, the round trip times and the queue metrics of one or all servers.
+	 *
+	 * Arguments:
+	 * - the server name (optional)
+	 */
+	Signal<std::string> onStats;
+
+	/**
+	 * Signal: onSubscribe
+	 * ------------------------------------------------
+	 *
+	 * Select the events sent to this client.
+	 *
+	 * Arguments:
+	 * - the compiled filter
+	 */
+	Signal<TransportFilter> onSubscribe;
+
 	/**
 	 * Signal: onTopic
 	 * ------------------------------------------------
@@ -258,6 +319,23 @@ public:
 	 */
 	Signal<std::string, std::string> onUserMode;
 
+	/**
+	 * Signal: onClients
+	 * ------------------------------------------------
+	 *
+	 * Request the output statistics of the transport clients.
+	 */
+	Signal<> onClients;
+
+	/**
+	 * Signal: onOverflow
+	 * ------------------------------------------------
+	 *
+	 * The client did not read its output and the limit has been reached with the disconnect policy, it must be
+	 * closed. Emitted while sending, the client must not be removed immediately.
+	 */
+	Signal<> onOverflow;
+
 	/**
 	 * Signal: onDie
 	 * ------------------------------------------------
@@ -267,16 +345,35 @@ public:
 	Signal<> onDie;
 
 protected:
-	std::string m_input;
-	std::string m_output;
+	TransportBuffer m_input;
+	TransportOutput m_output;
+	TransportFilter m_filter;
+	TransportFormat m_format;
+	TransportRequest m_request;
+	bool m_dropping{false};
 
 	/* JSON helpers */
 	JsonValue value(const JsonObject &, const std::string &name) const;
 	JsonValue valueOr(const JsonObject &, const std::string &name, const JsonValue &def) const;
 
+	/*
+	 * Commands without handler must not be acknowledged as if they succeeded.
+	 */
+	template <typename... Args>
+	void require(const Signal<Args...> &signal) const
+	{
+		if (signal.empty()) {
+			throw std::runtime_error("command not implemented: " + m_request.command);
+		}
+	}
+
 	/* Parse JSON commands */
 	void parseChannelNotice(const JsonObject &) const;
+	void parseChannels(const JsonObject &) const;
+	void parseClients(const JsonObject &) const;
 	void parseConnect(const JsonObject &) const;
+	void parseConnections(const JsonObject &) const;
+	void parseFormat(const JsonObject &);
 	void parseDisconnect(const JsonObject &) const;
 	void parseInvite(const JsonObject &) const;
 	void parseJoin(const JsonObject &) const;
@@ -290,31 +387,70 @@ protected:
 	void parsePart(const JsonObject &) const;
 	void parseReconnect(const JsonObject &) const;
 	void parseReload(const JsonObject &) const;
+	void parseStats(const JsonObject &) const;
+	void parseSubscribe(const JsonObject &) const;
 	void parseTopic(const JsonObject &) const;
 	void parseUnload(const JsonObject &) const;
 	void parseUserMode(const JsonObject &) const;
-	void parse(const std::string &) const;
+	void parseBatch(const JsonArray &);
+	void dispatch(const JsonObject &);
+	void parse(const char *data, std::size_t length);
+
+	/* Frame the input depending on the format */
+	bool next(const char *&data, std::size_t &length);
 
 	/* Do I/O */
 	virtual void receive() = 0;
 	virtual void send() = 0;
 
 public:
+	/**
+	 * Create the client.
+	 *
+	 * @param output the output queue
+	 * @param format the initial format, the client may change it with the format command
+	 */
+	inline TransportClientAbstract(TransportOutput output = TransportOutput(), TransportFormat format = TransportFormat::Json) noexcept
+		: m_output(std::move(output))
+		, m_format(format)
+	{
+	}
+
 	/**
 	 * Virtual destructor defaulted.
 	 */
 	virtual ~TransportClientAbstract() = default;
 
 	/**
-	 * Send or receive data, called after a select.
+	 * Send or receive data, called when the socket is ready.
+	 *
+	 * @param flags the ready directions (SocketListener::Read, SocketListener::Write)
+	 */
+	void sync(int flags);
+
+	/**
+	 * Take the request being parsed, its replies will be sent later. The client does not acknowledge it
+	 * anymore when the command returns.
+	 *
+	 * @return the request
+	 */
+	TransportRequest defer() noexcept;
+
+	/**
+	 * Restore a deferred request before executing it, the next responses and errors are sent with its identifier.
 	 *
-	 * @param setinput the input fd_set
-	 * @param setoutput the output fd_set
+	 * @param request the request returned by defer()
 	 */
-	void sync(fd_set &setinput, fd_set &setoutput);
+	void resume(TransportRequest request) noexcept;
 
 	/**
-	 * Send an error message to the client.
+	 * Terminate the current request. If it has an identifier and nothing has been sent, an acknowledgement
+	 * { "response": "command", "id": ... } is sent.
+	 */
+	void complete();
+
+	/**
+	 * Send an error message to the client, with the identifier of the current request.
 	 *
 	 * @param message the error message
 	 */
@@ -324,11 +460,24 @@ public:
 	 * Send some data, it will be pushed to the outgoing buffer.
 	 *
 	 * This function appends "\r\n\r\n" after the message so you don't have
-	 * to do it manually.
+	 * to do it manually. The message is converted if the client uses MessagePack.
+	 *
+	 * The identifier of the current request is added to the message.
+	 *
+	 * @param message the JSON message
+	 */
+	void send(const std::string &message);
+
+	/**
+	 * Send a message shared with other clients, see TransportOutput::make and TransportOutput::makeFrame, it must
+	 * be in the client format.
+	 *
+	 * Depending on the policy, the oldest messages are discarded or onOverflow is emitted if the client does not
+	 * read fast enough.
 	 *
 	 * @param message the message
 	 */
-	void send(std::string message);
+	void send(TransportOutput::Message message);
 
 	/**
 	 * Tell if the client has data pending for output.
@@ -340,6 +489,46 @@ public:
 		return !m_output.empty();
 	}
 
+	/**
+	 * Get the format of the messages exchanged with this client.
+	 *
+	 * @return the format
+	 */
+	inline TransportFormat format() const noexcept
+	{
+		return m_format;
+	}
+
+	/**
+	 * Get the output queue, for the statistics.
+	 *
+	 * @return the output
+	 */
+	inline const TransportOutput &output() const noexcept
+	{
+		return m_output;
+	}
+
+	/**
+	 * Get the events this client wants.
+	 *
+	 * @return the filter
+	 */
+	inline const TransportFilter &filter() const noexcept
+	{
+		return m_filter;
+	}
+
+	/**
+	 * Change the events this client wants.
+	 *
+	 * @param filter the filter
+	 */
+	inline void setFilter(TransportFilter filter) noexcept
+	{
+		m_filter = std::move(filter);
+	}
+
 	/**
 	 * Get the underlying socket.
 	 *
@@ -366,10 +555,15 @@ public:
 	 * Create a client.
 	 *
 	 * @param sock the socket
+	 * @param output the output queue
+	 * @param format the initial format
 	 */
-	inline TransportClient(SocketTcp<Address> socket)
-		: m_socket{std::move(socket)}
+	inline TransportClient(SocketTcp<Address> socket, TransportOutput output = TransportOutput(), TransportFormat format = TransportFormat::Json)
+		: TransportClientAbstract(std::move(output), format)
+		, m_socket{std::move(socket)}
 	{
+		/* A slow client must not block the event loop */
+		m_socket.setBlockMode(false);
 	}
 
 	/**
@@ -385,40 +579,60 @@ template <typename Address>
 void TransportClient<Address>::receive()
 {
 	try {
-		auto message = m_socket.recv(512);
+		std::size_t length;
+		char *data = m_input.reserve(length);
+		unsigned nbread = m_socket.recv(data, static_cast<unsigned>(length));
 
-		if (message.empty()) {
+		if (nbread == 0) {
 			throw std::runtime_error("client disconnected");
 		}
 
-		m_input += message;
+		m_input.commit(nbread);
+	} catch (const SocketError &ex) {
+		if (ex.code() != SocketError::WouldBlockRead) {
+			onDie();
+		}
+
+		return;
 	} catch (const std::exception &ex) {
 		onDie();
+		return;
 	}
 
-	std::string::size_type pos;
-	while ((pos = m_input.find("\r\n\r\n")) != std::string::npos) {
-		/*
-		 * Make a copy and erase it in case that onComplete function
-		 * throws.
-		 */
-		auto message = m_input.substr(0, pos);
-
-		m_input.erase(m_input.begin(), m_input.begin() + pos + 4);
-
-		try {
-			parse(message);
-		} catch (const std::exception &ex) {
-			// TODO: report error to client
-			Logger::warning() << "transport: " << ex.what() << std::endl;
+	try {
+		const char *message;
+		std::size_t length;
+
+		while (next(message, length)) {
+			try {
+				parse(message, length);
+			} catch (const std::exception &ex) {
+				/* The message could not be decoded, its identifier is unknown */
+				Logger::warning() << "transport: " << ex.what() << std::endl;
+				error(ex.what());
+			}
 		}
+	} catch (const std::length_error &ex) {
+		/* The rest of the stream can not be framed anymore */
+		Logger::warning() << "transport: " << ex.what() << ", closing the client" << std::endl;
+		onDie();
 	}
 }
 
 template <typename Address>
 void TransportClient<Address>::send()
 {
-	m_output.erase(0, m_socket.send(m_output));
+	try {
+		m_output.write(m_socket.handle());
+	} catch (const std::exception &ex) {
+		Logger::warning() << "transport: " << ex.what() << std::endl;
+		onDie();
+		return;
+	}
+
+	if (m_output.empty()) {
+		m_dropping = false;
+	}
 }
 
 } // !irccd
@@ -0,0 +1,196 @@
+/*
+ * TransportFilter.cpp -- per client filter of the transport events
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+#include "Server.h"
+#include "TransportFilter.h"
+
+namespace irccd {
+
+namespace {
+
+inline char lower(char c) noexcept
+{
+	return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+std::vector<std::string> lowercase(std::vector<std::string> list)
+{
+	for (std::string &value : list) {
+		std::transform(value.begin(), value.end(), value.begin(), lower);
+	}
+
+	return list;
+}
+
+bool equals(const std::string &lowered, const char *value, std::size_t length) noexcept
+{
+	if (lowered.length() != length) {
+		return false;
+	}
+
+	for (std::size_t i = 0; i < length; ++i) {
+		if (lowered[i] != lower(value[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Only the last star is backtracked, which is enough since a star matches everything the previous one could.
+ */
+bool wildcard(const std::string &pattern, const char *value, std::size_t length) noexcept
+{
+	std::size_t p = 0, v = 0;
+	std::size_t star = std::string::npos, mark = 0;
+
+	while (v < length) {
+		if (p < pattern.length() && pattern[p] == '*') {
+			star = p++;
+			mark = v;
+		} else if (p < pattern.length() && (pattern[p] == '?' || pattern[p] == lower(value[v]))) {
+			++ p;
+			++ v;
+		} else if (star != std::string::npos) {
+			p = star + 1;
+			v = ++ mark;
+		} else {
+			return false;
+		}
+	}
+
+	while (p < pattern.length() && pattern[p] == '*') {
+		++ p;
+	}
+
+	return p == pattern.length();
+}
+
+} // !namespace
+
+bool TransportFilter::matchChannel(const char *channel, std::size_t length) const noexcept
+{
+	return std::any_of(m_channels.begin(), m_channels.end(), [&] (const std::string &value) {
+		return equals(value, channel, length);
+	});
+}
+
+bool TransportFilter::matchOrigin(const char *origin, std::size_t length) const noexcept
+{
+	/* Only the nickname, like the rules */
+	length = std::find(origin, origin + length, '!') - origin;
+
+	return std::any_of(m_origins.begin(), m_origins.end(), [&] (const std::string &pattern) {
+		return wildcard(pattern, origin, length);
+	});
+}
+
+bool TransportFilter::matchBatch(const ServerEvent &event) const noexcept
+{
+	if (m_anyChannel && m_anyOrigin) {
+		return true;
+	}
+
+	for (const ServerEventEntry &entry : event.entries) {
+		if ((m_anyChannel || matchChannel(entry.channel.data, entry.channel.length)) &&
+		    (m_anyOrigin || matchOrigin(entry.origin.data, entry.origin.length))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+TransportFilter::TransportFilter()
+{
+	m_events.set();
+}
+
+void TransportFilter::setEvents(const std::vector<std::string> &events)
+{
+	Events result;
+
+	for (const std::string &name : events) {
+		std::size_t i = 0;
+
+		while (i < result.size() && name != ServerEvent::typeName(static_cast<ServerEventType>(i))) {
+			++ i;
+		}
+
+		if (i == result.size()) {
+			throw std::invalid_argument("invalid event: " + name);
+		}
+
+		result.set(i);
+	}
+
+	m_events = result;
+	m_all = false;
+}
+
+void TransportFilter::setServers(std::vector<std::string> servers)
+{
+	m_servers = std::unordered_set<std::string>(servers.begin(), servers.end());
+	m_anyServer = false;
+	m_all = false;
+}
+
+void TransportFilter::setChannels(std::vector<std::string> channels)
+{
+	m_channels = lowercase(std::move(channels));
+	m_anyChannel = false;
+	m_all = false;
+}
+
+void TransportFilter::setOrigins(std::vector<std::string> origins)
+{
+	m_origins = lowercase(std::move(origins));
+	m_anyOrigin = false;
+	m_all = false;
+}
+
+bool TransportFilter::match(const ServerEvent &event) const noexcept
+{
+	if (m_all) {
+		return true;
+	}
+	if (!m_events.test(static_cast<std::size_t>(event.type))) {
+		return false;
+	}
+	if (!m_anyServer && (event.server == nullptr || m_servers.count(event.server->info().name) == 0)) {
+		return false;
+	}
+	if (event.isBatch()) {
+		return matchBatch(event);
+	}
+	if (!m_anyChannel && event.channel.length > 0 && !matchChannel(event.channel.data, event.channel.length)) {
+		return false;
+	}
+	if (!m_anyOrigin && event.origin.length > 0 && !matchOrigin(event.origin.data, event.origin.length)) {
+		return false;
+	}
+
+	return true;
+}
+
+} // !irccd
@@ -0,0 +1,123 @@
+/*
+ * TransportFilter.h -- per client filter of the transport events
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_TRANSPORT_FILTER_H_
+#define _IRCCD_TRANSPORT_FILTER_H_
+
+/**
+ * @file TransportFilter.h
+ * @brief Per client filter of the transport events
+ */
+
+#include <bitset>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "ServerEvent.h"
+
+namespace irccd {
+
+/**
+ * @class TransportFilter
+ * @brief Per client filter of the transport events
+ *
+ * A transport client may only want some events, on some servers, channels or from some users. The filter is
+ * compiled once when the client subscribes and is checked before the event is serialized, the events that no client
+ * wants are never converted to JSON.
+ *
+ * Each criterion is optional, an unset criterion accepts everything. The channels are compared case-insensitively
+ * and the origins are wildcard patterns (`*' and `?') matched against the nickname part of the origin. The channel
+ * and origin criteria only apply to the events that have these fields: an origin filter does not hide onNames for
+ * instance. A batch is accepted if one of its entries is.
+ */
+class TransportFilter {
+private:
+	using Events = std::bitset<static_cast<std::size_t>(ServerEventType::UserMode) + 1>;
+
+	Events m_events;
+	std::unordered_set<std::string> m_servers;
+	std::vector<std::string> m_channels;
+	std::vector<std::string> m_origins;
+
+	bool m_all{true};
+	bool m_anyServer{true};
+	bool m_anyChannel{true};
+	bool m_anyOrigin{true};
+
+	bool matchChannel(const char *channel, std::size_t length) const noexcept;
+	bool matchOrigin(const char *origin, std::size_t length) const noexcept;
+	bool matchBatch(const ServerEvent &event) const noexcept;
+
+public:
+	/**
+	 * Create a filter that accepts every event, used until the client subscribes.
+	 */
+	TransportFilter();
+
+	/**
+	 * Accept only the given events.
+	 *
+	 * @param events the event names (e.g. onMessage)
+	 * @throw std::invalid_argument if an event does not exist
+	 */
+	void setEvents(const std::vector<std::string> &events);
+
+	/**
+	 * Accept only the events of the given servers.
+	 *
+	 * @param servers the server names
+	 */
+	void setServers(std::vector<std::string> servers);
+
+	/**
+	 * Accept only the events on the given channels.
+	 *
+	 * @param channels the channels
+	 */
+	void setChannels(std::vector<std::string> channels);
+
+	/**
+	 * Accept only the events from the users matching one of the patterns.
+	 *
+	 * @param origins the nickname patterns
+	 */
+	void setOrigins(std::vector<std::string> origins);
+
+	/**
+	 * Tell if the filter accepts everything.
+	 *
+	 * @return true if all events are accepted
+	 */
+	inline bool isAll() const noexcept
+	{
+		return m_all;
+	}
+
+	/**
+	 * Check if the client wants an event.
+	 *
+	 * @param event the event
+	 * @return true if the event must be sent
+	 */
+	bool match(const ServerEvent &event) const noexcept;
+};
+
+} // !irccd
+
+#endif // !_IRCCD_TRANSPORT_FILTER_H_
@@ -0,0 +1,177 @@
+/*
+ * TransportOutput.cpp -- bounded output queue of transport clients
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdint>
+
+#if !defined(_WIN32)
+#  include <sys/socket.h>
+#  include <sys/uio.h>
+#endif
+
+#include "TransportOutput.h"
+
+#if !defined(MSG_NOSIGNAL)
+#  define MSG_NOSIGNAL 0
+#endif
+
+namespace irccd {
+
+constexpr std::size_t TransportOutput::DefaultLimit;
+constexpr std::size_t TransportOutput::MaxVectors;
+
+void TransportOutput::consume(std::size_t length) noexcept
+{
+	m_size -= length;
+
+	while (length > 0) {
+		std::size_t remaining = m_queue.front()->size() - m_offset;
+
+		if (length < remaining) {
+			m_offset += length;
+			break;
+		}
+
+		length -= remaining;
+		m_offset = 0;
+		m_queue.pop_front();
+		++ m_sent;
+	}
+}
+
+TransportOutput::TransportOutput(std::size_t limit, TransportOverflow overflow) noexcept
+	: m_limit(limit)
+	, m_overflow(overflow)
+{
+}
+
+TransportOutput::Message TransportOutput::make(std::string content)
+{
+	content.append("\r\n\r\n", 4);
+
+	return std::make_shared<const std::string>(std::move(content));
+}
+
+TransportOutput::Message TransportOutput::makeFrame(const std::string &content)
+{
+	std::string frame;
+	std::uint32_t length = static_cast<std::uint32_t>(content.length());
+
+	frame.reserve(content.length() + 4);
+	frame.push_back(static_cast<char>((length >> 24) & 0xff));
+	frame.push_back(static_cast<char>((length >> 16) & 0xff));
+	frame.push_back(static_cast<char>((length >> 8) & 0xff));
+	frame.push_back(static_cast<char>(length & 0xff));
+	frame += content;
+
+	return std::make_shared<const std::string>(std::move(frame));
+}
+
+bool TransportOutput::push(Message message)
+{
+	if (m_overflowed) {
+		++ m_dropped;
+		return false;
+	}
+
+	if (m_size + message->size() > m_limit && !m_queue.empty()) {
+		if (m_overflow == TransportOverflow::Disconnect) {
+			m_dropped += m_queue.size() + 1;
+			m_queue.clear();
+			m_offset = 0;
+			m_size = 0;
+			m_overflowed = true;
+
+			return false;
+		}
+
+		/* The message being sent must be completed */
+		std::size_t first = (m_offset > 0) ? 1 : 0;
+
+		while (m_queue.size() > first && m_size + message->size() > m_limit) {
+			m_size -= m_queue[first]->size();
+			m_queue.erase(m_queue.begin() + first);
+			++ m_dropped;
+		}
+	}
+
+	m_size += message->size();
+	m_queue.push_back(std::move(message));
+
+	return true;
+}
+
+std::size_t TransportOutput::write(SocketAbstract::Handle handle)
+{
+	if (m_queue.empty()) {
+		return 0;
+	}
+
+	++ m_writes;
+
+#if defined(_WIN32)
+	const std::string &front = *m_queue.front();
+	int nbsent = ::send(handle, front.data() + m_offset, static_cast<int>(front.size() - m_offset), 0);
+
+	if (nbsent == SocketAbstract::Error) {
+		int error = WSAGetLastError();
+
+		if (error == WSAEWOULDBLOCK) {
+			return 0;
+		}
+
+		throw SocketError{SocketError::System, "send", error};
+	}
+#else
+	iovec vectors[MaxVectors];
+	std::size_t count = 0;
+
+	for (auto it = m_queue.begin(); it != m_queue.end() && count < MaxVectors; ++it, ++count) {
+		std::size_t offset = (count == 0) ? m_offset : 0;
+
+		vectors[count].iov_base = const_cast<char *>((*it)->data() + offset);
+		vectors[count].iov_len = (*it)->size() - offset;
+	}
+
+	msghdr header{};
+
+	header.msg_iov = vectors;
+	header.msg_iovlen = count;
+
+	/* Like writev but without SIGPIPE when the client has gone */
+	ssize_t nbsent;
+
+	do {
+		nbsent = ::sendmsg(handle, &header, MSG_NOSIGNAL);
+	} while (nbsent < 0 && errno == EINTR);
+
+	if (nbsent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+
+		throw SocketError{SocketError::System, "sendmsg"};
+	}
+#endif
+
+	consume(static_cast<std::size_t>(nbsent));
+
+	return static_cast<std::size_t>(nbsent);
+}
+
+} // !irccd
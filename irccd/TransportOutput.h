@@ -0,0 +1,234 @@
+/*
+ * TransportOutput.h -- bounded output queue of transport clients
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _IRCCD_TRANSPORT_OUTPUT_H_
+#define _IRCCD_TRANSPORT_OUTPUT_H_
+
+/**
+ * @file TransportOutput.h
+ * @brief Bounded output queue of transport clients
+ */
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <Socket.h>
+
+namespace irccd {
+
+/**
+ * @enum TransportOverflow
+ * @brief What to do when a client does not read its output fast enough
+ */
+enum class TransportOverflow {
+	DropOldest,		//!< discard the oldest messages that are not being sent
+	Disconnect		//!< close the client
+};
+
+/**
+ * @enum TransportFormat
+ * @brief Encoding of the transport messages
+ */
+enum class TransportFormat {
+	Json,			//!< JSON objects separated by "\r\n\r\n"
+	MsgPack			//!< MessagePack maps prefixed by their length (32 bits, big endian)
+};
+
+/**
+ * @class TransportOutput
+ * @brief Bounded output queue of transport clients
+ *
+ * The messages are shared between the clients: an event is serialized once and each client queue only holds a
+ * reference to it. The pending messages are written with one scatter/gather call and the sent ones are released
+ * without copying the rest of the queue.
+ *
+ * The queue is bounded by a number of bytes. When a message would exceed the limit, the oldest messages are discarded
+ * or the queue is marked as overflowed depending on the policy, the client must then be closed. The message being
+ * sent is never discarded so the client does not receive a truncated frame, and a message is always accepted when
+ * the queue is empty even if it is larger than the limit.
+ */
+class TransportOutput {
+public:
+	/**
+	 * A message, the delimiter included.
+	 */
+	using Message = std::shared_ptr<const std::string>;
+
+	/**
+	 * Default limit in bytes.
+	 */
+	static constexpr std::size_t DefaultLimit{4194304};
+
+	/**
+	 * Maximum number of messages written at once.
+	 */
+	static constexpr std::size_t MaxVectors{64};
+
+private:
+	std::deque<Message> m_queue;
+	std::size_t m_offset{0};
+	std::size_t m_size{0};
+	std::size_t m_limit;
+	TransportOverflow m_overflow;
+	bool m_overflowed{false};
+
+	/* Statistics */
+	std::size_t m_sent{0};
+	std::size_t m_dropped{0};
+	std::size_t m_writes{0};
+
+	void consume(std::size_t length) noexcept;
+
+public:
+	/**
+	 * Create the queue.
+	 *
+	 * @param limit the maximum number of bytes pending
+	 * @param overflow the policy when the limit is reached
+	 */
+	TransportOutput(std::size_t limit = DefaultLimit, TransportOverflow overflow = TransportOverflow::DropOldest) noexcept;
+
+	/**
+	 * Create a message from its content.
+	 *
+	 * @param content the message without delimiter
+	 * @return the message
+	 */
+	static Message make(std::string content);
+
+	/**
+	 * Create a binary message, see TransportFormat::MsgPack.
+	 *
+	 * @param content the encoded message
+	 * @return the message
+	 */
+	static Message makeFrame(const std::string &content);
+
+	/**
+	 * Queue a message, depending on the policy the oldest messages may be discarded.
+	 *
+	 * @param message the message
+	 * @return false if the queue overflowed with the disconnect policy, the message is then discarded
+	 */
+	bool push(Message message);
+
+	/**
+	 * Write as many pending messages as possible.
+	 *
+	 * @param handle the socket
+	 * @return the number of bytes sent, 0 if the socket would block
+	 * @throw SocketError on errors
+	 */
+	std::size_t write(SocketAbstract::Handle handle);
+
+	/**
+	 * Tell if there is nothing to send.
+	 *
+	 * @return true if empty
+	 */
+	inline bool empty() const noexcept
+	{
+		return m_queue.empty();
+	}
+
+	/**
+	 * Get the number of bytes pending.
+	 *
+	 * @return the size
+	 */
+	inline std::size_t size() const noexcept
+	{
+		return m_size;
+	}
+
+	/**
+	 * Get the number of messages pending.
+	 *
+	 * @return the number of messages
+	 */
+	inline std::size_t count() const noexcept
+	{
+		return m_queue.size();
+	}
+
+	/**
+	 * Get the limit.
+	 *
+	 * @return the limit in bytes
+	 */
+	inline std::size_t limit() const noexcept
+	{
+		return m_limit;
+	}
+
+	/**
+	 * Get the overflow policy.
+	 *
+	 * @return the policy
+	 */
+	inline TransportOverflow overflow() const noexcept
+	{
+		return m_overflow;
+	}
+
+	/**
+	 * Tell if the queue overflowed with the disconnect policy, no more messages are accepted.
+	 *
+	 * @return true if overflowed
+	 */
+	inline bool isOverflowed() const noexcept
+	{
+		return m_overflowed;
+	}
+
+	/**
+	 * Get the number of messages completely sent.
+	 *
+	 * @return the number of messages
+	 */
+	inline std::size_t sent() const noexcept
+	{
+		return m_sent;
+	}
+
+	/**
+	 * Get the number of messages discarded.
+	 *
+	 * @return the number of messages
+	 */
+	inline std::size_t dropped() const noexcept
+	{
+		return m_dropped;
+	}
+
+	/**
+	 * Get the number of write calls.
+	 *
+	 * @return the number of writes
+	 */
+	inline std::size_t writes() const noexcept
+	{
+		return m_writes;
+	}
+};
+
+} // !irccd
+
+#endif // !_IRCCD_TRANSPORT_OUTPUT_H_
@@ -59,6 +59,11 @@ private:
 	TransportServerAbstract &operator=(const TransportServerAbstract &) = delete;
 	TransportServerAbstract &operator=(TransportServerAbstract &&) = delete;
 
+protected:
+	std::size_t m_outputLimit{TransportOutput::DefaultLimit};
+	TransportOverflow m_outputOverflow{TransportOverflow::DropOldest};
+	TransportFormat m_format{TransportFormat::Json};
+
 public:
 	/**
 	 * Default constructor.
@@ -84,6 +89,28 @@ public:
 	 */
 	virtual std::shared_ptr<TransportClientAbstract> accept() = 0;
 
+	/**
+	 * Bound the output of the clients accepted from now.
+	 *
+	 * @param limit the maximum number of bytes pending per client
+	 * @param overflow the policy when a client reaches the limit
+	 */
+	inline void setOutputLimit(std::size_t limit, TransportOverflow overflow) noexcept
+	{
+		m_outputLimit = limit;
+		m_outputOverflow = overflow;
+	}
+
+	/**
+	 * Set the initial format of the clients accepted from now.
+	 *
+	 * @param format the format
+	 */
+	inline void setFormat(TransportFormat format) noexcept
+	{
+		m_format = format;
+	}
+
 	/**
 	 * Get information about the transport.
 	 *
@@ -132,7 +159,7 @@ public:
 	 */
 	std::shared_ptr<TransportClientAbstract> accept() override
 	{
-		return std::make_shared<TransportClient<Address>>(m_socket.accept());
+		return std::make_shared<TransportClient<Address>>(m_socket.accept(), TransportOutput(m_outputLimit, m_outputOverflow), m_format);
 	}
 };
 
@@ -16,6 +16,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <chrono>
 #include <csignal>
 #include <iostream>
 #include <memory>
@@ -42,6 +43,10 @@ namespace irccd {
  * uid = number or name (Unix only)
  * gid = number or name (Unix only)
  * foreground = true | false (Unix only)
+ * workers = number of plugin threads (Optional, default: 0)
+ * dns-cache = seconds to keep resolved host names (Optional, default: 60, 0 to disable)
+ * connect-limit = maximum number of servers connecting at the same time (Optional, default: 4, 0 for unlimited)
+ * reactors = number of threads running the servers (Optional, default: 0 to run them in the main loop)
  *
  * [logs]
  * verbose = true | false
@@ -71,6 +76,16 @@ namespace irccd {
  * identity = identity name (Optional, use default)
  * auto-rejoin = true | false (Optional, default: false)
  * channels = space separated list of channels to join in format channel[:password]
+ * flood-burst = number of commands sent at once before rate limiting (Optional, default: 5, 0 to disable)
+ * flood-delay = milliseconds to earn one more command (Optional, default: 2000)
+ * queue-size = maximum number of pending commands (Optional, default: 512, 0 for unbounded)
+ * queue-overflow = drop-oldest | drop-new (Optional, default: drop-oldest)
+ * batch-size = JOIN or PART received in a row delivered as onJoinBatch or onPartBatch (Optional, default: 8, 0 to disable)
+ * reconnect-tries = number of tries before giving up, -1 to disable (Optional, default: 3)
+ * reconnect-timeout = seconds to wait before reconnecting (Optional, default: 30)
+ * reconnect-max-timeout = maximum seconds to wait after consecutive failures (Optional, default: 300)
+ * ping-interval = seconds between two PING probes measuring the lag (Optional, default: 30, 0 to disable)
+ * ping-timeout = seconds without data before reconnecting (Optional, default: 90, 0 to disable)
  *
  * [plugin.<plugin name>]
  * <parameter name> = <parameter value>
@@ -81,8 +96,52 @@ namespace irccd {
  * origins = a list of nicknames
  * plugins = which plugins
  * events = which events (e.g onCommand, onMessage, ...)
+ * action = accept | drop
  */
 
+void loadGeneral(Irccd &irccd, const Ini &config)
+{
+	for (const IniSection &section : config) {
+		if (section.key() != "general") {
+			continue;
+		}
+
+		if (section.contains("dns-cache")) {
+			try {
+				irccd.resolver().setCacheTime(std::chrono::seconds(std::stoul(section["dns-cache"].value())));
+			} catch (const std::exception &) {
+				Logger::warning() << "general: `" << section["dns-cache"].value() << "': invalid cache time" << std::endl;
+			}
+		}
+
+		if (section.contains("connect-limit")) {
+			try {
+				irccd.scheduler().setLimit(std::stoul(section["connect-limit"].value()));
+			} catch (const std::exception &) {
+				Logger::warning() << "general: `" << section["connect-limit"].value() << "': invalid connect limit" << std::endl;
+			}
+		}
+
+		if (section.contains("reactors")) {
+			try {
+				irccd.setReactors(std::stoul(section["reactors"].value()));
+			} catch (const std::exception &) {
+				Logger::warning() << "general: `" << section["reactors"].value() << "': invalid number of reactors" << std::endl;
+			}
+		}
+
+#if defined(WITH_JS)
+		if (section.contains("workers")) {
+			try {
+				irccd.setWorkers(std::stoul(section["workers"].value()));
+			} catch (const std::exception &) {
+				Logger::warning() << "general: `" << section["workers"].value() << "': invalid number of workers" << std::endl;
+			}
+		}
+#endif
+	}
+}
+
 void loadPlugin(Irccd &irccd, const IniSection &sc)
 {
 	for (const IniOption &option : sc) {
@@ -131,6 +190,63 @@ void loadPlugins(Irccd &irccd, const Ini &config)
 	}
 }
 
+RuleMap loadRuleSet(const IniSection &sc, const std::string &name)
+{
+	RuleMap result;
+
+	if (sc.contains(name)) {
+		for (std::string value : Util::split(sc[name].value(), " \t")) {
+			result.insert(std::move(value));
+		}
+	}
+
+	return result;
+}
+
+void loadRule(Irccd &irccd, const IniSection &sc)
+{
+	RuleMap events = loadRuleSet(sc, "events");
+	RuleAction action = RuleAction::Accept;
+
+	for (const std::string &event : events) {
+		if (RuleValidEvents.count(event) == 0) {
+			throw std::invalid_argument("`"s + event + "'"s + ": invalid event"s);
+		}
+	}
+
+	if (sc.contains("action")) {
+		auto value = sc["action"].value();
+
+		if (value == "drop") {
+			action = RuleAction::Drop;
+		} else if (value != "accept") {
+			throw std::invalid_argument("`"s + value + "'"s + ": invalid action"s);
+		}
+	}
+
+	irccd.addRule(Rule(
+		loadRuleSet(sc, "servers"),
+		loadRuleSet(sc, "channels"),
+		loadRuleSet(sc, "origins"),
+		loadRuleSet(sc, "plugins"),
+		std::move(events),
+		action
+	));
+}
+
+void loadRules(Irccd &irccd, const Ini &config)
+{
+	for (const IniSection &section : config) {
+		if (section.key() == "rule") {
+			try {
+				loadRule(irccd, section);
+			} catch (const std::exception &ex) {
+				Logger::warning() << "rule: " << ex.what() << std::endl;
+			}
+		}
+	}
+}
+
 void loadServer(Irccd &irccd, const IniSection &sc)
 {
 	ServerInfo info;
@@ -181,6 +297,67 @@ void loadServer(Irccd &irccd, const IniSection &sc)
 		}
 	}
 
+	auto boolean = [&] (const char *key, bool &value) {
+		if (sc.contains(key)) {
+			auto v = sc[key].value();
+
+			value = v == "true" || v == "yes" || v == "1";
+		}
+	};
+
+	boolean("ipv6", info.ipv6);
+	boolean("ssl", info.ssl);
+	boolean("ssl-verify", info.sslverify);
+
+	/* Outgoing rate limit */
+	auto number = [&] (const char *key, unsigned &value) {
+		if (sc.contains(key)) {
+			try {
+				value = std::stoul(sc[key].value());
+			} catch (const std::exception &) {
+				throw std::invalid_argument("`"s + sc[key].value() + "'"s + ": invalid "s + key);
+			}
+		}
+	};
+
+	number("flood-burst", settings.floodburst);
+	number("flood-delay", settings.flooddelay);
+	number("queue-size", settings.queuesize);
+
+	/* Reconnection */
+	auto integer = [&] (const char *key, int &value) {
+		if (sc.contains(key)) {
+			try {
+				value = std::stoi(sc[key].value());
+			} catch (const std::exception &) {
+				throw std::invalid_argument("`"s + sc[key].value() + "'"s + ": invalid "s + key);
+			}
+		}
+	};
+
+	integer("reconnect-tries", settings.recotries);
+	integer("reconnect-timeout", settings.recotimeout);
+	integer("reconnect-max-timeout", settings.recomaxtimeout);
+
+	/* Netjoin and netsplit coalescing */
+	number("batch-size", settings.batchsize);
+
+	/* Lag and stale connection detection */
+	integer("ping-interval", settings.pinginterval);
+	integer("ping-timeout", settings.pingtimeout);
+
+	if (sc.contains("queue-overflow")) {
+		auto value = sc["queue-overflow"].value();
+
+		if (value == "drop-new") {
+			settings.queueoverflow = ServerOverflow::DropNew;
+		} else if (value == "drop-oldest") {
+			settings.queueoverflow = ServerOverflow::DropOldest;
+		} else {
+			throw std::invalid_argument("`"s + value + "'"s + ": invalid queue-overflow"s);
+		}
+	}
+
 	irccd.addServer(std::make_shared<Server>(std::move(info), std::move(identity), std::move(settings)));
 }
 
@@ -247,6 +424,40 @@ void loadIdentities(Irccd &irccd, const Ini &config)
 	}
 }
 
+/*
+ * Message format and bounded output of the slow clients, common to all listener types.
+ */
+void loadListenerOutput(TransportServerAbstract &transport, const IniSection &sc)
+{
+	if (sc.contains("format")) {
+		auto value = sc["format"].value();
+
+		if (value == "msgpack") {
+			transport.setFormat(TransportFormat::MsgPack);
+		} else if (value != "json") {
+			throw std::invalid_argument("`"s + value + "'"s + ": invalid format"s);
+		}
+	}
+
+	std::size_t limit = TransportOutput::DefaultLimit;
+	TransportOverflow overflow = TransportOverflow::DropOldest;
+
+	if (sc.contains("output-limit")) {
+		limit = std::stoul(sc["output-limit"].value());
+	}
+	if (sc.contains("output-overflow")) {
+		auto value = sc["output-overflow"].value();
+
+		if (value == "disconnect") {
+			overflow = TransportOverflow::Disconnect;
+		} else if (value != "drop-oldest") {
+			throw std::invalid_argument("`"s + value + "'"s + ": invalid output-overflow"s);
+		}
+	}
+
+	transport.setOutputLimit(limit, overflow);
+}
+
 void loadListenerInet(Irccd &irccd, const IniSection &sc)
 {
 	// TODO ipv4 and ipv6 back
@@ -263,7 +474,10 @@ void loadListenerInet(Irccd &irccd, const IniSection &sc)
 		address = sc["address"].value();
 	}
 
-	irccd.addTransport(std::make_shared<TransportServerIpv4>(address, port));
+	auto transport = std::make_shared<TransportServerIpv4>(address, port);
+
+	loadListenerOutput(*transport, sc);
+	irccd.addTransport(std::move(transport));
 }
 
 void loadListenerUnix(Irccd &irccd, const IniSection &sc)
@@ -304,9 +518,11 @@ bool openConfig(Irccd &irccd, const std::string &path)
 		 */
 		Ini config(path);
 
+		loadGeneral(irccd, config);
 		loadIdentities(irccd, config);
 		loadServers(irccd, config);
 		loadPlugins(irccd, config);
+		loadRules(irccd, config);
 		loadListeners(irccd, config);
 	} catch (const std::exception &ex) {
 		Logger::info() << getprogname() << ": " << path << ": " << ex.what() << std::endl;
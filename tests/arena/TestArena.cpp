@@ -0,0 +1,390 @@
+/*
+ * TestArena.cpp -- test the event arena
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <Arena.h>
+#include <Server.h>
+#include <ServerEvent.h>
+
+using namespace irccd;
+
+/*
+ * Count every heap allocation of the process, the benchmark only looks at the difference around the measured code.
+ */
+namespace {
+
+std::size_t allocations{0};
+
+} // !namespace
+
+void *operator new(std::size_t size)
+{
+	++ allocations;
+
+	if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+/* --------------------------------------------------------
+ * Arena
+ * -------------------------------------------------------- */
+
+TEST(Basic, alignment)
+{
+	Arena arena(64);
+
+	for (std::size_t alignment : { 1, 2, 4, 8, 16 }) {
+		arena.allocate(1, 1);
+
+		auto ptr = reinterpret_cast<std::uintptr_t>(arena.allocate(3, alignment));
+
+		ASSERT_EQ(0U, ptr % alignment);
+	}
+}
+
+TEST(Basic, copy)
+{
+	Arena arena(16);
+
+	ArenaString empty = arena.copy("");
+	ArenaString hello = arena.copy("hello");
+	ArenaString large = arena.copy(std::string(100, 'x'));
+
+	ASSERT_EQ("", empty.str());
+	ASSERT_EQ('\0', empty.data[0]);
+	ASSERT_EQ("hello", hello.str());
+	ASSERT_EQ('\0', hello.data[5]);
+	ASSERT_EQ(std::string(100, 'x'), large.str());
+}
+
+TEST(Basic, array)
+{
+	Arena arena(16);
+
+	ArenaArray<ArenaString> empty = arena.array<ArenaString>(0);
+	ArenaArray<ArenaString> strings = arena.array<ArenaString>(3);
+
+	ASSERT_EQ(0U, empty.length);
+	ASSERT_EQ(3U, strings.length);
+	ASSERT_EQ(0U, reinterpret_cast<std::uintptr_t>(strings.data) % alignof(ArenaString));
+
+	/* Default constructed */
+	for (const ArenaString &string : strings) {
+		ASSERT_EQ("", string.str());
+	}
+
+	strings[1] = arena.copy("hello");
+
+	ASSERT_EQ("hello", strings[1].str());
+}
+
+TEST(Basic, reset)
+{
+	Arena arena(32);
+	std::string value{"a string that does not fit in one block"};
+
+	for (int i = 0; i < 10; ++i) {
+		arena.copy(value);
+	}
+
+	ASSERT_LT(1U, arena.blocks());
+
+	/* All blocks are merged, the same workload then fits in a single block */
+	arena.reset();
+
+	ASSERT_EQ(1U, arena.blocks());
+	ASSERT_EQ(0U, arena.used());
+
+	std::size_t before = allocations;
+
+	for (int i = 0; i < 10; ++i) {
+		arena.copy(value);
+	}
+
+	ASSERT_EQ(before, allocations);
+	ASSERT_EQ(1U, arena.blocks());
+}
+
+TEST(Basic, event)
+{
+	Arena arena;
+	ServerEvent *event = ServerEvent::create(arena, ServerEventType::Kick, nullptr, "jean!jean@localhost", "#staff", "francis", "spam");
+
+	ASSERT_EQ(ServerEventType::Kick, event->type);
+	ASSERT_EQ("jean!jean@localhost", event->origin.str());
+	ASSERT_EQ("#staff", event->channel.str());
+	ASSERT_EQ("francis", event->message.str());
+	ASSERT_EQ("spam", event->extra.str());
+}
+
+/* --------------------------------------------------------
+ * Plugin commands
+ * -------------------------------------------------------- */
+
+namespace {
+
+ServerEvent *command(Arena &arena, const std::string &message, const std::string &prefix = "!")
+{
+	ServerEvent *event = ServerEvent::create(arena, ServerEventType::Message, nullptr, "jean", "#staff", message);
+
+	event->parseCommand(arena, prefix);
+
+	return event;
+}
+
+} // !namespace
+
+TEST(Command, simple)
+{
+	Arena arena;
+	ServerEvent *event = command(arena, "!ask will I be rich?");
+
+	ASSERT_EQ("ask", event->plugin.str());
+	ASSERT_EQ("will I be rich?", event->command.str());
+	ASSERT_EQ("!ask will I be rich?", event->message.str());
+	ASSERT_TRUE(event->isCommandFor("ask"));
+	ASSERT_FALSE(event->isCommandFor("as"));
+	ASSERT_FALSE(event->isCommandFor("asks"));
+}
+
+TEST(Command, noArguments)
+{
+	Arena arena;
+	ServerEvent *event = command(arena, "!ask");
+
+	ASSERT_EQ("ask", event->plugin.str());
+	ASSERT_EQ("", event->command.str());
+}
+
+TEST(Command, tab)
+{
+	Arena arena;
+	ServerEvent *event = command(arena, "!ask\tsomething");
+
+	ASSERT_EQ("ask", event->plugin.str());
+	ASSERT_EQ("something", event->command.str());
+}
+
+TEST(Command, prefix)
+{
+	Arena arena;
+	ServerEvent *event = command(arena, "irccd: ask something", "irccd: ");
+
+	ASSERT_EQ("ask", event->plugin.str());
+	ASSERT_EQ("something", event->command.str());
+}
+
+TEST(Command, none)
+{
+	Arena arena;
+
+	ASSERT_EQ(0U, command(arena, "hello world")->plugin.length);
+	ASSERT_EQ(0U, command(arena, "! ask")->plugin.length);
+	ASSERT_EQ(0U, command(arena, "!")->plugin.length);
+	ASSERT_EQ(0U, command(arena, "!ask", "")->plugin.length);
+	ASSERT_FALSE(command(arena, "hello")->isCommandFor(""));
+}
+
+/* --------------------------------------------------------
+ * Join and part batches
+ * -------------------------------------------------------- */
+
+TEST(Batch, join)
+{
+	Arena arena;
+	ServerEvent *event = ServerEvent::create(arena, ServerEventType::JoinBatch, nullptr, {
+		{ "jean!jean@localhost", "#staff", "" },
+		{ "francis!francis@localhost", "#test", "" }
+	});
+
+	ASSERT_TRUE(event->isBatch());
+	ASSERT_EQ("", event->channel.str());
+
+	const auto &entries = event->entries;
+
+	ASSERT_EQ(2U, entries.length);
+	ASSERT_EQ("jean!jean@localhost", entries[0].origin.str());
+	ASSERT_EQ("#staff", entries[0].channel.str());
+	ASSERT_EQ("francis!francis@localhost", entries[1].origin.str());
+	ASSERT_EQ("#test", entries[1].channel.str());
+	ASSERT_EQ("", entries[1].reason.str());
+}
+
+TEST(Batch, part)
+{
+	Arena arena;
+	ServerEvent *event = ServerEvent::create(arena, ServerEventType::PartBatch, nullptr, {
+		{ "jean", "#staff", "irc.example.org irc2.example.org" },
+		{ "francis", "#staff", "" }
+	});
+
+	/* Same channel for all entries, the rules can use it */
+	ASSERT_EQ("#staff", event->channel.str());
+
+	const auto &entries = event->entries;
+
+	ASSERT_EQ(2U, entries.length);
+	ASSERT_EQ("irc.example.org irc2.example.org", entries[0].reason.str());
+	ASSERT_EQ("francis", entries[1].origin.str());
+	ASSERT_EQ("", entries[1].reason.str());
+}
+
+/* --------------------------------------------------------
+ * Allocations per event, closures vs arena
+ * -------------------------------------------------------- */
+
+namespace {
+
+const int rounds = 100;
+const int perRound = 100;
+
+const std::string origin{"markand!~markand@irc.example.org"};
+const std::string channel{"#irccd-development"};
+const std::string message{"this message is long enough to not fit in the small string buffer"};
+
+/*
+ * Previous representation, every field is a std::string and the three std::function capture copies of the
+ * arguments again, the event is then shared into the dispatch closure.
+ */
+class LegacyEvent {
+public:
+	std::string server;
+	std::string origin;
+	std::string target;
+	std::function<std::string ()> json;
+	std::function<std::string (int)> name;
+	std::function<void (int)> exec;
+};
+
+using LegacyEvents = std::vector<std::function<void ()>>;
+
+void legacyHandler(LegacyEvents &events, std::shared_ptr<int> server, std::string origin, std::string channel, std::string message)
+{
+	LegacyEvent event{"local", origin, channel,
+		[=] () -> std::string {
+			return std::to_string(*server) + origin + channel + message;
+		},
+		[=] (int) -> std::string {
+			return "onMessage";
+		},
+		[=] (int plugin) {
+			(void)plugin;
+			(void)origin;
+			(void)channel;
+			(void)message;
+		}
+	};
+
+	events.push_back([event = std::make_shared<LegacyEvent>(std::move(event))] () {
+		event->exec(event->name(0).size());
+	});
+}
+
+void arenaHandler(Arena &arena, std::vector<ServerEvent *> &events, const std::string &origin, const std::string &channel, const std::string &message)
+{
+	events.push_back(ServerEvent::create(arena, ServerEventType::Message, nullptr, origin, channel, message));
+}
+
+} // !namespace
+
+TEST(Benchmark, allocations)
+{
+	/* Previous implementation */
+	LegacyEvents legacy;
+	std::shared_ptr<int> server = std::make_shared<int>(0);
+	std::size_t before = allocations;
+
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < perRound; ++i) {
+			legacyHandler(legacy, server, origin, channel, message);
+		}
+
+		LegacyEvents copy = std::move(legacy);
+
+		legacy.clear();
+
+		for (auto &ev : copy) {
+			ev();
+		}
+	}
+
+	std::size_t legacyCount = allocations - before;
+
+	/* Arena, first round is a warm up that sizes the arena and the vector */
+	Arena arena;
+	std::vector<ServerEvent *> events;
+
+	for (int i = 0; i < perRound; ++i) {
+		arenaHandler(arena, events, origin, channel, message);
+	}
+
+	events.clear();
+	arena.reset();
+	before = allocations;
+
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < perRound; ++i) {
+			arenaHandler(arena, events, origin, channel, message);
+		}
+
+		for (ServerEvent *event : events) {
+			ASSERT_EQ(ServerEventType::Message, event->type);
+		}
+
+		events.clear();
+		arena.reset();
+	}
+
+	std::size_t arenaCount = allocations - before;
+
+	std::cout << "closures: " << legacyCount << " allocations for " << rounds * perRound << " events" << std::endl;
+	std::cout << "arena:    " << arenaCount << " allocations for " << rounds * perRound << " events" << std::endl;
+
+	ASSERT_EQ(0U, arenaCount);
+	ASSERT_LT(arenaCount, legacyCount);
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,130 @@
+/*
+ * TestConnectScheduler.cpp -- test the concurrent connection limit
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ConnectScheduler.h>
+
+using namespace irccd;
+
+TEST(ConnectScheduler, limit)
+{
+	ConnectScheduler scheduler;
+
+	scheduler.setLimit(2);
+
+	ConnectTicket a(scheduler, "a");
+	ConnectTicket b(scheduler, "b");
+	ConnectTicket c(scheduler, "c");
+
+	ASSERT_TRUE(a.acquire());
+	ASSERT_TRUE(b.acquire());
+	ASSERT_FALSE(c.acquire());
+	ASSERT_FALSE(scheduler.available());
+	ASSERT_EQ((std::vector<std::string>{"a", "b"}), scheduler.active());
+	ASSERT_EQ((std::deque<std::string>{"c"}), scheduler.waiting());
+}
+
+TEST(ConnectScheduler, release)
+{
+	ConnectScheduler scheduler;
+
+	scheduler.setLimit(1);
+
+	auto a = std::make_unique<ConnectTicket>(scheduler, "a");
+	ConnectTicket b(scheduler, "b");
+
+	ASSERT_TRUE(a->acquire());
+	ASSERT_FALSE(b.acquire());
+
+	a.reset();
+
+	ASSERT_TRUE(scheduler.available());
+	ASSERT_TRUE(b.acquire());
+	ASSERT_TRUE(b.active());
+	ASSERT_TRUE(scheduler.waiting().empty());
+}
+
+TEST(ConnectScheduler, order)
+{
+	ConnectScheduler scheduler;
+
+	scheduler.setLimit(1);
+
+	auto a = std::make_unique<ConnectTicket>(scheduler, "a");
+	ConnectTicket b(scheduler, "b");
+	ConnectTicket c(scheduler, "c");
+
+	ASSERT_TRUE(a->acquire());
+
+	a.reset();
+
+	/* c came after b */
+	ASSERT_FALSE(c.acquire());
+	ASSERT_TRUE(b.acquire());
+}
+
+TEST(ConnectScheduler, cancel)
+{
+	ConnectScheduler scheduler;
+
+	scheduler.setLimit(1);
+
+	ConnectTicket a(scheduler, "a");
+
+	ASSERT_TRUE(a.acquire());
+
+	{
+		ConnectTicket b(scheduler, "b");
+
+		ASSERT_FALSE(b.acquire());
+		ASSERT_EQ(1U, scheduler.waiting().size());
+	}
+
+	/* Leaving the Connecting state while waiting gives the place back */
+	ASSERT_TRUE(scheduler.waiting().empty());
+	ASSERT_EQ(1U, scheduler.active().size());
+}
+
+TEST(ConnectScheduler, unlimited)
+{
+	ConnectScheduler scheduler;
+	std::vector<std::unique_ptr<ConnectTicket>> tickets;
+
+	scheduler.setLimit(0);
+
+	for (int i = 0; i < 100; ++i) {
+		tickets.push_back(std::make_unique<ConnectTicket>(scheduler, std::to_string(i)));
+
+		ASSERT_TRUE(tickets.back()->acquire());
+	}
+
+	ASSERT_EQ(100U, scheduler.active().size());
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,189 @@
+/*
+ * TestEventQueue.cpp -- test the cross-thread event queue
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <SocketListener.h>
+
+#include <EventQueue.h>
+
+using namespace irccd;
+
+namespace {
+
+bool readable(EventQueue &queue)
+{
+	SocketListener listener;
+
+	listener.set(queue.socket(), SocketListener::Read);
+
+	try {
+		return listener.waitMultiple(0).size() == 1;
+	} catch (const SocketError &) {
+		return false;
+	}
+}
+
+} // !namespace
+
+TEST(Basic, order)
+{
+	EventQueue queue(16);
+	std::vector<int> result;
+	Event ev;
+
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_TRUE(queue.push([&result, i] () { result.push_back(i); }));
+	}
+
+	ASSERT_EQ(10U, queue.depth());
+
+	while (queue.pop(ev)) {
+		ev();
+	}
+
+	ASSERT_EQ((std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), result);
+	ASSERT_EQ(0U, queue.depth());
+	ASSERT_EQ(10U, queue.highWater());
+}
+
+TEST(Basic, full)
+{
+	EventQueue queue(4);
+	Event ev;
+
+	for (int i = 0; i < 4; ++i) {
+		ASSERT_TRUE(queue.push([] () {}));
+	}
+
+	ASSERT_FALSE(queue.push([] () {}));
+	ASSERT_EQ(1U, queue.dropped());
+
+	/* A free cell can be reused */
+	ASSERT_TRUE(queue.pop(ev));
+	ASSERT_TRUE(queue.push([] () {}));
+	ASSERT_EQ(4U, queue.depth());
+}
+
+TEST(Basic, offer)
+{
+	EventQueue queue(2);
+	Event ev;
+	bool called = false;
+
+	ASSERT_TRUE(queue.push([] () {}));
+	ASSERT_TRUE(queue.push([] () {}));
+
+	/* The event is left to the caller and not counted as dropped */
+	Event pending = [&] () { called = true; };
+
+	ASSERT_FALSE(queue.offer(pending));
+	ASSERT_TRUE(static_cast<bool>(pending));
+	ASSERT_EQ(0U, queue.dropped());
+
+	ASSERT_TRUE(queue.pop(ev));
+	ASSERT_TRUE(queue.offer(pending));
+	ASSERT_TRUE(queue.pop(ev));
+	ASSERT_TRUE(queue.pop(ev));
+	ev();
+	ASSERT_TRUE(called);
+}
+
+TEST(Wakeup, coalesced)
+{
+	EventQueue queue;
+	Event ev;
+
+	ASSERT_FALSE(readable(queue));
+
+	for (int i = 0; i < 100; ++i) {
+		queue.push([] () {});
+	}
+
+	ASSERT_TRUE(readable(queue));
+
+	queue.clear();
+
+	ASSERT_FALSE(readable(queue));
+
+	while (queue.pop(ev)) {
+		continue;
+	}
+
+	/* A new push after the drain must wake up the loop again */
+	queue.push([] () {});
+
+	ASSERT_TRUE(readable(queue));
+}
+
+TEST(Threads, producers)
+{
+	constexpr int producers = 4;
+	constexpr int count = 100000;
+
+	EventQueue queue(1024);
+	std::vector<std::thread> threads;
+	std::vector<int> last(producers, -1);
+	int received = 0;
+	bool ordered = true;
+
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] () {
+			for (int i = 0; i < count; ++i) {
+				queue.push([&, p, i] () {
+					ordered = ordered && i > last[p];
+					last[p] = i;
+					received ++;
+				});
+			}
+		});
+	}
+
+	Event ev;
+
+	for (;;) {
+		bool done = received + queue.dropped() == producers * count;
+
+		if (done) {
+			break;
+		}
+		if (queue.pop(ev)) {
+			ev();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	ASSERT_TRUE(ordered);
+	ASSERT_EQ(static_cast<std::size_t>(producers * count), received + queue.dropped());
+	ASSERT_LE(queue.highWater(), queue.capacity());
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
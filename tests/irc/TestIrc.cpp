@@ -0,0 +1,694 @@
+/*
+ * TestIrc.cpp -- test the IRC parser and connection
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <IrccdConfig.h>
+
+#if defined(WITH_SSL)
+#  include <netinet/tcp.h>
+#  include <openssl/evp.h>
+#  include <openssl/ssl.h>
+#  include <openssl/x509.h>
+#endif
+
+#include <libircclient.h>
+
+#include <SocketListener.h>
+
+#include <IrcConnection.h>
+#include <IrcMessage.h>
+
+using namespace irccd;
+using namespace std::chrono;
+
+/*
+ * Count every heap allocation of the process, the benchmarks only look at the difference around the measured code.
+ */
+namespace {
+
+std::atomic<std::size_t> allocations{0};
+
+} // !namespace
+
+void *operator new(std::size_t size)
+{
+	++ allocations;
+
+	if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+/* --------------------------------------------------------
+ * Parser
+ * -------------------------------------------------------- */
+
+namespace {
+
+bool parse(IrcMessage &message, std::string &line)
+{
+	return message.parse(&line[0], line.length());
+}
+
+} // !namespace
+
+TEST(Parser, simple)
+{
+	IrcMessage message;
+	std::string line{":jean!~jean@localhost PRIVMSG #staff :hello world"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_EQ("jean!~jean@localhost", message.prefix.str());
+	ASSERT_EQ("jean", message.nickname().str());
+	ASSERT_EQ("PRIVMSG", message.command.str());
+	ASSERT_EQ(2U, message.paramCount);
+	ASSERT_EQ("#staff", message.param(0).str());
+	ASSERT_EQ("hello world", message.param(1).str());
+	ASSERT_EQ("", message.param(2).str());
+	ASSERT_EQ(0, message.numeric());
+}
+
+TEST(Parser, noPrefix)
+{
+	IrcMessage message;
+	std::string line{"PING :irc.example.org"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_TRUE(message.prefix.empty());
+	ASSERT_EQ("PING", message.command.str());
+	ASSERT_EQ("irc.example.org", message.param(0).str());
+}
+
+TEST(Parser, numeric)
+{
+	IrcMessage message;
+	std::string line{":irc.example.org 005 irccd CHANTYPES=# PREFIX=(ov)@+ :are supported by this server"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_EQ(5, message.numeric());
+	ASSERT_EQ(4U, message.paramCount);
+	ASSERT_EQ("irccd", message.param(0).str());
+	ASSERT_EQ("CHANTYPES=#", message.param(1).str());
+	ASSERT_EQ("PREFIX=(ov)@+", message.param(2).str());
+	ASSERT_EQ("are supported by this server", message.param(3).str());
+}
+
+TEST(Parser, spaces)
+{
+	IrcMessage message;
+	std::string line{":jean  MODE   #staff +ov  jean francis :"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_EQ("MODE", message.command.str());
+	ASSERT_EQ(5U, message.paramCount);
+	ASSERT_EQ("#staff", message.param(0).str());
+	ASSERT_EQ("+ov", message.param(1).str());
+	ASSERT_EQ("jean", message.param(2).str());
+	ASSERT_EQ("francis", message.param(3).str());
+	ASSERT_EQ("", message.param(4).str());
+}
+
+TEST(Parser, maxParams)
+{
+	IrcMessage message;
+	std::string line{"CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_EQ(15U, message.paramCount);
+	ASSERT_EQ("14", message.param(13).str());
+	ASSERT_EQ("15 16", message.param(14).str());
+}
+
+TEST(Parser, tags)
+{
+	IrcMessage message;
+	std::string line{"@time=2015-06-01T12:00:00.000Z;+example.org/flag;msgid=a\\sb\\:c\\\\d :jean PRIVMSG #staff :hi"};
+
+	ASSERT_TRUE(parse(message, line));
+	ASSERT_EQ(3U, message.tagCount);
+	ASSERT_EQ("time", message.tags[0].key.str());
+	ASSERT_EQ("2015-06-01T12:00:00.000Z", message.tags[0].value.str());
+	ASSERT_EQ("+example.org/flag", message.tags[1].key.str());
+	ASSERT_TRUE(message.tags[1].value.empty());
+	ASSERT_EQ("a b;c\\d", message.tag("msgid")->value.str());
+	ASSERT_EQ(nullptr, message.tag("account"));
+	ASSERT_EQ("jean", message.prefix.str());
+	ASSERT_EQ("PRIVMSG", message.command.str());
+	ASSERT_EQ("hi", message.param(1).str());
+}
+
+TEST(Parser, invalid)
+{
+	IrcMessage message;
+	std::string empty;
+	std::string prefix{":jean"};
+	std::string tags{"@a=b "};
+
+	ASSERT_FALSE(parse(message, empty));
+	ASSERT_FALSE(parse(message, prefix));
+	ASSERT_FALSE(parse(message, tags));
+}
+
+TEST(Parser, origin)
+{
+	ASSERT_EQ("jean", ircNickname("jean!~jean@localhost"));
+	ASSERT_EQ("jean", ircNickname("jean"));
+	ASSERT_EQ("localhost", ircHost("jean!~jean@localhost"));
+	ASSERT_EQ("irc.example.org", ircHost("irc.example.org"));
+}
+
+/* --------------------------------------------------------
+ * Connection
+ * -------------------------------------------------------- */
+
+namespace {
+
+/*
+ * Non-owning socket to register the connection descriptor into a listener.
+ */
+class Descriptor : public SocketAbstract {
+public:
+	inline Descriptor(Handle handle) noexcept
+		: SocketAbstract(handle)
+	{
+	}
+
+	inline ~Descriptor()
+	{
+		m_handle = Invalid;
+	}
+
+	inline void close() override
+	{
+		m_handle = Invalid;
+	}
+};
+
+class ConnectionTest : public testing::Test {
+protected:
+	SocketTcp<address::Ip> m_server{AF_INET, 0};
+	std::uint16_t m_port;
+
+	ConnectionTest()
+	{
+		m_server.set(SOL_SOCKET, SO_REUSEADDR, 1);
+		m_server.bind(address::Ip("127.0.0.1", 0, AF_INET));
+		m_server.listen();
+		m_port = static_cast<std::uint16_t>(m_server.getsockname().port());
+	}
+
+	/*
+	 * Run the connection until the predicate is true or until it is disconnected.
+	 */
+	template <typename Predicate>
+	void run(IrcConnection &connection, Predicate predicate)
+	{
+		SocketListener listener;
+		Descriptor descriptor(connection.handle());
+
+		while (connection.state() != IrcConnection::Disconnected && !predicate()) {
+			listener.set(descriptor, connection.flags());
+			listener.unset(descriptor, ~connection.flags() & (SocketListener::Read | SocketListener::Write));
+
+			try {
+				for (const SocketStatus &status : listener.waitMultiple(1000)) {
+					connection.sync(status.flags);
+				}
+			} catch (const SocketError &ex) {
+				if (ex.code() != SocketError::Timeout) {
+					throw;
+				}
+			}
+		}
+	}
+
+	void write(SocketTcp<address::Ip> &client, const std::string &data)
+	{
+		std::size_t sent = 0;
+
+		while (sent < data.size()) {
+			sent += client.send(data.data() + sent, static_cast<unsigned>(data.size() - sent));
+		}
+	}
+};
+
+} // !namespace
+
+TEST_F(ConnectionTest, lines)
+{
+	std::vector<std::string> received;
+	IrcConnection connection([&] (const IrcMessage &message) {
+		received.push_back(message.command.str() + " " + message.param(0).str());
+	});
+
+	connection.connect("127.0.0.1", m_port);
+
+	ASSERT_TRUE(connection.send("NICK irccd"));
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	/* A line split across several reads, a bare LF and an empty line */
+	write(client, ":srv 001 irccd :Welcome\r\n:jean JOIN #st");
+	run(connection, [&] () { return received.size() == 1; });
+	write(client, "aff\r\n\r\n:jean PART #staff\n");
+	run(connection, [&] () { return received.size() == 3; });
+
+	ASSERT_EQ((std::vector<std::string>{"001 irccd", "JOIN #staff", "PART #staff"}), received);
+	ASSERT_EQ(0U, connection.pending());
+	ASSERT_EQ("NICK irccd\r\n", client.recv(512));
+}
+
+TEST_F(ConnectionTest, ping)
+{
+	bool pinged{false};
+	IrcConnection connection([&] (const IrcMessage &message) {
+		pinged = message.command == "PING";
+	});
+
+	connection.connect("127.0.0.1", m_port);
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	/* The PONG is sent in the same sync */
+	write(client, "PING :irc.example.org\r\n");
+	run(connection, [&] () { return pinged; });
+
+	ASSERT_EQ(0U, connection.pending());
+
+	ASSERT_EQ("PONG :irc.example.org\r\n", client.recv(512));
+}
+
+TEST_F(ConnectionTest, coalescing)
+{
+	IrcConnection connection;
+
+	connection.connect("127.0.0.1", m_port);
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	run(connection, [&] () { return connection.state() == IrcConnection::Connected; });
+
+	std::string expected;
+
+	for (int i = 0; i < 50; ++i) {
+		std::string line = "PRIVMSG #staff :line " + std::to_string(i);
+
+		ASSERT_TRUE(connection.send(line));
+		expected += line + "\r\n";
+	}
+
+	/* Nothing is written before the flush */
+	ASSERT_EQ(0U, connection.stats().writes);
+
+	connection.flush();
+
+	ASSERT_EQ(0U, connection.pending());
+	ASSERT_EQ(50U, connection.stats().lines);
+	ASSERT_EQ(1U, connection.stats().writes);
+	ASSERT_EQ(expected.size(), connection.stats().bytes);
+	ASSERT_DOUBLE_EQ(1.0 / 50, connection.stats().writesPerLine());
+
+	std::string received;
+
+	while (received.size() < expected.size()) {
+		received += client.recv(expected.size() - received.size());
+	}
+
+	ASSERT_EQ(expected, received);
+}
+
+TEST_F(ConnectionTest, closed)
+{
+	IrcConnection connection;
+
+	connection.connect("127.0.0.1", m_port);
+	m_server.accept().close();
+	run(connection, [] () { return false; });
+
+	ASSERT_EQ(IrcConnection::Disconnected, connection.state());
+	ASSERT_FALSE(connection.error().empty());
+	ASSERT_FALSE(connection.send("NICK irccd"));
+}
+
+TEST_F(ConnectionTest, lineTooLong)
+{
+	IrcConnection connection;
+
+	connection.connect("127.0.0.1", m_port);
+
+	SocketTcp<address::Ip> client = m_server.accept();
+	std::thread writer([&] () {
+		try {
+			write(client, std::string(IrcConnection::MaxLine * 3, 'x'));
+		} catch (...) {
+		}
+	});
+
+	run(connection, [] () { return false; });
+	client.close();
+	writer.join();
+
+	ASSERT_EQ("line too long", connection.error());
+}
+
+/* --------------------------------------------------------
+ * Parser benchmark, libircclient vs IrcConnection
+ * -------------------------------------------------------- */
+
+namespace {
+
+const int lines = 20000;
+
+std::string workload()
+{
+	std::string data{":irc.example.org 001 irccd :Welcome\r\n"};
+
+	for (int i = 0; i < lines; ++i) {
+		switch (i % 4) {
+		case 0:
+			data += ":markand!~markand@irc.example.org PRIVMSG #irccd-development :this message is long enough to not fit in the small string buffer\r\n";
+			break;
+		case 1:
+			data += ":francis!~francis@localhost NOTICE irccd :a private notice that is also long enough to be copied\r\n";
+			break;
+		case 2:
+			data += ":jean!~jean@localhost JOIN #irccd-development\r\n";
+			break;
+		default:
+			data += ":jean!~jean@localhost MODE #irccd-development +ov jean francis\r\n";
+			break;
+		}
+	}
+
+	return data;
+}
+
+/*
+ * Previous path: libircclient callbacks and a std::string for each field like Server::strify did.
+ */
+std::size_t legacyTotal{0};
+
+inline std::string strify(const char *s)
+{
+	return (s == nullptr) ? "" : std::string(s);
+}
+
+void legacy(const char *origin, const char **params, unsigned count)
+{
+	legacyTotal += strify(origin).size();
+
+	for (unsigned i = 0; i < count; ++i) {
+		legacyTotal += strify(params[i]).size();
+	}
+}
+
+} // !namespace
+
+TEST_F(ConnectionTest, benchmark)
+{
+	std::string data = workload();
+
+	/* Zero-copy parser alone */
+	std::string copy = data;
+	IrcMessage message;
+	std::size_t before = allocations;
+	auto start = steady_clock::now();
+	std::size_t parsed = 0;
+
+	for (char *line = &copy[0], *end = line + copy.size(); line < end; ) {
+		char *newline = static_cast<char *>(std::memchr(line, '\n', end - line));
+
+		parsed += message.parse(line, newline - line - 1);
+		line = newline + 1;
+	}
+
+	auto parserTime = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	std::size_t parserCount = allocations - before;
+
+	ASSERT_EQ(static_cast<std::size_t>(lines + 1), parsed);
+	ASSERT_EQ(0U, parserCount);
+
+	/* libircclient */
+	irc_callbacks_t callbacks;
+
+	std::memset(&callbacks, 0, sizeof (irc_callbacks_t));
+	callbacks.event_channel = [] (auto, auto, auto origin, auto params, auto count) {
+		legacy(origin, params, count);
+	};
+	callbacks.event_notice = [] (auto, auto, auto origin, auto params, auto count) {
+		legacy(origin, params, count);
+	};
+	callbacks.event_join = [] (auto, auto, auto origin, auto params, auto count) {
+		legacy(origin, params, count);
+	};
+	callbacks.event_mode = [] (auto, auto, auto origin, auto params, auto count) {
+		legacy(origin, params, count);
+	};
+
+	std::unique_ptr<irc_session_t, void (*)(irc_session_t *)> session{irc_create_session(&callbacks), irc_destroy_session};
+
+	ASSERT_EQ(0, irc_connect(session.get(), "127.0.0.1", m_port, nullptr, "irccd", "irccd", "irccd"));
+
+	SocketTcp<address::Ip> legacyClient = m_server.accept();
+	std::thread legacyWriter([&] () {
+		write(legacyClient, data);
+		::shutdown(legacyClient.handle(), SHUT_WR);
+	});
+
+	before = allocations;
+	start = steady_clock::now();
+
+	while (irc_is_connected(session.get())) {
+		fd_set in, out;
+		int max = 0;
+		timeval tv{1, 0};
+
+		FD_ZERO(&in);
+		FD_ZERO(&out);
+		irc_add_select_descriptors(session.get(), &in, &out, &max);
+		select(max + 1, &in, &out, nullptr, &tv);
+		irc_process_select_descriptors(session.get(), &in, &out);
+	}
+
+	auto legacyTime = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	std::size_t legacyCount = allocations - before;
+
+	legacyWriter.join();
+
+	/* IrcConnection */
+	std::size_t total{0};
+	IrcConnection connection([&] (const IrcMessage &message) {
+		total += message.prefix.length;
+
+		for (std::size_t i = 0; i < message.paramCount; ++i) {
+			total += message.params[i].length;
+		}
+	});
+
+	connection.connect("127.0.0.1", m_port);
+
+	SocketTcp<address::Ip> client = m_server.accept();
+	std::thread writer([&] () {
+		write(client, data);
+		::shutdown(client.handle(), SHUT_WR);
+	});
+
+	before = allocations;
+	start = steady_clock::now();
+	run(connection, [] () { return false; });
+
+	auto engineTime = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	std::size_t engineCount = allocations - before;
+
+	writer.join();
+
+	std::cout << "parser:       " << parserTime / (lines + 1) << " ns/line, " << parserCount << " allocations" << std::endl;
+	std::cout << "libircclient: " << legacyTime / (lines + 1) << " ns/line, " << legacyCount << " allocations" << std::endl;
+	std::cout << "connection:   " << engineTime / (lines + 1) << " ns/line, " << engineCount << " allocations" << std::endl;
+
+	/* Both saw the same bytes, libircclient does not report the 001 parameters */
+	ASSERT_EQ(total, legacyTotal + std::strlen("irc.example.org") + std::strlen("irccdWelcome"));
+	ASSERT_LT(engineCount, legacyCount);
+}
+
+#if defined(WITH_SSL)
+
+/* --------------------------------------------------------
+ * TLS session resumption benchmark
+ * -------------------------------------------------------- */
+
+namespace {
+
+/*
+ * Local TLS IRC stand-in with a self-signed certificate generated at startup.
+ */
+class TlsTest : public ConnectionTest {
+protected:
+	std::unique_ptr<SSL_CTX, void (*)(SSL_CTX *)> m_context{SSL_CTX_new(TLS_server_method()), SSL_CTX_free};
+
+	TlsTest()
+	{
+		std::unique_ptr<EVP_PKEY_CTX, void (*)(EVP_PKEY_CTX *)> keygen{EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free};
+		EVP_PKEY *key = nullptr;
+
+		EVP_PKEY_keygen_init(keygen.get());
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen.get(), NID_X9_62_prime256v1);
+		EVP_PKEY_keygen(keygen.get(), &key);
+
+		std::unique_ptr<EVP_PKEY, void (*)(EVP_PKEY *)> pkey{key, EVP_PKEY_free};
+		std::unique_ptr<X509, void (*)(X509 *)> cert{X509_new(), X509_free};
+
+		X509_set_version(cert.get(), 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert.get()), 3600);
+		X509_set_pubkey(cert.get(), pkey.get());
+		X509_NAME_add_entry_by_txt(X509_get_subject_name(cert.get()), "CN", MBSTRING_ASC,
+					   reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+		X509_set_issuer_name(cert.get(), X509_get_subject_name(cert.get()));
+		X509_sign(cert.get(), pkey.get(), EVP_sha256());
+
+		SSL_CTX_use_certificate(m_context.get(), cert.get());
+		SSL_CTX_use_PrivateKey(m_context.get(), pkey.get());
+	}
+
+	/*
+	 * Accept the connections, greet each client and wait until it leaves.
+	 */
+	std::thread serve(int count)
+	{
+		return std::thread([this, count] () {
+			for (int i = 0; i < count; ++i) {
+				SocketTcp<address::Ip> client = m_server.accept();
+				std::unique_ptr<SSL, void (*)(SSL *)> ssl{SSL_new(m_context.get()), SSL_free};
+				char buffer[512];
+
+				client.set(IPPROTO_TCP, TCP_NODELAY, 1);
+				SSL_set_fd(ssl.get(), static_cast<int>(client.handle()));
+
+				if (SSL_accept(ssl.get()) != 1) {
+					continue;
+				}
+
+				SSL_write(ssl.get(), ":srv 001 irccd :Welcome\r\n", 25);
+
+				while (SSL_read(ssl.get(), buffer, sizeof (buffer)) > 0) {
+					continue;
+				}
+
+				SSL_shutdown(ssl.get());
+			}
+		});
+	}
+
+	/*
+	 * Connect and wait for the welcome message.
+	 *
+	 * @return the time spent
+	 */
+	nanoseconds welcome(IrcConnection &connection, bool &welcomed)
+	{
+		auto start = steady_clock::now();
+
+		welcomed = false;
+		connection.connect("127.0.0.1", m_port, false, true, false);
+		run(connection, [&] () { return welcomed; });
+
+		auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+
+		connection.disconnect();
+
+		return elapsed;
+	}
+};
+
+} // !namespace
+
+TEST_F(TlsTest, resumption)
+{
+	const int rounds = 50;
+	bool welcomed{false};
+	std::thread server = serve(rounds * 2);
+
+	auto handler = [&] (const IrcMessage &message) {
+		welcomed = welcomed || message.numeric() == 1;
+	};
+
+	/* Full handshake each time, like a new connection object */
+	nanoseconds full{0};
+
+	for (int i = 0; i < rounds; ++i) {
+		IrcConnection connection(handler);
+
+		full += welcome(connection, welcomed);
+
+		ASSERT_TRUE(welcomed);
+		ASSERT_EQ(0U, connection.stats().resumed);
+	}
+
+	/* One connection object reconnecting, like a server */
+	IrcConnection connection(handler);
+	nanoseconds resumed{0};
+
+	for (int i = 0; i < rounds; ++i) {
+		resumed += welcome(connection, welcomed);
+
+		ASSERT_TRUE(welcomed);
+	}
+
+	server.join();
+
+	std::cout << "full handshake: " << full.count() / rounds / 1000 << " us/connection" << std::endl;
+	std::cout << "resumed:        " << resumed.count() / rounds / 1000 << " us/connection" << std::endl;
+
+	/* Only the first connection needs the key exchange */
+	ASSERT_EQ(static_cast<std::uint64_t>(rounds), connection.stats().handshakes);
+	ASSERT_EQ(static_cast<std::uint64_t>(rounds - 1), connection.stats().resumed);
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
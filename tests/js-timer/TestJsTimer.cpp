@@ -16,54 +16,188 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <ElapsedTimer.h>
 #include <Plugin.h>
 #include <Timer.h>
+#include <TimerQueue.h>
 
 using namespace irccd;
 using namespace std::chrono_literals;
 
+namespace {
+
+/*
+ * Emulate the irccd event loop for the given duration.
+ */
+void run(TimerQueue &queue, std::chrono::milliseconds duration)
+{
+	auto end = Timer::Clock::now() + duration;
+
+	while (Timer::Clock::now() < end) {
+		int timeout = queue.timeout(10);
+
+		if (timeout > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		}
+
+		queue.process();
+	}
+}
+
+std::shared_ptr<Timer> schedule(TimerQueue &queue, TimerType type, int delay)
+{
+	auto timer = std::make_shared<Timer>(type, delay);
+
+	timer->onStart.connect([&queue, timer] () {
+		queue.add(timer);
+	});
+
+	return timer;
+}
+
+} // !namespace
+
 /* --------------------------------------------------------
  * Timer object itself
  * -------------------------------------------------------- */
 
 TEST(Basic, single)
 {
-	Timer timer(TimerType::Single, 1000);
+	TimerQueue queue;
+	auto timer = schedule(queue, TimerType::Single, 1000);
 	ElapsedTimer elapsed;
 	int count = 0;
+	bool ended = false;
 
-	timer.onSignal.connect([&] () {
+	timer->onSignal.connect([&] () {
 		count = elapsed.elapsed();
 	});
+	timer->onEnd.connect([&] () {
+		ended = true;
+	});
 
 	elapsed.reset();
-	timer.start();
+	timer->start();
 
-	std::this_thread::sleep_for(3s);
+	run(queue, 3s);
 
 	ASSERT_TRUE(count >= 950 && count <= 1050);
+	ASSERT_TRUE(ended);
+	ASSERT_FALSE(timer->isRunning());
+	ASSERT_EQ(0U, queue.size());
 }
 
 TEST(Basic, repeat)
 {
-	Timer timer(TimerType::Repeat, 500);
+	TimerQueue queue;
+	auto timer = schedule(queue, TimerType::Repeat, 500);
 	int max = 0;
 
-	timer.onSignal.connect([&] () {
+	timer->onSignal.connect([&] () {
 		max ++;
 	});
 
-	timer.start();
+	timer->start();
 
 	// Should be at least 5
-	std::this_thread::sleep_for(3s);
+	run(queue, 3s);
 
 	ASSERT_TRUE(max >= 5);
 }
 
+TEST(Basic, stop)
+{
+	TimerQueue queue;
+	auto timer = schedule(queue, TimerType::Repeat, 100);
+	int count = 0;
+	bool ended = false;
+
+	timer->onSignal.connect([&] () {
+		if (++count == 2) {
+			timer->stop();
+		}
+	});
+	timer->onEnd.connect([&] () {
+		ended = true;
+	});
+
+	timer->start();
+
+	run(queue, 1s);
+
+	ASSERT_EQ(2, count);
+	ASSERT_TRUE(ended);
+	ASSERT_EQ(-1, queue.timeout());
+}
+
+TEST(Basic, noDrift)
+{
+	TimerQueue queue;
+	auto timer = schedule(queue, TimerType::Repeat, 50);
+	int count = 0;
+
+	/* A slow callback must not shift the next deadlines */
+	timer->onSignal.connect([&] () {
+		count ++;
+		std::this_thread::sleep_for(20ms);
+	});
+
+	timer->start();
+
+	auto origin = timer->deadline() - 50ms;
+
+	run(queue, 1s);
+
+	ASSERT_TRUE(count >= 15);
+	ASSERT_TRUE(timer->deadline() - origin == (count + 1) * 50ms);
+}
+
+TEST(Basic, skipMissed)
+{
+	TimerQueue queue;
+	auto timer = schedule(queue, TimerType::Repeat, 50);
+	int count = 0;
+
+	timer->onSignal.connect([&] () {
+		count ++;
+	});
+
+	timer->start();
+
+	auto origin = timer->deadline() - 50ms;
+
+	/* Simulate a blocked loop, the missed periods are not replayed */
+	std::this_thread::sleep_for(280ms);
+	queue.process();
+
+	ASSERT_EQ(1, count);
+	ASSERT_TRUE(timer->deadline() - origin == 300ms);
+}
+
+TEST(Basic, many)
+{
+	TimerQueue queue;
+	std::vector<std::shared_ptr<Timer>> timers;
+	int count = 0;
+
+	for (int i = 0; i < 1000; ++i) {
+		timers.push_back(schedule(queue, TimerType::Single, 10 + i % 100));
+		timers.back()->onSignal.connect([&] () {
+			count ++;
+		});
+		timers.back()->start();
+	}
+
+	run(queue, 500ms);
+
+	ASSERT_EQ(1000, count);
+	ASSERT_EQ(0U, queue.size());
+}
+
 /* --------------------------------------------------------
  * JS Timer API
  * -------------------------------------------------------- */
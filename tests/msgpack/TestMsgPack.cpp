@@ -0,0 +1,413 @@
+/*
+ * TestMsgPack.cpp -- test the MessagePack encoding of the transport messages
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <Arena.h>
+#include <MsgPack.h>
+#include <Server.h>
+#include <ServerEvent.h>
+#include <TransportBuffer.h>
+#include <TransportOutput.h>
+
+using namespace irccd;
+using namespace std::chrono;
+
+namespace {
+
+std::string bytes(std::initializer_list<unsigned char> list)
+{
+	return std::string(list.begin(), list.end());
+}
+
+JsonValue roundTrip(const JsonValue &value)
+{
+	MsgPackWriter writer;
+
+	writer.value(value);
+
+	return MsgPackReader(writer.data().data(), writer.data().size()).read();
+}
+
+void invalid(const std::string &data)
+{
+	ASSERT_THROW(MsgPackReader(data.data(), data.size()).read(), std::invalid_argument);
+}
+
+} // !namespace
+
+/* --------------------------------------------------------
+ * Encoding
+ * -------------------------------------------------------- */
+
+TEST(Writer, integers)
+{
+	auto encode = [] (std::int64_t value) {
+		MsgPackWriter writer;
+
+		writer.integer(value);
+
+		return writer.data();
+	};
+
+	ASSERT_EQ(bytes({ 0x00 }), encode(0));
+	ASSERT_EQ(bytes({ 0x7f }), encode(127));
+	ASSERT_EQ(bytes({ 0xcc, 0x80 }), encode(128));
+	ASSERT_EQ(bytes({ 0xcd, 0x01, 0x00 }), encode(256));
+	ASSERT_EQ(bytes({ 0xce, 0x00, 0x01, 0x00, 0x00 }), encode(65536));
+	ASSERT_EQ(bytes({ 0xcf, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 }), encode(4294967296LL));
+	ASSERT_EQ(bytes({ 0xff }), encode(-1));
+	ASSERT_EQ(bytes({ 0xe0 }), encode(-32));
+	ASSERT_EQ(bytes({ 0xd0, 0xdf }), encode(-33));
+	ASSERT_EQ(bytes({ 0xd1, 0xff, 0x7f }), encode(-129));
+}
+
+TEST(Writer, containers)
+{
+	MsgPackWriter writer;
+
+	writer.map(2);
+	writer.string("a");
+	writer.nil();
+	writer.string("b");
+	writer.array(2);
+	writer.boolean(true);
+	writer.boolean(false);
+
+	ASSERT_EQ(bytes({ 0x82, 0xa1, 'a', 0xc0, 0xa1, 'b', 0x92, 0xc3, 0xc2 }), writer.data());
+}
+
+TEST(Writer, strings)
+{
+	MsgPackWriter writer;
+
+	writer.string(std::string(31, 'x'));
+	writer.string(std::string(32, 'x'));
+	writer.string(std::string(256, 'x'));
+
+	ASSERT_EQ(static_cast<char>(0xbf), writer.data()[0]);
+	ASSERT_EQ(bytes({ 0xd9, 32 }), writer.data().substr(32, 2));
+	ASSERT_EQ(bytes({ 0xda, 0x01, 0x00 }), writer.data().substr(32 + 34, 3));
+	ASSERT_EQ(32U + 34U + 259U, writer.data().size());
+}
+
+/* --------------------------------------------------------
+ * Decoding
+ * -------------------------------------------------------- */
+
+TEST(Reader, roundTrip)
+{
+	JsonDocument document(
+		"{"
+		"\"command\":\"message\","
+		"\"long\":\"" + std::string(300, 'x') + "\","
+		"\"numbers\":[0,127,128,-1,-33,-40000,70000,5000000000,-5000000000,1.5],"
+		"\"flags\":[true,false,null],"
+		"\"nested\":{\"a\":{\"b\":[[],{}]}}"
+		"}"
+	);
+
+	ASSERT_TRUE(document.toObject() == roundTrip(document.toObject()));
+}
+
+TEST(Reader, manyElements)
+{
+	JsonArray array;
+
+	for (int i = 0; i < 70000; ++i) {
+		array.append(i);
+	}
+
+	JsonValue result = roundTrip(array);
+
+	ASSERT_TRUE(result.isArray());
+	ASSERT_EQ(70000U, result.toArray().size());
+}
+
+TEST(Reader, errors)
+{
+	/* Truncated */
+	invalid(bytes({ 0x82, 0xa1, 'a' }));
+	invalid(bytes({ 0xa5, 'a', 'b' }));
+	invalid(bytes({ 0xcd, 0x01 }));
+
+	/* Trailing data */
+	invalid(bytes({ 0xc0, 0xc0 }));
+
+	/* Not a string key */
+	invalid(bytes({ 0x81, 0x01, 0x02 }));
+
+	/* Binary and extensions */
+	invalid(bytes({ 0xc4, 0x01, 0x00 }));
+	invalid(bytes({ 0xd4, 0x01, 0x00 }));
+
+	/* Declares more elements than there are bytes */
+	invalid(bytes({ 0xdd, 0xff, 0xff, 0xff, 0xff, 0xc0 }));
+
+	/* Too deep */
+	invalid(std::string(MsgPackReader::MaxDepth + 1, static_cast<char>(0x91)) + bytes({ 0xc0 }));
+}
+
+/* --------------------------------------------------------
+ * Events and frames
+ * -------------------------------------------------------- */
+
+namespace {
+
+class MsgPackEventTest : public testing::Test {
+protected:
+	Arena m_arena{4096};
+	std::shared_ptr<Server> m_server;
+
+	MsgPackEventTest()
+	{
+		ServerInfo info;
+		ServerIdentity identity;
+
+		info.name = "local";
+		info.host = "127.0.0.1";
+
+		m_server = std::make_shared<Server>(info, identity);
+	}
+
+	void compare(const ServerEvent &event)
+	{
+		std::string data = event.msgpack();
+
+		ASSERT_TRUE(JsonDocument(event.json()).toObject() == MsgPackReader(data.data(), data.size()).read());
+	}
+};
+
+} // !namespace
+
+TEST_F(MsgPackEventTest, sameAsJson)
+{
+	compare(*ServerEvent::create(m_arena, ServerEventType::Connect, m_server.get()));
+	compare(*ServerEvent::create(m_arena, ServerEventType::Message, m_server.get(), "jean!jean@localhost", "#staff", "hello \"world\""));
+	compare(*ServerEvent::create(m_arena, ServerEventType::Kick, m_server.get(), "jean", "#staff", "francis", "spam"));
+	compare(*ServerEvent::create(m_arena, ServerEventType::PartBatch, m_server.get(), {
+		{ "jean!jean@localhost", "#staff", "bye" },
+		{ "francis!francis@localhost", "#test", "" }
+	}));
+}
+
+TEST_F(MsgPackEventTest, escapedServer)
+{
+	ServerInfo info;
+
+	info.name = "lo\"cal\\";
+	info.host = "127.0.0.1";
+
+	std::shared_ptr<Server> server = std::make_shared<Server>(info);
+
+	compare(*ServerEvent::create(m_arena, ServerEventType::Connect, server.get()));
+}
+
+TEST_F(MsgPackEventTest, copy)
+{
+	ServerEvent *event = ServerEvent::create(m_arena, ServerEventType::PartBatch, m_server.get(), {
+		{ "jean!jean@localhost", "#staff", "bye" },
+		{ "francis!francis@localhost", "#test", "" }
+	});
+
+	std::string json = event->json();
+	std::string msgpack = event->msgpack();
+	ServerEventCopy copy(*event);
+
+	/* The copy owns its entries and strings */
+	m_arena.reset();
+	m_arena.copy(std::string(256, 'x'));
+
+	ASSERT_EQ(json, copy.event().json());
+	ASSERT_EQ(msgpack, copy.event().msgpack());
+}
+
+TEST(Frame, prefixed)
+{
+	TransportOutput::Message first = TransportOutput::makeFrame("abc");
+	TransportOutput::Message second = TransportOutput::makeFrame(std::string(70000, 'x'));
+	std::string stream = *first + *second;
+
+	ASSERT_EQ(bytes({ 0x00, 0x00, 0x00, 0x03, 'a', 'b', 'c' }), *first);
+
+	/* Received in small parts */
+	TransportBuffer buffer;
+	std::vector<std::string> frames;
+
+	for (std::size_t offset = 0; offset < stream.size(); ) {
+		std::size_t length;
+		char *dest = buffer.reserve(length);
+
+		length = std::min({ length, std::size_t(1000), stream.size() - offset });
+		std::memcpy(dest, stream.data() + offset, length);
+		buffer.commit(length);
+		offset += length;
+
+		const char *data;
+
+		while (buffer.nextPrefixed(data, length)) {
+			frames.emplace_back(data, length);
+		}
+	}
+
+	ASSERT_EQ(2U, frames.size());
+	ASSERT_EQ("abc", frames[0]);
+	ASSERT_EQ(std::string(70000, 'x'), frames[1]);
+}
+
+TEST(Frame, limit)
+{
+	TransportBuffer buffer(1024);
+	std::size_t length;
+	const char *data;
+	char *dest = buffer.reserve(length);
+
+	/* Rejected as soon as the prefix is received */
+	std::memcpy(dest, bytes({ 0x00, 0x00, 0x04, 0x01 }).data(), 4);
+	buffer.commit(4);
+
+	ASSERT_THROW(buffer.nextPrefixed(data, length), std::length_error);
+}
+
+/* --------------------------------------------------------
+ * Benchmark, JSON vs MessagePack round trip
+ * -------------------------------------------------------- */
+
+namespace {
+
+template <typename Function>
+long long measure(Function function)
+{
+	auto start = steady_clock::now();
+
+	function();
+
+	return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+/*
+ * Frame and decode all the commands like TransportClient::receive and parse do, then read the fields.
+ */
+template <typename Next, typename Decode>
+std::size_t receive(const std::string &stream, Next next, Decode decode)
+{
+	TransportBuffer buffer(stream.size());
+	std::size_t count = 0;
+	std::size_t offset = 0;
+
+	while (offset < stream.size()) {
+		std::size_t length;
+		char *dest = buffer.reserve(length);
+
+		length = std::min(length, stream.size() - offset);
+		std::memcpy(dest, stream.data() + offset, length);
+		buffer.commit(length);
+		offset += length;
+
+		const char *data;
+
+		while (next(buffer, data, length)) {
+			JsonObject object = decode(data, length);
+
+			count += object["command"].toString() == "message" && object["message"].toString().size() == 20;
+		}
+	}
+
+	return count;
+}
+
+} // !namespace
+
+TEST_F(MsgPackEventTest, benchmark)
+{
+	const int count = 20000;
+
+	/* The same commands in both formats */
+	std::string json, msgpack;
+
+	for (int i = 0; i < count; ++i) {
+		MsgPackWriter writer;
+
+		writer.map(4);
+		writer.string("command");
+		writer.string("message");
+		writer.string("server");
+		writer.string("local");
+		writer.string("target");
+		writer.string("#staff");
+		writer.string("message");
+		writer.string(std::string(20, 'a' + i % 26));
+
+		json += "{\"command\":\"message\",\"server\":\"local\",\"target\":\"#staff\",\"message\":\"" + std::string(20, 'a' + i % 26) + "\"}\r\n\r\n";
+		msgpack += *TransportOutput::makeFrame(writer.data());
+	}
+
+	std::size_t received = 0;
+
+	auto jsonCommands = measure([&] () {
+		received = receive(json, [] (TransportBuffer &buffer, const char *&data, std::size_t &length) {
+			return buffer.next(data, length);
+		}, [] (const char *data, std::size_t length) {
+			return JsonDocument(data, length).toObject();
+		});
+	});
+	ASSERT_EQ(static_cast<std::size_t>(count), received);
+
+	auto msgpackCommands = measure([&] () {
+		received = receive(msgpack, [] (TransportBuffer &buffer, const char *&data, std::size_t &length) {
+			return buffer.nextPrefixed(data, length);
+		}, [] (const char *data, std::size_t length) {
+			return MsgPackReader(data, length).read().toObject();
+		});
+	});
+	ASSERT_EQ(static_cast<std::size_t>(count), received);
+
+	/* Events, encoded once per event */
+	ServerEvent *event = ServerEvent::create(m_arena, ServerEventType::Message, m_server.get(), "jean!jean@localhost", "#staff", "hello world, how are you?");
+	std::size_t jsonSize = 0, msgpackSize = 0;
+
+	auto jsonEvents = measure([&] () {
+		for (int i = 0; i < count; ++i) {
+			jsonSize += TransportOutput::make(event->json())->size();
+		}
+	});
+	auto msgpackEvents = measure([&] () {
+		for (int i = 0; i < count; ++i) {
+			msgpackSize += TransportOutput::makeFrame(event->msgpack())->size();
+		}
+	});
+
+	std::cout << "commands: json " << jsonCommands << " us (" << json.size() << " bytes), "
+		  << "msgpack " << msgpackCommands << " us (" << msgpack.size() << " bytes)" << std::endl;
+	std::cout << "events:   json " << jsonEvents << " us (" << jsonSize << " bytes), "
+		  << "msgpack " << msgpackEvents << " us (" << msgpackSize << " bytes)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
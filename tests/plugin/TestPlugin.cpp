@@ -0,0 +1,120 @@
+/*
+ * TestPlugin.cpp -- test the plugin handlers bitmap
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <Plugin.h>
+
+using namespace irccd;
+
+namespace {
+
+class Handlers : public testing::Test {
+protected:
+	std::string m_path;
+
+	/*
+	 * Write the script next to the test binary, it is removed at the end of the test.
+	 */
+	std::unique_ptr<Plugin> load(const std::string &name, const std::string &code)
+	{
+		m_path = TESTS_BINARY_DIR "/" + name + ".js";
+
+		std::ofstream(m_path) << code;
+
+		return std::make_unique<Plugin>(name, m_path, PluginConfig{});
+	}
+
+	void TearDown() override
+	{
+		if (!m_path.empty()) {
+			std::remove(m_path.c_str());
+		}
+	}
+};
+
+} // !namespace
+
+TEST_F(Handlers, static)
+{
+	auto plugin = load("static",
+		"function onLoad() {}\n"
+		"function onMessage() {}\n"
+		"var onJoin = 42;\n"
+	);
+
+	ASSERT_TRUE(plugin->implements(PluginHandler::Load));
+	ASSERT_TRUE(plugin->implements(PluginHandler::Message));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Command));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Join));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Whois));
+}
+
+TEST_F(Handlers, dynamic)
+{
+	auto plugin = load("dynamic",
+		"function onLoad() {\n"
+		"  onReload = function () {\n"
+		"    onUnload = function () {};\n"
+		"    onLoad = undefined;\n"
+		"  };\n"
+		"}\n"
+	);
+
+	ASSERT_TRUE(plugin->implements(PluginHandler::Load));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Reload));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Unload));
+
+	plugin->onLoad();
+
+	ASSERT_TRUE(plugin->implements(PluginHandler::Reload));
+	ASSERT_FALSE(plugin->implements(PluginHandler::Unload));
+
+	plugin->onReload();
+
+	ASSERT_FALSE(plugin->implements(PluginHandler::Load));
+	ASSERT_TRUE(plugin->implements(PluginHandler::Unload));
+}
+
+TEST_F(Handlers, stack)
+{
+	auto plugin = load("stack",
+		"function onReload() { onUnload = function () {}; }\n"
+	);
+
+	duk_context *ctx = plugin->context();
+	int top = duk_get_top(ctx);
+
+	plugin->onLoad();
+	plugin->onReload();
+	plugin->onUnload();
+
+	ASSERT_EQ(top, duk_get_top(ctx));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
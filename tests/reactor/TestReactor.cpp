@@ -0,0 +1,215 @@
+/*
+ * TestReactor.cpp -- test the threads running the servers
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <Reactor.h>
+#include <Server.h>
+
+using namespace irccd;
+using namespace std::chrono_literals;
+
+namespace {
+
+template <typename Predicate>
+bool wait(Predicate predicate)
+{
+	for (int i = 0; i < 500 && !predicate(); ++i) {
+		std::this_thread::sleep_for(10ms);
+	}
+
+	return predicate();
+}
+
+/*
+ * Pop the events forwarded to the main loop, like Irccd::dispatch does.
+ */
+int drain(Reactor &reactor)
+{
+	Event ev;
+	int count = 0;
+
+	reactor.outbox().clear();
+
+	while (reactor.outbox().pop(ev)) {
+		ev();
+		++ count;
+	}
+
+	return count;
+}
+
+} // !namespace
+
+TEST(Reactor, post)
+{
+	Reactor reactor;
+	std::atomic<Reactor *> current{nullptr};
+
+	ASSERT_EQ(nullptr, Reactor::current());
+	ASSERT_TRUE(reactor.post([&] () {
+		current = Reactor::current();
+	}));
+	ASSERT_TRUE(wait([&] () { return current == &reactor; }));
+}
+
+TEST(Reactor, outbox)
+{
+	Reactor reactor;
+	int result = 0;
+
+	for (int i = 0; i < 10; ++i) {
+		reactor.post([&, i] () {
+			reactor.outbox().push([&, i] () {
+				result += i;
+			});
+		});
+	}
+
+	int count = 0;
+
+	ASSERT_TRUE(wait([&] () { return (count += drain(reactor)) == 10; }));
+	ASSERT_EQ(45, result);
+}
+
+TEST(Reactor, overfill)
+{
+	Reactor reactor;
+	std::size_t total = reactor.outbox().capacity() * 2 + 100;
+	std::size_t next = 0;
+	bool ordered = true;
+
+	/* Twice the capacity at once, the overflow is kept in the reactor */
+	reactor.post([&] () {
+		for (std::size_t i = 0; i < total; ++i) {
+			reactor.forward([&, i] () {
+				ordered = ordered && i == next++;
+			});
+		}
+	});
+
+	/* Drained like Irccd::dispatch, the reactor is resumed after each round */
+	std::size_t count = 0;
+
+	ASSERT_TRUE(wait([&] () {
+		count += drain(reactor);
+		reactor.resume();
+
+		return count == total;
+	}));
+	ASSERT_TRUE(ordered);
+	ASSERT_EQ(0U, reactor.outbox().dropped());
+}
+
+TEST(Reactor, stop)
+{
+	Reactor reactor;
+
+	reactor.stop();
+
+	/* Nothing runs anymore, stopping again is allowed */
+	reactor.post([] () {});
+	reactor.stop();
+}
+
+/* --------------------------------------------------------
+ * Servers
+ * -------------------------------------------------------- */
+
+namespace {
+
+class ReactorServerTest : public testing::Test {
+protected:
+	SocketTcp<address::Ip> m_server{AF_INET, 0};
+	std::shared_ptr<Server> m_irc;
+
+	ReactorServerTest()
+	{
+		m_server.set(SOL_SOCKET, SO_REUSEADDR, 1);
+		m_server.bind(address::Ip("127.0.0.1", 0, AF_INET));
+		m_server.listen();
+
+		ServerInfo info;
+		ServerIdentity identity;
+
+		info.name = "local";
+		info.host = "127.0.0.1";
+		info.port = static_cast<std::uint16_t>(m_server.getsockname().port());
+		identity.nickname = "irccd";
+
+		m_irc = std::make_shared<Server>(info, identity);
+	}
+
+	/*
+	 * Read until the text has been received.
+	 */
+	std::string read(SocketTcp<address::Ip> &client, const std::string &expected)
+	{
+		std::string received;
+
+		while (received.find(expected) == std::string::npos) {
+			received += client.recv(512);
+		}
+
+		return received;
+	}
+};
+
+} // !namespace
+
+TEST_F(ReactorServerTest, connect)
+{
+	Reactor reactor;
+	std::atomic<Reactor *> current{nullptr};
+
+	m_irc->onConnect.connect([&] () {
+		current = Reactor::current();
+	});
+	m_irc->onQueued.connect([&] () {
+		reactor.wake();
+	});
+
+	reactor.add(m_irc);
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	read(client, "USER");
+	client.send(":srv 001 irccd :Welcome\r\n");
+
+	/* The signals are emitted from the reactor thread */
+	ASSERT_TRUE(wait([&] () { return current == &reactor; }));
+	ASSERT_TRUE(wait([&] () { return m_irc->status().state == ServerState::Connected; }));
+
+	/* Commands queued from another thread are written by the reactor */
+	m_irc->message("#staff", "hello");
+
+	ASSERT_NE(std::string::npos, read(client, "\r\n").find("PRIVMSG #staff :hello"));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,159 @@
+/*
+ * TestResolver.cpp -- test the asynchronous host name resolution
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <Resolver.h>
+
+using namespace irccd;
+using namespace std::chrono_literals;
+
+namespace {
+
+class ResolverTest : public testing::Test {
+protected:
+	std::atomic<int> notified{0};
+	Resolver resolver{[this] () { ++notified; }};
+
+	/*
+	 * Wait for the query like the event loop does, it only checks ready() when notified.
+	 */
+	bool wait(const std::shared_ptr<const ResolverQuery> &query)
+	{
+		for (int i = 0; i < 500 && !query->ready(); ++i) {
+			std::this_thread::sleep_for(10ms);
+		}
+
+		return query->ready();
+	}
+
+	/*
+	 * The notify function is called just after the queries are ready.
+	 */
+	int notifications(int expected)
+	{
+		for (int i = 0; i < 500 && notified < expected; ++i) {
+			std::this_thread::sleep_for(10ms);
+		}
+
+		return notified;
+	}
+};
+
+} // !namespace
+
+TEST_F(ResolverTest, resolve)
+{
+	auto query = resolver.resolve("127.0.0.1", 6667, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_TRUE(query->result().error.empty());
+	ASSERT_FALSE(query->result().cached);
+	ASSERT_EQ("127.0.0.1", query->result().address.ip());
+	ASSERT_EQ(6667U, query->result().address.port());
+	ASSERT_EQ(1, notifications(1));
+}
+
+TEST_F(ResolverTest, cache)
+{
+	ASSERT_TRUE(wait(resolver.resolve("127.0.0.1", 6667, AF_INET)));
+
+	/* Second one does not need the threads */
+	auto query = resolver.resolve("127.0.0.1", 6667, AF_INET);
+
+	ASSERT_TRUE(query->ready());
+	ASSERT_TRUE(query->result().cached);
+	ASSERT_EQ("127.0.0.1", query->result().address.ip());
+	ASSERT_EQ(1, notifications(1));
+
+	/* Another port is another entry */
+	query = resolver.resolve("127.0.0.1", 6697, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_FALSE(query->result().cached);
+	ASSERT_EQ(6697U, query->result().address.port());
+}
+
+TEST_F(ResolverTest, cacheDisabled)
+{
+	resolver.setCacheTime(0s);
+
+	ASSERT_TRUE(wait(resolver.resolve("127.0.0.1", 6667, AF_INET)));
+
+	auto query = resolver.resolve("127.0.0.1", 6667, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_FALSE(query->result().cached);
+	ASSERT_EQ(2, notifications(2));
+}
+
+TEST_F(ResolverTest, clear)
+{
+	ASSERT_TRUE(wait(resolver.resolve("127.0.0.1", 6667, AF_INET)));
+
+	resolver.clear();
+
+	auto query = resolver.resolve("127.0.0.1", 6667, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_FALSE(query->result().cached);
+}
+
+TEST_F(ResolverTest, error)
+{
+	/* RFC 2606, never resolves */
+	auto query = resolver.resolve("irccd.invalid", 6667, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_FALSE(query->result().error.empty());
+
+	/* Failures are not cached */
+	query = resolver.resolve("irccd.invalid", 6667, AF_INET);
+
+	ASSERT_TRUE(wait(query));
+	ASSERT_FALSE(query->result().cached);
+	ASSERT_FALSE(query->result().error.empty());
+}
+
+TEST_F(ResolverTest, many)
+{
+	std::vector<std::shared_ptr<const ResolverQuery>> queries;
+
+	for (int i = 0; i < 32; ++i) {
+		queries.push_back(resolver.resolve("127.0.0." + std::to_string(i + 1), 6667, AF_INET));
+	}
+
+	for (int i = 0; i < 32; ++i) {
+		ASSERT_TRUE(wait(queries[i]));
+		ASSERT_EQ("127.0.0." + std::to_string(i + 1), queries[i]->result().address.ip());
+	}
+
+	ASSERT_EQ(32, notifications(32));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
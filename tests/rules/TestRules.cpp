@@ -16,6 +16,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <chrono>
+#include <iostream>
+#include <random>
+
 #include <gtest/gtest.h>
 
 #include <RuleManager.h>
@@ -65,10 +69,10 @@ namespace irccd {
  */
 class RulesTest : public testing::Test {
 protected:
+	RuleManager manager;
+
 	RulesTest()
 	{
-		auto &manager = RuleManager::instance();
-
 		// #1
 		{
 			manager.add({
@@ -117,11 +121,6 @@ protected:
 			});
 		}
 	}
-
-	~RulesTest()
-	{
-		RuleManager::instance().clear();
-	}
 };
 
 TEST_F(RulesTest, basicMatch1)
@@ -196,8 +195,6 @@ TEST_F(RulesTest, complexMatch1)
 
 TEST_F(RulesTest, basicSolve)
 {
-	auto &manager = RuleManager::instance();
-
 	/* Allowed */
 	ASSERT_TRUE(manager.solve("malikania", "#staff", "", "a", "onMessage"));
 
@@ -216,8 +213,6 @@ TEST_F(RulesTest, basicSolve)
 
 TEST_F(RulesTest, gamesSolve)
 {
-	auto &manager = RuleManager::instance();
-
 	/* Allowed */
 	ASSERT_TRUE(manager.solve("malikania", "#games", "", "game", "onMessage"));
 
@@ -237,6 +232,135 @@ TEST_F(RulesTest, gamesSolve)
 	ASSERT_FALSE(manager.solve("malikania", "#test", "", "game", "onMessage"));
 }
 
+TEST_F(RulesTest, recompile)
+{
+	ASSERT_TRUE(manager.solve("unsafe", "#staff", "", "c", "onCommand"));
+
+	/* Rule #2 removed, the index must be rebuilt */
+	manager.remove(1);
+
+	ASSERT_FALSE(manager.solve("unsafe", "#staff", "", "c", "onCommand"));
+
+	/* Unconditional rule at the end */
+	manager.add(Rule{RuleMap{}, RuleMap{}, RuleMap{}, RuleMap{}, RuleMap{"onCommand"}, RuleAction::Accept});
+
+	ASSERT_TRUE(manager.solve("unsafe", "#staff", "", "c", "onCommand"));
+	ASSERT_TRUE(manager.solve("malikania", "#staff", "", "", "onCommand"));
+	ASSERT_FALSE(manager.solve("malikania", "#staff", "", "game", "onMessage"));
+}
+
+/* --------------------------------------------------------
+ * Large rule set, compare against the naive linear scan
+ * -------------------------------------------------------- */
+
+namespace {
+
+bool solveLinear(const std::vector<Rule> &rules,
+		 const std::string &server,
+		 const std::string &channel,
+		 const std::string &nickname,
+		 const std::string &plugin,
+		 const std::string &event)
+{
+	bool result{true};
+
+	for (const auto &r : rules) {
+		if (r.match(server, channel, nickname, plugin, event)) {
+			result = r.action() == RuleAction::Accept;
+		}
+	}
+
+	return result;
+}
+
+} // !namespace
+
+TEST(Benchmark, large)
+{
+	std::mt19937 rand(42);
+	std::vector<std::string> servers, channels, nicknames, plugins;
+	std::vector<std::string> events(RuleValidEvents.begin(), RuleValidEvents.end());
+
+	for (int i = 0; i < 20; ++i) {
+		servers.push_back("server" + std::to_string(i));
+		channels.push_back("#channel" + std::to_string(i));
+		nicknames.push_back("nick" + std::to_string(i));
+		plugins.push_back("plugin" + std::to_string(i));
+	}
+
+	auto pick = [&] (const std::vector<std::string> &list, int percent) {
+		RuleMap map;
+
+		if (static_cast<int>(rand() % 100) < percent) {
+			for (unsigned n = rand() % 3 + 1; n > 0; --n) {
+				map.insert(list[rand() % list.size()]);
+			}
+		}
+
+		return map;
+	};
+
+	RuleManager manager;
+	std::vector<Rule> rules;
+
+	for (int i = 0; i < 2000; ++i) {
+		Rule rule{
+			pick(servers, 50),
+			pick(channels, 50),
+			pick(nicknames, 20),
+			pick(plugins, 30),
+			pick(events, 70),
+			(rand() % 2) ? RuleAction::Accept : RuleAction::Drop
+		};
+
+		rules.push_back(rule);
+		manager.add(std::move(rule));
+	}
+
+	struct Query {
+		std::string server, channel, nickname, plugin, event;
+	};
+
+	std::vector<Query> queries;
+
+	for (int i = 0; i < 2000; ++i) {
+		queries.push_back({
+			servers[rand() % servers.size()],
+			channels[rand() % channels.size()],
+			nicknames[rand() % nicknames.size()],
+			plugins[rand() % plugins.size()],
+			events[rand() % events.size()]
+		});
+	}
+
+	std::vector<bool> expected, result;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (const auto &q : queries) {
+		expected.push_back(solveLinear(rules, q.server, q.channel, q.nickname, q.plugin, q.event));
+	}
+
+	auto linear = std::chrono::steady_clock::now() - start;
+
+	/* Include the compilation in the measure */
+	start = std::chrono::steady_clock::now();
+
+	for (const auto &q : queries) {
+		result.push_back(manager.solve(q.server, q.channel, q.nickname, q.plugin, q.event));
+	}
+
+	auto compiled = std::chrono::steady_clock::now() - start;
+
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	std::cout << "linear:   " << duration_cast<microseconds>(linear).count() << "us" << std::endl;
+	std::cout << "compiled: " << duration_cast<microseconds>(compiled).count() << "us" << std::endl;
+
+	ASSERT_EQ(expected, result);
+}
+
 } // !irccd
 
 int main(int argc, char **argv)
@@ -0,0 +1,234 @@
+/*
+ * TestServerLatency.cpp -- test the lag measurement and the stale connection detection
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <Server.h>
+#include <ServerLatency.h>
+
+using namespace irccd;
+using namespace std::chrono_literals;
+
+/* --------------------------------------------------------
+ * Histogram
+ * -------------------------------------------------------- */
+
+TEST(Histogram, empty)
+{
+	ServerLatency latency;
+
+	ASSERT_EQ(0U, latency.count());
+	ASSERT_EQ(0, latency.last().count());
+	ASSERT_EQ(0, latency.average().count());
+	ASSERT_EQ(0, latency.percentile(99).count());
+}
+
+TEST(Histogram, record)
+{
+	ServerLatency latency;
+
+	latency.record(40ms);
+	latency.record(10ms);
+	latency.record(100ms);
+
+	ASSERT_EQ(3U, latency.count());
+	ASSERT_EQ(100, latency.last().count());
+	ASSERT_EQ(10, latency.min().count());
+	ASSERT_EQ(100, latency.max().count());
+	ASSERT_EQ(50, latency.average().count());
+}
+
+TEST(Histogram, buckets)
+{
+	ServerLatency latency;
+
+	latency.record(0ms);
+	latency.record(1ms);
+	latency.record(3ms);
+	latency.record(1000ms);
+	latency.record(60000ms);
+
+	/* [0, 1), [1, 2), [2, 4), ... [512, 1024), ... and everything else in the last one */
+	ASSERT_EQ(1U, latency.bucket(0));
+	ASSERT_EQ(1U, latency.bucket(1));
+	ASSERT_EQ(1U, latency.bucket(2));
+	ASSERT_EQ(1U, latency.bucket(10));
+	ASSERT_EQ(1U, latency.bucket(ServerLatency::Buckets - 1));
+	ASSERT_EQ(std::chrono::milliseconds::max(), ServerLatency::bound(ServerLatency::Buckets - 1));
+}
+
+TEST(Histogram, percentile)
+{
+	ServerLatency latency;
+
+	for (int i = 0; i < 99; ++i) {
+		latency.record(20ms);
+	}
+
+	latency.record(900ms);
+
+	/* Upper bound of the bucket, capped to the maximum */
+	ASSERT_EQ(32, latency.percentile(50).count());
+	ASSERT_EQ(32, latency.percentile(99).count());
+	ASSERT_EQ(900, latency.percentile(100).count());
+}
+
+/* --------------------------------------------------------
+ * Keepalive
+ * -------------------------------------------------------- */
+
+namespace {
+
+template <typename Predicate>
+bool wait(Predicate predicate)
+{
+	for (int i = 0; i < 500 && !predicate(); ++i) {
+		std::this_thread::sleep_for(10ms);
+	}
+
+	return predicate();
+}
+
+class KeepaliveTest : public testing::Test {
+protected:
+	SocketTcp<address::Ip> m_server{AF_INET, 0};
+	std::shared_ptr<Server> m_irc;
+	std::atomic<bool> m_running{true};
+	std::thread m_thread;
+
+	KeepaliveTest()
+	{
+		m_server.set(SOL_SOCKET, SO_REUSEADDR, 1);
+		m_server.bind(address::Ip("127.0.0.1", 0, AF_INET));
+		m_server.listen();
+
+		ServerInfo info;
+		ServerIdentity identity;
+		ServerSettings settings;
+
+		info.name = "local";
+		info.host = "127.0.0.1";
+		info.port = static_cast<std::uint16_t>(m_server.getsockname().port());
+		identity.nickname = "irccd";
+		settings.pinginterval = 1;
+		settings.pingtimeout = 2;
+		settings.recotries = 0;
+
+		m_irc = std::make_shared<Server>(info, identity, settings);
+	}
+
+	~KeepaliveTest()
+	{
+		m_running = false;
+
+		if (m_thread.joinable()) {
+			m_thread.join();
+		}
+	}
+
+	/*
+	 * Run the server like the event loop does.
+	 */
+	void start()
+	{
+		m_thread = std::thread([this] () {
+			SocketListener listener;
+
+			while (m_running) {
+				m_irc->update();
+				m_irc->prepare(listener);
+
+				int timeout = m_irc->timeout();
+
+				try {
+					for (const SocketStatus &status : listener.waitMultiple((timeout < 0 || timeout > 50) ? 50 : timeout)) {
+						m_irc->sync(status.flags);
+					}
+				} catch (const SocketError &) {
+				}
+			}
+		});
+	}
+
+	/*
+	 * Read until the text has been received.
+	 */
+	std::string read(SocketTcp<address::Ip> &client, const std::string &expected)
+	{
+		std::string received;
+
+		while (received.find(expected) == std::string::npos) {
+			received += client.recv(512);
+		}
+
+		return received;
+	}
+};
+
+} // !namespace
+
+TEST_F(KeepaliveTest, pong)
+{
+	start();
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	read(client, "USER");
+	client.send(":srv 001 irccd :Welcome\r\n");
+
+	/* The first probe is sent after one interval */
+	std::string received = read(client, "PING :irccd-1\r\n");
+
+	ASSERT_EQ(std::string::npos, received.find("PING :irccd-2"));
+
+	client.send(":srv PONG srv :irccd-1\r\n");
+
+	ASSERT_TRUE(wait([&] () { return m_irc->latency().count() == 1U; }));
+	ASSERT_LT(m_irc->latency().last(), 1000ms);
+	ASSERT_EQ(ServerState::Connected, m_irc->status().state);
+	ASSERT_NE(std::chrono::steady_clock::time_point(), m_irc->status().lastReceived);
+}
+
+TEST_F(KeepaliveTest, stale)
+{
+	start();
+
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	read(client, "USER");
+	client.send(":srv 001 irccd :Welcome\r\n");
+
+	ASSERT_TRUE(wait([&] () { return m_irc->status().state == ServerState::Connected; }));
+
+	/* The socket stays open but nothing comes anymore, the probes are not answered */
+	ASSERT_TRUE(wait([&] () { return m_irc->status().state != ServerState::Connected; }));
+	ASSERT_EQ(0U, m_irc->latency().count());
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
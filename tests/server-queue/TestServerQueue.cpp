@@ -0,0 +1,300 @@
+/*
+ * TestServerQueue.cpp -- test the rate limited server queue
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <Server.h>
+#include <ServerQueue.h>
+
+using namespace irccd;
+using namespace std::chrono_literals;
+
+/* --------------------------------------------------------
+ * ServerQueue
+ * -------------------------------------------------------- */
+
+namespace {
+
+class ServerQueueTest : public testing::Test {
+protected:
+	ServerQueue::Clock::time_point now{ServerQueue::Clock::now()};
+	std::vector<std::string> sent;
+
+	ServerCommand command(std::string name, bool result = true)
+	{
+		return [this, name, result] () {
+			if (result) {
+				sent.push_back(name);
+			}
+
+			return result;
+		};
+	}
+};
+
+} // !namespace
+
+TEST_F(ServerQueueTest, burst)
+{
+	ServerQueue queue(3, 1000, 0, ServerOverflow::DropNew);
+
+	for (int i = 0; i < 5; ++i) {
+		queue.push(ServerLane::Message, command(std::to_string(i)), now);
+	}
+
+	queue.flush(now);
+
+	ASSERT_EQ((std::vector<std::string>{"0", "1", "2"}), sent);
+	ASSERT_EQ(1000, queue.timeout(now));
+	ASSERT_EQ(500, queue.timeout(now + 500ms));
+
+	/* One token per second */
+	queue.flush(now + 999ms);
+	ASSERT_EQ(3U, sent.size());
+	queue.flush(now + 1000ms);
+	ASSERT_EQ(4U, sent.size());
+	queue.flush(now + 2500ms);
+	ASSERT_EQ(5U, sent.size());
+	ASSERT_EQ(-1, queue.timeout(now + 2500ms));
+}
+
+TEST_F(ServerQueueTest, refillCapped)
+{
+	ServerQueue queue(2, 1000, 0, ServerOverflow::DropNew);
+
+	/* A long idle period does not earn more than the burst */
+	for (int i = 0; i < 4; ++i) {
+		queue.push(ServerLane::Message, command(std::to_string(i)), now + 10s);
+	}
+
+	queue.flush(now + 10s);
+
+	ASSERT_EQ(2U, sent.size());
+}
+
+TEST_F(ServerQueueTest, unlimited)
+{
+	ServerQueue queue(0, 1000, 0, ServerOverflow::DropNew);
+
+	for (int i = 0; i < 100; ++i) {
+		queue.push(ServerLane::Message, command(std::to_string(i)), now);
+	}
+
+	queue.flush(now);
+
+	ASSERT_EQ(100U, sent.size());
+	ASSERT_EQ(-1, queue.timeout(now));
+}
+
+TEST_F(ServerQueueTest, lanes)
+{
+	ServerQueue queue(10, 1000, 0, ServerOverflow::DropNew);
+
+	queue.push(ServerLane::Message, command("privmsg 1"), now);
+	queue.push(ServerLane::Message, command("privmsg 2"), now);
+	queue.push(ServerLane::Control, command("join"), now);
+	queue.push(ServerLane::Control, command("mode"), now);
+	queue.flush(now);
+
+	ASSERT_EQ((std::vector<std::string>{"join", "mode", "privmsg 1", "privmsg 2"}), sent);
+}
+
+TEST_F(ServerQueueTest, failure)
+{
+	ServerQueue queue(10, 1000, 0, ServerOverflow::DropNew);
+
+	queue.push(ServerLane::Message, command("a", false), now);
+	queue.push(ServerLane::Message, command("b"), now);
+	queue.flush(now);
+
+	/* The order is kept and no token is consumed */
+	ASSERT_TRUE(sent.empty());
+	ASSERT_EQ(2U, queue.size());
+	ASSERT_EQ(-1, queue.timeout(now));
+}
+
+TEST_F(ServerQueueTest, dropNew)
+{
+	ServerQueue queue(10, 1000, 2, ServerOverflow::DropNew);
+
+	ASSERT_TRUE(queue.push(ServerLane::Message, command("a"), now));
+	ASSERT_TRUE(queue.push(ServerLane::Message, command("b"), now));
+	ASSERT_FALSE(queue.push(ServerLane::Control, command("c"), now));
+
+	queue.flush(now);
+
+	ASSERT_EQ((std::vector<std::string>{"a", "b"}), sent);
+	ASSERT_EQ(1U, queue.stats().dropped);
+}
+
+TEST_F(ServerQueueTest, dropOldest)
+{
+	ServerQueue queue(10, 1000, 3, ServerOverflow::DropOldest);
+
+	queue.push(ServerLane::Message, command("a"), now);
+	queue.push(ServerLane::Control, command("join"), now);
+	queue.push(ServerLane::Message, command("b"), now);
+
+	/* The oldest message makes room for the new one */
+	ASSERT_TRUE(queue.push(ServerLane::Message, command("c"), now));
+
+	/* The oldest message makes room for the control command */
+	ASSERT_TRUE(queue.push(ServerLane::Control, command("mode"), now));
+
+	queue.flush(now);
+
+	ASSERT_EQ((std::vector<std::string>{"join", "mode", "c"}), sent);
+	ASSERT_EQ(2U, queue.stats().dropped);
+}
+
+TEST_F(ServerQueueTest, dropOldestControlOnly)
+{
+	ServerQueue queue(10, 1000, 2, ServerOverflow::DropOldest);
+
+	queue.push(ServerLane::Control, command("join 1"), now);
+	queue.push(ServerLane::Control, command("join 2"), now);
+
+	/* A message never evicts a control command */
+	ASSERT_FALSE(queue.push(ServerLane::Message, command("a"), now));
+	ASSERT_TRUE(queue.push(ServerLane::Control, command("join 3"), now));
+
+	queue.flush(now);
+
+	ASSERT_EQ((std::vector<std::string>{"join 2", "join 3"}), sent);
+}
+
+TEST_F(ServerQueueTest, stats)
+{
+	ServerQueue queue(1, 1000, 0, ServerOverflow::DropNew);
+
+	queue.push(ServerLane::Message, command("a"), now);
+	queue.push(ServerLane::Message, command("b"), now);
+	queue.push(ServerLane::Message, command("c"), now);
+	queue.flush(now);
+	queue.flush(now + 1s);
+	queue.flush(now + 2s);
+
+	ServerQueueStats stats = queue.stats();
+
+	ASSERT_EQ(0U, stats.depth);
+	ASSERT_EQ(3U, stats.highWater);
+	ASSERT_EQ(3U, stats.sent);
+	ASSERT_EQ(0U, stats.dropped);
+	ASSERT_EQ(2000ms, stats.maxWait);
+	ASSERT_EQ(3000ms, stats.totalWait);
+}
+
+/* --------------------------------------------------------
+ * Server lanes
+ * -------------------------------------------------------- */
+
+namespace {
+
+class ServerLaneTest : public testing::Test {
+protected:
+	SocketTcp<address::Ip> m_server{AF_INET, 0};
+	std::shared_ptr<Server> m_irc;
+	std::atomic<bool> m_running{true};
+	std::thread m_thread;
+
+	ServerLaneTest()
+	{
+		m_server.set(SOL_SOCKET, SO_REUSEADDR, 1);
+		m_server.bind(address::Ip("127.0.0.1", 0, AF_INET));
+		m_server.listen();
+
+		ServerInfo info;
+		ServerIdentity identity;
+		ServerSettings settings;
+
+		info.name = "local";
+		info.host = "127.0.0.1";
+		info.port = static_cast<std::uint16_t>(m_server.getsockname().port());
+		identity.nickname = "irccd";
+		settings.recotries = 0;
+
+		m_irc = std::make_shared<Server>(info, identity, settings);
+		m_thread = std::thread([this] () {
+			SocketListener listener;
+
+			while (m_running) {
+				m_irc->update();
+				m_irc->prepare(listener);
+
+				int timeout = m_irc->timeout();
+
+				try {
+					for (const SocketStatus &status : listener.waitMultiple((timeout < 0 || timeout > 50) ? 50 : timeout)) {
+						m_irc->sync(status.flags);
+					}
+				} catch (const SocketError &) {
+				}
+			}
+		});
+	}
+
+	~ServerLaneTest()
+	{
+		m_running = false;
+		m_thread.join();
+	}
+
+	std::string read(SocketTcp<address::Ip> &client, const std::string &expected)
+	{
+		std::string received;
+
+		while (received.find(expected) == std::string::npos) {
+			received += client.recv(512);
+		}
+
+		return received;
+	}
+};
+
+} // !namespace
+
+TEST_F(ServerLaneTest, messageThenPart)
+{
+	SocketTcp<address::Ip> client = m_server.accept();
+
+	read(client, "USER");
+	client.send(":srv 001 irccd :Welcome\r\n");
+
+	/* The goodbye message must not be overtaken by the part */
+	m_irc->message("#staff", "bye");
+	m_irc->part("#staff");
+
+	std::string received = read(client, "PART #staff\r\n");
+	std::size_t message = received.find("PRIVMSG #staff :bye\r\n");
+
+	ASSERT_NE(std::string::npos, message);
+	ASSERT_LT(message, received.find("PART #staff\r\n"));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,303 @@
+/*
+ * TestServerTracker.cpp -- test the channel membership tracking
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ServerTracker.h>
+
+using namespace irccd;
+using namespace std::chrono;
+
+namespace {
+
+class ServerTrackerTest : public testing::Test {
+protected:
+	ServerTracker tracker;
+	IrcMessage message;
+
+	void feed(std::string line)
+	{
+		ASSERT_TRUE(message.parse(&line[0], line.size()));
+
+		tracker.update(message);
+	}
+
+	/*
+	 * Members as "modes nickname" for easier comparisons.
+	 */
+	std::vector<std::string> members(const std::string &channel)
+	{
+		std::vector<std::string> list;
+
+		for (const ServerMember &member : tracker.channel(channel).members) {
+			list.push_back(member.modes + member.nickname);
+		}
+
+		return list;
+	}
+
+	ServerTrackerTest()
+	{
+		feed(":irc.example.org 001 irccd :Welcome");
+		feed(":irccd!~irccd@localhost JOIN #staff");
+		feed(":irc.example.org 353 irccd = #staff :@irccd +jean francis");
+		feed(":irc.example.org 366 irccd #staff :End of /NAMES list.");
+	}
+};
+
+} // !namespace
+
+TEST_F(ServerTrackerTest, names)
+{
+	ASSERT_EQ((std::vector<std::string>{"#staff"}), tracker.channels());
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd", "+jean"}), members("#staff"));
+	ASSERT_EQ(3U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, namesAgain)
+{
+	/* A new NAMES reply replaces the list */
+	feed(":irc.example.org 353 irccd = #staff :@irccd @markand");
+	feed(":irc.example.org 353 irccd = #staff :+markand");
+	feed(":irc.example.org 366 irccd #staff :End of /NAMES list.");
+
+	ASSERT_EQ((std::vector<std::string>{"@irccd", "@+markand"}), members("#staff"));
+	ASSERT_EQ(2U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, namesOther)
+{
+	/* Not in that channel */
+	feed(":irc.example.org 353 irccd = #other :jean");
+	feed(":irc.example.org 366 irccd #other :End of /NAMES list.");
+
+	ASSERT_THROW(tracker.channel("#other"), std::out_of_range);
+}
+
+TEST_F(ServerTrackerTest, userhostInNames)
+{
+	feed(":irc.example.org 353 irccd = #staff :@irccd!~irccd@localhost +jean!~jean@localhost");
+	feed(":irc.example.org 366 irccd #staff :End of /NAMES list.");
+
+	ASSERT_EQ((std::vector<std::string>{"@irccd", "+jean"}), members("#staff"));
+}
+
+TEST_F(ServerTrackerTest, joinPart)
+{
+	feed(":markand!~markand@localhost JOIN #staff");
+	feed(":jean!~jean@localhost PART #staff :bye");
+
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd", "markand"}), members("#staff"));
+	ASSERT_EQ(3U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, kick)
+{
+	feed(":irccd!~irccd@localhost KICK #staff jean :spam");
+
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd"}), members("#staff"));
+
+	/* Kicked ourselves */
+	feed(":francis!~francis@localhost KICK #staff irccd :revenge");
+
+	ASSERT_TRUE(tracker.channels().empty());
+	ASSERT_EQ(1U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, quit)
+{
+	feed(":irccd!~irccd@localhost JOIN #test");
+	feed(":jean!~jean@localhost JOIN #test");
+	feed(":jean!~jean@localhost QUIT :Quit: bye");
+
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd"}), members("#staff"));
+	ASSERT_EQ((std::vector<std::string>{"irccd"}), members("#test"));
+	ASSERT_EQ(2U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, part)
+{
+	feed(":irccd!~irccd@localhost PART #staff");
+
+	ASSERT_TRUE(tracker.channels().empty());
+	ASSERT_THROW(tracker.channel("#staff"), std::out_of_range);
+	ASSERT_EQ(1U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, nick)
+{
+	feed(":jean!~jean@localhost NICK :Jean_");
+
+	ASSERT_EQ((std::vector<std::string>{"+Jean_", "francis", "@irccd"}), members("#staff"));
+
+	/* The new nickname is used for the next events */
+	feed(":JEAN_!~jean@localhost PART #staff");
+
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd"}), members("#staff"));
+}
+
+TEST_F(ServerTrackerTest, nickSelf)
+{
+	feed(":irccd!~irccd@localhost NICK :bot");
+	feed(":bot!~irccd@localhost PART #staff");
+
+	ASSERT_TRUE(tracker.channels().empty());
+}
+
+TEST_F(ServerTrackerTest, mode)
+{
+	/* b and l take an argument, n does not */
+	feed(":irccd!~irccd@localhost MODE #staff +bo-v+nl *!*@spam francis jean 10");
+
+	ASSERT_EQ((std::vector<std::string>{"@francis", "@irccd", "jean"}), members("#staff"));
+
+	/* l does not take an argument when removed */
+	feed(":irccd!~irccd@localhost MODE #staff -lo francis");
+
+	ASSERT_EQ((std::vector<std::string>{"francis", "@irccd", "jean"}), members("#staff"));
+}
+
+TEST_F(ServerTrackerTest, support)
+{
+	feed(":irc.example.org 005 irccd PREFIX=(qaohv)~&@%+ CHANMODES=beI,k,fl,imnpst :are supported");
+	feed(":irc.example.org 353 irccd = #staff :~@irccd %jean &+francis");
+	feed(":irc.example.org 366 irccd #staff :End of /NAMES list.");
+
+	ASSERT_EQ((std::vector<std::string>{"&+francis", "~@irccd", "%jean"}), members("#staff"));
+
+	/* f takes an argument when set */
+	feed(":irccd!~irccd@localhost MODE #staff +fh 10:5 francis");
+
+	ASSERT_EQ((std::vector<std::string>{"&%+francis", "~@irccd", "%jean"}), members("#staff"));
+}
+
+TEST_F(ServerTrackerTest, casemapping)
+{
+	feed(":irccd!~irccd@localhost JOIN #[test]");
+	feed(":[jean]!~jean@localhost JOIN #[test]");
+
+	/* rfc1459: [ ] \ ~ are the upper case of { } | ^ */
+	ASSERT_NO_THROW(tracker.channel("#{TEST}"));
+
+	feed(":{JEAN}!~jean@localhost PART #{test}");
+
+	ASSERT_EQ((std::vector<std::string>{"irccd"}), members("#[test]"));
+}
+
+TEST_F(ServerTrackerTest, casemappingAscii)
+{
+	feed(":irc.example.org 005 irccd CASEMAPPING=ascii :are supported");
+	feed(":irccd!~irccd@localhost JOIN #[test]");
+
+	ASSERT_THROW(tracker.channel("#{test}"), std::out_of_range);
+	ASSERT_NO_THROW(tracker.channel("#[TEST]"));
+}
+
+TEST_F(ServerTrackerTest, casemappingChanged)
+{
+	/* Our nickname and the channel are interned before the ISUPPORT tokens */
+	feed(":irc.example.org 001 [bot] :Welcome");
+	feed(":[bot]!~bot@localhost JOIN #[test]");
+	feed(":irc.example.org 005 [bot] CASEMAPPING=ascii :are supported");
+
+	ASSERT_NO_THROW(tracker.channel("#[TEST]"));
+	ASSERT_THROW(tracker.channel("#{test}"), std::out_of_range);
+
+	feed(":[BOT]!~bot@localhost PART #[test]");
+
+	ASSERT_TRUE(tracker.channels().empty());
+}
+
+TEST_F(ServerTrackerTest, topic)
+{
+	feed(":irc.example.org 332 irccd #staff :welcome");
+
+	ASSERT_EQ("welcome", tracker.channel("#staff").topic);
+
+	feed(":jean!~jean@localhost TOPIC #staff :new topic");
+
+	ASSERT_EQ("new topic", tracker.channel("#staff").topic);
+}
+
+TEST_F(ServerTrackerTest, reconnect)
+{
+	feed(":irc.example.org 001 irccd :Welcome");
+
+	ASSERT_TRUE(tracker.channels().empty());
+	ASSERT_EQ(1U, tracker.users());
+}
+
+TEST_F(ServerTrackerTest, benchmark)
+{
+	const int users = 10000;
+
+	feed(":irccd!~irccd@localhost JOIN #big");
+
+	/* NAMES burst */
+	auto start = steady_clock::now();
+
+	for (int i = 0; i < users; i += 100) {
+		std::string line = ":irc.example.org 353 irccd = #big :";
+
+		for (int j = i; j < i + 100; ++j) {
+			line += (j % 10 == 0 ? "@user" : "user") + std::to_string(j) + " ";
+		}
+
+		feed(line);
+	}
+
+	feed(":irc.example.org 366 irccd #big :End of /NAMES list.");
+
+	auto namesTime = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	ASSERT_EQ(static_cast<std::size_t>(users + 3), tracker.users());
+
+	/* Churn: joins, renames and quits on the full channel */
+	start = steady_clock::now();
+
+	for (int i = 0; i < users; ++i) {
+		std::string id = std::to_string(i);
+
+		feed(":guest" + id + "!~guest@localhost JOIN #big");
+		feed(":user" + id + "!~user@localhost NICK :renamed" + id);
+		feed(":guest" + id + "!~guest@localhost QUIT :bye");
+	}
+
+	auto churnTime = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	ServerChannelInfo info = tracker.channel("#big");
+
+	ASSERT_EQ(static_cast<std::size_t>(users), info.members.size());
+	ASSERT_EQ(static_cast<std::size_t>(users + 3), tracker.users());
+
+	std::cout << "names:  " << namesTime << " us for " << users << " users" << std::endl;
+	std::cout << "churn:  " << churnTime * 1000 / (users * 3) << " ns/event" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,237 @@
+/*
+ * TestTransportBuffer.cpp -- test the transport input buffer
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <TransportBuffer.h>
+
+using namespace irccd;
+using namespace std::chrono;
+
+namespace {
+
+/*
+ * Write the data like recv() would, at most chunk bytes at once, and collect the frames after each read.
+ */
+std::vector<std::string> feed(TransportBuffer &buffer, const std::string &data, std::size_t chunk = 512)
+{
+	std::vector<std::string> frames;
+	std::size_t offset = 0;
+
+	while (offset < data.size()) {
+		std::size_t length;
+		char *dest = buffer.reserve(length);
+
+		length = std::min({length, chunk, data.size() - offset});
+		std::memcpy(dest, data.data() + offset, length);
+		buffer.commit(length);
+		offset += length;
+
+		const char *frame;
+		std::size_t size;
+
+		while (buffer.next(frame, size)) {
+			frames.emplace_back(frame, size);
+		}
+	}
+
+	return frames;
+}
+
+} // !namespace
+
+TEST(TransportBuffer, simple)
+{
+	TransportBuffer buffer;
+
+	ASSERT_EQ((std::vector<std::string>{"{\"command\":\"reload\"}"}), feed(buffer, "{\"command\":\"reload\"}\r\n\r\n"));
+	ASSERT_EQ(0U, buffer.size());
+}
+
+TEST(TransportBuffer, pipelined)
+{
+	TransportBuffer buffer;
+
+	ASSERT_EQ((std::vector<std::string>{"a", "", "b"}), feed(buffer, "a\r\n\r\n\r\n\r\nb\r\n\r\nc"));
+	ASSERT_EQ(1U, buffer.size());
+}
+
+TEST(TransportBuffer, splitDelimiter)
+{
+	TransportBuffer buffer;
+
+	/* The delimiter arrives one byte at a time, a lone \r\n is part of the message */
+	ASSERT_EQ((std::vector<std::string>{"a\r\nb", "c"}), feed(buffer, "a\r\nb\r\n\r\nc\r\n\r\n", 1));
+}
+
+TEST(TransportBuffer, compaction)
+{
+	TransportBuffer buffer;
+	std::string data;
+
+	for (int i = 0; i < 1000; ++i) {
+		data += "{\"command\":\"message\",\"server\":\"local\",\"target\":\"#staff\",\"message\":\"" + std::to_string(i) + "\"}\r\n\r\n";
+	}
+
+	ASSERT_EQ(1000U, feed(buffer, data, 100).size());
+
+	/* Consumed data is reused instead of growing, the room for one read is kept after a partial frame */
+	ASSERT_LE(buffer.capacity(), TransportBuffer::MinRead * 2);
+}
+
+TEST(TransportBuffer, adaptive)
+{
+	TransportBuffer buffer;
+	std::string large(TransportBuffer::MaxRead * 2 - TransportBuffer::MinRead, 'x');
+
+	/* Full reads double the size: 4096 + 8192 + ... + 65536 */
+	feed(buffer, large, TransportBuffer::MaxRead);
+
+	ASSERT_EQ(TransportBuffer::MaxRead, buffer.readSize());
+
+	/* Small reads shrink it again */
+	for (int i = 0; i < 10; ++i) {
+		feed(buffer, "x", 1);
+	}
+
+	ASSERT_EQ(TransportBuffer::MinRead, buffer.readSize());
+}
+
+TEST(TransportBuffer, limit)
+{
+	TransportBuffer buffer(8192);
+
+	try {
+		feed(buffer, std::string(16384, 'x'));
+		FAIL() << "exception expected";
+	} catch (const std::length_error &) {
+	}
+
+	/* Stopped as soon as the limit was reached */
+	ASSERT_LE(buffer.size(), 8192U + 512U);
+}
+
+/* --------------------------------------------------------
+ * Benchmark, find/substr/erase vs TransportBuffer
+ * -------------------------------------------------------- */
+
+namespace {
+
+/*
+ * Previous path of TransportClient::receive.
+ */
+std::size_t legacy(const std::string &data, std::size_t chunk)
+{
+	std::string input;
+	std::size_t count = 0;
+
+	for (std::size_t offset = 0; offset < data.size(); offset += chunk) {
+		input += data.substr(offset, chunk);
+
+		std::string::size_type pos;
+
+		while ((pos = input.find("\r\n\r\n")) != std::string::npos) {
+			auto message = input.substr(0, pos);
+
+			input.erase(input.begin(), input.begin() + pos + 4);
+			count += !message.empty();
+		}
+	}
+
+	return count;
+}
+
+std::size_t current(const std::string &data, std::size_t chunk)
+{
+	TransportBuffer buffer(data.size());
+	std::size_t count = 0;
+	std::size_t offset = 0;
+
+	while (offset < data.size()) {
+		std::size_t length;
+		char *dest = buffer.reserve(length);
+
+		length = std::min({length, chunk, data.size() - offset});
+		std::memcpy(dest, data.data() + offset, length);
+		buffer.commit(length);
+		offset += length;
+
+		const char *frame;
+		std::size_t size;
+
+		while (buffer.next(frame, size)) {
+			count += size > 0;
+		}
+	}
+
+	return count;
+}
+
+template <typename Function>
+long long measure(Function function)
+{
+	auto start = steady_clock::now();
+
+	function();
+
+	return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+} // !namespace
+
+TEST(TransportBuffer, benchmark)
+{
+	/* 20000 pipelined commands received at once */
+	std::string pipelined;
+
+	for (int i = 0; i < 20000; ++i) {
+		pipelined += "{\"command\":\"message\",\"server\":\"local\",\"target\":\"#staff\",\"message\":\"hello\"}\r\n\r\n";
+	}
+
+	/* One 2 MB message, read 512 bytes at once before and with the adaptive size now */
+	std::string large = "{\"command\":\"message\",\"message\":\"" + std::string(2 * 1024 * 1024, 'x') + "\"}\r\n\r\n";
+
+	std::size_t count = 0;
+
+	auto legacyPipelined = measure([&] () { count = legacy(pipelined, pipelined.size()); });
+	ASSERT_EQ(20000U, count);
+	auto currentPipelined = measure([&] () { count = current(pipelined, pipelined.size()); });
+	ASSERT_EQ(20000U, count);
+	auto legacyLarge = measure([&] () { count = legacy(large, 512); });
+	ASSERT_EQ(1U, count);
+	auto currentLarge = measure([&] () { count = current(large, TransportBuffer::MaxRead); });
+	ASSERT_EQ(1U, count);
+
+	std::cout << "pipelined: find/erase " << legacyPipelined << " us, buffer " << currentPipelined << " us" << std::endl;
+	std::cout << "large:     find/erase " << legacyLarge << " us, buffer " << currentLarge << " us" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,308 @@
+/*
+ * TestTransportClient.cpp -- test the transport commands parsing
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <MsgPack.h>
+#include <TransportClient.h>
+
+using namespace irccd;
+
+namespace {
+
+/*
+ * Client without I/O, the messages are given directly to parse and the output is flushed to a socket pair.
+ */
+class FakeClient : public TransportClientAbstract {
+private:
+	SocketTcp<address::Ip> m_socket{AF_INET, 0};
+
+protected:
+	void receive() override
+	{
+	}
+
+	void send() override
+	{
+	}
+
+public:
+	using TransportClientAbstract::parse;
+	using TransportClientAbstract::send;
+
+	void parse(const std::string &message)
+	{
+		parse(message.data(), message.size());
+	}
+
+	TransportOutput &output() noexcept
+	{
+		return m_output;
+	}
+
+	SocketAbstract &socket() noexcept override
+	{
+		return m_socket;
+	}
+};
+
+class TransportClientTest : public testing::Test {
+protected:
+	int m_sockets[2];
+	FakeClient m_client;
+
+	TransportClientTest()
+	{
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, m_sockets) < 0) {
+			throw std::runtime_error("socketpair failed");
+		}
+
+		::fcntl(m_sockets[1], F_SETFL, ::fcntl(m_sockets[1], F_GETFL) | O_NONBLOCK);
+	}
+
+	~TransportClientTest()
+	{
+		::close(m_sockets[0]);
+		::close(m_sockets[1]);
+	}
+
+	/*
+	 * Flush the client output and split the JSON messages.
+	 */
+	std::vector<std::string> replies()
+	{
+		std::string data;
+		std::vector<std::string> result;
+		char buffer[8192];
+		ssize_t nbread;
+
+		while (!m_client.output().empty()) {
+			m_client.output().write(m_sockets[0]);
+		}
+		while ((nbread = ::read(m_sockets[1], buffer, sizeof (buffer))) > 0) {
+			data.append(buffer, nbread);
+		}
+
+		for (std::size_t pos; (pos = data.find("\r\n\r\n")) != std::string::npos; data.erase(0, pos + 4)) {
+			result.push_back(data.substr(0, pos));
+		}
+
+		return result;
+	}
+};
+
+} // !namespace
+
+TEST_F(TransportClientTest, withoutId)
+{
+	int count = 0;
+
+	m_client.onMessage.connect([&] (std::string, std::string, std::string) {
+		++ count;
+	});
+	m_client.parse("{\"command\":\"message\",\"server\":\"local\",\"target\":\"#staff\",\"message\":\"hello\"}");
+
+	/* Fire-and-forget as before */
+	ASSERT_EQ(1, count);
+	ASSERT_TRUE(replies().empty());
+
+	m_client.parse("{\"command\":\"foo\"}");
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(1U, result.size());
+	ASSERT_EQ("{\"error\":\"invalid command: foo\"}", result[0]);
+}
+
+TEST_F(TransportClientTest, acknowledge)
+{
+	m_client.parse("{\"command\":\"message\",\"id\":42,\"server\":\"local\",\"target\":\"#staff\",\"message\":\"hello\"}");
+	m_client.parse("{\"command\":\"subscribe\",\"id\":\"sub\"}");
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(2U, result.size());
+	ASSERT_EQ("{\"response\":\"message\",\"id\":42}", result[0]);
+	ASSERT_EQ("{\"response\":\"subscribe\",\"id\":\"sub\"}", result[1]);
+}
+
+TEST_F(TransportClientTest, error)
+{
+	m_client.parse("{\"command\":\"foo\",\"id\":1}");
+	m_client.parse("{\"command\":\"reload\",\"id\":2}");
+	m_client.parse("{\"id\":3}");
+	m_client.parse("{\"command\":\"message\",\"id\":{}}");
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(4U, result.size());
+	ASSERT_EQ("{\"error\":\"invalid command: foo\",\"id\":1}", result[0]);
+	ASSERT_EQ("{\"error\":\"missing `plugin' property\",\"id\":2}", result[1]);
+	ASSERT_EQ("{\"error\":\"invalid message: missing `command' property\",\"id\":3}", result[2]);
+	ASSERT_EQ("{\"error\":\"invalid message: `id' property must be a string or an integer\"}", result[3]);
+}
+
+TEST_F(TransportClientTest, notImplemented)
+{
+	m_client.parse("{\"command\":\"reload\",\"id\":1,\"plugin\":\"ask\"}");
+	m_client.parse("{\"command\":\"reconnect\",\"id\":2}");
+
+	/* Only acknowledged once something handles it */
+	m_client.onReload.connect([] (std::string) {});
+	m_client.parse("{\"command\":\"reload\",\"id\":3,\"plugin\":\"ask\"}");
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(3U, result.size());
+	ASSERT_EQ("{\"error\":\"command not implemented: reload\",\"id\":1}", result[0]);
+	ASSERT_EQ("{\"error\":\"command not implemented: reconnect\",\"id\":2}", result[1]);
+	ASSERT_EQ("{\"response\":\"reload\",\"id\":3}", result[2]);
+}
+
+TEST_F(TransportClientTest, deferred)
+{
+	std::vector<TransportRequest> requests;
+
+	m_client.onStats.connect([&] (std::string) {
+		requests.push_back(m_client.defer());
+	});
+	m_client.onNotice.connect([&] (std::string, std::string, std::string) {
+		requests.push_back(m_client.defer());
+	});
+	m_client.parse("{\"command\":\"stats\",\"id\":1}");
+	m_client.parse("{\"command\":\"notice\",\"id\":2,\"server\":\"local\",\"target\":\"jean\",\"message\":\"hi\"}");
+	m_client.parse("{\"command\":\"notice\",\"id\":3,\"server\":\"local\",\"target\":\"jean\",\"message\":\"hi\"}");
+
+	/* Nothing until executed */
+	ASSERT_EQ(3U, requests.size());
+	ASSERT_TRUE(replies().empty());
+
+	/* Executed later, in any order */
+	m_client.resume(requests[2]);
+	m_client.complete();
+	m_client.resume(requests[0]);
+	m_client.send("{\"response\":\"stats\",\"servers\":[]}");
+	m_client.complete();
+	m_client.resume(requests[1]);
+	m_client.error("server local not found");
+	m_client.complete();
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(3U, result.size());
+	ASSERT_EQ("{\"response\":\"notice\",\"id\":3}", result[0]);
+	ASSERT_EQ("{\"response\":\"stats\",\"servers\":[],\"id\":1}", result[1]);
+	ASSERT_EQ("{\"error\":\"server local not found\",\"id\":2}", result[2]);
+}
+
+TEST_F(TransportClientTest, batch)
+{
+	std::vector<std::string> messages;
+
+	m_client.onMessage.connect([&] (std::string, std::string target, std::string message) {
+		messages.push_back(target + ":" + message);
+	});
+	m_client.parse("["
+		"{\"command\":\"message\",\"id\":1,\"server\":\"local\",\"target\":\"#a\",\"message\":\"one\"},"
+		"{\"command\":\"message\",\"id\":2,\"server\":\"local\"},"
+		"42,"
+		"{\"command\":\"message\",\"server\":\"local\",\"target\":\"#b\",\"message\":\"two\"},"
+		"{\"command\":\"message\",\"id\":\"x\",\"server\":\"local\",\"target\":\"#c\",\"message\":\"three\"}"
+	"]");
+
+	/* An invalid command does not stop the batch */
+	ASSERT_EQ(3U, messages.size());
+	ASSERT_EQ("#a:one", messages[0]);
+	ASSERT_EQ("#b:two", messages[1]);
+	ASSERT_EQ("#c:three", messages[2]);
+
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(4U, result.size());
+	ASSERT_EQ("{\"response\":\"message\",\"id\":1}", result[0]);
+	ASSERT_EQ("{\"error\":\"missing `target' property\",\"id\":2}", result[1]);
+	ASSERT_EQ("{\"error\":\"invalid message: a batch must only contain objects\"}", result[2]);
+	ASSERT_EQ("{\"response\":\"message\",\"id\":\"x\"}", result[3]);
+}
+
+TEST_F(TransportClientTest, msgpack)
+{
+	m_client.parse("{\"command\":\"format\",\"id\":1,\"format\":\"msgpack\"}");
+
+	/* The format response is still in JSON */
+	std::vector<std::string> result = replies();
+
+	ASSERT_EQ(1U, result.size());
+	ASSERT_EQ("{\"response\":\"format\",\"format\":\"msgpack\",\"id\":1}", result[0]);
+
+	MsgPackWriter writer;
+
+	writer.array(2);
+	writer.map(2);
+	writer.string("command");
+	writer.string("subscribe");
+	writer.string("id");
+	writer.integer(2);
+	writer.map(2);
+	writer.string("command");
+	writer.string("foo");
+	writer.string("id");
+	writer.string("bar");
+	m_client.parse(writer.data());
+
+	std::string data;
+	char buffer[512];
+	ssize_t nbread;
+
+	while (!m_client.output().empty()) {
+		m_client.output().write(m_sockets[0]);
+	}
+	while ((nbread = ::read(m_sockets[1], buffer, sizeof (buffer))) > 0) {
+		data.append(buffer, nbread);
+	}
+
+	std::vector<JsonObject> objects;
+
+	while (data.size() >= 4) {
+		std::size_t length = (static_cast<unsigned char>(data[0]) << 24) | (static_cast<unsigned char>(data[1]) << 16) |
+			(static_cast<unsigned char>(data[2]) << 8) | static_cast<unsigned char>(data[3]);
+
+		objects.push_back(MsgPackReader(data.data() + 4, length).read().toObject());
+		data.erase(0, 4 + length);
+	}
+
+	ASSERT_EQ(2U, objects.size());
+	ASSERT_EQ("subscribe", objects[0]["response"].toString());
+	ASSERT_EQ(2, objects[0]["id"].toInteger());
+	ASSERT_EQ("invalid command: foo", objects[1]["error"].toString());
+	ASSERT_EQ("bar", objects[1]["id"].toString());
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
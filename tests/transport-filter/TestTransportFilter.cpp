@@ -0,0 +1,178 @@
+/*
+ * TestTransportFilter.cpp -- test the per client filter of the transport events
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include <Arena.h>
+#include <Server.h>
+#include <ServerEvent.h>
+#include <TransportFilter.h>
+
+using namespace irccd;
+
+namespace {
+
+class TransportFilterTest : public testing::Test {
+protected:
+	Arena m_arena{4096};
+	std::shared_ptr<Server> m_freenode;
+	std::shared_ptr<Server> m_oftc;
+
+	std::shared_ptr<Server> server(const std::string &name)
+	{
+		ServerInfo info;
+		ServerIdentity identity;
+
+		info.name = name;
+		info.host = "127.0.0.1";
+
+		return std::make_shared<Server>(info, identity);
+	}
+
+	TransportFilterTest()
+		: m_freenode(server("freenode"))
+		, m_oftc(server("oftc"))
+	{
+	}
+
+	ServerEvent *message(Server &server, const std::string &origin, const std::string &channel)
+	{
+		return ServerEvent::create(m_arena, ServerEventType::Message, &server, origin, channel, "hello");
+	}
+};
+
+} // !namespace
+
+TEST_F(TransportFilterTest, all)
+{
+	TransportFilter filter;
+
+	ASSERT_TRUE(filter.isAll());
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "jean!jean@localhost", "#staff")));
+	ASSERT_TRUE(filter.match(*ServerEvent::create(m_arena, ServerEventType::Connect, m_oftc.get())));
+}
+
+TEST_F(TransportFilterTest, events)
+{
+	TransportFilter filter;
+
+	filter.setEvents({ "onMessage", "onJoinBatch" });
+
+	ASSERT_FALSE(filter.isAll());
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "jean", "#staff")));
+	ASSERT_TRUE(filter.match(*ServerEvent::create(m_arena, ServerEventType::JoinBatch, m_freenode.get(), { { "jean", "#staff", "" } })));
+	ASSERT_FALSE(filter.match(*ServerEvent::create(m_arena, ServerEventType::Join, m_freenode.get(), "jean", "#staff")));
+
+	/* No event at all, the client only sends commands */
+	filter.setEvents({});
+
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "jean", "#staff")));
+}
+
+TEST_F(TransportFilterTest, invalidEvent)
+{
+	TransportFilter filter;
+
+	ASSERT_THROW(filter.setEvents({ "onMessage", "onCommand" }), std::invalid_argument);
+	ASSERT_TRUE(filter.isAll());
+}
+
+TEST_F(TransportFilterTest, servers)
+{
+	TransportFilter filter;
+
+	filter.setServers({ "oftc" });
+
+	ASSERT_TRUE(filter.match(*message(*m_oftc, "jean", "#staff")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "jean", "#staff")));
+}
+
+TEST_F(TransportFilterTest, channels)
+{
+	TransportFilter filter;
+
+	filter.setChannels({ "#Staff" });
+
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "jean", "#staff")));
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "jean", "#STAFF")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "jean", "#staffs")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "jean", "#test")));
+
+	/* Not related to a channel */
+	ASSERT_TRUE(filter.match(*ServerEvent::create(m_arena, ServerEventType::Nick, m_freenode.get(), "jean", "", "francis")));
+}
+
+TEST_F(TransportFilterTest, origins)
+{
+	TransportFilter filter;
+
+	filter.setOrigins({ "adm*", "j?an" });
+
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "Admin!admin@localhost", "#staff")));
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "adm", "#staff")));
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "jean!jean@localhost", "#staff")));
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "joan", "#staff")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "jeanne", "#staff")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "francis!adm@localhost", "#staff")));
+
+	/* No origin */
+	ASSERT_TRUE(filter.match(*ServerEvent::create(m_arena, ServerEventType::Names, m_freenode.get(), "", "#staff", "jean francis")));
+}
+
+TEST_F(TransportFilterTest, wildcards)
+{
+	TransportFilter filter;
+
+	filter.setOrigins({ "*a*b*c" });
+
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "abc", "#staff")));
+	ASSERT_TRUE(filter.match(*message(*m_freenode, "xaxbxbxc", "#staff")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "abcx", "#staff")));
+	ASSERT_FALSE(filter.match(*message(*m_freenode, "acb", "#staff")));
+}
+
+TEST_F(TransportFilterTest, batch)
+{
+	TransportFilter filter;
+
+	filter.setChannels({ "#staff" });
+	filter.setOrigins({ "jean" });
+
+	ServerEvent *joins = ServerEvent::create(m_arena, ServerEventType::JoinBatch, m_freenode.get(), {
+		{ "francis!francis@localhost", "#staff", "" },
+		{ "jean!jean@localhost", "#test", "" },
+		{ "jean!jean@localhost", "#staff", "" }
+	});
+	ServerEvent *parts = ServerEvent::create(m_arena, ServerEventType::PartBatch, m_freenode.get(), {
+		{ "francis!francis@localhost", "#staff", "bye" },
+		{ "jean!jean@localhost", "#test", "bye" }
+	});
+
+	/* The same entry must match both */
+	ASSERT_TRUE(filter.match(*joins));
+	ASSERT_FALSE(filter.match(*parts));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,230 @@
+/*
+ * TestTransportOutput.cpp -- test the bounded output queue of transport clients
+ *
+ * Copyright (c) 2013, 2014, 2015 David Demelier <markand@malikania.fr>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <TransportOutput.h>
+
+using namespace irccd;
+
+namespace {
+
+class TransportOutputTest : public testing::Test {
+protected:
+	int m_sockets[2];
+
+	TransportOutputTest()
+	{
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, m_sockets) < 0) {
+			throw std::runtime_error("socketpair failed");
+		}
+
+		::fcntl(m_sockets[0], F_SETFL, ::fcntl(m_sockets[0], F_GETFL) | O_NONBLOCK);
+		::fcntl(m_sockets[1], F_SETFL, ::fcntl(m_sockets[1], F_GETFL) | O_NONBLOCK);
+	}
+
+	~TransportOutputTest()
+	{
+		::close(m_sockets[0]);
+		::close(m_sockets[1]);
+	}
+
+	/*
+	 * Write until the socket blocks or the queue is empty.
+	 */
+	void flush(TransportOutput &output)
+	{
+		while (!output.empty() && output.write(m_sockets[0]) > 0) {
+			continue;
+		}
+	}
+
+	/*
+	 * Read everything the peer received.
+	 */
+	std::string drain()
+	{
+		std::string result;
+		char buffer[8192];
+		ssize_t nbread;
+
+		while ((nbread = ::read(m_sockets[1], buffer, sizeof (buffer))) > 0) {
+			result.append(buffer, nbread);
+		}
+
+		return result;
+	}
+};
+
+} // !namespace
+
+TEST_F(TransportOutputTest, basic)
+{
+	TransportOutput output;
+	TransportOutput::Message message = TransportOutput::make("{\"event\":\"onJoin\"}");
+
+	ASSERT_EQ("{\"event\":\"onJoin\"}\r\n\r\n", *message);
+
+	ASSERT_TRUE(output.push(message));
+	ASSERT_TRUE(output.push(TransportOutput::make("{}")));
+	ASSERT_EQ(2U, output.count());
+	ASSERT_EQ(message->size() + 6, output.size());
+
+	/* The message is shared, not copied */
+	ASSERT_EQ(2, message.use_count());
+
+	flush(output);
+
+	ASSERT_TRUE(output.empty());
+	ASSERT_EQ(0U, output.size());
+	ASSERT_EQ(2U, output.sent());
+	ASSERT_EQ(1U, output.writes());
+	ASSERT_EQ(1, message.use_count());
+	ASSERT_EQ("{\"event\":\"onJoin\"}\r\n\r\n{}\r\n\r\n", drain());
+}
+
+TEST_F(TransportOutputTest, vectors)
+{
+	TransportOutput output;
+
+	for (int i = 0; i < 100; ++i) {
+		output.push(TransportOutput::make(std::to_string(i)));
+	}
+
+	/* One call writes up to MaxVectors messages */
+	output.write(m_sockets[0]);
+
+	ASSERT_EQ(TransportOutput::MaxVectors, output.sent());
+	ASSERT_EQ(100 - TransportOutput::MaxVectors, output.count());
+
+	flush(output);
+
+	std::string expected;
+
+	for (int i = 0; i < 100; ++i) {
+		expected += std::to_string(i) + "\r\n\r\n";
+	}
+
+	ASSERT_EQ(expected, drain());
+}
+
+TEST_F(TransportOutputTest, dropOldest)
+{
+	TransportOutput output(20, TransportOverflow::DropOldest);
+
+	output.push(TransportOutput::make("aaaaaa"));
+	output.push(TransportOutput::make("bbbbbb"));
+	output.push(TransportOutput::make("cccccc"));
+
+	ASSERT_EQ(1U, output.dropped());
+	ASSERT_EQ(2U, output.count());
+	ASSERT_EQ(20U, output.size());
+
+	flush(output);
+
+	ASSERT_EQ("bbbbbb\r\n\r\ncccccc\r\n\r\n", drain());
+}
+
+TEST_F(TransportOutputTest, dropOldestPartial)
+{
+	/* Fill the socket so that the first message is only partially sent */
+	const std::string big(1 << 20, 'x');
+	TransportOutput output(big.size() + 4, TransportOverflow::DropOldest);
+
+	output.push(TransportOutput::make(big));
+	flush(output);
+
+	ASSERT_EQ(1U, output.count());
+	ASSERT_LT(output.size(), big.size() + 4);
+
+	/* The new message only fits without the previous one */
+	const std::string last(output.limit() - output.size() - 4 - 6, 'n');
+
+	output.push(TransportOutput::make("old"));
+	output.push(TransportOutput::make(last));
+
+	/* The message being sent is kept, the next one is dropped */
+	ASSERT_EQ(1U, output.dropped());
+	ASSERT_EQ(2U, output.count());
+
+	std::string received;
+
+	while (!output.empty()) {
+		received += drain();
+		flush(output);
+	}
+
+	received += drain();
+
+	ASSERT_EQ(big + "\r\n\r\n" + last + "\r\n\r\n", received);
+}
+
+TEST_F(TransportOutputTest, disconnect)
+{
+	TransportOutput output(20, TransportOverflow::Disconnect);
+
+	ASSERT_TRUE(output.push(TransportOutput::make("aaaaaa")));
+	ASSERT_TRUE(output.push(TransportOutput::make("bbbbbb")));
+	ASSERT_FALSE(output.push(TransportOutput::make("cccccc")));
+	ASSERT_TRUE(output.isOverflowed());
+	ASSERT_TRUE(output.empty());
+	ASSERT_EQ(3U, output.dropped());
+
+	/* Nothing is accepted anymore */
+	ASSERT_FALSE(output.push(TransportOutput::make("d")));
+	ASSERT_EQ(4U, output.dropped());
+}
+
+TEST_F(TransportOutputTest, larger)
+{
+	TransportOutput output(8, TransportOverflow::Disconnect);
+
+	/* Accepted when nothing else is pending */
+	ASSERT_TRUE(output.push(TransportOutput::make("a very long message")));
+	ASSERT_FALSE(output.isOverflowed());
+
+	flush(output);
+
+	ASSERT_EQ("a very long message\r\n\r\n", drain());
+}
+
+TEST_F(TransportOutputTest, closed)
+{
+	TransportOutput output;
+
+	::close(m_sockets[1]);
+	m_sockets[1] = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+	output.push(TransportOutput::make("{}"));
+
+	/* No SIGPIPE, an error instead */
+	ASSERT_THROW(output.write(m_sockets[0]), SocketError);
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}